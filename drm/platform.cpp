@@ -24,11 +24,13 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <memory.h>
+#include <poll.h>
 #include <pthread.h>
 #include <sys/file.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/un.h>
 #include <unistd.h>
 
@@ -42,6 +44,7 @@
 #include <drm/drm_fourcc.h>
 
 #include "platform.h"
+#include "wayland-server.h"
 
 typedef EGLBoolean (*PREALEGLSWAPBUFFERS)(EGLDisplay, EGLSurface surface );
 typedef EGLSurface (*PREALEGLCREATEWINDOWSURFACE)(EGLDisplay, 
@@ -49,6 +52,13 @@ typedef EGLSurface (*PREALEGLCREATEWINDOWSURFACE)(EGLDisplay,
                                                   EGLNativeWindowType,
                                                   const EGLint *attrib_list);
 
+#define PLATFORM_MAX_SCANOUT_BOS (8)
+#define PLATFORM_FLIP_TIMEOUT_MS (100)
+
+#ifndef MIN
+#define MIN(a,b) (((a)<(b))?(a):(b))
+#endif
+
 typedef struct _PlatformFormatInfo
 {
    uint32_t format;
@@ -86,7 +96,23 @@ typedef struct _PlatformOverlayPlanes
    PlatformOverlayPlane *primary;
 } PlatformOverlayPlanes;
 
-typedef struct _PlatformCtx
+// The framebuffer for a client buffer put on a plane, kept for as long as
+// the wl_buffer lives so a swapchain's buffers are imported and added once
+// rather than every frame
+typedef struct _PlatformScanoutFb
+{
+   struct _PlatformScanoutFb *next;
+   PlatformCtx *ctx;
+   struct wl_resource *buffer;
+   struct wl_listener destroyListener;
+   struct gbm_bo *bo;
+   uint32_t fbId;
+   uint32_t format;
+   int width;
+   int height;
+} PlatformScanoutFb;
+
+struct _PlatformCtx
 {
    pthread_mutex_t mutex;
    int drmFd;
@@ -105,6 +131,7 @@ typedef struct _PlatformCtx
    bool haveAtomic;
    bool graphicsPreferPrimary;
    bool modeSet;
+   bool noPlaneScaling;
    void *nativeWindow;
    PlatformOverlayPlane *nativeWindowPlane;
    int windowWidth;
@@ -115,9 +142,22 @@ typedef struct _PlatformCtx
    int flipPending;
    struct gbm_bo *prevBo;
    uint32_t prevFbId;
-} PlatformCtx;
+   struct gbm_bo *scanoutBos[PLATFORM_MAX_SCANOUT_BOS];
+   int scanoutBoCount;
+   long long scanoutBoBytes;
+   PlatformSwapStats swapStats;
+   PlatformOverlayPlane *clientPlane;
+   bool clientPlaneOwned;
+   PlatformScanoutFb *scanoutFbs;
+   PlatformScanoutFb *clientFb;
+   PlatformScanoutFb *clientFbPending;
+   bool scanoutFlipPending;
+   PlatformScanoutListener scanoutListener;
+   void *scanoutListenerData;
+};
 
 static PREALEGLSWAPBUFFERS gRealEGLSwapBuffers= 0;
+static PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC gRealEGLSwapBuffersWithDamage= 0;
 static PREALEGLCREATEWINDOWSURFACE gRealEGLCreateWindowSurface= 0;
 static PlatformCtx *gCtx= 0;
 
@@ -385,6 +425,43 @@ static void platformOverlayAppendUnused( PlatformOverlayPlanes *planes, Platform
    overlay->prev= insertAfter;
 }
 
+// Move a specific plane from the available list to the used list.  Called
+// with the context mutex held.
+static void platformOverlayTake( PlatformOverlayPlanes *planes, PlatformOverlayPlane *overlay )
+{
+   ++planes->usedCount;
+
+   if ( overlay->next )
+   {
+      overlay->next->prev= overlay->prev;
+   }
+   else
+   {
+      planes->availTail= overlay->prev;
+   }
+   if ( overlay->prev )
+   {
+      overlay->prev->next= overlay->next;
+   }
+   else
+   {
+      planes->availHead= overlay->next;
+   }
+
+   overlay->next= 0;
+   overlay->prev= planes->usedTail;
+   if ( planes->usedTail )
+   {
+      planes->usedTail->next= overlay;
+   }
+   else
+   {
+      planes->usedHead= overlay;
+   }
+   planes->usedTail= overlay;
+   overlay->inUse= true;
+}
+
 static PlatformOverlayPlane *platformOverlayAllocPrimary( PlatformOverlayPlanes *planes )
 {
    PlatformOverlayPlane *overlay= 0;
@@ -395,38 +472,8 @@ static PlatformOverlayPlane *platformOverlayAllocPrimary( PlatformOverlayPlanes
    {
       if ( !planes->primary->inUse )
       {
-         ++planes->usedCount;
-
          overlay= planes->primary;
-         if ( overlay->next )
-         {
-            overlay->next->prev= overlay->prev;
-         }
-         else
-         {
-            planes->availTail= overlay->prev;
-         }
-         if ( overlay->prev )
-         {
-            overlay->prev->next= overlay->next;
-         }
-         else
-         {
-            planes->availHead= overlay->next;
-         }
-
-         overlay->next= 0;
-         overlay->prev= planes->usedTail;
-         if ( planes->usedTail )
-         {
-            planes->usedTail->next= overlay;
-         }
-         else
-         {
-            planes->usedHead= overlay;
-         }
-         planes->usedTail= overlay;
-         overlay->inUse= true;
+         platformOverlayTake( planes, overlay );
       }
       else
       {
@@ -443,6 +490,52 @@ static PlatformOverlayPlane *platformOverlayAllocPrimary( PlatformOverlayPlanes
    return overlay;
 }
 
+static bool platformOverlayHasFormat( PlatformOverlayPlane *overlay, uint32_t format )
+{
+   for( int i= 0; i < overlay->formatCount; ++i )
+   {
+      if ( overlay->formats[i].format == format )
+      {
+         return true;
+      }
+   }
+   return false;
+}
+
+// Pick a plane for a client buffer.  A free plane stacked above the
+// compositor's output is preferred as the output is then left untouched.
+// A buffer covering the whole output can replace the output instead.
+static PlatformOverlayPlane *platformOverlayAllocClient( PlatformCtx *ctx, uint32_t format, bool coversOutput, bool *owned )
+{
+   PlatformOverlayPlanes *planes= &ctx->overlayPlanes;
+   PlatformOverlayPlane *overlay;
+
+   *owned= false;
+   pthread_mutex_lock( &ctx->mutex );
+   for( overlay= planes->availTail; overlay; overlay= overlay->prev )
+   {
+      if ( overlay->zOrder <= ctx->nativeWindowPlane->zOrder )
+      {
+         overlay= 0;
+         break;
+      }
+      if ( platformOverlayHasFormat( overlay, format ) )
+      {
+         platformOverlayTake( planes, overlay );
+         *owned= true;
+         break;
+      }
+   }
+   pthread_mutex_unlock( &ctx->mutex );
+
+   if ( !overlay && coversOutput && platformOverlayHasFormat( ctx->nativeWindowPlane, format ) )
+   {
+      overlay= ctx->nativeWindowPlane;
+   }
+
+   return overlay;
+}
+
 static PlatformOverlayPlane *platformOverlayAlloc( PlatformOverlayPlanes *planes, bool graphics, bool primaryVideo )
 {
    PlatformOverlayPlane *overlay= 0;
@@ -562,6 +655,133 @@ static void platformOverlayFree( PlatformOverlayPlanes *planes, PlatformOverlayP
    }
 }
 
+static void platformScanoutFbFree( PlatformCtx *ctx, PlatformScanoutFb *fb )
+{
+   if ( fb->fbId )
+   {
+      drmModeRmFB( ctx->drmFd, fb->fbId );
+   }
+   if ( fb->bo )
+   {
+      gbm_bo_destroy( fb->bo );
+   }
+   free( fb );
+}
+
+static void platformScanoutFbUnlink( PlatformCtx *ctx, PlatformScanoutFb *fb )
+{
+   PlatformScanoutFb **link;
+
+   for( link= &ctx->scanoutFbs; *link; link= &(*link)->next )
+   {
+      if ( *link == fb )
+      {
+         *link= fb->next;
+         break;
+      }
+   }
+   fb->next= 0;
+}
+
+static void platformScanoutBufferDestroyed( struct wl_listener *listener, void *data )
+{
+   PlatformScanoutFb *fb;
+   PlatformCtx *ctx;
+
+   fb= wl_container_of( listener, fb, destroyListener );
+   ctx= fb->ctx;
+   platformScanoutFbUnlink( ctx, fb );
+   fb->buffer= 0;
+   // An fb on screen, or about to be, goes once it is replaced, as removing
+   // an fb still being scanned out disables the plane
+   if ( (fb != ctx->clientFb) && (fb != ctx->clientFbPending) )
+   {
+      platformScanoutFbFree( ctx, fb );
+   }
+}
+
+// Find or create the fb for a client buffer.  Returns null for buffers the
+// display can not read, such as shm or a tiling the display does not support.
+static PlatformScanoutFb *platformScanoutFbGet( PlatformCtx *ctx, struct wl_resource *buffer )
+{
+   PlatformScanoutFb *fb;
+   struct gbm_bo *bo;
+   uint32_t fbId= 0;
+   uint32_t format;
+   uint32_t handles[4], strides[4], offsets[4];
+   uint64_t modifier, modifiers[4];
+   int i, rc, width, height;
+
+   for( fb= ctx->scanoutFbs; fb; fb= fb->next )
+   {
+      if ( fb->buffer == buffer )
+      {
+         return fb;
+      }
+   }
+
+   bo= gbm_bo_import( ctx->gbm, GBM_BO_IMPORT_WL_BUFFER, buffer, GBM_BO_USE_SCANOUT );
+   if ( !bo )
+   {
+      return 0;
+   }
+   format= gbm_bo_get_format( bo );
+   width= gbm_bo_get_width( bo );
+   height= gbm_bo_get_height( bo );
+   modifier= gbm_bo_get_modifier( bo );
+
+   memset( handles, 0, sizeof(handles) );
+   memset( strides, 0, sizeof(strides) );
+   memset( offsets, 0, sizeof(offsets) );
+   memset( modifiers, 0, sizeof(modifiers) );
+   for( i= 0; (i < gbm_bo_get_plane_count( bo )) && (i < 4); ++i )
+   {
+      handles[i]= gbm_bo_get_handle_for_plane( bo, i ).u32;
+      strides[i]= gbm_bo_get_stride_for_plane( bo, i );
+      offsets[i]= gbm_bo_get_offset( bo, i );
+      modifiers[i]= modifier;
+   }
+   // Pass the layout explicitly so a tiled or compressed buffer is not
+   // taken for linear; drivers without modifier support get the legacy call
+   rc= -1;
+   if ( modifier != DRM_FORMAT_MOD_INVALID )
+   {
+      rc= drmModeAddFB2WithModifiers( ctx->drmFd, width, height, format, handles, strides, offsets, modifiers,
+                                      &fbId, DRM_MODE_FB_MODIFIERS );
+   }
+   if ( rc )
+   {
+      rc= drmModeAddFB2( ctx->drmFd, width, height, format, handles, strides, offsets, &fbId, 0 );
+   }
+   if ( rc )
+   {
+      if ( gVerbose ) fprintf(stderr,"platformScanoutFbGet: drmModeAddFB2 format %.4s rc %d errno %d\n", (char*)&format, rc, errno);
+      gbm_bo_destroy( bo );
+      return 0;
+   }
+
+   fb= (PlatformScanoutFb*)calloc( 1, sizeof(PlatformScanoutFb) );
+   if ( !fb )
+   {
+      drmModeRmFB( ctx->drmFd, fbId );
+      gbm_bo_destroy( bo );
+      return 0;
+   }
+   fb->ctx= ctx;
+   fb->buffer= buffer;
+   fb->bo= bo;
+   fb->fbId= fbId;
+   fb->format= format;
+   fb->width= width;
+   fb->height= height;
+   fb->destroyListener.notify= platformScanoutBufferDestroyed;
+   wl_resource_add_destroy_listener( buffer, &fb->destroyListener );
+   fb->next= ctx->scanoutFbs;
+   ctx->scanoutFbs= fb;
+
+   return fb;
+}
+
 PlatformCtx* PlatfromInit( void )
 {
    PlatformCtx *ctx= 0;
@@ -962,6 +1182,13 @@ PlatformCtx* PlatfromInit( void )
       goto exit;
    }
 
+   // Optional: without it swaps with damage fall back to full swaps
+   gRealEGLSwapBuffersWithDamage= (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress( "eglSwapBuffersWithDamageKHR" );
+   if ( !gRealEGLSwapBuffersWithDamage )
+   {
+      gRealEGLSwapBuffersWithDamage= (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress( "eglSwapBuffersWithDamageEXT" );
+   }
+
    gCtx= ctx;
 
    error= false;
@@ -980,6 +1207,25 @@ void PlatformTerm( PlatformCtx *ctx )
 {
    if ( ctx )
    {
+      // Fbs whose buffer has gone are off the list until they leave the screen
+      if ( ctx->clientFbPending && !ctx->clientFbPending->buffer )
+      {
+         platformScanoutFbFree( ctx, ctx->clientFbPending );
+      }
+      if ( ctx->clientFb && !ctx->clientFb->buffer )
+      {
+         platformScanoutFbFree( ctx, ctx->clientFb );
+      }
+      ctx->clientFbPending= 0;
+      ctx->clientFb= 0;
+      while( ctx->scanoutFbs )
+      {
+         PlatformScanoutFb *fb= ctx->scanoutFbs;
+
+         ctx->scanoutFbs= fb->next;
+         wl_list_remove( &fb->destroyListener.link );
+         platformScanoutFbFree( ctx, fb );
+      }
       if ( ctx->gbm )
       {
          gbm_device_destroy(ctx->gbm);
@@ -1072,8 +1318,21 @@ void *PlatformCreateNativeWindow( PlatformCtx *ctx, int width, int height )
       }
       if ( !found )
       {
+         // No matching mode: use the preferred mode and let the plane scale
+         // the window up or down to fill the crtc
          ctx->modeInfo= &ctx->conn->modes[0];
+         for( i= 0; i < ctx->conn->count_modes; ++i )
+         {
+            if ( ctx->conn->modes[i].type & DRM_MODE_TYPE_PREFERRED )
+            {
+               ctx->modeInfo= &ctx->conn->modes[i];
+               break;
+            }
+         }
+         fprintf(stderr,"PlatformCreateNativeWindow: no %dx%d mode, scaling to %dx%d\n",
+                 width, height, ctx->modeInfo->hdisplay, ctx->modeInfo->vdisplay );
       }
+      ctx->noPlaneScaling= false;
 
       nativeWindow= gbm_surface_create(ctx->gbm,
                                        width, height,
@@ -1104,6 +1363,7 @@ void PlatformDestroyNativeWindow( PlatformCtx *ctx, void *nativeWindow )
    if ( ctx )
    {
       struct gbm_surface *gs = (struct gbm_surface*)nativeWindow;
+      PlatformScanoutStop( ctx );
       if ( ctx->prevBo )
       {
          gbm_surface_release_buffer(gs, ctx->prevBo);
@@ -1114,6 +1374,10 @@ void PlatformDestroyNativeWindow( PlatformCtx *ctx, void *nativeWindow )
       }
       gbm_surface_destroy( gs );
       ctx->nativeWindow= 0;
+      // The next surface's bos may reuse handle values so force new fbs
+      ctx->handle= 0;
+      ctx->scanoutBoCount= 0;
+      ctx->scanoutBoBytes= 0;
       if ( ctx->nativeWindowPlane )
       {
          platformOverlayFree( &ctx->overlayPlanes, ctx->nativeWindowPlane );
@@ -1122,6 +1386,128 @@ void PlatformDestroyNativeWindow( PlatformCtx *ctx, void *nativeWindow )
    }
 }
 
+bool PlatformGetMemoryStats( PlatformCtx *ctx, PlatformMemoryStats *stats )
+{
+   bool result= false;
+
+   if ( ctx )
+   {
+      pthread_mutex_lock( &ctx->mutex );
+      stats->scanoutBufferCount= ctx->scanoutBoCount;
+      stats->scanoutBufferBytes= ctx->scanoutBoBytes;
+      pthread_mutex_unlock( &ctx->mutex );
+      result= true;
+   }
+
+   return result;
+}
+
+bool PlatformGetSwapStats( PlatformCtx *ctx, PlatformSwapStats *stats, bool reset )
+{
+   bool result= false;
+
+   if ( ctx )
+   {
+      pthread_mutex_lock( &ctx->mutex );
+      if ( stats )
+      {
+         *stats= ctx->swapStats;
+      }
+      if ( reset )
+      {
+         memset( &ctx->swapStats, 0, sizeof(PlatformSwapStats) );
+      }
+      pthread_mutex_unlock( &ctx->mutex );
+      result= true;
+   }
+
+   return result;
+}
+
+bool PlatformGetDisplayInfo( PlatformCtx *ctx, PlatformDisplayInfo *info )
+{
+   bool result= false;
+   drmModeModeInfo *mode;
+
+   if ( ctx )
+   {
+      mode= (ctx->modeInfo ? ctx->modeInfo : &ctx->conn->modes[0]);
+      info->modeWidth= mode->hdisplay;
+      info->modeHeight= mode->vdisplay;
+      if ( mode->htotal && mode->vtotal )
+      {
+         info->refreshMilliHz= (int)((long long)mode->clock*1000000LL/((long long)mode->htotal*mode->vtotal));
+      }
+      else
+      {
+         info->refreshMilliHz= mode->vrefresh*1000;
+      }
+      info->scaled= ctx->nativeWindow &&
+                    !ctx->noPlaneScaling &&
+                    ((ctx->windowWidth != mode->hdisplay) || (ctx->windowHeight != mode->vdisplay));
+      result= true;
+   }
+
+   return result;
+}
+
+static long long platformSwapTime( void )
+{
+   struct timespec tm;
+
+   clock_gettime( CLOCK_MONOTONIC, &tm );
+
+   return tm.tv_sec*1000000000LL + tm.tv_nsec;
+}
+
+static void platformSwapStatsRecord( PlatformCtx *ctx, long long *stageNs )
+{
+   PlatformSwapStats *stats= &ctx->swapStats;
+   long long us;
+   int i, bucket;
+
+   pthread_mutex_lock( &ctx->mutex );
+   ++stats->count;
+   for( i= 0; i < PLATFORM_SWAP_STAGE_COUNT; ++i )
+   {
+      stats->totalNs[i] += stageNs[i];
+      if ( stageNs[i] > stats->maxNs[i] )
+      {
+         stats->maxNs[i]= stageNs[i];
+      }
+      us= stageNs[i]/1000;
+      bucket= 0;
+      while( us && (bucket < PLATFORM_SWAP_HIST_BUCKETS-1) )
+      {
+         us >>= 1;
+         ++bucket;
+      }
+      ++stats->hist[i][bucket];
+   }
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void platformTrackScanoutBo( PlatformCtx *ctx, struct gbm_bo *bo, uint32_t stride )
+{
+   int i;
+
+   // The gbm surface recycles a small set of bos, so count each one once
+   for( i= 0; i < ctx->scanoutBoCount; ++i )
+   {
+      if ( ctx->scanoutBos[i] == bo )
+      {
+         return;
+      }
+   }
+   if ( ctx->scanoutBoCount < PLATFORM_MAX_SCANOUT_BOS )
+   {
+      pthread_mutex_lock( &ctx->mutex );
+      ctx->scanoutBos[ctx->scanoutBoCount++]= bo;
+      ctx->scanoutBoBytes += (long long)stride*gbm_bo_get_height(bo);
+      pthread_mutex_unlock( &ctx->mutex );
+   }
+}
+
 static void platformAtomicAddProperty( PlatformCtx *ctx, drmModeAtomicReq *req, uint32_t objectId,
                                        int countProps, drmModePropertyRes **propRes, const char *name, uint64_t value )
 {
@@ -1154,7 +1540,7 @@ static void platformAtomicAddProperty( PlatformCtx *ctx, drmModeAtomicReq *req,
    }
 }
 
-EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
+static EGLBoolean platformSwapBuffers( EGLDisplay dpy, EGLSurface surface, EGLint *rects, EGLint count )
 {
    EGLBoolean result= EGL_FALSE;
 
@@ -1166,9 +1552,22 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
       fd_set fds;
       drmEventContext ev;
       int rc;
+      long long stageNs[PLATFORM_SWAP_STAGE_COUNT];
+      long long timeStart, time1, time2;
 
       if ( gVerbose ) fprintf(stderr,"eglSwapBuffers: start\n");
-      result= gRealEGLSwapBuffers( dpy, surface );
+      memset( stageNs, 0, sizeof(stageNs) );
+      timeStart= platformSwapTime();
+      if ( rects && gRealEGLSwapBuffersWithDamage )
+      {
+         result= gRealEGLSwapBuffersWithDamage( dpy, surface, rects, count );
+      }
+      else
+      {
+         result= gRealEGLSwapBuffers( dpy, surface );
+      }
+      time1= platformSwapTime();
+      stageNs[PLATFORM_SWAP_STAGE_SWAP]= time1-timeStart;
 
       if ( surface == gCtx->surfaceDirect )
       {
@@ -1209,10 +1608,18 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
                }
             }
 
+            time2= platformSwapTime();
+            stageNs[PLATFORM_SWAP_STAGE_BUILD] += time2-time1;
+            time1= time2;
+
             bo= gbm_surface_lock_front_buffer(gs);
 
             handle= gbm_bo_get_handle(bo).u32;
             stride = gbm_bo_get_stride(bo);
+            platformTrackScanoutBo( gCtx, bo, stride );
+            time2= platformSwapTime();
+            stageNs[PLATFORM_SWAP_STAGE_LOCK]= time2-time1;
+            time1= time2;
 
             if ( gCtx->handle != handle )
             {
@@ -1230,6 +1637,9 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
                   goto exit;
                }
                gCtx->handle= handle;
+               time2= platformSwapTime();
+               stageNs[PLATFORM_SWAP_STAGE_ADDFB]= time2-time1;
+               time1= time2;
 
                platformAtomicAddProperty( gCtx, req, gCtx->nativeWindowPlane->plane->plane_id,
                                      gCtx->nativeWindowPlane->planeProps->count_props, gCtx->nativeWindowPlane->planePropRes,
@@ -1249,11 +1659,11 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
 
                platformAtomicAddProperty( gCtx, req, gCtx->nativeWindowPlane->plane->plane_id,
                                      gCtx->nativeWindowPlane->planeProps->count_props, gCtx->nativeWindowPlane->planePropRes,
-                                     "SRC_W", gCtx->windowWidth<<16 );
+                                     "SRC_W", (gCtx->noPlaneScaling ? MIN(gCtx->windowWidth, gCtx->modeInfo->hdisplay) : gCtx->windowWidth)<<16 );
 
                platformAtomicAddProperty( gCtx, req, gCtx->nativeWindowPlane->plane->plane_id,
                                      gCtx->nativeWindowPlane->planeProps->count_props, gCtx->nativeWindowPlane->planePropRes,
-                                     "SRC_H", gCtx->windowHeight<<16 );
+                                     "SRC_H", (gCtx->noPlaneScaling ? MIN(gCtx->windowHeight, gCtx->modeInfo->vdisplay) : gCtx->windowHeight)<<16 );
 
                platformAtomicAddProperty( gCtx, req, gCtx->nativeWindowPlane->plane->plane_id,
                                      gCtx->nativeWindowPlane->planeProps->count_props, gCtx->nativeWindowPlane->planePropRes,
@@ -1265,11 +1675,11 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
 
                platformAtomicAddProperty( gCtx, req, gCtx->nativeWindowPlane->plane->plane_id,
                                      gCtx->nativeWindowPlane->planeProps->count_props, gCtx->nativeWindowPlane->planePropRes,
-                                     "CRTC_W", gCtx->modeInfo->hdisplay );
+                                     "CRTC_W", (gCtx->noPlaneScaling ? MIN(gCtx->windowWidth, gCtx->modeInfo->hdisplay) : gCtx->modeInfo->hdisplay) );
 
                platformAtomicAddProperty( gCtx, req, gCtx->nativeWindowPlane->plane->plane_id,
                                      gCtx->nativeWindowPlane->planeProps->count_props, gCtx->nativeWindowPlane->planePropRes,
-                                     "CRTC_H", gCtx->modeInfo->vdisplay );
+                                     "CRTC_H", (gCtx->noPlaneScaling ? MIN(gCtx->windowHeight, gCtx->modeInfo->vdisplay) : gCtx->modeInfo->vdisplay) );
 
                platformAtomicAddProperty( gCtx, req, gCtx->nativeWindowPlane->plane->plane_id,
                                      gCtx->nativeWindowPlane->planeProps->count_props, gCtx->nativeWindowPlane->planePropRes,
@@ -1282,12 +1692,24 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
                }
             }
 
+            time2= platformSwapTime();
+            stageNs[PLATFORM_SWAP_STAGE_BUILD] += time2-time1;
+            time1= time2;
+
             if ( req )
             {
                rc= drmModeAtomicCommit( gCtx->drmFd, req, flags, 0 );
                if ( rc )
                {
                   fprintf(stderr,"drmModeAtomicCommit failed: rc %d errno %d\n", rc, errno );
+                  if ( !gCtx->noPlaneScaling &&
+                       ((gCtx->windowWidth != gCtx->modeInfo->hdisplay) || (gCtx->windowHeight != gCtx->modeInfo->vdisplay)) )
+                  {
+                     // Not every plane can scale, so fall back to showing the window unscaled
+                     fprintf(stderr,"plane scaling rejected, presenting %dx%d unscaled\n", gCtx->windowWidth, gCtx->windowHeight );
+                     gCtx->noPlaneScaling= true;
+                     gCtx->handle= 0;
+                  }
                }
                if ( gVerbose ) fprintf(stderr,"drmModeAtomicCommit: done\n");
                if ( (flags & DRM_MODE_ATOMIC_ALLOW_MODESET) && !rc )
@@ -1305,6 +1727,9 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
                   }
                }
             }
+            time2= platformSwapTime();
+            stageNs[PLATFORM_SWAP_STAGE_COMMIT]= time2-time1;
+            time1= time2;
 
             if ( gCtx->prevBo )
             {
@@ -1313,6 +1738,10 @@ EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
             }
             gCtx->prevBo= bo;
             gCtx->prevFbId= gCtx->fbId;
+            time2= platformSwapTime();
+            stageNs[PLATFORM_SWAP_STAGE_RELEASE]= time2-time1;
+            stageNs[PLATFORM_SWAP_STAGE_TOTAL]= time2-timeStart;
+            platformSwapStatsRecord( gCtx, stageNs );
          }
       }
    }
@@ -1323,6 +1752,397 @@ exit:
    return result;    
 }
 
+EGLAPI EGLBoolean eglSwapBuffers( EGLDisplay dpy, EGLSurface surface )
+{
+   return platformSwapBuffers( dpy, surface, 0, 0 );
+}
+
+bool PlatformSwapBuffersWithDamage( PlatformCtx *ctx, EGLDisplay dpy, EGLSurface surface, EGLint *rects, EGLint count )
+{
+   bool result= false;
+
+   // Calling the EGL entry point directly would skip the flip to the
+   // display, so take the same path as eglSwapBuffers
+   if ( ctx && gRealEGLSwapBuffersWithDamage )
+   {
+      platformSwapBuffers( dpy, surface, rects, count );
+      result= true;
+   }
+
+   return result;
+}
+
+static void platformAtomicAddPlane( PlatformCtx *ctx, drmModeAtomicReq *req, PlatformOverlayPlane *overlay, uint32_t fbId,
+                                    int srcW, int srcH, int crtcX, int crtcY, int crtcW, int crtcH )
+{
+   uint32_t planeId= overlay->plane->plane_id;
+   int count= overlay->planeProps->count_props;
+   drmModePropertyRes **propRes= overlay->planePropRes;
+
+   platformAtomicAddProperty( ctx, req, planeId, count, propRes, "FB_ID", fbId );
+   platformAtomicAddProperty( ctx, req, planeId, count, propRes, "CRTC_ID", (fbId ? overlay->crtc_id : 0) );
+   if ( fbId )
+   {
+      platformAtomicAddProperty( ctx, req, planeId, count, propRes, "SRC_X", 0 );
+      platformAtomicAddProperty( ctx, req, planeId, count, propRes, "SRC_Y", 0 );
+      platformAtomicAddProperty( ctx, req, planeId, count, propRes, "SRC_W", srcW<<16 );
+      platformAtomicAddProperty( ctx, req, planeId, count, propRes, "SRC_H", srcH<<16 );
+      platformAtomicAddProperty( ctx, req, planeId, count, propRes, "CRTC_X", crtcX );
+      platformAtomicAddProperty( ctx, req, planeId, count, propRes, "CRTC_Y", crtcY );
+      platformAtomicAddProperty( ctx, req, planeId, count, propRes, "CRTC_W", crtcW );
+      platformAtomicAddProperty( ctx, req, planeId, count, propRes, "CRTC_H", crtcH );
+      if ( ctx->useZPos )
+      {
+         platformAtomicAddProperty( ctx, req, planeId, count, propRes, "zpos", overlay->zOrder );
+      }
+   }
+}
+
+// An fb left the screen: free it if its buffer has gone meanwhile and
+// return the buffer to hand back to the client
+static struct wl_resource *platformScanoutFbRetire( PlatformCtx *ctx, PlatformScanoutFb *fb )
+{
+   struct wl_resource *buffer= 0;
+
+   if ( fb && (fb != ctx->clientFb) && (fb != ctx->clientFbPending) )
+   {
+      buffer= fb->buffer;
+      if ( !buffer )
+      {
+         platformScanoutFbFree( ctx, fb );
+      }
+   }
+
+   return buffer;
+}
+
+static void platformScanoutFlipped( PlatformCtx *ctx )
+{
+   PlatformScanoutFb *prev;
+   struct wl_resource *released;
+
+   prev= ctx->clientFb;
+   ctx->clientFb= ctx->clientFbPending;
+   ctx->clientFbPending= 0;
+   ctx->scanoutFlipPending= false;
+   released= platformScanoutFbRetire( ctx, prev );
+   if ( ctx->scanoutListener )
+   {
+      ctx->scanoutListener( ctx->scanoutListenerData, (ctx->clientFb ? ctx->clientFb->buffer : 0), released );
+   }
+}
+
+static void platformPageFlipHandler( int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *userData )
+{
+   PlatformCtx *ctx= (PlatformCtx*)userData;
+
+   if ( ctx && ctx->scanoutFlipPending )
+   {
+      platformScanoutFlipped( ctx );
+   }
+}
+
+void PlatformSetScanoutListener( PlatformCtx *ctx, PlatformScanoutListener listener, void *userData )
+{
+   if ( ctx )
+   {
+      ctx->scanoutListener= listener;
+      ctx->scanoutListenerData= userData;
+   }
+}
+
+int PlatformGetEventFd( PlatformCtx *ctx )
+{
+   return (ctx && ctx->haveAtomic) ? ctx->drmFd : -1;
+}
+
+void PlatformDispatchEvents( PlatformCtx *ctx )
+{
+   drmEventContext ev;
+
+   if ( ctx )
+   {
+      memset( &ev, 0, sizeof(ev) );
+      ev.version= DRM_EVENT_CONTEXT_VERSION;
+      ev.page_flip_handler= platformPageFlipHandler;
+      drmHandleEvent( ctx->drmFd, &ev );
+   }
+}
+
+void PlatformScanoutWait( PlatformCtx *ctx )
+{
+   struct pollfd pfd;
+   int rc;
+
+   while( ctx && ctx->scanoutFlipPending )
+   {
+      pfd.fd= ctx->drmFd;
+      pfd.events= POLLIN;
+      pfd.revents= 0;
+      rc= poll( &pfd, 1, PLATFORM_FLIP_TIMEOUT_MS );
+      if ( (rc < 0) && (errno == EINTR) )
+      {
+         continue;
+      }
+      if ( rc <= 0 )
+      {
+         // Do not hang the compositor on a lost event; the commit was
+         // accepted so treat it as done
+         fprintf(stderr,"Error: PlatformScanoutWait: no flip event: rc %d errno %d\n", rc, errno);
+         platformScanoutFlipped( ctx );
+         break;
+      }
+      PlatformDispatchEvents( ctx );
+   }
+}
+
+bool PlatformScanoutBuffer( PlatformCtx *ctx, struct wl_resource *buffer, int x, int y, int width, int height )
+{
+   bool result= false;
+   PlatformScanoutFb *fb;
+   PlatformOverlayPlane *overlay= 0;
+   bool owned= false;
+   drmModeAtomicReq *req= 0;
+   int rc;
+   int crtcX, crtcY, crtcW, crtcH;
+
+   // The output must be up so the crtc is active before planes can be used
+   if ( !ctx || !ctx->haveAtomic || !ctx->modeSet || !ctx->nativeWindowPlane )
+   {
+      goto exit;
+   }
+
+   // A nonblocking commit fails while the last one is still pending, so a
+   // client outpacing the display waits here for its previous frame
+   PlatformScanoutWait( ctx );
+
+   fb= platformScanoutFbGet( ctx, buffer );
+   if ( !fb )
+   {
+      goto exit;
+   }
+
+   overlay= ctx->clientPlane;
+   if ( !overlay || !platformOverlayHasFormat( overlay, fb->format ) )
+   {
+      if ( overlay )
+      {
+         PlatformScanoutStop( ctx );
+      }
+      overlay= platformOverlayAllocClient( ctx, fb->format,
+                                           (x <= 0) && (y <= 0) && (x+width >= ctx->windowWidth) && (y+height >= ctx->windowHeight),
+                                           &owned );
+      if ( !overlay )
+      {
+         goto exit;
+      }
+   }
+   else
+   {
+      owned= ctx->clientPlaneOwned;
+   }
+
+   // Client positions are in output coordinates and the output is scaled
+   // to the mode unless the plane can not scale
+   crtcX= x;
+   crtcY= y;
+   crtcW= width;
+   crtcH= height;
+   if ( !ctx->noPlaneScaling && ctx->windowWidth && ctx->windowHeight )
+   {
+      crtcX= (int)((long long)x*ctx->modeInfo->hdisplay/ctx->windowWidth);
+      crtcY= (int)((long long)y*ctx->modeInfo->vdisplay/ctx->windowHeight);
+      crtcW= (int)((long long)width*ctx->modeInfo->hdisplay/ctx->windowWidth);
+      crtcH= (int)((long long)height*ctx->modeInfo->vdisplay/ctx->windowHeight);
+   }
+
+   req= drmModeAtomicAlloc();
+   if ( !req )
+   {
+      fprintf(stderr,"Error: PlatformScanoutBuffer: drmModeAtomicAlloc failed, errno %x\n", errno);
+      goto exit;
+   }
+   platformAtomicAddPlane( ctx, req, overlay, fb->fbId, fb->width, fb->height, crtcX, crtcY, crtcW, crtcH );
+   rc= drmModeAtomicCommit( ctx->drmFd, req, DRM_MODE_ATOMIC_NONBLOCK|DRM_MODE_PAGE_FLIP_EVENT, ctx );
+   if ( rc )
+   {
+      if ( gVerbose ) fprintf(stderr,"PlatformScanoutBuffer: drmModeAtomicCommit rc %d errno %d\n", rc, errno);
+      if ( owned && (overlay != ctx->clientPlane) )
+      {
+         platformOverlayFree( &ctx->overlayPlanes, overlay );
+      }
+      goto exit;
+   }
+
+   // The fb on screen stays until the flip event says the new one replaced it
+   ctx->clientFbPending= fb;
+   ctx->scanoutFlipPending= true;
+   ctx->clientPlane= overlay;
+   ctx->clientPlaneOwned= owned;
+   if ( overlay == ctx->nativeWindowPlane )
+   {
+      // Have the next swap put the output back on its plane
+      ctx->handle= 0;
+   }
+   result= true;
+
+exit:
+   if ( req )
+   {
+      drmModeAtomicFree( req );
+   }
+
+   return result;
+}
+
+void PlatformScanoutStop( PlatformCtx *ctx )
+{
+   drmModeAtomicReq *req;
+   PlatformScanoutFb *prev;
+   int rc;
+
+   if ( ctx && ctx->clientPlane )
+   {
+      PlatformScanoutWait( ctx );
+
+      // Take the client buffer off screen before its fb can be removed, as
+      // removing an fb still being scanned out disables the plane
+      req= drmModeAtomicAlloc();
+      if ( req )
+      {
+         if ( ctx->clientPlaneOwned )
+         {
+            platformAtomicAddPlane( ctx, req, ctx->clientPlane, 0, 0, 0, 0, 0, 0, 0 );
+         }
+         else if ( ctx->prevFbId )
+         {
+            platformAtomicAddPlane( ctx, req, ctx->clientPlane, ctx->prevFbId,
+                                    (ctx->noPlaneScaling ? MIN(ctx->windowWidth, ctx->modeInfo->hdisplay) : ctx->windowWidth),
+                                    (ctx->noPlaneScaling ? MIN(ctx->windowHeight, ctx->modeInfo->vdisplay) : ctx->windowHeight),
+                                    0, 0,
+                                    (ctx->noPlaneScaling ? MIN(ctx->windowWidth, ctx->modeInfo->hdisplay) : ctx->modeInfo->hdisplay),
+                                    (ctx->noPlaneScaling ? MIN(ctx->windowHeight, ctx->modeInfo->vdisplay) : ctx->modeInfo->vdisplay) );
+         }
+         rc= drmModeAtomicCommit( ctx->drmFd, req, 0, 0 );
+         if ( rc )
+         {
+            fprintf(stderr,"Error: PlatformScanoutStop: drmModeAtomicCommit rc %d errno %d\n", rc, errno);
+         }
+         drmModeAtomicFree( req );
+      }
+      if ( ctx->clientPlaneOwned )
+      {
+         platformOverlayFree( &ctx->overlayPlanes, ctx->clientPlane );
+      }
+      ctx->clientPlane= 0;
+      ctx->clientPlaneOwned= false;
+      ctx->handle= 0;
+   }
+   if ( ctx )
+   {
+      // The blocking commit has taken it off screen; its buffer is the
+      // caller's to release along with its other state
+      prev= ctx->clientFb;
+      ctx->clientFb= 0;
+      platformScanoutFbRetire( ctx, prev );
+   }
+}
+
+bool PlatformAllocLinearBuffer( PlatformCtx *ctx, int bytesPerRow, int rows, PlatformLinearBuffer *buffer )
+{
+   bool result= false;
+   struct gbm_bo *bo= 0;
+
+   memset( buffer, 0, sizeof(PlatformLinearBuffer) );
+   buffer->fd= -1;
+
+   if ( !ctx || !ctx->gbm )
+   {
+      goto exit;
+   }
+
+   // Allocated as a 32 bit format wide enough for the rows, the client
+   // lays out its own planes inside
+   bo= gbm_bo_create( ctx->gbm, (bytesPerRow+3)/4, rows, GBM_FORMAT_XRGB8888, GBM_BO_USE_LINEAR );
+   if ( !bo )
+   {
+      fprintf(stderr,"Error: PlatformAllocLinearBuffer: gbm_bo_create failed for %d x %d bytes\n", bytesPerRow, rows);
+      goto exit;
+   }
+
+   buffer->fd= gbm_bo_get_fd( bo );
+   if ( buffer->fd < 0 )
+   {
+      fprintf(stderr,"Error: PlatformAllocLinearBuffer: gbm_bo_get_fd failed\n");
+      goto exit;
+   }
+   buffer->stride= gbm_bo_get_stride( bo );
+   buffer->rows= rows;
+   buffer->bo= bo;
+   bo= 0;
+
+   result= true;
+
+exit:
+   if ( bo )
+   {
+      gbm_bo_destroy( bo );
+   }
+
+   return result;
+}
+
+bool PlatformMapLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer )
+{
+   bool result= false;
+   struct gbm_bo *bo= (struct gbm_bo*)buffer->bo;
+   uint32_t stride= 0;
+
+   if ( bo && !buffer->map )
+   {
+      buffer->map= gbm_bo_map( bo, 0, 0, gbm_bo_get_width( bo ), gbm_bo_get_height( bo ),
+                               GBM_BO_TRANSFER_READ_WRITE, &stride, &buffer->mapData );
+      if ( buffer->map )
+      {
+         // A driver may map through a staging copy with its own pitch
+         buffer->mapStride= stride;
+         result= true;
+      }
+      else
+      {
+         fprintf(stderr,"Error: PlatformMapLinearBuffer: gbm_bo_map failed\n");
+      }
+   }
+
+   return result;
+}
+
+void PlatformUnmapLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer )
+{
+   if ( buffer->bo && buffer->map )
+   {
+      gbm_bo_unmap( (struct gbm_bo*)buffer->bo, buffer->mapData );
+      buffer->map= 0;
+      buffer->mapStride= 0;
+      buffer->mapData= 0;
+   }
+}
+
+void PlatformFreeLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer )
+{
+   PlatformUnmapLinearBuffer( ctx, buffer );
+   if ( buffer->fd >= 0 )
+   {
+      close( buffer->fd );
+      buffer->fd= -1;
+   }
+   if ( buffer->bo )
+   {
+      gbm_bo_destroy( (struct gbm_bo*)buffer->bo );
+      buffer->bo= 0;
+   }
+}
+
 EGLAPI EGLSurface EGLAPIENTRY eglCreateWindowSurface( EGLDisplay dpy, EGLConfig config,
                                                       EGLNativeWindowType win,
                                                       const EGLint *attrib_list )
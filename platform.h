@@ -23,6 +23,51 @@
 
 typedef struct _PlatformCtx PlatformCtx;
 
+typedef struct _PlatformMemoryStats
+{
+   int scanoutBufferCount;
+   long long scanoutBufferBytes;
+} PlatformMemoryStats;
+
+typedef struct _PlatformDisplayInfo
+{
+   int modeWidth;
+   int modeHeight;
+   int refreshMilliHz;
+   bool scaled;
+} PlatformDisplayInfo;
+
+#define PLATFORM_SWAP_STAGE_SWAP (0)
+#define PLATFORM_SWAP_STAGE_LOCK (1)
+#define PLATFORM_SWAP_STAGE_ADDFB (2)
+#define PLATFORM_SWAP_STAGE_BUILD (3)
+#define PLATFORM_SWAP_STAGE_COMMIT (4)
+#define PLATFORM_SWAP_STAGE_RELEASE (5)
+#define PLATFORM_SWAP_STAGE_TOTAL (6)
+#define PLATFORM_SWAP_STAGE_COUNT (7)
+
+// Bucket 0 holds times under 1 us, bucket n holds [2^(n-1), 2^n) us
+#define PLATFORM_SWAP_HIST_BUCKETS (22)
+
+typedef struct _PlatformSwapStats
+{
+   int count;
+   long long totalNs[PLATFORM_SWAP_STAGE_COUNT];
+   long long maxNs[PLATFORM_SWAP_STAGE_COUNT];
+   int hist[PLATFORM_SWAP_STAGE_COUNT][PLATFORM_SWAP_HIST_BUCKETS];
+} PlatformSwapStats;
+
+typedef struct _PlatformLinearBuffer
+{
+   int fd;
+   int stride;
+   int rows;
+   void *map;
+   int mapStride;
+   void *bo;
+   void *mapData;
+} PlatformLinearBuffer;
+
 PlatformCtx* PlatfromInit( void );
 void PlatformTerm( PlatformCtx *ctx );
 NativeDisplayType PlatformGetEGLDisplayType( PlatformCtx *ctx );
@@ -30,6 +75,33 @@ EGLDisplay PlatformGetEGLDisplay( PlatformCtx *ctx, NativeDisplayType type );
 EGLDisplay PlatformGetEGLDisplayWayland( PlatformCtx *ctx, struct wl_display *display );
 void *PlatformCreateNativeWindow( PlatformCtx *ctx, int width, int height );
 void PlatformDestroyNativeWindow( PlatformCtx *ctx, void *nativeWindow );
+bool PlatformGetMemoryStats( PlatformCtx *ctx, PlatformMemoryStats *stats );
+bool PlatformGetSwapStats( PlatformCtx *ctx, PlatformSwapStats *stats, bool reset );
+bool PlatformGetDisplayInfo( PlatformCtx *ctx, PlatformDisplayInfo *info );
+// Returns false if the platform leaves swap with damage to EGL
+bool PlatformSwapBuffersWithDamage( PlatformCtx *ctx, EGLDisplay dpy, EGLSurface surface, EGLint *rects, EGLint count );
+// Called once a scanout commit has reached the display: shown is the client
+// buffer now on screen and released the one it replaced, which the display
+// no longer reads (null if the same buffer was shown again or it was destroyed)
+typedef void (*PlatformScanoutListener)( void *userData, struct wl_resource *shown, struct wl_resource *released );
+void PlatformSetScanoutListener( PlatformCtx *ctx, PlatformScanoutListener listener, void *userData );
+// Show a client's wl_buffer on a display plane at the given output position
+// in place of composing it.  Returns false if the buffer can not be scanned out.
+// The commit does not wait for the display; completion is reported to the
+// scanout listener from PlatformDispatchEvents or PlatformScanoutWait.
+bool PlatformScanoutBuffer( PlatformCtx *ctx, struct wl_resource *buffer, int x, int y, int width, int height );
+// Wait for a scanout commit still on its way to the display, if any
+void PlatformScanoutWait( PlatformCtx *ctx );
+void PlatformScanoutStop( PlatformCtx *ctx );
+// A descriptor to poll for display events, or -1 if the platform has none
+int PlatformGetEventFd( PlatformCtx *ctx );
+void PlatformDispatchEvents( PlatformCtx *ctx );
+// Allocate a linear buffer shared by dma-buf fd that a client fills with
+// the CPU, eg with video frames.  Returns false if the platform has none.
+bool PlatformAllocLinearBuffer( PlatformCtx *ctx, int bytesPerRow, int rows, PlatformLinearBuffer *buffer );
+bool PlatformMapLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer );
+void PlatformUnmapLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer );
+void PlatformFreeLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer );
 
 #endif
 
@@ -106,5 +106,113 @@ void PlatformDestroyNativeWindow( PlatformCtx *ctx, void *nativeWindow )
    }
 }
 
+bool PlatformGetMemoryStats( PlatformCtx *ctx, PlatformMemoryStats *stats )
+{
+   bool result= false;
+
+   if ( ctx )
+   {
+      // TBD
+   }
+
+   return result;
+}
+
+bool PlatformGetSwapStats( PlatformCtx *ctx, PlatformSwapStats *stats, bool reset )
+{
+   bool result= false;
+
+   if ( ctx )
+   {
+      // TBD
+   }
+
+   return result;
+}
+
+bool PlatformGetDisplayInfo( PlatformCtx *ctx, PlatformDisplayInfo *info )
+{
+   bool result= false;
+
+   if ( ctx )
+   {
+      // TBD
+   }
+
+   return result;
+}
+
+bool PlatformSwapBuffersWithDamage( PlatformCtx *ctx, EGLDisplay dpy, EGLSurface surface, EGLint *rects, EGLint count )
+{
+   bool result= false;
+
+   if ( ctx )
+   {
+      // TBD
+   }
+
+   return result;
+}
+
+bool PlatformScanoutBuffer( PlatformCtx *ctx, struct wl_resource *buffer, int x, int y, int width, int height )
+{
+   bool result= false;
+
+   if ( ctx )
+   {
+      // TBD
+   }
+
+   return result;
+}
+
+void PlatformScanoutStop( PlatformCtx *ctx )
+{
+   if ( ctx )
+   {
+      // TBD
+   }
+}
+
+bool PlatformAllocLinearBuffer( PlatformCtx *ctx, int bytesPerRow, int rows, PlatformLinearBuffer *buffer )
+{
+   bool result= false;
+
+   if ( ctx )
+   {
+      // TBD
+   }
+
+   return result;
+}
+
+bool PlatformMapLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer )
+{
+   bool result= false;
+
+   if ( ctx )
+   {
+      // TBD
+   }
+
+   return result;
+}
+
+void PlatformUnmapLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer )
+{
+   if ( ctx )
+   {
+      // TBD
+   }
+}
+
+void PlatformFreeLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer )
+{
+   if ( ctx )
+   {
+      // TBD
+   }
+}
+
 #endif
 
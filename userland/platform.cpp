@@ -220,5 +220,86 @@ void PlatformDestroyNativeWindow( PlatformCtx *ctx, void *nativeWindow )
    }
 }
 
+bool PlatformGetMemoryStats( PlatformCtx *ctx, PlatformMemoryStats *stats )
+{
+   // Dispmanx buffers are owned by the VideoCore and are not visible here
+   return false;
+}
+
+bool PlatformGetSwapStats( PlatformCtx *ctx, PlatformSwapStats *stats, bool reset )
+{
+   // eglSwapBuffers is not interposed on this platform
+   return false;
+}
+
+bool PlatformGetDisplayInfo( PlatformCtx *ctx, PlatformDisplayInfo *info )
+{
+   bool result= false;
+
+   if ( ctx )
+   {
+      // Windows larger than the display are clipped rather than scaled
+      info->modeWidth= ctx->displayWidth;
+      info->modeHeight= ctx->displayHeight;
+      info->refreshMilliHz= 0;
+      info->scaled= false;
+      result= true;
+   }
+
+   return result;
+}
+
+bool PlatformSwapBuffersWithDamage( PlatformCtx *ctx, EGLDisplay dpy, EGLSurface surface, EGLint *rects, EGLint count )
+{
+   // eglSwapBuffers is not interposed on this platform
+   return false;
+}
+
+bool PlatformScanoutBuffer( PlatformCtx *ctx, struct wl_resource *buffer, int x, int y, int width, int height )
+{
+   // Client buffers can not be put on a dispmanx element directly
+   return false;
+}
+
+void PlatformSetScanoutListener( PlatformCtx *ctx, PlatformScanoutListener listener, void *userData )
+{
+}
+
+void PlatformScanoutWait( PlatformCtx *ctx )
+{
+}
+
+void PlatformScanoutStop( PlatformCtx *ctx )
+{
+}
+
+int PlatformGetEventFd( PlatformCtx *ctx )
+{
+   return -1;
+}
+
+void PlatformDispatchEvents( PlatformCtx *ctx )
+{
+}
+
+bool PlatformAllocLinearBuffer( PlatformCtx *ctx, int bytesPerRow, int rows, PlatformLinearBuffer *buffer )
+{
+   // VideoCore buffers are not shared by dma-buf
+   return false;
+}
+
+bool PlatformMapLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer )
+{
+   return false;
+}
+
+void PlatformUnmapLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer )
+{
+}
+
+void PlatformFreeLinearBuffer( PlatformCtx *ctx, PlatformLinearBuffer *buffer )
+{
+}
+
 #endif
 
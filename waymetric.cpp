@@ -18,11 +18,31 @@
  */
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <math.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
 #include <dlfcn.h>
+#include <dirent.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined (USE_ALLOC_HOOKS)
+#include <link.h>
+#endif
 
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
@@ -39,8 +59,6 @@
 
 #include "platform.h"
 
-#include <vector>
-
 #define WAYMETRIC_VERSION "0.61"
 
 #define UNUSED(x) ((void)x)
@@ -49,9 +67,20 @@
 
 #define DEFAULT_WIDTH (1280)
 #define DEFAULT_HEIGHT (720)
+#define DEFAULT_VIDEO_FPS (30)
+#define DEFAULT_SUBSURFACE_OVERLAP (50)
 #define DEFAULT_ITERATIONS (300)
+#define DEFAULT_SOAK_INTERVAL (10)
+#define DEFAULT_WARMUP_MAX_FRAMES (64)
+#define DEFAULT_COMPARE_THRESHOLD (5.0)
+#define DEFAULT_COMPARE_ALPHA (0.01)
+
+#define DEFAULT_REFRESH_PERIOD_US (1000000/60)
+
+#define WAYLAND_CONNECT_TIMEOUT_US (2000000)
 
-#define FRAME_PERIOD_MILLIS_60FPS (1000/60)
+#define PACING_INCREMENT (1000)
+#define PACING_STEP_COUNT (18)
 
 #ifndef PFNEGLGETPLATFORMDISPLAYEXTPROC
 typedef EGLDisplay (EGLAPIENTRYP PFNEGLGETPLATFORMDISPLAYEXTPROC) (EGLenum platform, void *native_display, const EGLint *attrib_list);
@@ -67,28 +96,71 @@ typedef struct wl_buffer* (*PFNREMOTECLONEBUFFERFROMRESOURCE)( struct wl_display
 
 typedef struct _AppCtx AppCtx;
 typedef struct _WaylandCtx WaylandCtx;
+typedef struct _SoakCtx SoakCtx;
 
-#define MAX_TEXTURES (2)
+#define MAX_TEXTURES (3)
+
+// Damage is tracked as a single bounding box in top left origin coordinates,
+// the same convention wl_surface damage uses
+typedef struct _DamageRect
+{
+   int x0;
+   int y0;
+   int x1;
+   int y1;
+} DamageRect;
 
 typedef struct _Surface
 {
+   struct wl_list link;
    struct wl_resource *resource;
    WaylandCtx *ctx;
    struct wl_listener attachedBufferDestroyListener;
    struct wl_listener detachedBufferDestroyListener;
    struct wl_resource *attachedBufferResource;
    struct wl_resource *detachedBufferResource;
+   int attachedFrame;
+   int detachedFrame;
    int attachedX;
    int attachedY;
    int refCount;
    int textureCount;
    GLuint textureId[MAX_TEXTURES];
    EGLImageKHR eglImage[MAX_TEXTURES];
+   int program;
    int bufferWidth;
    int bufferHeight;
+   int x;
+   int y;
+   int width;
+   int height;
+   DamageRect pendingDamage;
+   DamageRect damage;
+   bool hasAlpha;
+   bool opaquePending;
+   DamageRect pendingOpaque;
+   DamageRect opaque;
+   struct _Surface *parent;
+   struct wl_resource *subsurfaceResource;
+   bool isSubsurface;
+   bool sync;
+   bool positionPending;
+   int pendingSubX;
+   int pendingSubY;
+   int subX;
+   int subY;
    struct wl_surface *surfaceNested;
 } Surface;
 
+// Only the largest rectangle added to a region is kept.  That is exact for
+// the single rectangle opaque regions clients normally set and never claims
+// more than the client asked for.
+typedef struct _Region
+{
+   struct wl_resource *resource;
+   DamageRect rect;
+} Region;
+
 typedef struct _EGLCtx
 {
    AppCtx *appCtx;
@@ -103,13 +175,24 @@ typedef struct _EGLCtx
    EGLConfig eglConfig;
    EGLint majorVersion;
    EGLint minorVersion;
+   bool haveBufferAge;
+   PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC eglSwapBuffersWithDamage;
+   PFNEGLSETDAMAGEREGIONKHRPROC eglSetDamageRegion;
 } EGLCtx;
 
-typedef struct _GLCtx
+#define PROGRAM_RGB (0)
+#define PROGRAM_YUV (1)
+#define PROGRAM_YUV3 (2)
+#define PROGRAM_YUYV (3)
+#define NUM_PROGRAMS (4)
+
+static const char *gProgramNames[NUM_PROGRAMS]= { "RGB", "YUV", "YUV3", "YUYV" };
+
+typedef struct _GLProgram
 {
-   AppCtx *appCtx;
-   bool haveYUVTextures;
-   bool haveYUVShaders;
+   bool isYUV;
+   int textureCount;
+   bool fromCache;
    GLuint frag;
    GLuint vert;
    GLuint prog;
@@ -120,18 +203,275 @@ typedef struct _GLCtx
    GLint locMatrix;
    GLint locTexture;
    GLint locTextureUV;
+   GLint locTextureV;
+   long long compileTime;
+   long long linkTime;
+   long long loadTime;
+   bool uniformsSet;
+   GLfloat resWidth;
+   GLfloat resHeight;
+} GLProgram;
+
+#define MAX_DRAW_SURFACES (64)
+#define QUAD_VERTICES (6)
+#define VERTEX_FLOATS (4)
+#define QUAD_FLOATS (QUAD_VERTICES*VERTEX_FLOATS)
+
+typedef struct _DrawItem
+{
+   Surface *surface;
+   int program;
+   int batch;
+   int order;
+   bool blend;
+} DrawItem;
+
+typedef struct _GLCtx
+{
+   AppCtx *appCtx;
+   bool haveProgramBinary;
+   PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinaryOES;
+   PFNGLPROGRAMBINARYOESPROC glProgramBinaryOES;
+   unsigned long long cacheKey;
+   char cacheDir[PATH_MAX];
+   GLProgram programs[NUM_PROGRAMS];
+   GLuint vbo;
+   int vboQuadCapacity;
+   int uploadedQuadCount;
+   int drawCount;
+   DrawItem drawItems[MAX_DRAW_SURFACES];
+   GLfloat vertices[MAX_DRAW_SURFACES*QUAD_FLOATS];
+   GLfloat uploadedVertices[MAX_DRAW_SURFACES*QUAD_FLOATS];
 } GLCtx;
 
+typedef struct _CpuSample
+{
+   long long threadUser;
+   long long threadSys;
+   long long procUser;
+   long long procSys;
+   long long statUser;
+   long long statSys;
+   long long volCsw;
+   long long involCsw;
+} CpuSample;
+
+#define PERF_COUNTER_COUNT (7)
+#define PERF_GROUP_HW (0)
+#define PERF_GROUP_SW (1)
+#define PERF_GROUP_COUNT (2)
+
+typedef struct _PerfEventDesc
+{
+   const char *name;
+   int group;
+   unsigned int type;
+   unsigned long long config;
+} PerfEventDesc;
+
+typedef struct _PerfCounters
+{
+   bool requested;
+   bool enabled;
+   bool userOnly;
+   int leaderFd[PERF_GROUP_COUNT];
+   int fd[PERF_COUNTER_COUNT];
+   int memberCount[PERF_GROUP_COUNT];
+   int member[PERF_GROUP_COUNT][PERF_COUNTER_COUNT];
+   bool multiplexed;
+} PerfCounters;
+
+#define MAX_CPUS (16)
+
+typedef struct _CpuFreqSample
+{
+   int cpuCount;
+   int freqKHz[MAX_CPUS];
+   int maxTempMilliC;
+   int coolingState;
+   long long throttleCount;
+} CpuFreqSample;
+
+typedef struct _MemSample
+{
+   long long rss;
+   // The kernel's RSS high water mark, catching peaks between samples
+   long long rssHwm;
+   long long pss;
+   long long swap;
+   int eglImages;
+   int scanoutBuffers;
+   long long scanoutBytes;
+   long long drmBytes;
+} MemSample;
+
+typedef struct _JankStats
+{
+   long long periodUs;
+   int frames;
+   int onTime;
+   int missed1;
+   int missed2;
+   int missed3Plus;
+   int missedVblanks;
+   int streak;
+   int longestStreak;
+} JankStats;
+
+#define PROTOCOL_MAX_MESSAGE_TYPES (64)
+#define SOCKET_CLIENTS (0)
+#define SOCKET_UPSTREAM (1)
+#define SOCKET_KIND_COUNT (2)
+
+typedef struct _ProtocolMessageStats
+{
+   const struct wl_message *message;
+   const char *interface;
+   bool isEvent;
+   long long count;
+   long long bytes;
+} ProtocolMessageStats;
+
+typedef struct _ProtocolStats
+{
+   struct wl_protocol_logger *logger;
+   int typeCount;
+   long long requests;
+   long long requestBytes;
+   long long events;
+   long long eventBytes;
+   ProtocolMessageStats types[PROTOCOL_MAX_MESSAGE_TYPES];
+} ProtocolStats;
+
+typedef struct _SocketSnapshot
+{
+   long long sendCalls[SOCKET_KIND_COUNT];
+   long long sendBytes[SOCKET_KIND_COUNT];
+   long long recvCalls[SOCKET_KIND_COUNT];
+   long long recvBytes[SOCKET_KIND_COUNT];
+   long long flushes;
+   long long roundtrips;
+} SocketSnapshot;
+
+// Wayland messages counted by a compositor's protocol logger
+typedef struct _ProtocolCounts
+{
+   long long requests;
+   long long requestBytes;
+   long long events;
+   long long eventBytes;
+} ProtocolCounts;
+
+typedef struct _StepMetrics
+{
+   int frames;
+   CpuSample cpu;
+   bool havePerf;
+   long long perf[PERF_COUNTER_COUNT];
+   MemSample mem;
+   CpuFreqSample freqStart;
+   CpuFreqSample freqEnd;
+   int gpuMode;
+   int gpuFrames;
+   long long gpuNs;
+   long long gpuMaxNs;
+   JankStats jank;
+   int repaintFrames;
+   long long repaintPixels;
+   long long outputPixels;
+   int presentFrames;
+   long long presentUs;
+   long long presentMaxUs;
+   int scanoutFrames;
+   long long composeBytes;
+   int importFrames;
+   long long importUs;
+   long long importMaxUs;
+   int importProgram;
+   int layerFrames;
+   long long layers;
+   long long culledLayers;
+   long long blendedLayers;
+   long long drawnPixels;
+   long long blendedPixels;
+   long long layerOutputPixels;
+   bool haveProtocol;
+   bool haveMessages;
+   ProtocolCounts messages;
+   SocketSnapshot socket;
+} StepMetrics;
+
+typedef struct _RoleMetrics
+{
+   AppCtx *appCtx;
+   int currentStep;
+   bool inStep;
+   int stepStartFrame;
+   long long lastFrameTime;
+   CpuSample cpuStart;
+   long long perfStart[PERF_COUNTER_COUNT];
+   ProtocolStats *protocol;
+   ProtocolCounts messagesStart;
+   SocketSnapshot socketStart;
+   MemSample memBaseline;
+   MemSample memPeak;
+   StepMetrics steps[PACING_STEP_COUNT];
+} RoleMetrics;
+
+// Frames of output damage kept for EGL_EXT_buffer_age.  Older buffers
+// are repainted in full.
+#define DAMAGE_HISTORY (4)
+
+#define GPU_TIMER_NONE (0)
+#define GPU_TIMER_QUERY (1)
+#define GPU_TIMER_FENCE (2)
+#define GPU_TIMER_RING (8)
+#define GPU_TIMER_FENCE_WAIT_NS (1000000)
+
+typedef struct _GpuTimer
+{
+   int mode;
+   EGLDisplay eglDisplay;
+   PFNGLGENQUERIESEXTPROC glGenQueriesEXT;
+   PFNGLDELETEQUERIESEXTPROC glDeleteQueriesEXT;
+   PFNGLBEGINQUERYEXTPROC glBeginQueryEXT;
+   PFNGLENDQUERYEXTPROC glEndQueryEXT;
+   PFNGLGETQUERYOBJECTUIVEXTPROC glGetQueryObjectuivEXT;
+   PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
+   PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR;
+   PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR;
+   PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR;
+   GLuint queries[GPU_TIMER_RING];
+   EGLSyncKHR syncs[GPU_TIMER_RING];
+   long long submitTime[GPU_TIMER_RING];
+   int head;
+   int pending;
+   bool active;
+   long long disjointCount;
+} GpuTimer;
+
 typedef struct _NestedBufferInfo
 {
+   struct _NestedBufferInfo *next;
    WaylandCtx *ctx;
    struct wl_surface *surface;
    struct wl_resource *bufferRemote;
+   long long releaseTime;
+   int frame;
 } NestedBufferInfo;
 
+typedef struct _ClientLayer
+{
+   struct wl_surface *surface;
+   struct wl_subsurface *subsurface;
+   struct wl_egl_window *winWayland;
+   EGLSurface eglSurface;
+} ClientLayer;
+
 typedef struct _WaylandCtx
 {
    AppCtx *appCtx;
+   const char *name;
    EGLCtx eglServer;
    EGLCtx eglClient;
    GLCtx gl;
@@ -139,16 +479,41 @@ typedef struct _WaylandCtx
    pthread_mutex_t mutexReady;
    pthread_cond_t condReady;
    struct wl_compositor *compositor;
+   struct wl_subcompositor *subcompositor;
+   ClientLayer *layers;
+   int layerCount;
+   struct wl_proxy *drm;
+   struct wl_proxy *control;
+   bool drmPrime;
+   unsigned int drmFormats;
+   bool drmXrgb;
    struct wl_surface *surface;
    struct wl_egl_window *winWayland;
    struct wl_display *dispWayland;
-   struct wl_resource *rescb;
-   struct wl_event_source *displayTimer;
+   struct wl_list surfaces;
+   struct wl_list frameCallbacks;
+   bool childActive;
+   bool stepMarkPending;
+   int stepEndFrame;
+   int frameCount;
+   DamageRect outputDamage;
+   DamageRect damageHistory[DAMAGE_HISTORY];
+   int damageHistoryCount;
+   Surface *scanoutSurface;
+   struct wl_event_source *scanoutEventSource;
+   RoleMetrics metrics;
+   ProtocolStats protocol;
+   GpuTimer gpu;
+   SoakCtx *soak;
    const char *upstreamDisplayName;
    bool isRepeater;
    struct wl_display *upstreamDisplay;
-   pthread_mutex_t buffersToReleaseMutex;
-   std::vector<NestedBufferInfo> buffersToRelease;
+   NestedBufferInfo *releaseQueue;
+   int releaseEventFd;
+   struct wl_event_source *releaseEventSource;
+   int releaseCount;
+   long long releaseLatencyTotal;
+   long long releaseLatencyMax;
 } WaylandCtx;
 
 typedef struct _MultiComp
@@ -168,9 +533,204 @@ typedef struct _MultiComp
    bool error;
 } MultiComp;
 
+#define SURFACE_POOL_CAPACITY (MAX_DRAW_SURFACES)
+#define BUFFER_INFO_POOL_CAPACITY (64)
+
+typedef struct _ObjectPool
+{
+   const char *name;
+   pthread_mutex_t mutex;
+   size_t objectSize;
+   int capacity;
+   unsigned char *storage;
+   void *freeList;
+   int inUse;
+   int peakInUse;
+   long long allocCount;
+   long long fallbackCount;
+} ObjectPool;
+
+typedef struct _AllocSnapshot
+{
+   long long poolAllocs;
+   long long poolFallbacks;
+   long long heapAllocs;
+   long long waylandAllocs;
+} AllocSnapshot;
+
+#define TRACE_RING_CAPACITY (32768)
+#define TRACE_RUN_STRIDE (1000000LL)
+#define TRACE_FRAGMENT_FORMAT "%s.%s"
+
+typedef struct _TraceEvent
+{
+   const char *name;
+   long long start;
+   long long duration;
+   long long flowId;
+   char flow;
+} TraceEvent;
+
+typedef struct _TraceRing
+{
+   struct _TraceRing *next;
+   int tid;
+   unsigned int count;
+   TraceEvent events[TRACE_RING_CAPACITY];
+} TraceRing;
+
+typedef struct _TraceCtx
+{
+   bool enabled;
+   bool isMaster;
+   const char *filename;
+   const char *processName;
+   int run;
+   pthread_mutex_t mutex;
+   TraceRing *rings;
+} TraceCtx;
+
+#define ROLE_MASTER (0)
+#define ROLE_NESTED (1)
+#define ROLE_CLIENT (2)
+#define ROLE_COUNT (3)
+
+#define VIDEO_FORMAT_NONE (0)
+#define VIDEO_FORMAT_NV12 (1)
+#define VIDEO_FORMAT_YUV420 (2)
+#define VIDEO_FORMAT_YUYV (3)
+#define VIDEO_FORMAT_COUNT (4)
+
+#define MAX_SUBSURFACES (32)
+
+#define MIN_CLIENT_BUFFERS (2)
+#define MAX_CLIENT_BUFFERS (4)
+
+// Buffer ages 0 (contents unknown), 1, 2, 3 and 4 or more
+#define BUFFER_AGE_BUCKETS (5)
+
+typedef struct _RoleControl
+{
+   const char *cpuList;
+   const char *schedArg;
+   int policy;
+   int priority;
+   bool haveSched;
+} RoleControl;
+
+// Log-linear histogram of microsecond values: exact below HDR_SUB_COUNT, then
+// HDR_HALF_COUNT linear buckets per power of two, so relative error stays
+// under 1/HDR_HALF_COUNT across the full 32 bit range in constant memory.
+#define HDR_SUB_BITS (7)
+#define HDR_SUB_COUNT (1<<HDR_SUB_BITS)
+#define HDR_HALF_COUNT (HDR_SUB_COUNT/2)
+#define HDR_BUCKETS (HDR_SUB_COUNT+(32-HDR_SUB_BITS)*HDR_HALF_COUNT)
+
+typedef struct _HdrHistogram
+{
+   long long count;
+   long long max;
+   int counts[HDR_BUCKETS];
+} HdrHistogram;
+
+#define SOAK_PAGE_NAME "/waymetric-soak"
+#define SOAK_PAGE_MAGIC (0x4B414F53)
+#define SOAK_PAGE_VERSION (2)
+
+// A soak runs the client straight against the master, so the nested role
+// has no slot
+#define SOAK_SLOT_MASTER (0)
+#define SOAK_SLOT_CLIENT (1)
+#define SOAK_SLOT_COUNT (2)
+#define SOAK_MAX_INTERVALS (240)
+
+// Published through shared memory; a reader copies a slot and retries if seq
+// was odd or changed while copying
+typedef struct _SoakPageSlot
+{
+   unsigned int seq;
+   int pid;
+   char role[16];
+   long long elapsedMs;
+   long long frames;
+   int p50Us;
+   int p90Us;
+   int p99Us;
+   int maxUs;
+   int totalP99Us;
+   int surfaces;
+   int bufferInfos;
+   int eglImages;
+   long long rss;
+   long long pss;
+} SoakPageSlot;
+
+typedef struct _SoakPage
+{
+   unsigned int magic;
+   unsigned int version;
+   SoakPageSlot slots[SOAK_SLOT_COUNT];
+} SoakPage;
+
+typedef struct _SoakInterval
+{
+   int elapsedS;
+   int frames;
+   int p50Us;
+   int p90Us;
+   int p99Us;
+   int maxUs;
+   int surfaces;
+   int eglImages;
+   long long rss;
+   long long pss;
+} SoakInterval;
+
+struct _SoakCtx
+{
+   SoakPageSlot *slot;
+   long long startTime;
+   long long lastFrameTime;
+   long long nextPublish;
+   long long frames;
+   long long windowFrames;
+   int intervalIndex;
+   int stride;
+   int historyCount;
+   HdrHistogram window;
+   HdrHistogram total;
+   SoakInterval history[SOAK_MAX_INTERVALS];
+};
+
+#define WARMUP_WINDOW (16)
+#define WARMUP_TOLERANCE (0.05)
+
+// Frames are rendered before each measured window until two successive
+// windows of frame times agree in mean and spread, or maxFrames is reached
+typedef struct _WarmupCtx
+{
+   int maxFrames;
+   int frames;
+   long long startTime;
+   long long lastTime;
+   long long firstFrameTime;
+   long long windowSum;
+   long long windowSumSq;
+   int windowCount;
+   bool havePrev;
+   double prevMean;
+   double prevStdDev;
+   double mean;
+   bool settled;
+   bool done;
+} WarmupCtx;
+
 typedef struct _AppCtx
 {
    FILE *pReport;
+   FILE *pResults;
+   const char *resultsFilename;
+   const char *section;
    PlatformCtx *platformCtx;
    WaylandCtx master;
    WaylandCtx nested;
@@ -193,6 +753,21 @@ typedef struct _AppCtx
    PFNREMOTECLONEBUFFERFROMRESOURCE remoteCloneBufferFromResource;
    bool canRemoteClone;
 
+   ObjectPool surfacePool;
+   ObjectPool bufferInfoPool;
+
+   RoleControl control[ROLE_COUNT];
+   char startCpuList[64];
+   int soakSeconds;
+   int soakPacing;
+   int soakInterval;
+   SoakPage *soakPage;
+   int *frameSamples;
+   int frameSampleCount;
+   const char *compareFilename;
+   double compareThreshold;
+   double compareAlpha;
+
    pthread_mutex_t mutex;
    const char *displayName;
    const char *nestedDisplayName;
@@ -202,6 +777,26 @@ typedef struct _AppCtx
    pthread_t nestedDispatchThreadId;
    bool renderWayland;
    int pacingDelay;
+   int pacingStart;
+   int pacingIncrement;
+   int pacingSteps;
+   int pacingStep;
+   int swapInterval;
+   bool decoupleFrames;
+   bool damageTracking;
+   int damageWidth;
+   int damageHeight;
+   bool directScanout;
+   int videoFormat;
+   int videoFps;
+   int subsurfaceCount;
+   int subsurfaceOverlap;
+   int subsurfaceAlpha;
+   int clientBuffers;
+   long long refreshPeriodUs;
+   bool refreshPeriodSet;
+   int warmupMaxFrames;
+   WarmupCtx warmup;
 
    int maxIterations;
    int windowWidth;
@@ -210,6 +805,8 @@ typedef struct _AppCtx
    int directEGLIterationCount;
    long long directEGLTimeTotal;
    double directEGLFPS;
+   PlatformSwapStats directSwapStats;
+   bool haveDirectSwapStats;
 
    int waylandEGLIterationCount;
    long long waylandEGLTimeTotal;
@@ -220,6 +817,34 @@ typedef struct _AppCtx
 
 bool gVerbose= false;
 
+static PerfCounters gPerf;
+
+static int gEGLImageCount= 0;
+
+static bool gProtocolStats= false;
+static bool gGpuTiming= false;
+static SocketSnapshot gSocketCounts;
+static int gUpstreamFd= -1;
+static __thread int gRoundtripDepth= 0;
+
+static TraceCtx gTrace= { false, false, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, 0 };
+static __thread TraceRing *gTraceRing= 0;
+
+static const PerfEventDesc gPerfEvents[PERF_COUNTER_COUNT]=
+{
+   { "cycles", PERF_GROUP_HW, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+   { "instructions", PERF_GROUP_HW, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+   { "cache-refs", PERF_GROUP_HW, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+   { "cache-misses", PERF_GROUP_HW, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+   { "branch-misses", PERF_GROUP_HW, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+   { "context-switches", PERF_GROUP_SW, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+   { "page-faults", PERF_GROUP_SW, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS }
+};
+#define PERF_CYCLES (0)
+#define PERF_INSTRUCTIONS (1)
+#define PERF_CACHE_REFS (2)
+#define PERF_CACHE_MISSES (3)
+
 static long long getCurrentTimeMicro(void)
 {
    struct timeval tv;
@@ -242,1841 +867,10399 @@ static long long getCurrentTimeMillis(void)
    return utcCurrentTimeMillis;
 }
 
-#define RESULT_FILE "/tmp/waymetric-result"
-#define RESULT_FORMAT "result: %lld\n"
-
-static void writeResult( long long value )
+static bool poolInit( ObjectPool *pool, const char *name, size_t objectSize, int capacity )
 {
-   FILE *pFile= 0;
-   pFile= fopen( RESULT_FILE, "wt");
-   if ( pFile )
-   {
-      fprintf( pFile, RESULT_FORMAT, value );
-      fclose( pFile );
+   bool result= false;
+
+   pool->name= name;
+   pool->objectSize= (objectSize < sizeof(void*)) ? sizeof(void*) : objectSize;
+   pool->capacity= capacity;
+   pool->freeList= 0;
+   pool->inUse= 0;
+   pool->peakInUse= 0;
+   pool->allocCount= 0;
+   pool->fallbackCount= 0;
+   pthread_mutex_init( &pool->mutex, 0 );
+
+   pool->storage= (unsigned char*)calloc( capacity, pool->objectSize );
+   if ( !pool->storage )
+   {
+      printf("Error: poolInit: no memory for %s pool\n", name);
+      pool->capacity= 0;
+      goto exit;
    }
-   else
+
+   for( int i= capacity-1; i >= 0; --i )
    {
-      printf("Error: unable to open result file: %s\n", RESULT_FILE);
+      void *obj= pool->storage+i*pool->objectSize;
+      *((void**)obj)= pool->freeList;
+      pool->freeList= obj;
    }
+
+   result= true;
+
+exit:
+   return result;
 }
 
-static long long readResult()
+static void poolTerm( ObjectPool *pool )
 {
-   long long value= 0;
-   FILE *pFile= 0;
-   pFile= fopen( RESULT_FILE, "rt");
-   if ( pFile )
+   if ( pool->inUse )
    {
-      if ( fscanf( pFile, RESULT_FORMAT, &value ) != 1 )
-      {
-         printf("Error: unable to parse result from %s\n" RESULT_FILE);
-      }
-      fclose( pFile );
-      remove( RESULT_FILE );
+      printf("Warning: poolTerm: %d %s objects still in use\n", pool->inUse, pool->name);
    }
-   else
+   if ( pool->storage )
    {
-      printf("Error: unable to open result file: %s\n", RESULT_FILE);
+      free( pool->storage );
+      pool->storage= 0;
    }
-   return value;
+   pool->freeList= 0;
+   pthread_mutex_destroy( &pool->mutex );
 }
 
-#define MAX_ATTRIBS (24)
-#define RED_SIZE (8)
-#define GREEN_SIZE (8)
-#define BLUE_SIZE (8)
-#define ALPHA_SIZE (8)
-#define DEPTH_SIZE (0)
-
-static bool initEGL( EGLCtx *eglCtx )
+static void *poolAlloc( ObjectPool *pool )
 {
-   bool result= false;
-   int i;
-   EGLBoolean br;
-   EGLint configCount;
-   EGLConfig *configs= 0;
-   EGLint attrs[MAX_ATTRIBS];
-   EGLint redSize, greenSize, blueSize;
-   EGLint alphaSize, depthSize;
-
-   eglCtx->eglDisplay= EGL_NO_DISPLAY;
-   eglCtx->eglContext= EGL_NO_CONTEXT;
-   eglCtx->eglSurface= EGL_NO_SURFACE;
+   void *obj;
 
-   if ( eglCtx->useWayland )
-   {
-      eglCtx->eglDisplay= PlatformGetEGLDisplayWayland( eglCtx->appCtx->platformCtx, eglCtx->dispWayland );
-   }
-   else
+   pthread_mutex_lock( &pool->mutex );
+   obj= pool->freeList;
+   if ( obj )
    {
-      eglCtx->eglDisplay= PlatformGetEGLDisplay( eglCtx->appCtx->platformCtx, (NativeDisplayType)eglCtx->nativeDisplay );
+      pool->freeList= *((void**)obj);
    }
-   if ( eglCtx->eglDisplay == EGL_NO_DISPLAY )
+   ++pool->allocCount;
+   if ( ++pool->inUse > pool->peakInUse )
    {
-      printf("Error: initEGL: eglGetDisplay failed: %X\n", eglGetError() );
-      goto exit;
+      pool->peakInUse= pool->inUse;
    }
-
-   br= eglInitialize( eglCtx->eglDisplay, &eglCtx->majorVersion, &eglCtx->minorVersion );
-   if ( !br )
+   if ( !obj )
    {
-      printf("Error: initEGL: unable to initialize EGL display: %X\n", eglGetError() );
-      goto exit;
+      ++pool->fallbackCount;
    }
+   pthread_mutex_unlock( &pool->mutex );
 
-   br= eglGetConfigs( eglCtx->eglDisplay, NULL, 0, &configCount );
-   if ( !br )
+   if ( obj )
    {
-      printf("Error: initEGL: unable to get count of EGL configurations: %X\n", eglGetError() );
-      goto exit;
+      memset( obj, 0, pool->objectSize );
    }
-
-   configs= (EGLConfig*)malloc( configCount*sizeof(EGLConfig) );
-   if ( !configs )
+   else
    {
-      printf("Error: initEGL: no memory for EGL configurations\n");
-      goto exit;
+      // Pool exhausted: fall back to the heap so the test can continue
+      obj= calloc( 1, pool->objectSize );
+      if ( !obj )
+      {
+         pthread_mutex_lock( &pool->mutex );
+         --pool->inUse;
+         pthread_mutex_unlock( &pool->mutex );
+      }
    }
 
-   i= 0;
-   attrs[i++]= EGL_RED_SIZE;
-   attrs[i++]= RED_SIZE;
-   attrs[i++]= EGL_GREEN_SIZE;
-   attrs[i++]= GREEN_SIZE;
-   attrs[i++]= EGL_BLUE_SIZE;
-   attrs[i++]= BLUE_SIZE;
-   attrs[i++]= EGL_DEPTH_SIZE;
-   attrs[i++]= DEPTH_SIZE;
-   attrs[i++]= EGL_STENCIL_SIZE;
-   attrs[i++]= 0;
-   attrs[i++]= EGL_SURFACE_TYPE;
-   attrs[i++]= EGL_WINDOW_BIT;
-   attrs[i++]= EGL_RENDERABLE_TYPE;
-   attrs[i++]= EGL_OPENGL_ES2_BIT;
-   attrs[i++]= EGL_NONE;
+   return obj;
+}
 
-   br= eglChooseConfig( eglCtx->eglDisplay, attrs, configs, configCount, &configCount );
-   if ( !br )
-   {
-      printf("Error: initEGL: eglChooseConfig failed: %X\n", eglGetError() );
-      goto exit;
-   }
+static void poolFree( ObjectPool *pool, void *obj )
+{
+   bool fromPool;
 
-   for( i= 0; i < configCount; ++i )
+   if ( obj )
    {
-      eglGetConfigAttrib( eglCtx->eglDisplay, configs[i], EGL_RED_SIZE, &redSize );
-      eglGetConfigAttrib( eglCtx->eglDisplay, configs[i], EGL_GREEN_SIZE, &greenSize );
-      eglGetConfigAttrib( eglCtx->eglDisplay, configs[i], EGL_BLUE_SIZE, &blueSize );
-      eglGetConfigAttrib( eglCtx->eglDisplay, configs[i], EGL_ALPHA_SIZE, &alphaSize );
-      eglGetConfigAttrib( eglCtx->eglDisplay, configs[i], EGL_DEPTH_SIZE, &depthSize );
+      fromPool= ( (pool->storage != 0) &&
+                  ((unsigned char*)obj >= pool->storage) &&
+                  ((unsigned char*)obj < pool->storage+pool->capacity*pool->objectSize) );
 
-      printf("config %d: red: %d green: %d blue: %d alpha: %d depth: %d\n",
-              i, redSize, greenSize, blueSize, alphaSize, depthSize );
+      pthread_mutex_lock( &pool->mutex );
+      if ( fromPool )
+      {
+         *((void**)obj)= pool->freeList;
+         pool->freeList= obj;
+      }
+      --pool->inUse;
+      pthread_mutex_unlock( &pool->mutex );
 
-      if ( (redSize == RED_SIZE) &&
-           (greenSize == GREEN_SIZE) &&
-           (blueSize == BLUE_SIZE) &&
-           (alphaSize == ALPHA_SIZE) &&
-           (depthSize >= DEPTH_SIZE) )
+      if ( !fromPool )
       {
-         printf( "choosing config %d\n", i);
-         break;
+         free( obj );
       }
    }
-   if ( configCount == i )
-   {
-      printf("Error: initEGL: no suitable configuration is available\n");
-      goto exit;
-   }
-   eglCtx->eglConfig= configs[i];
+}
 
-   attrs[0]= EGL_CONTEXT_CLIENT_VERSION;
-   attrs[1]= 2;
-   attrs[2]= EGL_NONE;
-    
-   eglCtx->eglContext= eglCreateContext( eglCtx->eglDisplay, eglCtx->eglConfig, EGL_NO_CONTEXT, attrs );
-   if ( eglCtx->eglContext == EGL_NO_CONTEXT )
+#if defined (USE_ALLOC_HOOKS)
+// Interpose the allocator so allocations made on a compositor thread can be
+// counted, and attributed to libwayland by the caller's return address.
+extern "C" void *__libc_malloc( size_t size );
+extern "C" void *__libc_calloc( size_t count, size_t size );
+extern "C" void *__libc_realloc( void *ptr, size_t size );
+
+typedef struct _CodeRange
+{
+   uintptr_t start;
+   uintptr_t end;
+} CodeRange;
+
+#define MAX_WAYLAND_RANGES (4)
+static CodeRange gWaylandRanges[MAX_WAYLAND_RANGES];
+static int gWaylandRangeCount= 0;
+static long long gHeapAllocs= 0;
+static long long gWaylandAllocs= 0;
+static __thread bool gCountAllocs= false;
+
+static inline void countAlloc( void *caller )
+{
+   if ( gCountAllocs )
    {
-      printf( "Error: initEGL: eglCreateContext failed: %X\n", eglGetError() );
-      goto exit;
+      uintptr_t addr= (uintptr_t)caller;
+      __atomic_fetch_add( &gHeapAllocs, 1, __ATOMIC_RELAXED );
+      for( int i= 0; i < gWaylandRangeCount; ++i )
+      {
+         if ( (addr >= gWaylandRanges[i].start) && (addr < gWaylandRanges[i].end) )
+         {
+            __atomic_fetch_add( &gWaylandAllocs, 1, __ATOMIC_RELAXED );
+            break;
+         }
+      }
    }
+}
 
-   eglCtx->initialized= true;
+void *malloc( size_t size ) __THROW
+{
+   countAlloc( __builtin_return_address(0) );
+   return __libc_malloc( size );
+}
 
-   result= true;
+void *calloc( size_t count, size_t size ) __THROW
+{
+   countAlloc( __builtin_return_address(0) );
+   return __libc_calloc( count, size );
+}
 
-exit:
+void *realloc( void *ptr, size_t size ) __THROW
+{
+   countAlloc( __builtin_return_address(0) );
+   return __libc_realloc( ptr, size );
+}
 
-   if ( configs )
+static int findWaylandCode( struct dl_phdr_info *info, size_t size, void *data )
+{
+   if ( info->dlpi_name && strstr( info->dlpi_name, "libwayland-" ) )
    {
-      free( configs );
+      for( int i= 0; i < info->dlpi_phnum; ++i )
+      {
+         const ElfW(Phdr) *phdr= &info->dlpi_phdr[i];
+         if ( (phdr->p_type == PT_LOAD) && (phdr->p_flags & PF_X) && (gWaylandRangeCount < MAX_WAYLAND_RANGES) )
+         {
+            gWaylandRanges[gWaylandRangeCount].start= info->dlpi_addr+phdr->p_vaddr;
+            gWaylandRanges[gWaylandRangeCount].end= info->dlpi_addr+phdr->p_vaddr+phdr->p_memsz;
+            ++gWaylandRangeCount;
+         }
+      }
    }
-
-   return result;
+   return 0;
 }
+#endif
 
-static void termEGL( EGLCtx *eglCtx )
+static void allocCountingBegin( void )
 {
-   if ( eglCtx->eglDisplay != EGL_NO_DISPLAY )
+   #if defined (USE_ALLOC_HOOKS)
+   if ( !gWaylandRangeCount )
    {
-      eglMakeCurrent( eglCtx->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+      dl_iterate_phdr( findWaylandCode, 0 );
    }
+   gCountAllocs= true;
+   #endif
+}
 
-   if ( eglCtx->eglSurface != EGL_NO_SURFACE )
-   {
-      eglDestroySurface( eglCtx->eglDisplay, eglCtx->eglSurface );
-      eglCtx->eglSurface= EGL_NO_SURFACE;
-   }
+static void allocCountingEnd( void )
+{
+   #if defined (USE_ALLOC_HOOKS)
+   gCountAllocs= false;
+   #endif
+}
 
-   if ( eglCtx->eglContext != EGL_NO_CONTEXT )
-   {
-      eglDestroyContext( eglCtx->eglDisplay, eglCtx->eglContext );
-      eglCtx->eglContext= EGL_NO_CONTEXT;
+static void getAllocSnapshot( AppCtx *ctx, AllocSnapshot *snap )
+{
+   pthread_mutex_lock( &ctx->surfacePool.mutex );
+   snap->poolAllocs= ctx->surfacePool.allocCount;
+   snap->poolFallbacks= ctx->surfacePool.fallbackCount;
+   pthread_mutex_unlock( &ctx->surfacePool.mutex );
+
+   pthread_mutex_lock( &ctx->bufferInfoPool.mutex );
+   snap->poolAllocs += ctx->bufferInfoPool.allocCount;
+   snap->poolFallbacks += ctx->bufferInfoPool.fallbackCount;
+   pthread_mutex_unlock( &ctx->bufferInfoPool.mutex );
+
+   #if defined (USE_ALLOC_HOOKS)
+   snap->heapAllocs= __atomic_load_n( &gHeapAllocs, __ATOMIC_RELAXED );
+   snap->waylandAllocs= __atomic_load_n( &gWaylandAllocs, __ATOMIC_RELAXED );
+   #else
+   snap->heapAllocs= 0;
+   snap->waylandAllocs= 0;
+   #endif
+}
+
+static void reportAllocations( AppCtx *ctx, WaylandCtx *wctx, AllocSnapshot *start )
+{
+   AllocSnapshot end;
+   double frames;
+
+   getAllocSnapshot( ctx, &end );
+
+   if ( ctx->pReport && (wctx->frameCount > 0) )
+   {
+      frames= wctx->frameCount;
+      fprintf(ctx->pReport, "%s: frames %d allocations per frame: pool %.2f heap fallback %.2f\n",
+              wctx->name, wctx->frameCount,
+              (end.poolAllocs-start->poolAllocs)/frames,
+              (end.poolFallbacks-start->poolFallbacks)/frames );
+      #if defined (USE_ALLOC_HOOKS)
+      fprintf(ctx->pReport, "%s: hooked heap allocations per frame: total %.2f libwayland %.2f\n",
+              wctx->name,
+              (end.heapAllocs-start->heapAllocs)/frames,
+              (end.waylandAllocs-start->waylandAllocs)/frames );
+      #endif
+      fprintf(ctx->pReport, "%s: pool peak use: surfaces %d/%d buffer info %d/%d\n",
+              wctx->name,
+              ctx->surfacePool.peakInUse, ctx->surfacePool.capacity,
+              ctx->bufferInfoPool.peakInUse, ctx->bufferInfoPool.capacity );
    }
+}
 
-   if ( eglCtx->initialized )
-   {      
-      eglTerminate( eglCtx->eglDisplay );
-      eglReleaseThread();
-      eglCtx->initialized= false;
+static void resultSamples( AppCtx *ctx, const char *role, int step )
+{
+   // Per frame times are written one per record so a later run can compare
+   // distributions rather than totals
+   if ( ctx->pResults )
+   {
+      for( int i= 0; i < ctx->frameSampleCount; ++i )
+      {
+         fprintf(ctx->pResults, "%s %s %d frame_us %d\n", (ctx->section ? ctx->section : "none"), role, step, ctx->frameSamples[i] );
+      }
    }
+   ctx->frameSampleCount= 0;
 }
 
-static const char *vertTexture=
-  "attribute vec2 pos;\n"
-  "attribute vec2 texcoord;\n"
-  "uniform mat4 u_matrix;\n"
-  "uniform vec2 u_resolution;\n"
-  "varying vec2 tx;\n"
-  "void main()\n"
-  "{\n"
-  "  vec4 v1= u_matrix * vec4(pos, 0, 1);\n"
-  "  vec4 v2= v1 / vec4(u_resolution, u_resolution.x, 1);\n"
-  "  vec4 v3= v2 * vec4(2.0, 2.0, 1, 1);\n"
-  "  vec4 v4= v3 - vec4(1.0, 1.0, 0, 0);\n"
-  "  v4.w= 1.0+v4.z;\n"
-  "  gl_Position=  v4 * vec4(1, -1, 1, 1);\n"
-  "  tx= texcoord;\n"
-  "}\n";
+static long long recordFrameSample( AppCtx *ctx, long long *lastTime )
+{
+   long long now= getCurrentTimeMicro();
+   long long interval= now-*lastTime;
 
-static const char *fragTexture=
-  "#ifdef GL_ES\n"
-  "precision mediump float;\n"
-  "#endif\n"
-  "uniform sampler2D texture;\n"
-  "varying vec2 tx;\n"
-  "void main()\n"
-  "{\n"
-  "  gl_FragColor= texture2D(texture, tx);\n"
-  "}\n";
+   if ( ctx->frameSamples && (ctx->frameSampleCount < ctx->maxIterations) )
+   {
+      ctx->frameSamples[ctx->frameSampleCount++]= interval;
+   }
+   *lastTime= now;
 
-static const char *vertTextureYUV=
-  "attribute vec2 pos;\n"
-  "attribute vec2 texcoord;\n"
-  "attribute vec2 texcoorduv;\n"
-  "uniform mat4 u_matrix;\n"
-  "uniform vec2 u_resolution;\n"
-  "varying vec2 tx;\n"
-  "varying vec2 txuv;\n"
-  "void main()\n"
-  "{\n"
-  "  vec4 v1= u_matrix * vec4(pos, 0, 1);\n"
-  "  vec4 v2= v1 / vec4(u_resolution, u_resolution.x, 1);\n"
-  "  vec4 v3= v2 * vec4(2.0, 2.0, 1, 1);\n"
-  "  vec4 v4= v3 - vec4(1.0, 1.0, 0, 0);\n"
-  "  v4.w= 1.0+v4.z;\n"
-  "  gl_Position=  v4 * vec4(1, -1, 1, 1);\n"
-  "  tx= texcoord;\n"
-  "  txuv= texcoorduv;\n"
-  "}\n";
+   return interval;
+}
 
-static const char *fragTextureYUV=
-  "#ifdef GL_ES\n"
-  "precision mediump float;\n"
-  "#endif\n"
-  "uniform sampler2D texture;\n"
-  "uniform sampler2D textureuv;\n"
-  "const vec3 cc_r= vec3(1.0, -0.8604, 1.59580);\n"
-  "const vec4 cc_g= vec4(1.0, 0.539815, -0.39173, -0.81290);\n"
-  "const vec3 cc_b= vec3(1.0, -1.071, 2.01700);\n"
-  "varying vec2 tx;\n"
-  "varying vec2 txuv;\n"
-  "void main()\n"
-  "{\n"
-  "   vec4 y_vec= texture2D(texture, tx);\n"
-  "   vec4 c_vec= texture2D(textureuv, txuv);\n"
-  "   vec4 temp_vec= vec4(y_vec.a, 1.0, c_vec.b, c_vec.a);\n"
-  "   gl_FragColor= vec4( dot(cc_r,temp_vec.xyw), dot(cc_g,temp_vec), dot(cc_b,temp_vec.xyz), alpha );\n"
-  "}\n";
+static void resultValue( AppCtx *ctx, const char *role, int step, const char *key, double value )
+{
+   // Structured results are one record per line:
+   //   <section> <role> <step> <key> <value>
+   // where step is the 1 based pacing step, or 0 for a whole run value
+   if ( ctx->pResults )
+   {
+      fprintf(ctx->pResults, "%s %s %d %s %f\n", (ctx->section ? ctx->section : "none"), role, step, key, value );
+   }
+}
 
-static bool initGL( WaylandCtx *ctx )
+typedef ssize_t (*PFNSENDMSG)( int fd, const struct msghdr *msg, int flags );
+typedef ssize_t (*PFNRECVMSG)( int fd, struct msghdr *msg, int flags );
+typedef int (*PFNDISPLAYFLUSH)( struct wl_display *display );
+typedef int (*PFNDISPLAYROUNDTRIP)( struct wl_display *display );
+typedef int (*PFNDISPLAYROUNDTRIPQUEUE)( struct wl_display *display, struct wl_event_queue *queue );
+
+static void countSocket( int fd, bool send, ssize_t len )
 {
-   bool result= false;
-   GLint status;
-   GLsizei length;
-   char infoLog[512];
-   const char *fragSrc, *vertSrc;
+   int kind;
 
-   if ( ctx->gl.haveYUVShaders )
+   kind= ((gUpstreamFd >= 0) && (fd == gUpstreamFd)) ? SOCKET_UPSTREAM : SOCKET_CLIENTS;
+   if ( send )
    {
-      fragSrc= fragTextureYUV;
-      vertSrc= vertTextureYUV;
+      __atomic_fetch_add( &gSocketCounts.sendCalls[kind], 1, __ATOMIC_RELAXED );
+      if ( len > 0 ) __atomic_fetch_add( &gSocketCounts.sendBytes[kind], len, __ATOMIC_RELAXED );
    }
    else
    {
-      fragSrc= fragTexture;
-      vertSrc= vertTexture;
+      __atomic_fetch_add( &gSocketCounts.recvCalls[kind], 1, __ATOMIC_RELAXED );
+      if ( len > 0 ) __atomic_fetch_add( &gSocketCounts.recvBytes[kind], len, __ATOMIC_RELAXED );
    }
+}
+
+static PFNSENDMSG gRealSendmsg= 0;
+static PFNRECVMSG gRealRecvmsg= 0;
+static PFNDISPLAYFLUSH gRealDisplayFlush= 0;
+static PFNDISPLAYROUNDTRIP gRealDisplayRoundtrip= 0;
+static PFNDISPLAYROUNDTRIPQUEUE gRealDisplayRoundtripQueue= 0;
+
+// Resolve the calls interposed below once, before main and before any
+// library can use them, so the hooks cost only an indirect call when
+// --protocol-stats is off.  main refuses to run if any lookup failed.
+__attribute__((constructor)) static void initSocketHooks( void )
+{
+   gRealSendmsg= (PFNSENDMSG)dlsym( RTLD_NEXT, "sendmsg" );
+   gRealRecvmsg= (PFNRECVMSG)dlsym( RTLD_NEXT, "recvmsg" );
+   gRealDisplayFlush= (PFNDISPLAYFLUSH)dlsym( RTLD_NEXT, "wl_display_flush" );
+   gRealDisplayRoundtrip= (PFNDISPLAYROUNDTRIP)dlsym( RTLD_NEXT, "wl_display_roundtrip" );
+   gRealDisplayRoundtripQueue= (PFNDISPLAYROUNDTRIPQUEUE)dlsym( RTLD_NEXT, "wl_display_roundtrip_queue" );
+}
+
+static bool haveSocketHooks( void )
+{
+   bool result= true;
 
-   ctx->gl.frag= glCreateShader( GL_FRAGMENT_SHADER );
-   if ( !ctx->gl.frag )
+   if ( !gRealSendmsg || !gRealRecvmsg )
    {
-      printf("Error: initGL: failed to create fragment shader\n");
-      goto exit;
+      printf("Error: unable to locate underlying sendmsg and recvmsg\n");
+      result= false;
    }
-
-   glShaderSource( ctx->gl.frag, 1, (const char **)&fragSrc, NULL );
-   glCompileShader( ctx->gl.frag );
-   glGetShaderiv( ctx->gl.frag, GL_COMPILE_STATUS, &status );
-   if ( !status )
+   if ( !gRealDisplayFlush || !gRealDisplayRoundtrip || !gRealDisplayRoundtripQueue )
    {
-      glGetShaderInfoLog( ctx->gl.frag, sizeof(infoLog), &length, infoLog );
-      printf("Error: initGL: compiling fragment shader: %*s\n", length, infoLog );
-      goto exit;
+      printf("Error: unable to locate underlying wl_display_flush and wl_display_roundtrip\n");
+      result= false;
    }
 
-   ctx->gl.vert= glCreateShader( GL_VERTEX_SHADER );
-   if ( !ctx->gl.vert )
+   return result;
+}
+
+// libwayland does all socket I/O with sendmsg and recvmsg, and EGL flushes and
+// round trips through the exported client calls, so interposing them here
+// counts the syscalls, bytes, flushes and round trips for every role.  A call
+// whose real function could not be found fails rather than jumping to null.
+ssize_t sendmsg( int fd, const struct msghdr *msg, int flags )
+{
+   ssize_t rc;
+
+   if ( !gRealSendmsg )
    {
-      printf("Error: initGL: failed to create vertex shader\n");
-      goto exit;
+      errno= ENOSYS;
+      return -1;
    }
-
-   glShaderSource( ctx->gl.vert, 1, (const char **)&vertSrc, NULL );
-   glCompileShader( ctx->gl.vert );
-   glGetShaderiv( ctx->gl.vert, GL_COMPILE_STATUS, &status );
-   if ( !status )
+   rc= gRealSendmsg( fd, msg, flags );
+   if ( gProtocolStats )
    {
-      glGetShaderInfoLog( ctx->gl.vert, sizeof(infoLog), &length, infoLog );
-      printf("Error: initGL: compiling vertex shader: \n%*s\n", length, infoLog );
-      goto exit;
+      countSocket( fd, true, rc );
    }
 
-   ctx->gl.prog= glCreateProgram();
-   glAttachShader(ctx->gl.prog, ctx->gl.frag);
-   glAttachShader(ctx->gl.prog, ctx->gl.vert);
+   return rc;
+}
 
-   ctx->gl.locPos= 0;
-   ctx->gl.locTC= 1;
-   glBindAttribLocation(ctx->gl.prog, ctx->gl.locPos, "pos");
-   glBindAttribLocation(ctx->gl.prog, ctx->gl.locTC, "texcoord");
-   if ( ctx->gl.haveYUVShaders )
-   {
-      ctx->gl.locTCUV= 2;
-      glBindAttribLocation(ctx->gl.prog, ctx->gl.locTCUV, "texcoorduv");
-   }
+ssize_t recvmsg( int fd, struct msghdr *msg, int flags )
+{
+   ssize_t rc;
 
-   glLinkProgram(ctx->gl.prog);
-   glGetProgramiv(ctx->gl.prog, GL_LINK_STATUS, &status);
-   if (!status)
+   if ( !gRealRecvmsg )
    {
-      glGetProgramInfoLog(ctx->gl.prog, sizeof(infoLog), &length, infoLog);
-      printf("Error: initGL: linking:\n%*s\n", length, infoLog);
-      goto exit;
+      errno= ENOSYS;
+      return -1;
    }
-
-   ctx->gl.locRes= glGetUniformLocation(ctx->gl.prog,"u_resolution");
-   ctx->gl.locMatrix= glGetUniformLocation(ctx->gl.prog,"u_matrix");
-   ctx->gl.locTexture= glGetUniformLocation(ctx->gl.prog,"texture");
-   if ( ctx->gl.haveYUVShaders )
+   rc= gRealRecvmsg( fd, msg, flags );
+   if ( gProtocolStats )
    {
-      ctx->gl.locTextureUV= glGetUniformLocation(ctx->gl.prog,"textureuv");
+      countSocket( fd, false, rc );
    }
 
-   result= true;
-
-exit:
-
-   return result;
+   return rc;
 }
 
-static void termGL( WaylandCtx *ctx )
+int wl_display_flush( struct wl_display *display )
 {
-   if ( ctx->gl.frag )
-   {
-      glDeleteShader( ctx->gl.frag );
-      ctx->gl.frag= 0;
-   }
-   if ( ctx->gl.vert )
+   if ( !gRealDisplayFlush )
    {
-      glDeleteShader( ctx->gl.vert );
-      ctx->gl.vert= 0;
+      errno= ENOSYS;
+      return -1;
    }
-   if ( ctx->gl.prog )
+   if ( gProtocolStats )
    {
-      glDeleteProgram( ctx->gl.prog );
-      ctx->gl.prog= 0;
+      __atomic_fetch_add( &gSocketCounts.flushes, 1, __ATOMIC_RELAXED );
    }
+
+   return gRealDisplayFlush( display );
 }
 
-void drawGL( EGLCtx *eglCtx, Surface *surface )
+int wl_display_roundtrip_queue( struct wl_display *display, struct wl_event_queue *queue )
 {
-   int x, y, w, h;
-   GLenum glerr;
-   WaylandCtx *ctx= surface->ctx;
-   AppCtx *appCtx= ctx->appCtx;
-
-   x= 0;
-   y= 0;
-   w= appCtx->windowWidth;
-   h= appCtx->windowHeight;
- 
-   const float verts[4][2]=
-   {
-      { float(x), float(y) },
-      { float(x+w), float(y) },
-      { float(x),  float(y+h) },
-      { float(x+w), float(y+h) }
-   };
- 
-   const float uv[4][2]=
-   {
-      { 0,  0 },
-      { 1,  0 },
-      { 0,  1 },
-      { 1,  1 }
-   };
+   int rc;
 
-   const float identityMatrix[4][4]=
+   if ( !gRealDisplayRoundtripQueue )
    {
-      {1, 0, 0, 0},
-      {0, 1, 0, 0},
-      {0, 0, 1, 0},
-      {0, 0, 0, 1}
-   };
-
-   if ( ctx->gl.haveYUVShaders != ctx->gl.haveYUVTextures )
+      errno= ENOSYS;
+      return -1;
+   }
+   if ( !gProtocolStats )
    {
-      termGL( ctx );
-      ctx->gl.haveYUVShaders= ctx->gl.haveYUVTextures;
-      if ( !initGL( ctx ) )
-      {
-         printf("Error: drawGL: initGL failed while changing shaders\n");
-      }
+      return gRealDisplayRoundtripQueue( display, queue );
    }
-
-   if ( surface->textureId[0] == GL_NONE )
+   if ( gRoundtripDepth == 0 )
    {
-      for ( int i= 0; i < surface->textureCount; ++i )
-      {
-         if ( surface->textureId[i] == GL_NONE )
-         {
-            glGenTextures(1, &surface->textureId[i] );
-         }
-       
-         glActiveTexture(GL_TEXTURE0+i);
-         glBindTexture(GL_TEXTURE_2D, surface->textureId[i] );
-         if ( surface->eglImage[i] )
-         {
-            appCtx->glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, surface->eglImage[i]);
-         }
-         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-      }
+      __atomic_fetch_add( &gSocketCounts.roundtrips, 1, __ATOMIC_RELAXED );
    }
+   ++gRoundtripDepth;
+   rc= gRealDisplayRoundtripQueue( display, queue );
+   --gRoundtripDepth;
+
+   return rc;
+}
 
-   glUseProgram(ctx->gl.prog);
-   glUniform2f(ctx->gl.locRes, appCtx->windowWidth, appCtx->windowHeight);
-   glUniformMatrix4fv(ctx->gl.locMatrix, 1, GL_FALSE, (GLfloat*)identityMatrix);
+int wl_display_roundtrip( struct wl_display *display )
+{
+   int rc;
 
-   glActiveTexture(GL_TEXTURE0); 
-   glBindTexture(GL_TEXTURE_2D, surface->textureId[0]);
-   glUniform1i(ctx->gl.locTexture, 0);
-   glVertexAttribPointer(ctx->gl.locPos, 2, GL_FLOAT, GL_FALSE, 0, verts);
-   glVertexAttribPointer(ctx->gl.locTC, 2, GL_FLOAT, GL_FALSE, 0, uv);
-   glEnableVertexAttribArray(ctx->gl.locPos);
-   glEnableVertexAttribArray(ctx->gl.locTC);
-   if ( ctx->gl.haveYUVTextures )
+   if ( !gRealDisplayRoundtrip )
    {
-      glActiveTexture(GL_TEXTURE1); 
-      glBindTexture(GL_TEXTURE_2D, surface->textureId[1]);
-      glUniform1i(ctx->gl.locTexture, 1);
-      glVertexAttribPointer(ctx->gl.locTCUV, 2, GL_FLOAT, GL_FALSE, 0, uv);
-      glEnableVertexAttribArray(ctx->gl.locTCUV);
+      errno= ENOSYS;
+      return -1;
    }
-   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-   glDisableVertexAttribArray(ctx->gl.locPos);
-   glDisableVertexAttribArray(ctx->gl.locTC);
-   if ( ctx->gl.haveYUVTextures )
+   if ( !gProtocolStats )
    {
-      glDisableVertexAttribArray(ctx->gl.locTCUV);
+      return gRealDisplayRoundtrip( display );
    }
-   
-   glerr= glGetError();
-   if ( glerr != GL_NO_ERROR )
+   // wl_display_roundtrip may be built on wl_display_roundtrip_queue, so only count once
+   if ( gRoundtripDepth == 0 )
    {
-      printf("Warning: drawGL: glGetError: %X\n", glerr);
+      __atomic_fetch_add( &gSocketCounts.roundtrips, 1, __ATOMIC_RELAXED );
    }
+   ++gRoundtripDepth;
+   rc= gRealDisplayRoundtrip( display );
+   --gRoundtripDepth;
 
-   eglSwapBuffers( eglCtx->eglDisplay, eglCtx->eglSurface );
+   return rc;
 }
 
-static void surfaceDestroy(struct wl_client *client, struct wl_resource *resource)
+static void getSocketSnapshot( SocketSnapshot *snap )
 {
-   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
-
-   if ( surface->surfaceNested )
+   for( int i= 0; i < SOCKET_KIND_COUNT; ++i )
    {
-      wl_surface_destroy( surface->surfaceNested );
-      wl_display_flush( surface->ctx->upstreamDisplay );
-      surface->surfaceNested= 0;
+      snap->sendCalls[i]= __atomic_load_n( &gSocketCounts.sendCalls[i], __ATOMIC_RELAXED );
+      snap->sendBytes[i]= __atomic_load_n( &gSocketCounts.sendBytes[i], __ATOMIC_RELAXED );
+      snap->recvCalls[i]= __atomic_load_n( &gSocketCounts.recvCalls[i], __ATOMIC_RELAXED );
+      snap->recvBytes[i]= __atomic_load_n( &gSocketCounts.recvBytes[i], __ATOMIC_RELAXED );
    }
-   // terminate display to end test
-   wl_display_terminate( wl_client_get_display(client) );
-   wl_resource_destroy(resource);
+   snap->flushes= __atomic_load_n( &gSocketCounts.flushes, __ATOMIC_RELAXED );
+   snap->roundtrips= __atomic_load_n( &gSocketCounts.roundtrips, __ATOMIC_RELAXED );
 }
 
-static void surfaceAttach(struct wl_client *client,
-                          struct wl_resource *resource,
-                          struct wl_resource *bufferResource, int32_t sx, int32_t sy)
+#if ( (WAYLAND_VERSION_MAJOR >= 1) && (WAYLAND_VERSION_MINOR >= 13) )
+static int protocolMessageSize( const struct wl_protocol_logger_message *message )
 {
-   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+   const char *signature= message->message->signature;
+   const union wl_argument *arg;
+   int size= 8, i= 0;
 
-   pthread_mutex_lock( &surface->ctx->mutex );
-   if ( surface->attachedBufferResource != bufferResource )
+   // Header is object id plus size/opcode, then each argument padded to 32 bits.
+   // File descriptors travel as ancillary data and take no space in the message.
+   for( ; *signature; ++signature )
    {
-      if ( surface->detachedBufferResource )
-      {
-         wl_list_remove(&surface->detachedBufferDestroyListener.link);
-         wl_buffer_send_release( surface->detachedBufferResource );
-      }
-      if ( surface->attachedBufferResource )
-      {
-         wl_list_remove(&surface->attachedBufferDestroyListener.link);
-      }
-      surface->detachedBufferResource= surface->attachedBufferResource;
-      if ( surface->detachedBufferResource )
+      if ( i >= message->arguments_count )
       {
-         wl_resource_add_destroy_listener( surface->detachedBufferResource, &surface->detachedBufferDestroyListener );
+         break;
       }
-      surface->attachedBufferResource= 0;
-   }
-   if ( bufferResource )
-   {
-      if ( surface->attachedBufferResource != bufferResource )
+      arg= &message->arguments[i];
+      switch( *signature )
       {
-         surface->attachedBufferResource= bufferResource;
-         wl_resource_add_destroy_listener( surface->attachedBufferResource, &surface->attachedBufferDestroyListener );
+         case 'i':
+         case 'u':
+         case 'f':
+         case 'o':
+         case 'n':
+            size += 4;
+            ++i;
+            break;
+         case 's':
+            size += 4;
+            if ( arg->s )
+            {
+               size += (strlen(arg->s)+1+3) & ~3;
+            }
+            ++i;
+            break;
+         case 'a':
+            size += 4;
+            if ( arg->a )
+            {
+               size += (arg->a->size+3) & ~3;
+            }
+            ++i;
+            break;
+         case 'h':
+            ++i;
+            break;
+         default:
+            break;
       }
-      surface->attachedX= sx;
-      surface->attachedY= sy;
    }
-   pthread_mutex_unlock( &surface->ctx->mutex );
-}
 
-static void surfaceDamage(struct wl_client *, struct wl_resource *, int32_t, int32_t, int32_t, int32_t)
-{
-   // ignore
+   return size;
 }
 
-static void surfaceFrame(struct wl_client *client, struct wl_resource *resource, uint32_t callback)
+static void protocolLogger( void *userData, enum wl_protocol_logger_type direction, const struct wl_protocol_logger_message *message )
 {
-   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
-   struct wl_resource *rescb;
+   ProtocolStats *protocol= (ProtocolStats*)userData;
+   ProtocolMessageStats *type= 0;
+   bool isEvent= (direction == WL_PROTOCOL_LOGGER_EVENT);
+   int size, i;
 
-   rescb= wl_resource_create( client, &wl_callback_interface, 1, callback );
-   if ( rescb )
+   size= protocolMessageSize( message );
+   if ( isEvent )
    {
-      surface->ctx->rescb= rescb;
+      ++protocol->events;
+      protocol->eventBytes += size;
    }
    else
    {
-      wl_resource_post_no_memory(resource);
+      ++protocol->requests;
+      protocol->requestBytes += size;
    }
-}
 
-static void surfaceSetOpaqueRegion(struct wl_client *, struct wl_resource *, struct wl_resource *)
-{
-   // ignore
+   // wl_message entries are static per interface and opcode so the pointer is the key
+   for( i= 0; i < protocol->typeCount; ++i )
+   {
+      if ( protocol->types[i].message == message->message )
+      {
+         type= &protocol->types[i];
+         break;
+      }
+   }
+   if ( !type && (protocol->typeCount < PROTOCOL_MAX_MESSAGE_TYPES) )
+   {
+      type= &protocol->types[protocol->typeCount++];
+      type->message= message->message;
+      type->interface= wl_resource_get_class( message->resource );
+      type->isEvent= isEvent;
+   }
+   if ( type )
+   {
+      ++type->count;
+      type->bytes += size;
+   }
 }
+#endif
 
-static void surfaceSetInputRegion(struct wl_client *, struct wl_resource *, struct wl_resource *)
+static void protocolStatsInit( WaylandCtx *ctx )
 {
-   // ignore
-}
-
-static void buffer_release( void *data, struct wl_buffer *buffer )
-{
-   NestedBufferInfo *buffInfo= (NestedBufferInfo*)data;
-
-   wl_buffer_destroy( buffer );
-
-   if ( buffInfo )
-   {
-      if ( buffInfo->bufferRemote )
-      {
-         pthread_mutex_lock( &buffInfo->ctx->buffersToReleaseMutex );
-         buffInfo->ctx->buffersToRelease.push_back( *buffInfo );
-         pthread_mutex_unlock( &buffInfo->ctx->buffersToReleaseMutex );
-      }
-      free( buffInfo );
-   }
-}
-
-static struct wl_buffer_listener wl_buffer_listener=
-{
-   buffer_release
-};
-
-static void surfaceCommit(struct wl_client *client, struct wl_resource *resource)
-{
-   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
-   struct wl_resource *committedBufferResource;
-   WaylandCtx *ctx= surface->ctx;
-   AppCtx *appCtx= ctx->appCtx;
-
-   pthread_mutex_lock( &ctx->mutex );
-
-   committedBufferResource= surface->attachedBufferResource;
-   if ( committedBufferResource )
+   if ( gProtocolStats )
    {
-      if ( ctx->isRepeater )
+      #if ( (WAYLAND_VERSION_MAJOR >= 1) && (WAYLAND_VERSION_MINOR >= 13) )
+      ctx->protocol.logger= wl_display_add_protocol_logger( ctx->dispWayland, protocolLogger, &ctx->protocol );
+      if ( !ctx->protocol.logger )
       {
-         struct wl_buffer *clone;
-         int bufferWidth, bufferHeight;
-
-         clone= appCtx->remoteCloneBufferFromResource( appCtx->nested.dispWayland,
-                                                       committedBufferResource,
-                                                       appCtx->nested.upstreamDisplay,
-                                                       &bufferWidth,
-                                                       &bufferHeight );
-         if ( clone )
-         {
-            NestedBufferInfo *buffInfo= (NestedBufferInfo*)malloc( sizeof(NestedBufferInfo) );
-            if ( buffInfo )
-            {
-               buffInfo->ctx= ctx;
-               buffInfo->surface= surface->surfaceNested;
-               buffInfo->bufferRemote= committedBufferResource;
-               wl_buffer_add_listener( clone, &wl_buffer_listener, buffInfo );
-            }
-
-            wl_surface_attach( surface->surfaceNested, clone, 0, 0 );
-            wl_surface_damage( surface->surfaceNested, 0, 0, bufferWidth, bufferHeight);
-            wl_surface_commit( surface->surfaceNested );
-            wl_display_flush( appCtx->nested.upstreamDisplay );
-
-            wl_list_remove(&surface->attachedBufferDestroyListener.link);
-            surface->attachedBufferResource= 0;
-         }
+         printf("Warning: unable to add wayland protocol logger\n");
       }
       else
-      if ( appCtx->renderWayland )
-      {
-         EGLImageKHR eglImage= 0;
-         EGLint value, format;
-         EGLint attrList[3];
-         int bufferWidth= 0, bufferHeight= 0;
-
-         if (EGL_TRUE == appCtx->eglQueryWaylandBufferWL( ctx->eglServer.eglDisplay, committedBufferResource,
-                                                          EGL_WIDTH, &value ) )
-         {
-            bufferWidth= value;
-         }
-
-         if (EGL_TRUE == appCtx->eglQueryWaylandBufferWL( ctx->eglServer.eglDisplay, committedBufferResource,
-                                                          EGL_HEIGHT, &value ) )
-         {
-            bufferHeight= value;
-         }                                                        
-
-         if (EGL_TRUE == appCtx->eglQueryWaylandBufferWL( ctx->eglServer.eglDisplay, committedBufferResource,
-                                                          EGL_TEXTURE_FORMAT, &value ) )
-         {
-            format= value;
-         }
-
-         if ( (surface->bufferWidth != bufferWidth) || (surface->bufferHeight != bufferHeight) )
-         {
-            surface->bufferWidth= bufferWidth;
-            surface->bufferHeight= bufferHeight;
-         }
-
-         for( int i= 0; i < MAX_TEXTURES; ++i )
-         {
-            if ( surface->eglImage[i] )
-            {
-               appCtx->eglDestroyImageKHR( ctx->eglServer.eglDisplay, surface->eglImage[i] );
-               surface->eglImage[i]= 0;
-            }
-         }
-
-         switch ( format )
-         {
-            case EGL_TEXTURE_RGB:
-            case EGL_TEXTURE_RGBA:
-               eglImage= appCtx->eglCreateImageKHR( ctx->eglServer.eglDisplay, EGL_NO_CONTEXT,
-                                                        EGL_WAYLAND_BUFFER_WL, committedBufferResource,
-                                                        NULL // EGLInt attrList[]
-                                                       );
-               if ( eglImage )
-               {
-                  surface->eglImage[0]= eglImage;
-                  if ( surface->textureId[0] != GL_NONE )
-                  {
-                     glDeleteTextures( 1, &surface->textureId[0] );
-                  }
-                  surface->textureId[0]= GL_NONE;
-                  surface->textureCount= 1;
-               }
-               ctx->gl.haveYUVTextures= false;
-               break;
-            
-            case EGL_TEXTURE_Y_U_V_WL:
-               printf("Error: surfaceCommit: EGL_TEXTURE_Y_U_V_WL not supported\n" );
-               break;
-             
-            case EGL_TEXTURE_Y_UV_WL:
-               attrList[0]= EGL_WAYLAND_PLANE_WL;
-               attrList[2]= EGL_NONE;
-               for( int i= 0; i < 2; ++i )
-               {
-                  attrList[1]= i;
-                  
-                  eglImage= appCtx->eglCreateImageKHR( ctx->eglServer.eglDisplay, EGL_NO_CONTEXT,
-                                                           EGL_WAYLAND_BUFFER_WL, committedBufferResource,
-                                                           attrList
-                                                          );
-                  if ( eglImage )
-                  {
-                     surface->eglImage[i]= eglImage;
-                     if ( surface->textureId[i] != GL_NONE )
-                     {
-                        glDeleteTextures( 1, &surface->textureId[i] );
-                     }
-                     surface->textureId[i]= GL_NONE;
-                  }
-               }
-               surface->textureCount= 2;
-               ctx->gl.haveYUVTextures= true;
-               break;
-               
-            case EGL_TEXTURE_Y_XUXV_WL:
-               printf("Error: surfaceCommit: EGL_TEXTURE_Y_XUXV_WL not supported\n" );
-               break;
-               
-            default:
-               printf("Error: surfaceCommit:: unknown texture format: %x\n", format );
-               break;
-         }
-
-         drawGL( &ctx->eglServer, surface );
-      }
-
-      if ( ctx->rescb )
       {
-         wl_callback_send_done( ctx->rescb, getCurrentTimeMillis() );
-         wl_resource_destroy( ctx->rescb );
-         ctx->rescb= 0;
+         ctx->metrics.protocol= &ctx->protocol;
       }
+      #endif
    }
-
-   pthread_mutex_unlock( &ctx->mutex );
 }
 
-static void surfaceSetBufferTransform(struct wl_client *, struct wl_resource *, int)
+static void protocolStatsTerm( WaylandCtx *ctx )
 {
-   // ignore
+   #if ( (WAYLAND_VERSION_MAJOR >= 1) && (WAYLAND_VERSION_MINOR >= 13) )
+   if ( ctx->protocol.logger )
+   {
+      wl_protocol_logger_destroy( ctx->protocol.logger );
+      ctx->protocol.logger= 0;
+   }
+   #endif
+   ctx->metrics.protocol= 0;
 }
 
-static void surfaceSetBufferScale(struct wl_client *, struct wl_resource *, int32_t)
+static void protocolStatsReset( WaylandCtx *ctx )
 {
-   // ignore
-}
+   struct wl_protocol_logger *logger= ctx->protocol.logger;
 
-#if ( (WAYLAND_VERSION_MAJOR >= 1) && (WAYLAND_VERSION_MINOR >= 18) )
-static void surfaceDamageBuffer(struct wl_client *, struct wl_resource *, int32_t, int32_t, int32_t, int32_t)
-{
-   // ignore
+   memset( &ctx->protocol, 0, sizeof(ProtocolStats) );
+   ctx->protocol.logger= logger;
 }
-#endif
-
-static const struct wl_surface_interface surface_interface= 
-{
-   surfaceDestroy,
-   surfaceAttach,
-   surfaceDamage,
-   surfaceFrame,
-   surfaceSetOpaqueRegion,
-   surfaceSetInputRegion,
-   surfaceCommit,
-   surfaceSetBufferTransform,
-   surfaceSetBufferScale,
-   #if ( (WAYLAND_VERSION_MAJOR >= 1) && (WAYLAND_VERSION_MINOR >= 18) )
-   surfaceDamageBuffer
-   #endif
-};
 
-static void attachedBufferDestroyCallback(struct wl_listener *listener, void *data )
+static void protocolCountsGet( ProtocolStats *protocol, ProtocolCounts *counts )
 {
-   Surface *surface= wl_container_of(listener, surface, attachedBufferDestroyListener );
-   surface->attachedBufferResource= 0;
+   counts->requests= protocol->requests;
+   counts->requestBytes= protocol->requestBytes;
+   counts->events= protocol->events;
+   counts->eventBytes= protocol->eventBytes;
 }
 
-static void detachedBufferDestroyCallback(struct wl_listener *listener, void *data )
+static void socketDelta( SocketSnapshot *delta, SocketSnapshot *end, SocketSnapshot *start )
 {
-   Surface *surface= wl_container_of(listener, surface, detachedBufferDestroyListener );
-   surface->detachedBufferResource= 0;
+   for( int i= 0; i < SOCKET_KIND_COUNT; ++i )
+   {
+      delta->sendCalls[i]= end->sendCalls[i]-start->sendCalls[i];
+      delta->sendBytes[i]= end->sendBytes[i]-start->sendBytes[i];
+      delta->recvCalls[i]= end->recvCalls[i]-start->recvCalls[i];
+      delta->recvBytes[i]= end->recvBytes[i]-start->recvBytes[i];
+   }
+   delta->flushes= end->flushes-start->flushes;
+   delta->roundtrips= end->roundtrips-start->roundtrips;
 }
 
-static void destroySurfaceCallback(struct wl_resource *resource)
+static void reportProtocol( AppCtx *ctx, const char *name, int frameCount, ProtocolStats *protocol, SocketSnapshot *start )
 {
-   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+   SocketSnapshot end;
+   ProtocolMessageStats *type;
+   double frames;
+   char key[128];
+   int i;
 
-   WaylandCtx *ctx= surface->ctx;
+   if ( !gProtocolStats || !ctx->pReport || (frameCount <= 0) )
+   {
+      return;
+   }
 
-   pthread_mutex_lock( &ctx->mutex );
+   getSocketSnapshot( &end );
+   frames= frameCount;
 
-   surface->resource= NULL;
+   if ( protocol && protocol->logger )
+   {
+      fprintf(ctx->pReport, "%s protocol per frame: requests %.2f (%.1f bytes) events %.2f (%.1f bytes)\n",
+              name,
+              protocol->requests/frames, protocol->requestBytes/frames,
+              protocol->events/frames, protocol->eventBytes/frames );
+      resultValue( ctx, name, 0, "protocol.requests_per_frame", protocol->requests/frames );
+      resultValue( ctx, name, 0, "protocol.request_bytes_per_frame", protocol->requestBytes/frames );
+      resultValue( ctx, name, 0, "protocol.events_per_frame", protocol->events/frames );
+      resultValue( ctx, name, 0, "protocol.event_bytes_per_frame", protocol->eventBytes/frames );
+      for( i= 0; i < protocol->typeCount; ++i )
+      {
+         type= &protocol->types[i];
+         fprintf(ctx->pReport, "%s protocol: %s %s.%s count %lld per frame %.2f bytes per frame %.1f\n",
+                 name, (type->isEvent ? "event" : "request"),
+                 type->interface, type->message->name,
+                 type->count, type->count/frames, type->bytes/frames );
+         snprintf( key, sizeof(key), "protocol.%s.%s.per_frame", type->interface, type->message->name );
+         resultValue( ctx, name, 0, key, type->count/frames );
+      }
+   }
 
-   if ( --surface->refCount <= 0 )
+   for( i= 0; i < SOCKET_KIND_COUNT; ++i )
    {
-      if ( surface->attachedBufferResource || surface->detachedBufferResource )
+      long long sendCalls= end.sendCalls[i]-start->sendCalls[i];
+      long long recvCalls= end.recvCalls[i]-start->recvCalls[i];
+      const char *kind= (i == SOCKET_UPSTREAM) ? "upstream" : "clients";
+
+      if ( sendCalls || recvCalls )
       {
-         if ( surface->detachedBufferResource )
-         {
-            wl_list_remove(&surface->detachedBufferDestroyListener.link);
-            wl_buffer_send_release( surface->detachedBufferResource );
-         }
-         if ( surface->attachedBufferResource )
-         {
-            wl_list_remove(&surface->attachedBufferDestroyListener.link);
-            wl_buffer_send_release( surface->attachedBufferResource );
-         }
-         surface->attachedBufferResource= 0;
-         surface->detachedBufferResource= 0;
+         fprintf(ctx->pReport, "%s socket per frame (%s): sendmsg %.2f (%.1f bytes) recvmsg %.2f (%.1f bytes)\n",
+                 name, kind,
+                 sendCalls/frames, (end.sendBytes[i]-start->sendBytes[i])/frames,
+                 recvCalls/frames, (end.recvBytes[i]-start->recvBytes[i])/frames );
+         snprintf( key, sizeof(key), "socket.%s.sendmsg_per_frame", kind );
+         resultValue( ctx, name, 0, key, sendCalls/frames );
+         snprintf( key, sizeof(key), "socket.%s.send_bytes_per_frame", kind );
+         resultValue( ctx, name, 0, key, (end.sendBytes[i]-start->sendBytes[i])/frames );
+         snprintf( key, sizeof(key), "socket.%s.recvmsg_per_frame", kind );
+         resultValue( ctx, name, 0, key, recvCalls/frames );
+         snprintf( key, sizeof(key), "socket.%s.recv_bytes_per_frame", kind );
+         resultValue( ctx, name, 0, key, (end.recvBytes[i]-start->recvBytes[i])/frames );
       }
-      free( surface );
    }
 
-   pthread_mutex_unlock( &ctx->mutex );
+   if ( (end.flushes != start->flushes) || (end.roundtrips != start->roundtrips) )
+   {
+      fprintf(ctx->pReport, "%s wayland client calls per frame: wl_display_flush %.2f roundtrips %.2f\n",
+              name,
+              (end.flushes-start->flushes)/frames,
+              (end.roundtrips-start->roundtrips)/frames );
+      resultValue( ctx, name, 0, "wayland.flushes_per_frame", (end.flushes-start->flushes)/frames );
+      resultValue( ctx, name, 0, "wayland.roundtrips_per_frame", (end.roundtrips-start->roundtrips)/frames );
+   }
 }
 
-static void compositorCreateSurface( struct wl_client *client, struct wl_resource *resource, uint32_t id)
+static long long timevalMicro( struct timeval *tv )
 {
-   WaylandCtx *ctx= (WaylandCtx*)wl_resource_get_user_data(resource);
-   Surface *surface;
-   
-   pthread_mutex_lock( &ctx->mutex );
+   return tv->tv_sec*1000000LL+tv->tv_usec;
+}
 
-   surface= (Surface*)calloc( 1, sizeof(Surface) );   
-   if (!surface) 
-   {
-      wl_resource_post_no_memory(resource);
-      pthread_mutex_unlock( &ctx->mutex );
-      return;
-   }
+static void sampleCpu( CpuSample *sample )
+{
+   struct rusage usage;
+   FILE *pFile;
+   unsigned long utime, stime;
+   long ticksPerSecond;
 
-   surface->ctx= ctx;
-   surface->refCount= 1;
-   surface->attachedBufferDestroyListener.notify= attachedBufferDestroyCallback;
-   surface->detachedBufferDestroyListener.notify= detachedBufferDestroyCallback;
+   memset( sample, 0, sizeof(CpuSample) );
 
-   surface->resource= wl_resource_create(client, &wl_surface_interface, MIN(3,wl_resource_get_version(resource)), id);
-   if (!surface->resource)
+   if ( getrusage( RUSAGE_THREAD, &usage ) == 0 )
    {
-      free(surface);
-      wl_resource_post_no_memory(resource);
-      pthread_mutex_unlock( &ctx->mutex );
-      return;
+      sample->threadUser= timevalMicro( &usage.ru_utime );
+      sample->threadSys= timevalMicro( &usage.ru_stime );
    }
 
-   wl_resource_set_implementation(surface->resource, &surface_interface, surface, destroySurfaceCallback);
+   if ( getrusage( RUSAGE_SELF, &usage ) == 0 )
+   {
+      sample->procUser= timevalMicro( &usage.ru_utime );
+      sample->procSys= timevalMicro( &usage.ru_stime );
+      sample->volCsw= usage.ru_nvcsw;
+      sample->involCsw= usage.ru_nivcsw;
+   }
 
-   if ( ctx->isRepeater )
+   // /proc/self/stat is tick based but is what system monitors report
+   pFile= fopen( "/proc/self/stat", "rt" );
+   if ( pFile )
    {
-      surface->surfaceNested= wl_compositor_create_surface(ctx->compositor);
-      wl_display_flush( ctx->upstreamDisplay );
-      if ( !surface->surfaceNested )
+      ticksPerSecond= sysconf( _SC_CLK_TCK );
+      if ( (fscanf( pFile, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime ) == 2) &&
+           (ticksPerSecond > 0) )
       {
-         free(surface);
-         wl_resource_post_no_memory(resource);
-         pthread_mutex_unlock( &ctx->mutex );
-         return;
+         sample->statUser= (utime*1000000LL)/ticksPerSecond;
+         sample->statSys= (stime*1000000LL)/ticksPerSecond;
       }
+      fclose( pFile );
    }
-
-   pthread_mutex_unlock( &ctx->mutex );
 }
 
-static void compositorCreateRegion(struct wl_client *, struct wl_resource *resource, uint32_t)
+static void cpuDelta( CpuSample *result, CpuSample *end, CpuSample *start )
 {
-   wl_resource_post_no_memory(resource);
+   result->threadUser= end->threadUser-start->threadUser;
+   result->threadSys= end->threadSys-start->threadSys;
+   result->procUser= end->procUser-start->procUser;
+   result->procSys= end->procSys-start->procSys;
+   result->statUser= end->statUser-start->statUser;
+   result->statSys= end->statSys-start->statSys;
+   result->volCsw= end->volCsw-start->volCsw;
+   result->involCsw= end->involCsw-start->involCsw;
 }
 
-static const struct wl_compositor_interface compositor_interface= 
+static int perfEventOpen( const PerfEventDesc *desc, int groupFd, bool userOnly )
 {
-   compositorCreateSurface,
-   compositorCreateRegion
-};
+   struct perf_event_attr attr;
+
+   memset( &attr, 0, sizeof(attr) );
+   attr.size= sizeof(attr);
+   attr.type= desc->type;
+   attr.config= desc->config;
+   attr.read_format= PERF_FORMAT_GROUP|PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+   attr.disabled= (groupFd < 0) ? 1 : 0;
+   attr.exclude_kernel= userOnly ? 1 : 0;
+   attr.exclude_hv= 1;
+
+   // Count the calling thread on whichever cpu it runs
+   return syscall( __NR_perf_event_open, &attr, 0, -1, groupFd, 0 );
+}
 
-static void compositorBind( struct wl_client *client, void *data, uint32_t version, uint32_t id)
+static void perfInit( AppCtx *ctx, const char *name )
 {
-   WaylandCtx *ctx= (WaylandCtx*)data;
-   struct wl_resource *resource;
+   PerfCounters *perf= &gPerf;
+   int i, group, fd;
+   int leaderErrno[PERF_GROUP_COUNT];
 
-   resource= wl_resource_create(client, &wl_compositor_interface, MIN(3,version), id);
-   if (!resource)
+   for( i= 0; i < PERF_COUNTER_COUNT; ++i )
    {
-      wl_client_post_no_memory(client);
+      perf->fd[i]= -1;
    }
-   else
+   for( group= 0; group < PERF_GROUP_COUNT; ++group )
    {
-      wl_resource_set_implementation(resource, &compositor_interface, ctx, 0);
+      perf->leaderFd[group]= -1;
+      perf->memberCount[group]= 0;
+      leaderErrno[group]= 0;
    }
-}
-
-static bool initWayland( WaylandCtx *ctx, const char *displayName )
-{
-   bool result= false;
-   AppCtx *appCtx= ctx->appCtx;
 
-   ctx->dispWayland= wl_display_create();
-   if ( !ctx->dispWayland )
+   if ( !perf->requested )
    {
-      printf("Error: initWayland: wl_display_create failed\n");
-      goto exit;
+      return;
    }
 
-   if (!wl_global_create(ctx->dispWayland, &wl_compositor_interface, 3, ctx, compositorBind))
+   // Hardware and software events are kept in separate groups so the software
+   // events still work on devices without PMU access
+   for( i= 0; i < PERF_COUNTER_COUNT; ++i )
    {
-      printf("Error: initWayland: failed to create compositor interface\n");
-      goto exit;
+      group= gPerfEvents[i].group;
+      fd= perfEventOpen( &gPerfEvents[i], perf->leaderFd[group], perf->userOnly );
+      if ( (fd < 0) && !perf->userOnly && ((errno == EACCES) || (errno == EPERM)) )
+      {
+         // perf_event_paranoid may still allow counting user space only
+         perf->userOnly= true;
+         fd= perfEventOpen( &gPerfEvents[i], perf->leaderFd[group], perf->userOnly );
+      }
+      if ( fd >= 0 )
+      {
+         perf->fd[i]= fd;
+         if ( perf->leaderFd[group] < 0 )
+         {
+            perf->leaderFd[group]= fd;
+         }
+         perf->member[group][perf->memberCount[group]++]= i;
+      }
+      else
+      {
+         if ( perf->leaderFd[group] < 0 )
+         {
+            leaderErrno[group]= errno;
+         }
+         if ( gVerbose ) printf("perfInit: unable to open %s: errno %d\n", gPerfEvents[i].name, errno);
+      }
    }
 
-   if ( wl_display_add_socket( ctx->dispWayland, displayName ) )
+   for( group= 0; group < PERF_GROUP_COUNT; ++group )
    {
-      printf("Error: initWayland: failed to add socket\n");
-      goto exit;
+      if ( perf->leaderFd[group] >= 0 )
+      {
+         ioctl( perf->leaderFd[group], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+         ioctl( perf->leaderFd[group], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+         perf->enabled= true;
+      }
    }
 
-   if ( !appCtx->eglBindWaylandDisplayWL( ctx->eglServer.eglDisplay, ctx->dispWayland ) )
+   if ( ctx->pReport )
    {
-      printf("Error: initWayland: failed to bind EGL to wayland display\n");
-      goto exit;
+      fprintf(ctx->pReport, "%s: perf counters:", name);
+      for( i= 0; i < PERF_COUNTER_COUNT; ++i )
+      {
+         if ( perf->fd[i] >= 0 )
+         {
+            fprintf(ctx->pReport, " %s", gPerfEvents[i].name);
+         }
+      }
+      if ( perf->leaderFd[PERF_GROUP_HW] < 0 )
+      {
+         fprintf(ctx->pReport, " (hardware events unavailable: %s)", strerror(leaderErrno[PERF_GROUP_HW]));
+      }
+      if ( perf->leaderFd[PERF_GROUP_SW] < 0 )
+      {
+         fprintf(ctx->pReport, " (software events unavailable: %s)", strerror(leaderErrno[PERF_GROUP_SW]));
+      }
+      if ( perf->enabled && perf->userOnly )
+      {
+         fprintf(ctx->pReport, " (user space only)");
+      }
+      fprintf(ctx->pReport, "\n");
    }
-   ctx->eglServer.displayBound= true;
-
-   result= true;
-
-exit:
-   return result;
 }
 
-static void termWayland( WaylandCtx *ctx )
+static void perfTerm( void )
 {
-   AppCtx *appCtx= ctx->appCtx;
-   if ( ctx->dispWayland )
+   PerfCounters *perf= &gPerf;
+   int i, group;
+
+   if ( !perf->requested )
    {
-      if ( ctx->eglServer.displayBound )
+      return;
+   }
+
+   for( i= 0; i < PERF_COUNTER_COUNT; ++i )
+   {
+      if ( perf->fd[i] >= 0 )
       {
-         appCtx->eglUnbindWaylandDisplayWL( ctx->eglServer.eglDisplay, ctx->dispWayland );
-         ctx->eglServer.displayBound= false;
+         close( perf->fd[i] );
+         perf->fd[i]= -1;
       }
+   }
+   for( group= 0; group < PERF_GROUP_COUNT; ++group )
+   {
+      perf->leaderFd[group]= -1;
+      perf->memberCount[group]= 0;
+   }
+   perf->enabled= false;
+}
 
-      wl_display_destroy(ctx->dispWayland);
-      ctx->dispWayland= 0;
+static void perfSample( long long *values )
+{
+   PerfCounters *perf= &gPerf;
+   unsigned long long data[3+PERF_COUNTER_COUNT];
+   unsigned long long timeEnabled, timeRunning;
+   int group, i, count;
+   ssize_t len;
+
+   memset( values, 0, PERF_COUNTER_COUNT*sizeof(long long) );
+
+   for( group= 0; group < PERF_GROUP_COUNT; ++group )
+   {
+      if ( perf->leaderFd[group] < 0 )
+      {
+         continue;
+      }
+      count= perf->memberCount[group];
+      len= read( perf->leaderFd[group], data, sizeof(data) );
+      if ( (len < (ssize_t)((3+count)*sizeof(unsigned long long))) || (data[0] != (unsigned long long)count) )
+      {
+         continue;
+      }
+      timeEnabled= data[1];
+      timeRunning= data[2];
+      for( i= 0; i < count; ++i )
+      {
+         // Scale up if the kernel had to multiplex the group with other users of the PMU
+         if ( (timeRunning > 0) && (timeRunning < timeEnabled) )
+         {
+            values[perf->member[group][i]]= (long long)((double)data[3+i]*timeEnabled/timeRunning);
+            perf->multiplexed= true;
+         }
+         else
+         {
+            values[perf->member[group][i]]= data[3+i];
+         }
+      }
    }
 }
 
-namespace waylandClient
+static long long parseSizeKB( const char *s )
 {
-static void registryAdd(void *data,
-                        struct wl_registry *registry, uint32_t id,
-                        const char *interface, uint32_t version)
+   long long value= 0;
+   char unit[16];
+
+   unit[0]= '\0';
+   if ( sscanf( s, "%lld %15s", &value, unit ) >= 1 )
+   {
+      if ( !strcmp( unit, "MiB" ) )
+      {
+         value *= 1024;
+      }
+      else if ( !strcmp( unit, "GiB" ) )
+      {
+         value *= 1024*1024;
+      }
+      else if ( unit[0] == '\0' )
+      {
+         value /= 1024;
+      }
+   }
+
+   return value;
+}
+
+static long long sampleDrmMemory( void )
 {
-   WaylandCtx *ctx = (WaylandCtx*)data;
-   int len;
+   DIR *dir;
+   struct dirent *entry;
+   FILE *pFile;
+   char path[64];
+   char line[256];
+   unsigned long long clientIds[16];
+   unsigned long long clientId;
+   long long total= -1, totalKB, memoryKB;
+   int clientCount= 0, i;
+   bool isDrm, seen;
+
+   // DRM drivers publish per client memory in fdinfo (drm-total-<region>, or
+   // the older drm-memory-<region>).  Several fds can share one client so
+   // each client id is only counted once.
+   dir= opendir( "/proc/self/fdinfo" );
+   if ( !dir )
+   {
+      return -1;
+   }
+   while( (entry= readdir( dir )) != 0 )
+   {
+      if ( entry->d_name[0] == '.' )
+      {
+         continue;
+      }
+      snprintf( path, sizeof(path), "/proc/self/fdinfo/%s", entry->d_name );
+      pFile= fopen( path, "rt" );
+      if ( !pFile )
+      {
+         continue;
+      }
+      isDrm= false;
+      clientId= 0;
+      totalKB= 0;
+      memoryKB= 0;
+      while( fgets( line, sizeof(line), pFile ) )
+      {
+         if ( sscanf( line, "drm-client-id: %llu", &clientId ) == 1 )
+         {
+            isDrm= true;
+         }
+         else if ( !strncmp( line, "drm-total-", 10 ) && strchr( line, ':' ) )
+         {
+            totalKB += parseSizeKB( strchr( line, ':' )+1 );
+         }
+         else if ( !strncmp( line, "drm-memory-", 11 ) && strchr( line, ':' ) )
+         {
+            memoryKB += parseSizeKB( strchr( line, ':' )+1 );
+         }
+      }
+      fclose( pFile );
 
-   len= strlen(interface);
-   if ( (len==13) && !strncmp(interface, "wl_compositor", len) ) {
-      ctx->compositor= (struct wl_compositor*)wl_registry_bind(registry, id, &wl_compositor_interface, 1);
+      if ( isDrm )
+      {
+         seen= false;
+         for( i= 0; i < clientCount; ++i )
+         {
+            if ( clientIds[i] == clientId )
+            {
+               seen= true;
+               break;
+            }
+         }
+         if ( !seen )
+         {
+            if ( clientCount < 16 )
+            {
+               clientIds[clientCount++]= clientId;
+            }
+            if ( total < 0 )
+            {
+               total= 0;
+            }
+            total += (totalKB ? totalKB : memoryKB);
+         }
+      }
    }
+   closedir( dir );
+
+   return total;
 }
 
-static void registryRemove(void *, struct wl_registry *, uint32_t)
+static void sampleMemory( AppCtx *ctx, MemSample *sample )
 {
-   // ignore
+   FILE *pFile;
+   char line[256];
+   long long value;
+   bool haveRollup= false;
+   PlatformMemoryStats stats;
+
+   memset( sample, 0, sizeof(MemSample) );
+   sample->pss= -1;
+
+   pFile= fopen( "/proc/self/smaps_rollup", "rt" );
+   if ( pFile )
+   {
+      haveRollup= true;
+      while( fgets( line, sizeof(line), pFile ) )
+      {
+         if ( sscanf( line, "Rss: %lld kB", &value ) == 1 )
+         {
+            sample->rss= value;
+         }
+         else if ( sscanf( line, "Pss: %lld kB", &value ) == 1 )
+         {
+            sample->pss= value;
+         }
+         else if ( sscanf( line, "Swap: %lld kB", &value ) == 1 )
+         {
+            sample->swap= value;
+         }
+      }
+      fclose( pFile );
+   }
+
+   // Kernels before 4.14 have no smaps_rollup, so fall back to RSS only
+   pFile= fopen( "/proc/self/status", "rt" );
+   if ( pFile )
+   {
+      while( fgets( line, sizeof(line), pFile ) )
+      {
+         if ( sscanf( line, "VmHWM: %lld kB", &value ) == 1 )
+         {
+            sample->rssHwm= value;
+         }
+         else if ( haveRollup )
+         {
+            continue;
+         }
+         else if ( sscanf( line, "VmRSS: %lld kB", &value ) == 1 )
+         {
+            sample->rss= value;
+         }
+         else if ( sscanf( line, "VmSwap: %lld kB", &value ) == 1 )
+         {
+            sample->swap= value;
+         }
+      }
+      fclose( pFile );
+   }
+
+   sample->eglImages= __atomic_load_n( &gEGLImageCount, __ATOMIC_RELAXED );
+
+   if ( ctx && ctx->platformCtx && PlatformGetMemoryStats( ctx->platformCtx, &stats ) )
+   {
+      sample->scanoutBuffers= stats.scanoutBufferCount;
+      sample->scanoutBytes= stats.scanoutBufferBytes;
+   }
+
+   sample->drmBytes= sampleDrmMemory();
+   if ( sample->drmBytes > 0 )
+   {
+      sample->drmBytes *= 1024;
+   }
 }
 
-static const struct wl_registry_listener registryListener=
+// Start the kernel's RSS high water mark afresh, so a role's peak is its own
+// run's rather than the process's.  Kernels before 4.0 keep the lifetime peak.
+static void memPeakReset( void )
 {
-   registryAdd,
-   registryRemove
-};
-} // namespace waylandClient
+   FILE *pFile;
 
-static void waylandClientRole( AppCtx *ctx )
+   pFile= fopen( "/proc/self/clear_refs", "wt" );
+   if ( pFile )
+   {
+      fputs( "5", pFile );
+      fclose( pFile );
+   }
+}
+
+// Only RSS has a kernel kept peak; the other figures peak at a sample
+static void memPeakUpdate( MemSample *peak, MemSample *sample )
 {
-   using namespace waylandClient;
+   if ( sample->rss > peak->rss ) peak->rss= sample->rss;
+   if ( sample->rssHwm > peak->rss ) peak->rss= sample->rssHwm;
+   if ( sample->pss > peak->pss ) peak->pss= sample->pss;
+   if ( sample->swap > peak->swap ) peak->swap= sample->swap;
+   if ( sample->eglImages > peak->eglImages ) peak->eglImages= sample->eglImages;
+   if ( sample->scanoutBuffers > peak->scanoutBuffers ) peak->scanoutBuffers= sample->scanoutBuffers;
+   if ( sample->scanoutBytes > peak->scanoutBytes ) peak->scanoutBytes= sample->scanoutBytes;
+   if ( sample->drmBytes > peak->drmBytes ) peak->drmBytes= sample->drmBytes;
+}
 
-   struct wl_display *dispWayland= 0;
-   struct wl_registry *registry= 0;
-   long long time1, time2, diff;
-   GLfloat r, g, b, t;
-   int rc, pacingInc, step, maxStep;
-   const char *s;
-   
+static int readSysfsInt( const char *path, long long *value )
+{
+   FILE *pFile;
+   int rc= 0;
+
+   pFile= fopen( path, "rt" );
+   if ( pFile )
+   {
+      rc= (fscanf( pFile, "%lld", value ) == 1);
+      fclose( pFile );
+   }
 
-   usleep(100000);
+   return rc;
+}
 
-   dispWayland= wl_display_connect( ctx->client.upstreamDisplayName );
-   if ( !dispWayland )
+static void sampleCpuFreq( CpuFreqSample *sample )
+{
+   char path[128];
+   long long value;
+   int i;
+
+   memset( sample, 0, sizeof(CpuFreqSample) );
+
+   sample->cpuCount= sysconf( _SC_NPROCESSORS_CONF );
+   if ( sample->cpuCount > MAX_CPUS )
    {
-      printf("Error: roleWaylandClient: failed to connect to display\n");
-      goto exit;
+      sample->cpuCount= MAX_CPUS;
+   }
+   for( i= 0; i < sample->cpuCount; ++i )
+   {
+      snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", i );
+      if ( readSysfsInt( path, &value ) )
+      {
+         sample->freqKHz[i]= value;
+      }
+      // x86 exposes a count of thermal throttle events per core
+      snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu%d/thermal_throttle/core_throttle_count", i );
+      if ( readSysfsInt( path, &value ) )
+      {
+         sample->throttleCount += value;
+      }
    }
-   ctx->client.upstreamDisplay= dispWayland;
 
-   registry= wl_display_get_registry(dispWayland);
-   if ( !registry )
+   // On ARM SoCs throttling shows up as an active cpufreq cooling device
+   for( i= 0; ; ++i )
    {
-      printf("Error: roleWaylandClient: failed tp get wayland registry\n");
-      goto exit;
+      snprintf( path, sizeof(path), "/sys/class/thermal/thermal_zone%d/temp", i );
+      if ( !readSysfsInt( path, &value ) )
+      {
+         break;
+      }
+      if ( value > sample->maxTempMilliC )
+      {
+         sample->maxTempMilliC= value;
+      }
    }
+   for( i= 0; ; ++i )
+   {
+      FILE *pFile;
+      char type[64];
+      bool isCpu= false;
 
-   wl_registry_add_listener(registry, &registryListener, &ctx->client);
+      snprintf( path, sizeof(path), "/sys/class/thermal/cooling_device%d/type", i );
+      pFile= fopen( path, "rt" );
+      if ( !pFile )
+      {
+         break;
+      }
+      if ( fgets( type, sizeof(type), pFile ) )
+      {
+         isCpu= (strstr( type, "cpu" ) != 0) || (strstr( type, "Processor" ) != 0);
+      }
+      fclose( pFile );
+      snprintf( path, sizeof(path), "/sys/class/thermal/cooling_device%d/cur_state", i );
+      if ( isCpu && readSysfsInt( path, &value ) )
+      {
+         sample->coolingState += value;
+      }
+   }
+}
 
-   wl_display_roundtrip( dispWayland );
+static bool cpuFreqThrottled( CpuFreqSample *start, CpuFreqSample *end )
+{
+   return (end->coolingState > 0) || (end->throttleCount > start->throttleCount);
+}
 
-   if ( !ctx->client.compositor )
+static void reportCpuFreqPolicy( AppCtx *ctx, const char *name )
+{
+   FILE *pFile;
+   char path[128];
+   char governor[32];
+   int i, cpuCount;
+
+   if ( !ctx->pReport )
    {
-      printf("Error: roleWaylandClient: failed to obtain wayland compositor\n");
-      goto exit;
+      return;
    }
 
-   ctx->client.eglClient.useWayland= true;
-   ctx->client.eglClient.dispWayland= dispWayland;
-   if ( !initEGL( &ctx->client.eglClient ) )
+   cpuCount= MIN( sysconf( _SC_NPROCESSORS_CONF ), MAX_CPUS );
+   fprintf(ctx->pReport, "%s: cpufreq governor:", name);
+   for( i= 0; i < cpuCount; ++i )
    {
-      printf("Error: roleWaylandClient: failed to setup EGL\n");
-      goto exit;
+      snprintf( path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_governor", i );
+      pFile= fopen( path, "rt" );
+      if ( pFile )
+      {
+         if ( fscanf( pFile, "%31s", governor ) == 1 )
+         {
+            fprintf(ctx->pReport, " cpu%d %s", i, governor);
+         }
+         fclose( pFile );
+      }
    }
+   fprintf(ctx->pReport, "\n");
+}
 
-   s= eglQueryString( ctx->client.eglClient.eglDisplay, EGL_VENDOR );
-   if ( s )
+static const char *gRoleNames[ROLE_COUNT]= { "master", "nested", "client" };
+
+static bool parseCpuList( const char *s, cpu_set_t *mask )
+{
+   int first, last, cpu, len;
+
+   CPU_ZERO( mask );
+   while( *s )
    {
-      ctx->eglVendor= strdup(s);
+      if ( sscanf( s, "%d%n", &first, &len ) != 1 )
+      {
+         return false;
+      }
+      s += len;
+      last= first;
+      if ( *s == '-' )
+      {
+         ++s;
+         if ( sscanf( s, "%d%n", &last, &len ) != 1 )
+         {
+            return false;
+         }
+         s += len;
+      }
+      for( cpu= first; (cpu <= last) && (cpu < CPU_SETSIZE); ++cpu )
+      {
+         CPU_SET( cpu, mask );
+      }
+      if ( *s == ',' )
+      {
+         ++s;
+      }
+      else if ( *s )
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+// Format a mask as a cpu list parseCpuList accepts, eg 0-3,6
+static void formatCpuList( const cpu_set_t *mask, char *buf, int size )
+{
+   int cpu, last, len= 0;
+
+   buf[0]= '\0';
+   for( cpu= 0; cpu < CPU_SETSIZE; ++cpu )
+   {
+      if ( !CPU_ISSET( cpu, mask ) )
+      {
+         continue;
+      }
+      for( last= cpu; (last+1 < CPU_SETSIZE) && CPU_ISSET( last+1, mask ); ++last );
+      if ( last > cpu )
+      {
+         len += snprintf( buf+len, size-len, "%s%d-%d", (len ? "," : ""), cpu, last );
+      }
+      else
+      {
+         len += snprintf( buf+len, size-len, "%s%d", (len ? "," : ""), cpu );
+      }
+      if ( len >= size )
+      {
+         // Too long to pass on: leave the mask to be inherited
+         buf[0]= '\0';
+         return;
+      }
+      cpu= last;
+   }
+}
+
+static bool parseSchedPolicy( const char *s, int *policy, int *priority )
+{
+   char name[16];
+   int prio= 0;
+   int n;
+
+   n= sscanf( s, "%15[^:]:%d", name, &prio );
+   if ( n < 1 )
+   {
+      return false;
+   }
+   if ( !strcmp( name, "fifo" ) )
+   {
+      *policy= SCHED_FIFO;
+   }
+   else if ( !strcmp( name, "rr" ) )
+   {
+      *policy= SCHED_RR;
+   }
+   else if ( !strcmp( name, "other" ) )
+   {
+      *policy= SCHED_OTHER;
+   }
+   else if ( !strcmp( name, "batch" ) )
+   {
+      *policy= SCHED_BATCH;
+   }
+   else
+   {
+      return false;
+   }
+   *priority= prio;
+
+   return true;
+}
+
+// Parse "<role>:<value>" where role is master, nested, client or all
+static bool parseRoleControl( AppCtx *ctx, const char *arg, bool isSched )
+{
+   const char *value;
+   int role, len;
+   bool result= false;
+
+   value= strchr( arg, ':' );
+   if ( !value )
+   {
+      return false;
+   }
+   len= value-arg;
+   ++value;
+   for( role= 0; role < ROLE_COUNT; ++role )
+   {
+      if ( ((len == 3) && !strncmp( arg, "all", len )) ||
+           ((len == (int)strlen(gRoleNames[role])) && !strncmp( arg, gRoleNames[role], len )) )
+      {
+         if ( isSched )
+         {
+            if ( !parseSchedPolicy( value, &ctx->control[role].policy, &ctx->control[role].priority ) )
+            {
+               return false;
+            }
+            ctx->control[role].schedArg= value;
+            ctx->control[role].haveSched= true;
+         }
+         else
+         {
+            cpu_set_t mask;
+            if ( !parseCpuList( value, &mask ) )
+            {
+               return false;
+            }
+            ctx->control[role].cpuList= value;
+         }
+         result= true;
+      }
+   }
+
+   return result;
+}
+
+// Parse "<start>[:<increment>:<steps>]" into the pacing values, which are
+// left unchanged if the argument is invalid
+static bool parsePacing( const char *arg, int *pacingStart, int *pacingIncrement, int *pacingSteps )
+{
+   int start, increment, steps, n;
+
+   increment= *pacingIncrement;
+   steps= *pacingSteps;
+   n= sscanf( arg, "%d:%d:%d", &start, &increment, &steps );
+   if ( (n != 1) && (n != 3) )
+   {
+      return false;
+   }
+   if ( n == 1 )
+   {
+      // A single value is a fixed pacing
+      steps= 1;
+   }
+   if ( (start < 0) || (increment < 0) || (steps < 1) || (steps > PACING_STEP_COUNT) )
+   {
+      return false;
+   }
+   *pacingStart= start;
+   *pacingIncrement= increment;
+   *pacingSteps= steps;
+
+   return true;
+}
+
+static const char *gVideoFormatNames[VIDEO_FORMAT_COUNT]= { "none", "nv12", "yuv420", "yuyv" };
+
+static int parseVideoFormat( const char *arg, int len )
+{
+   for( int i= VIDEO_FORMAT_NONE+1; i < VIDEO_FORMAT_COUNT; ++i )
+   {
+      if ( (len == (int)strlen(gVideoFormatNames[i])) && !strncmp( arg, gVideoFormatNames[i], len ) )
+      {
+         return i;
+      }
+   }
+   return VIDEO_FORMAT_NONE;
+}
+
+// Parse <format>[@<fps>], eg nv12@30
+static bool parseVideoSpec( const char *arg, int *format, int *fps )
+{
+   const char *at= strchr( arg, '@' );
+   int len= (at ? (int)(at-arg) : (int)strlen(arg));
+
+   *format= parseVideoFormat( arg, len );
+   if ( *format == VIDEO_FORMAT_NONE )
+   {
+      return false;
+   }
+   if ( at )
+   {
+      *fps= atoi( at+1 );
+      if ( *fps <= 0 )
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+// Parse <count>[:<overlap-percent>], eg 4:50
+static bool parseSubsurfaceSpec( const char *arg, int *count, int *overlap )
+{
+   const char *colon= strchr( arg, ':' );
+
+   *count= atoi( arg );
+   if ( (*count < 0) || (*count > MAX_SUBSURFACES) )
+   {
+      return false;
+   }
+   if ( colon )
+   {
+      *overlap= atoi( colon+1 );
+      if ( (*overlap < 0) || (*overlap > 100) )
+      {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+#define CHILD_COMMAND_MAX (4096)
+
+// Command line for a child role, run through system().  Appends are bounded
+// and a command that does not fit is marked truncated so it is not run.
+typedef struct _ChildCommand
+{
+   char text[CHILD_COMMAND_MAX];
+   int len;
+   bool truncated;
+} ChildCommand;
+
+static void commandAppend( ChildCommand *cmd, const char *fmt, ... )
+{
+   va_list args;
+   int avail, n;
+
+   if ( cmd->truncated )
+   {
+      return;
+   }
+   avail= sizeof(cmd->text)-cmd->len;
+   va_start( args, fmt );
+   n= vsnprintf( cmd->text+cmd->len, avail, fmt, args );
+   va_end( args );
+   if ( (n < 0) || (n >= avail) )
+   {
+      cmd->text[cmd->len]= '\0';
+      cmd->truncated= true;
+   }
+   else
+   {
+      cmd->len += n;
+   }
+}
+
+// Append a user supplied value single quoted for the shell, so spaces and
+// metacharacters reach the child as part of one argument
+static void commandAppendQuoted( ChildCommand *cmd, const char *value )
+{
+   commandAppend( cmd, "'" );
+   for( const char *p= value; *p; ++p )
+   {
+      if ( *p == '\'' )
+      {
+         commandAppend( cmd, "'\\''" );
+      }
+      else
+      {
+         commandAppend( cmd, "%c", *p );
+      }
+   }
+   commandAppend( cmd, "'" );
+}
+
+static void appendRunParameters( AppCtx *ctx, ChildCommand *cmd )
+{
+   commandAppend( cmd, " --window-size %dx%d --pacing %d:%d:%d --swap-interval %d",
+                  ctx->windowWidth, ctx->windowHeight,
+                  ctx->pacingStart, ctx->pacingIncrement, ctx->pacingSteps,
+                  ctx->swapInterval );
+   commandAppend( cmd, " --warmup %d --refresh-period %lld", ctx->warmupMaxFrames, ctx->refreshPeriodUs );
+   if ( ctx->decoupleFrames )
+   {
+      commandAppend( cmd, " --decouple-frame-callbacks" );
+   }
+   if ( ctx->damageTracking )
+   {
+      commandAppend( cmd, " --damage" );
+   }
+   if ( ctx->damageWidth > 0 )
+   {
+      commandAppend( cmd, " --damage-region %dx%d", ctx->damageWidth, ctx->damageHeight );
+   }
+   if ( ctx->videoFormat != VIDEO_FORMAT_NONE )
+   {
+      commandAppend( cmd, " --video %s@%d", gVideoFormatNames[ctx->videoFormat], ctx->videoFps );
+   }
+   if ( ctx->subsurfaceCount > 0 )
+   {
+      commandAppend( cmd, " --subsurfaces %d:%d --subsurface-alpha %d",
+                     ctx->subsurfaceCount, ctx->subsurfaceOverlap, ctx->subsurfaceAlpha );
+   }
+   if ( ctx->clientBuffers > 0 )
+   {
+      commandAppend( cmd, " --client-buffers %d", ctx->clientBuffers );
+   }
+}
+
+// Options every child takes the same way: tracing, statistics and results
+static void appendChildOptions( ChildCommand *cmd )
+{
+   if ( gPerf.requested )
+   {
+      commandAppend( cmd, " --perf-counters" );
+   }
+   if ( gTrace.enabled )
+   {
+      commandAppend( cmd, " --trace " );
+      commandAppendQuoted( cmd, gTrace.filename );
+      commandAppend( cmd, " --trace-run %d", gTrace.run );
+   }
+   if ( gProtocolStats )
+   {
+      commandAppend( cmd, " --protocol-stats" );
+   }
+   if ( gGpuTiming )
+   {
+      commandAppend( cmd, " --gpu-timing" );
+   }
+}
+
+static void appendResultsOptions( AppCtx *ctx, ChildCommand *cmd )
+{
+   if ( ctx->pResults )
+   {
+      commandAppend( cmd, " --results " );
+      commandAppendQuoted( cmd, ctx->resultsFilename );
+      commandAppend( cmd, " --section " );
+      commandAppendQuoted( cmd, ctx->section );
+   }
+}
+
+static void appendRoleControls( AppCtx *ctx, ChildCommand *cmd )
+{
+   bool pinned= false;
+
+   for( int role= 0; role < ROLE_COUNT; ++role )
+   {
+      if ( ctx->control[role].cpuList )
+      {
+         pinned= true;
+      }
+   }
+   for( int role= 0; role < ROLE_COUNT; ++role )
+   {
+      if ( ctx->control[role].cpuList )
+      {
+         commandAppend( cmd, " --affinity %s:", gRoleNames[role] );
+         commandAppendQuoted( cmd, ctx->control[role].cpuList );
+      }
+      else if ( pinned && ctx->startCpuList[0] )
+      {
+         // A child inherits the affinity of the role that started it, so a
+         // role without its own gets the cpus this run started with
+         commandAppend( cmd, " --affinity %s:%s", gRoleNames[role], ctx->startCpuList );
+      }
+      if ( ctx->control[role].haveSched )
+      {
+         commandAppend( cmd, " --sched %s:", gRoleNames[role] );
+         commandAppendQuoted( cmd, ctx->control[role].schedArg );
+      }
+   }
+}
+
+// Run a child role and wait for it
+static void runChildCommand( const char *caller, ChildCommand *cmd )
+{
+   if ( cmd->truncated )
+   {
+      printf("Error: %s: command line longer than %d bytes, not started\n", caller, CHILD_COMMAND_MAX);
+      return;
+   }
+   system( cmd->text );
+}
+
+static void applyRoleControl( AppCtx *ctx, int role )
+{
+   RoleControl *control= &ctx->control[role];
+   const char *name= gRoleNames[role];
+   struct sched_param param;
+   cpu_set_t mask;
+
+   // Applied to the calling thread before the role initializes its platform
+   // and EGL, so threads started later inherit the affinity.  The scheduling
+   // policy is set with SCHED_RESET_ON_FORK so it stays with this thread and
+   // does not leak into child processes, such as the client and nested roles,
+   // or into driver threads.
+   if ( control->cpuList && parseCpuList( control->cpuList, &mask ) )
+   {
+      if ( sched_setaffinity( 0, sizeof(mask), &mask ) )
+      {
+         printf("Error: %s: unable to set cpu affinity %s: errno %d\n", name, control->cpuList, errno);
+         if ( ctx->pReport ) fprintf(ctx->pReport, "%s: unable to set cpu affinity %s: %s\n", name, control->cpuList, strerror(errno));
+      }
+      else if ( ctx->pReport )
+      {
+         fprintf(ctx->pReport, "%s: cpu affinity %s\n", name, control->cpuList);
+      }
+   }
+   if ( control->haveSched )
+   {
+      memset( &param, 0, sizeof(param) );
+      param.sched_priority= control->priority;
+      if ( sched_setscheduler( 0, control->policy|SCHED_RESET_ON_FORK, &param ) )
+      {
+         printf("Error: %s: unable to set scheduling %s: errno %d\n", name, control->schedArg, errno);
+         if ( ctx->pReport ) fprintf(ctx->pReport, "%s: unable to set scheduling %s: %s\n", name, control->schedArg, strerror(errno));
+      }
+      else if ( ctx->pReport )
+      {
+         fprintf(ctx->pReport, "%s: scheduling %s\n", name, control->schedArg);
+      }
+   }
+   reportCpuFreqPolicy( ctx, name );
+}
+
+static void warmupBegin( WarmupCtx *warmup, int maxFrames, long long firstFrameTime )
+{
+   memset( warmup, 0, sizeof(WarmupCtx) );
+   warmup->maxFrames= maxFrames;
+   warmup->firstFrameTime= firstFrameTime;
+   warmup->startTime= getCurrentTimeMicro();
+   warmup->lastTime= warmup->startTime;
+   warmup->done= (maxFrames <= 0);
+}
+
+static void warmupFrame( WarmupCtx *warmup )
+{
+   long long now, interval;
+   double mean, variance, stdDev;
+
+   now= getCurrentTimeMicro();
+   interval= now-warmup->lastTime;
+   warmup->lastTime= now;
+   ++warmup->frames;
+
+   warmup->windowSum += interval;
+   warmup->windowSumSq += interval*interval;
+   if ( ++warmup->windowCount == WARMUP_WINDOW )
+   {
+      mean= (double)warmup->windowSum/WARMUP_WINDOW;
+      variance= (double)warmup->windowSumSq/WARMUP_WINDOW - mean*mean;
+      stdDev= (variance > 0) ? sqrt(variance) : 0.0;
+      if ( warmup->havePrev &&
+           (fabs(mean-warmup->prevMean) <= WARMUP_TOLERANCE*mean) &&
+           (fabs(stdDev-warmup->prevStdDev) <= WARMUP_TOLERANCE*mean) )
+      {
+         warmup->settled= true;
+         warmup->done= true;
+      }
+      warmup->havePrev= true;
+      warmup->prevMean= mean;
+      warmup->prevStdDev= stdDev;
+      warmup->mean= mean;
+      warmup->windowSum= 0;
+      warmup->windowSumSq= 0;
+      warmup->windowCount= 0;
+   }
+   if ( warmup->frames >= warmup->maxFrames )
+   {
+      warmup->done= true;
+   }
+}
+
+// Render unmeasured frames the way the measured loop does until frame times settle
+static void warmupRun( AppCtx *ctx, WarmupCtx *warmup, EGLDisplay eglDisplay, EGLSurface eglSurface, long long firstFrameTime )
+{
+   GLfloat shade;
+
+   warmupBegin( warmup, ctx->warmupMaxFrames, firstFrameTime );
+   while( !warmup->done )
+   {
+      shade= (warmup->frames & 1) ? 0.25f : 0.5f;
+      glClearColor( shade, shade, shade, 1 );
+      glClear( GL_COLOR_BUFFER_BIT );
+      if ( ctx->pacingDelay )
+      {
+         usleep( ctx->pacingDelay );
+      }
+      eglSwapBuffers( eglDisplay, eglSurface );
+      warmupFrame( warmup );
+   }
+}
+
+static void reportWarmup( AppCtx *ctx, const char *name, int step, WarmupCtx *warmup )
+{
+   if ( warmup->firstFrameTime )
+   {
+      fprintf(ctx->pReport, "%s first frame: %lld us\n", name, warmup->firstFrameTime);
+      resultValue( ctx, name, step, "first_frame_us", warmup->firstFrameTime );
+   }
+   if ( warmup->maxFrames > 0 )
+   {
+      fprintf(ctx->pReport, "%s warm-up: %d frames %lld us, %s, steady frame time %.1f us\n",
+              name, warmup->frames, warmup->lastTime-warmup->startTime,
+              (warmup->settled ? "settled" : "did not settle"), warmup->mean );
+      resultValue( ctx, name, step, "warmup_frames", warmup->frames );
+      resultValue( ctx, name, step, "warmup_us", warmup->lastTime-warmup->startTime );
+      resultValue( ctx, name, step, "warmup_settled", warmup->settled ? 1 : 0 );
+   }
+}
+
+static void updateRefreshPeriod( AppCtx *ctx )
+{
+   PlatformDisplayInfo info;
+
+   if ( !ctx->refreshPeriodSet &&
+        PlatformGetDisplayInfo( ctx->platformCtx, &info ) &&
+        (info.refreshMilliHz > 0) )
+   {
+      ctx->refreshPeriodUs= 1000000000LL/info.refreshMilliHz;
+   }
+}
+
+// A frame is on time when it follows the previous one within the swap
+// interval's number of refresh periods, give or take half a period; each
+// further period is a missed vblank
+static void jankFrame( AppCtx *ctx, JankStats *jank, long long interval )
+{
+   long long period= ctx->refreshPeriodUs;
+   int expected, vblanks, missed;
+
+   if ( period <= 0 )
+   {
+      return;
+   }
+   expected= (ctx->swapInterval > 0) ? ctx->swapInterval : 1;
+   if ( ctx->videoFormat != VIDEO_FORMAT_NONE )
+   {
+      // Video frames are due once per frame period whatever the swap interval
+      expected= (int)((1000000LL/ctx->videoFps+period/2)/period);
+      if ( expected < 1 )
+      {
+         expected= 1;
+      }
+   }
+   vblanks= (int)((interval+period/2)/period);
+   missed= vblanks-expected;
+
+   jank->periodUs= period;
+   ++jank->frames;
+   if ( missed <= 0 )
+   {
+      ++jank->onTime;
+      jank->streak= 0;
+   }
+   else
+   {
+      if ( missed == 1 )
+      {
+         ++jank->missed1;
+      }
+      else if ( missed == 2 )
+      {
+         ++jank->missed2;
+      }
+      else
+      {
+         ++jank->missed3Plus;
+      }
+      jank->missedVblanks += missed;
+      if ( ++jank->streak > jank->longestStreak )
+      {
+         jank->longestStreak= jank->streak;
+      }
+   }
+}
+
+static void resultStepJank( AppCtx *ctx, const char *name, int step, StepMetrics *metrics )
+{
+   JankStats *jank= &metrics->jank;
+
+   if ( jank->frames > 0 )
+   {
+      resultValue( ctx, name, step, "smooth_pct", 100.0*jank->onTime/jank->frames );
+      resultValue( ctx, name, step, "jank_1", jank->missed1 );
+      resultValue( ctx, name, step, "jank_2", jank->missed2 );
+      resultValue( ctx, name, step, "jank_3plus", jank->missed3Plus );
+      resultValue( ctx, name, step, "jank_streak", jank->longestStreak );
+   }
+}
+
+static void resultStepProtocol( AppCtx *ctx, const char *name, int step, StepMetrics *metrics )
+{
+   SocketSnapshot *socket= &metrics->socket;
+   double frames= metrics->frames;
+   char key[128];
+
+   if ( !metrics->haveProtocol || (metrics->frames <= 0) )
+   {
+      return;
+   }
+   if ( metrics->haveMessages )
+   {
+      resultValue( ctx, name, step, "protocol.requests_per_frame", metrics->messages.requests/frames );
+      resultValue( ctx, name, step, "protocol.request_bytes_per_frame", metrics->messages.requestBytes/frames );
+      resultValue( ctx, name, step, "protocol.events_per_frame", metrics->messages.events/frames );
+      resultValue( ctx, name, step, "protocol.event_bytes_per_frame", metrics->messages.eventBytes/frames );
+   }
+   for( int i= 0; i < SOCKET_KIND_COUNT; ++i )
+   {
+      const char *kind= (i == SOCKET_UPSTREAM) ? "upstream" : "clients";
+
+      if ( socket->sendCalls[i] || socket->recvCalls[i] )
+      {
+         snprintf( key, sizeof(key), "socket.%s.sendmsg_per_frame", kind );
+         resultValue( ctx, name, step, key, socket->sendCalls[i]/frames );
+         snprintf( key, sizeof(key), "socket.%s.send_bytes_per_frame", kind );
+         resultValue( ctx, name, step, key, socket->sendBytes[i]/frames );
+         snprintf( key, sizeof(key), "socket.%s.recvmsg_per_frame", kind );
+         resultValue( ctx, name, step, key, socket->recvCalls[i]/frames );
+         snprintf( key, sizeof(key), "socket.%s.recv_bytes_per_frame", kind );
+         resultValue( ctx, name, step, key, socket->recvBytes[i]/frames );
+      }
+   }
+   if ( socket->flushes || socket->roundtrips )
+   {
+      resultValue( ctx, name, step, "wayland.flushes_per_frame", socket->flushes/frames );
+      resultValue( ctx, name, step, "wayland.roundtrips_per_frame", socket->roundtrips/frames );
+   }
+}
+
+static void metricsReset( RoleMetrics *metrics, AppCtx *ctx )
+{
+   ProtocolStats *protocol= metrics->protocol;
+
+   memset( metrics, 0, sizeof(RoleMetrics) );
+   metrics->appCtx= ctx;
+   metrics->protocol= protocol;
+   metrics->currentStep= -1;
+   memPeakReset();
+   sampleMemory( ctx, &metrics->memBaseline );
+   metrics->memPeak= metrics->memBaseline;
+}
+
+static void metricsStepBegin( RoleMetrics *metrics, int step, int frame )
+{
+   metrics->currentStep= step;
+   metrics->stepStartFrame= frame;
+   metrics->inStep= true;
+   sampleCpuFreq( &metrics->steps[step].freqStart );
+   sampleCpu( &metrics->cpuStart );
+   if ( gPerf.enabled )
+   {
+      perfSample( metrics->perfStart );
+   }
+   if ( gProtocolStats )
+   {
+      getSocketSnapshot( &metrics->socketStart );
+      if ( metrics->protocol )
+      {
+         protocolCountsGet( metrics->protocol, &metrics->messagesStart );
+      }
+   }
+}
+
+static void metricsStepEnd( RoleMetrics *metrics, int frame )
+{
+   StepMetrics *step;
+   CpuSample cpuEnd;
+   long long perfEnd[PERF_COUNTER_COUNT];
+   SocketSnapshot socketEnd;
+   ProtocolCounts messagesEnd;
+   int i;
+
+   if ( metrics->inStep )
+   {
+      sampleCpu( &cpuEnd );
+      step= &metrics->steps[metrics->currentStep];
+      step->frames= frame-metrics->stepStartFrame;
+      cpuDelta( &step->cpu, &cpuEnd, &metrics->cpuStart );
+      step->havePerf= gPerf.enabled;
+      if ( gPerf.enabled )
+      {
+         perfSample( perfEnd );
+         for( i= 0; i < PERF_COUNTER_COUNT; ++i )
+         {
+            step->perf[i]= perfEnd[i]-metrics->perfStart[i];
+         }
+      }
+      step->haveProtocol= gProtocolStats;
+      step->haveMessages= false;
+      if ( gProtocolStats )
+      {
+         getSocketSnapshot( &socketEnd );
+         socketDelta( &step->socket, &socketEnd, &metrics->socketStart );
+         if ( metrics->protocol )
+         {
+            protocolCountsGet( metrics->protocol, &messagesEnd );
+            step->messages.requests= messagesEnd.requests-metrics->messagesStart.requests;
+            step->messages.requestBytes= messagesEnd.requestBytes-metrics->messagesStart.requestBytes;
+            step->messages.events= messagesEnd.events-metrics->messagesStart.events;
+            step->messages.eventBytes= messagesEnd.eventBytes-metrics->messagesStart.eventBytes;
+            step->haveMessages= true;
+         }
+      }
+      sampleCpuFreq( &step->freqEnd );
+      // Sampled once per step since smaps_rollup walks every mapping
+      sampleMemory( metrics->appCtx, &step->mem );
+      memPeakUpdate( &metrics->memPeak, &step->mem );
+      metrics->inStep= false;
+   }
+}
+
+static void metricsCompositorFrame( WaylandCtx *ctx )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   RoleMetrics *metrics= &ctx->metrics;
+   long long now;
+   int frame, step;
+
+   // The client marks the start of each pacing step's measured frames (see
+   // clientMarkStep) and then submits maxIterations frames, so a compositor
+   // can find the step boundaries from its own commit count while leaving
+   // out the variable number of warm-up frames before the first step.
+   frame= ctx->frameCount;
+   now= getCurrentTimeMicro();
+   if ( metrics->inStep && metrics->lastFrameTime )
+   {
+      jankFrame( appCtx, &metrics->steps[metrics->currentStep].jank, now-metrics->lastFrameTime );
+   }
+   metrics->lastFrameTime= now;
+   if ( ctx->stepMarkPending )
+   {
+      ctx->stepMarkPending= false;
+      metricsStepEnd( metrics, frame );
+      step= metrics->currentStep+1;
+      if ( step < PACING_STEP_COUNT )
+      {
+         metricsStepBegin( metrics, step, frame );
+         ctx->stepEndFrame= frame+appCtx->maxIterations;
+      }
+      else
+      {
+         metrics->currentStep= step;
+      }
+   }
+   else if ( metrics->inStep && (frame == ctx->stepEndFrame) )
+   {
+      metricsStepEnd( metrics, frame );
+   }
+}
+
+// Time from a commit arriving to its frame being handed to the display,
+// whether composed with GL or put straight on a plane
+static void metricsPresent( WaylandCtx *ctx, bool scanout )
+{
+   RoleMetrics *metrics= &ctx->metrics;
+   StepMetrics *step;
+   long long us;
+
+   if ( metrics->inStep && (metrics->currentStep >= 0) && (metrics->currentStep < PACING_STEP_COUNT) )
+   {
+      step= &metrics->steps[metrics->currentStep];
+      us= getCurrentTimeMicro()-metrics->lastFrameTime;
+      ++step->presentFrames;
+      step->presentUs += us;
+      if ( us > step->presentMaxUs )
+      {
+         step->presentMaxUs= us;
+      }
+      if ( scanout )
+      {
+         ++step->scanoutFrames;
+      }
+   }
+}
+
+static void metricsComposeBytes( WaylandCtx *ctx, long long bytes )
+{
+   RoleMetrics *metrics= &ctx->metrics;
+
+   if ( metrics->inStep && (metrics->currentStep >= 0) && (metrics->currentStep < PACING_STEP_COUNT) )
+   {
+      metrics->steps[metrics->currentStep].composeBytes += bytes;
+   }
+}
+
+static void metricsImport( WaylandCtx *ctx, int program, long long us )
+{
+   RoleMetrics *metrics= &ctx->metrics;
+   StepMetrics *step;
+
+   if ( metrics->inStep && (metrics->currentStep >= 0) && (metrics->currentStep < PACING_STEP_COUNT) )
+   {
+      step= &metrics->steps[metrics->currentStep];
+      ++step->importFrames;
+      step->importUs += us;
+      if ( us > step->importMaxUs )
+      {
+         step->importMaxUs= us;
+      }
+      step->importProgram= program;
+   }
+}
+
+// Surfaces drawn in one composition, those skipped as hidden under an opaque
+// surface above, and the pixels written with and without blending
+static void metricsLayers( WaylandCtx *ctx, int layers, int culled, int blended, long long drawnPixels, long long blendedPixels, long long outputPixels )
+{
+   RoleMetrics *metrics= &ctx->metrics;
+   StepMetrics *step;
+
+   if ( metrics->inStep && (metrics->currentStep >= 0) && (metrics->currentStep < PACING_STEP_COUNT) )
+   {
+      step= &metrics->steps[metrics->currentStep];
+      ++step->layerFrames;
+      step->layers += layers;
+      step->culledLayers += culled;
+      step->blendedLayers += blended;
+      step->drawnPixels += drawnPixels;
+      step->blendedPixels += blendedPixels;
+      step->layerOutputPixels += outputPixels;
+   }
+}
+
+static void reportStepCpu( FILE *pReport, const char *name, StepMetrics *step )
+{
+   double frames;
+
+   if ( pReport && (step->frames > 0) )
+   {
+      frames= step->frames;
+      fprintf(pReport, "%s CPU per frame: process %.1f us (user %.1f sys %.1f) thread %.1f us (user %.1f sys %.1f) stat %.1f us"
+                       " csw per frame: voluntary %.2f involuntary %.2f\n",
+              name,
+              (step->cpu.procUser+step->cpu.procSys)/frames,
+              step->cpu.procUser/frames,
+              step->cpu.procSys/frames,
+              (step->cpu.threadUser+step->cpu.threadSys)/frames,
+              step->cpu.threadUser/frames,
+              step->cpu.threadSys/frames,
+              (step->cpu.statUser+step->cpu.statSys)/frames,
+              step->cpu.volCsw/frames,
+              step->cpu.involCsw/frames );
+   }
+}
+
+static void reportStepPerf( FILE *pReport, const char *name, StepMetrics *step )
+{
+   double frames;
+   int i;
+
+   if ( pReport && step->havePerf && (step->frames > 0) )
+   {
+      frames= step->frames;
+      fprintf(pReport, "%s perf per frame:", name);
+      for( i= 0; i < PERF_COUNTER_COUNT; ++i )
+      {
+         if ( gPerf.fd[i] >= 0 )
+         {
+            fprintf(pReport, " %s %.1f", gPerfEvents[i].name, step->perf[i]/frames);
+         }
+      }
+      if ( (gPerf.fd[PERF_CYCLES] >= 0) && (gPerf.fd[PERF_INSTRUCTIONS] >= 0) && (step->perf[PERF_CYCLES] > 0) )
+      {
+         fprintf(pReport, " IPC %.2f", (double)step->perf[PERF_INSTRUCTIONS]/(double)step->perf[PERF_CYCLES]);
+      }
+      if ( (gPerf.fd[PERF_CACHE_REFS] >= 0) && (gPerf.fd[PERF_CACHE_MISSES] >= 0) && (step->perf[PERF_CACHE_REFS] > 0) )
+      {
+         fprintf(pReport, " cache miss rate %.1f%%", (100.0*step->perf[PERF_CACHE_MISSES])/step->perf[PERF_CACHE_REFS]);
+      }
+      if ( gPerf.multiplexed )
+      {
+         fprintf(pReport, " (multiplexed)");
+      }
+      fprintf(pReport, "\n");
+   }
+}
+
+static void formatMemSample( char *work, size_t size, MemSample *mem )
+{
+   int len;
+
+   len= snprintf( work, size, "rss %lld kB", mem->rss );
+   if ( mem->pss >= 0 )
+   {
+      len += snprintf( work+len, size-len, " pss %lld kB", mem->pss );
+   }
+   len += snprintf( work+len, size-len, " swap %lld kB egl images %d", mem->swap, mem->eglImages );
+   if ( mem->scanoutBuffers )
+   {
+      len += snprintf( work+len, size-len, " scanout buffers %d (%lld kB)", mem->scanoutBuffers, mem->scanoutBytes/1024 );
+   }
+   if ( mem->drmBytes >= 0 )
+   {
+      snprintf( work+len, size-len, " drm %lld kB", mem->drmBytes/1024 );
+   }
+}
+
+static void reportStepMemory( FILE *pReport, const char *name, StepMetrics *step )
+{
+   char work[256];
+
+   if ( pReport && (step->frames > 0) )
+   {
+      formatMemSample( work, sizeof(work), &step->mem );
+      fprintf(pReport, "%s memory: %s\n", name, work);
+   }
+}
+
+static void reportStepFreq( FILE *pReport, const char *name, StepMetrics *step )
+{
+   int i;
+
+   if ( pReport && (step->frames > 0) )
+   {
+      fprintf(pReport, "%s cpufreq MHz (start/end):", name);
+      for( i= 0; i < step->freqEnd.cpuCount; ++i )
+      {
+         if ( step->freqEnd.freqKHz[i] )
+         {
+            fprintf(pReport, " cpu%d %d/%d", i, step->freqStart.freqKHz[i]/1000, step->freqEnd.freqKHz[i]/1000);
+         }
+      }
+      if ( step->freqEnd.maxTempMilliC )
+      {
+         fprintf(pReport, " max temp %.1f C", step->freqEnd.maxTempMilliC/1000.0);
+      }
+      if ( cpuFreqThrottled( &step->freqStart, &step->freqEnd ) )
+      {
+         fprintf(pReport, " THERMAL THROTTLING");
+      }
+      fprintf(pReport, "\n");
+   }
+}
+
+static void reportStepGpu( FILE *pReport, const char *name, StepMetrics *step )
+{
+   double gpuUs, cpuUs;
+
+   if ( pReport && (step->gpuFrames > 0) && (step->frames > 0) )
+   {
+      gpuUs= step->gpuNs/(1000.0*step->gpuFrames);
+      cpuUs= (step->cpu.threadUser+step->cpu.threadSys)/(double)step->frames;
+      fprintf(pReport, "%s GPU per frame: %.1f us max %.1f us (%s, %d frames) thread CPU %.1f us",
+              name, gpuUs, step->gpuMaxNs/1000.0,
+              (step->gpuMode == GPU_TIMER_QUERY) ? "timer query" : "fence estimate",
+              step->gpuFrames, cpuUs );
+      // A fence estimate is only an upper bound, too loose to call the role GPU bound
+      if ( step->gpuMode == GPU_TIMER_QUERY )
+      {
+         fprintf(pReport, ": %s bound", (gpuUs > cpuUs) ? "GPU" : "CPU" );
+      }
+      fprintf(pReport, "\n");
+   }
+}
+
+static void reportStepRepaint( FILE *pReport, const char *name, StepMetrics *step )
+{
+   if ( pReport && (step->repaintFrames > 0) && (step->outputPixels > 0) )
+   {
+      fprintf(pReport, "%s repaint: %.1f%% of output, %lld pixels per frame (%d frames)\n",
+              name, 100.0*step->repaintPixels/step->outputPixels,
+              step->repaintPixels/step->repaintFrames, step->repaintFrames );
+   }
+}
+
+static void reportStepPresent( FILE *pReport, const char *name, StepMetrics *step )
+{
+   if ( pReport && (step->presentFrames > 0) )
+   {
+      fprintf(pReport, "%s present: %.1f us max %lld us after commit, %d of %d frames scanned out, composition traffic %.1f kB per frame\n",
+              name, (double)step->presentUs/step->presentFrames, step->presentMaxUs,
+              step->scanoutFrames, step->presentFrames,
+              step->composeBytes/(1024.0*step->presentFrames) );
+   }
+}
+
+static void reportStepImport( FILE *pReport, const char *name, StepMetrics *step )
+{
+   if ( pReport && (step->importFrames > 0) )
+   {
+      fprintf(pReport, "%s import: %.1f us max %lld us per buffer (%d %s buffers)\n",
+              name, (double)step->importUs/step->importFrames, step->importMaxUs,
+              step->importFrames, gProgramNames[step->importProgram] );
+   }
+}
+
+static void reportStepLayers( FILE *pReport, const char *name, StepMetrics *step )
+{
+   double frames;
+
+   if ( pReport && (step->layerFrames > 0) && (step->layerOutputPixels > 0) )
+   {
+      frames= step->layerFrames;
+      fprintf(pReport, "%s layers per frame: drawn %.1f (blended %.1f) culled %.1f, overdraw %.2fx, blended %.1f%% of output (%d frames)\n",
+              name, step->layers/frames, step->blendedLayers/frames, step->culledLayers/frames,
+              (double)step->drawnPixels/step->layerOutputPixels,
+              100.0*step->blendedPixels/step->layerOutputPixels, step->layerFrames );
+   }
+}
+
+static void reportStepJank( FILE *pReport, const char *name, StepMetrics *step )
+{
+   JankStats *jank= &step->jank;
+
+   if ( pReport && (jank->frames > 0) )
+   {
+      fprintf(pReport, "%s jank: %.1f%% smooth, missed 1 vblank %d, 2 vblanks %d, 3+ vblanks %d, total missed %d, longest streak %d (of %d frames, refresh %lld us)\n",
+              name, 100.0*jank->onTime/jank->frames, jank->missed1, jank->missed2, jank->missed3Plus,
+              jank->missedVblanks, jank->longestStreak, jank->frames, jank->periodUs );
+   }
+}
+
+static void reportStepProtocol( FILE *pReport, const char *name, StepMetrics *step )
+{
+   SocketSnapshot *socket= &step->socket;
+   double frames= step->frames;
+
+   if ( !pReport || !step->haveProtocol || (step->frames <= 0) )
+   {
+      return;
+   }
+   if ( step->haveMessages )
+   {
+      fprintf(pReport, "%s protocol per frame: requests %.2f (%.1f bytes) events %.2f (%.1f bytes)\n",
+              name,
+              step->messages.requests/frames, step->messages.requestBytes/frames,
+              step->messages.events/frames, step->messages.eventBytes/frames );
+   }
+   for( int i= 0; i < SOCKET_KIND_COUNT; ++i )
+   {
+      if ( socket->sendCalls[i] || socket->recvCalls[i] )
+      {
+         fprintf(pReport, "%s socket per frame (%s): sendmsg %.2f (%.1f bytes) recvmsg %.2f (%.1f bytes)\n",
+                 name, ((i == SOCKET_UPSTREAM) ? "upstream" : "clients"),
+                 socket->sendCalls[i]/frames, socket->sendBytes[i]/frames,
+                 socket->recvCalls[i]/frames, socket->recvBytes[i]/frames );
+      }
+   }
+   if ( socket->flushes || socket->roundtrips )
+   {
+      fprintf(pReport, "%s wayland client calls per frame: wl_display_flush %.2f roundtrips %.2f\n",
+              name, socket->flushes/frames, socket->roundtrips/frames );
+   }
+}
+
+static void reportStepMetrics( FILE *pReport, const char *name, StepMetrics *step )
+{
+   reportStepJank( pReport, name, step );
+   reportStepCpu( pReport, name, step );
+   reportStepPerf( pReport, name, step );
+   reportStepMemory( pReport, name, step );
+   reportStepFreq( pReport, name, step );
+   reportStepGpu( pReport, name, step );
+   reportStepRepaint( pReport, name, step );
+   reportStepImport( pReport, name, step );
+   reportStepLayers( pReport, name, step );
+   reportStepPresent( pReport, name, step );
+   reportStepProtocol( pReport, name, step );
+}
+
+static void reportRoleMemory( FILE *pReport, const char *name, RoleMetrics *metrics )
+{
+   MemSample *steady= 0;
+   char work[256];
+   int step;
+
+   if ( !pReport )
+   {
+      return;
+   }
+
+   // Steady state is taken from the last step that ran
+   for( step= 0; step < PACING_STEP_COUNT; ++step )
+   {
+      if ( metrics->steps[step].frames > 0 )
+      {
+         steady= &metrics->steps[step].mem;
+      }
+   }
+   if ( !steady )
+   {
+      return;
+   }
+
+   formatMemSample( work, sizeof(work), &metrics->memBaseline );
+   fprintf(pReport, "%s memory baseline: %s\n", name, work);
+   formatMemSample( work, sizeof(work), &metrics->memPeak );
+   fprintf(pReport, "%s memory peak: %s\n", name, work);
+   formatMemSample( work, sizeof(work), steady );
+   fprintf(pReport, "%s memory steady: %s\n", name, work);
+   fprintf(pReport, "%s memory cost (steady - baseline): rss %lld kB", name, steady->rss-metrics->memBaseline.rss);
+   if ( (steady->pss >= 0) && (metrics->memBaseline.pss >= 0) )
+   {
+      fprintf(pReport, " pss %lld kB", steady->pss-metrics->memBaseline.pss);
+   }
+   if ( (steady->drmBytes >= 0) && (metrics->memBaseline.drmBytes >= 0) )
+   {
+      fprintf(pReport, " drm %lld kB", (steady->drmBytes-metrics->memBaseline.drmBytes)/1024);
+   }
+   fprintf(pReport, "\n");
+}
+
+static void reportRoleMetrics( AppCtx *ctx, WaylandCtx *wctx )
+{
+   RoleMetrics *metrics= &wctx->metrics;
+   int step, pacingDelay;
+
+   // Close a step left open if the client ended early
+   if ( metrics->inStep )
+   {
+      metricsStepEnd( metrics, wctx->frameCount-1 );
+   }
+
+   if ( !ctx->pReport || (metrics->currentStep < 0) )
+   {
+      return;
+   }
+
+   fprintf(ctx->pReport, "\n%s compositor cost by pacing step:\n", wctx->name);
+   pacingDelay= ctx->pacingStart;
+   for( step= 0; step < PACING_STEP_COUNT; ++step )
+   {
+      if ( metrics->steps[step].frames > 0 )
+      {
+         fprintf(ctx->pReport, "%d) pacing %d us frames %d\n", step+1, pacingDelay, metrics->steps[step].frames);
+         reportStepMetrics( ctx->pReport, wctx->name, &metrics->steps[step] );
+         resultStepJank( ctx, wctx->name, step+1, &metrics->steps[step] );
+         resultStepProtocol( ctx, wctx->name, step+1, &metrics->steps[step] );
+         if ( metrics->steps[step].outputPixels > 0 )
+         {
+            resultValue( ctx, wctx->name, step+1, "repaint_pct",
+                         100.0*metrics->steps[step].repaintPixels/metrics->steps[step].outputPixels );
+         }
+         if ( metrics->steps[step].presentFrames > 0 )
+         {
+            resultValue( ctx, wctx->name, step+1, "present_us",
+                         (double)metrics->steps[step].presentUs/metrics->steps[step].presentFrames );
+            resultValue( ctx, wctx->name, step+1, "scanout_pct",
+                         100.0*metrics->steps[step].scanoutFrames/metrics->steps[step].presentFrames );
+         }
+         if ( metrics->steps[step].importFrames > 0 )
+         {
+            resultValue( ctx, wctx->name, step+1, "import_us",
+                         (double)metrics->steps[step].importUs/metrics->steps[step].importFrames );
+         }
+         if ( metrics->steps[step].layerOutputPixels > 0 )
+         {
+            resultValue( ctx, wctx->name, step+1, "layers",
+                         (double)metrics->steps[step].layers/metrics->steps[step].layerFrames );
+            resultValue( ctx, wctx->name, step+1, "overdraw",
+                         (double)metrics->steps[step].drawnPixels/metrics->steps[step].layerOutputPixels );
+            resultValue( ctx, wctx->name, step+1, "blend_pct",
+                         100.0*metrics->steps[step].blendedPixels/metrics->steps[step].layerOutputPixels );
+         }
+      }
+      pacingDelay += ctx->pacingIncrement;
+   }
+   reportRoleMemory( ctx->pReport, wctx->name, metrics );
+}
+
+static long long traceTime( void )
+{
+   struct timespec ts;
+
+   if ( !gTrace.enabled )
+   {
+      return 0;
+   }
+
+   // CLOCK_MONOTONIC is shared by all processes so client, nested and
+   // master events line up without any offset correction
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+static TraceRing *traceGetRing( void )
+{
+   TraceRing *ring= gTraceRing;
+
+   if ( !ring )
+   {
+      ring= (TraceRing*)calloc( 1, sizeof(TraceRing) );
+      if ( ring )
+      {
+         ring->tid= syscall( SYS_gettid );
+         pthread_mutex_lock( &gTrace.mutex );
+         ring->next= gTrace.rings;
+         gTrace.rings= ring;
+         pthread_mutex_unlock( &gTrace.mutex );
+         gTraceRing= ring;
+      }
+   }
+
+   return ring;
+}
+
+static void traceRecord( const char *name, long long start, long long duration, int frame, char flow )
+{
+   TraceRing *ring= traceGetRing();
+   TraceEvent *event;
+
+   if ( ring )
+   {
+      // Once the ring wraps the oldest events are overwritten
+      event= &ring->events[ring->count % TRACE_RING_CAPACITY];
+      event->name= name;
+      event->start= start;
+      event->duration= duration;
+      event->flowId= gTrace.run*TRACE_RUN_STRIDE+frame;
+      event->flow= flow;
+      ++ring->count;
+   }
+}
+
+static void traceSlice( const char *name, long long start, int frame, char flow )
+{
+   if ( gTrace.enabled )
+   {
+      traceRecord( name, start, traceTime()-start, frame, flow );
+   }
+}
+
+static void traceInstant( const char *name, int frame )
+{
+   if ( gTrace.enabled )
+   {
+      traceRecord( name, traceTime(), -1, frame, 0 );
+   }
+}
+
+static void traceWriteEvents( FILE *pFile, int pid )
+{
+   TraceRing *ring;
+   TraceEvent *event;
+   unsigned int i, first;
+
+   for( ring= gTrace.rings; ring; ring= ring->next )
+   {
+      fprintf(pFile, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s%s\"}},\n",
+              pid, ring->tid, gTrace.processName, (ring->tid == pid) ? "" : " worker" );
+
+      first= 0;
+      if ( ring->count > TRACE_RING_CAPACITY )
+      {
+         first= ring->count-TRACE_RING_CAPACITY;
+         printf("Warning: trace: %s thread %d dropped %u oldest events\n", gTrace.processName, ring->tid, first);
+      }
+      for( i= first; i < ring->count; ++i )
+      {
+         event= &ring->events[i % TRACE_RING_CAPACITY];
+         if ( event->duration >= 0 )
+         {
+            fprintf(pFile, "{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%lld}},\n",
+                    event->name, pid, ring->tid, event->start/1000.0, event->duration/1000.0, event->flowId%TRACE_RUN_STRIDE );
+         }
+         else
+         {
+            fprintf(pFile, "{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"args\":{\"frame\":%lld}},\n",
+                    event->name, pid, ring->tid, event->start/1000.0, event->flowId%TRACE_RUN_STRIDE );
+         }
+         if ( event->flow )
+         {
+            // Flow events bind to the enclosing slice so the viewer links one frame across processes
+            fprintf(pFile, "{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"%c\",\"id\":%lld,\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"bp\":\"e\"},\n",
+                    event->flow, event->flowId, pid, ring->tid, event->start/1000.0 );
+         }
+      }
+   }
+}
+
+static void traceInit( const char *processName, bool isMaster )
+{
+   char work[512];
+
+   if ( !gTrace.enabled )
+   {
+      return;
+   }
+
+   gTrace.processName= processName;
+   gTrace.isMaster= isMaster;
+
+   if ( isMaster )
+   {
+      // Discard fragments left by an earlier interrupted run
+      snprintf( work, sizeof(work), TRACE_FRAGMENT_FORMAT, gTrace.filename, "client" );
+      unlink( work );
+      snprintf( work, sizeof(work), TRACE_FRAGMENT_FORMAT, gTrace.filename, "nested" );
+      unlink( work );
+   }
+}
+
+static void traceMergeFragment( FILE *pFile, const char *processName )
+{
+   FILE *pFragment;
+   char work[512];
+   char buffer[4096];
+   size_t len;
+
+   snprintf( work, sizeof(work), TRACE_FRAGMENT_FORMAT, gTrace.filename, processName );
+   pFragment= fopen( work, "rt" );
+   if ( pFragment )
+   {
+      while( (len= fread( buffer, 1, sizeof(buffer), pFragment )) > 0 )
+      {
+         fwrite( buffer, 1, len, pFile );
+      }
+      fclose( pFragment );
+      unlink( work );
+   }
+}
+
+static void traceTerm( void )
+{
+   FILE *pFile;
+   TraceRing *ring;
+   char work[512];
+   int pid;
+
+   if ( !gTrace.enabled || !gTrace.processName )
+   {
+      return;
+   }
+
+   pid= getpid();
+   if ( gTrace.isMaster )
+   {
+      // Children append fragments as they exit; the master writes the final
+      // Chrome trace JSON with its own events first and then every fragment
+      pFile= fopen( gTrace.filename, "wt" );
+      if ( pFile )
+      {
+         fprintf(pFile, "{\"traceEvents\":[\n");
+         traceWriteEvents( pFile, pid );
+         traceMergeFragment( pFile, "nested" );
+         traceMergeFragment( pFile, "client" );
+         fprintf(pFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}\n]}\n",
+                 pid, gTrace.processName );
+         fclose( pFile );
+      }
+      else
+      {
+         printf("Error: traceTerm: unable to open trace file: %s\n", gTrace.filename);
+      }
+   }
+   else
+   {
+      snprintf( work, sizeof(work), TRACE_FRAGMENT_FORMAT, gTrace.filename, gTrace.processName );
+      pFile= fopen( work, "at" );
+      if ( pFile )
+      {
+         fprintf(pFile, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+                 pid, gTrace.processName );
+         traceWriteEvents( pFile, pid );
+         fclose( pFile );
+      }
+      else
+      {
+         printf("Error: traceTerm: unable to open trace fragment: %s\n", work);
+      }
+   }
+
+   pthread_mutex_lock( &gTrace.mutex );
+   while( gTrace.rings )
+   {
+      ring= gTrace.rings;
+      gTrace.rings= ring->next;
+      free( ring );
+   }
+   pthread_mutex_unlock( &gTrace.mutex );
+   gTraceRing= 0;
+}
+
+#define RESULT_FILE "/tmp/waymetric-result"
+#define RESULT_FORMAT "result: %lld\n"
+
+static void writeResult( long long value )
+{
+   FILE *pFile= 0;
+   pFile= fopen( RESULT_FILE, "wt");
+   if ( pFile )
+   {
+      fprintf( pFile, RESULT_FORMAT, value );
+      fclose( pFile );
+   }
+   else
+   {
+      printf("Error: unable to open result file: %s\n", RESULT_FILE);
+   }
+}
+
+static long long readResult()
+{
+   long long value= 0;
+   FILE *pFile= 0;
+   pFile= fopen( RESULT_FILE, "rt");
+   if ( pFile )
+   {
+      if ( fscanf( pFile, RESULT_FORMAT, &value ) != 1 )
+      {
+         printf("Error: unable to parse result from %s\n" RESULT_FILE);
+      }
+      fclose( pFile );
+      remove( RESULT_FILE );
+   }
+   else
+   {
+      printf("Error: unable to open result file: %s\n", RESULT_FILE);
+   }
+   return value;
+}
+
+#define MAX_ATTRIBS (24)
+#define RED_SIZE (8)
+#define GREEN_SIZE (8)
+#define BLUE_SIZE (8)
+#define ALPHA_SIZE (8)
+#define DEPTH_SIZE (0)
+
+static bool initEGL( EGLCtx *eglCtx )
+{
+   bool result= false;
+   int i;
+   EGLBoolean br;
+   EGLint configCount;
+   EGLConfig *configs= 0;
+   EGLint attrs[MAX_ATTRIBS];
+   EGLint redSize, greenSize, blueSize;
+   EGLint alphaSize, depthSize;
+   const char *s;
+
+   eglCtx->eglDisplay= EGL_NO_DISPLAY;
+   eglCtx->eglContext= EGL_NO_CONTEXT;
+   eglCtx->eglSurface= EGL_NO_SURFACE;
+
+   if ( eglCtx->useWayland )
+   {
+      eglCtx->eglDisplay= PlatformGetEGLDisplayWayland( eglCtx->appCtx->platformCtx, eglCtx->dispWayland );
+   }
+   else
+   {
+      eglCtx->eglDisplay= PlatformGetEGLDisplay( eglCtx->appCtx->platformCtx, (NativeDisplayType)eglCtx->nativeDisplay );
+   }
+   if ( eglCtx->eglDisplay == EGL_NO_DISPLAY )
+   {
+      printf("Error: initEGL: eglGetDisplay failed: %X\n", eglGetError() );
+      goto exit;
+   }
+
+   br= eglInitialize( eglCtx->eglDisplay, &eglCtx->majorVersion, &eglCtx->minorVersion );
+   if ( !br )
+   {
+      printf("Error: initEGL: unable to initialize EGL display: %X\n", eglGetError() );
+      goto exit;
+   }
+
+   br= eglGetConfigs( eglCtx->eglDisplay, NULL, 0, &configCount );
+   if ( !br )
+   {
+      printf("Error: initEGL: unable to get count of EGL configurations: %X\n", eglGetError() );
+      goto exit;
+   }
+
+   configs= (EGLConfig*)malloc( configCount*sizeof(EGLConfig) );
+   if ( !configs )
+   {
+      printf("Error: initEGL: no memory for EGL configurations\n");
+      goto exit;
+   }
+
+   i= 0;
+   attrs[i++]= EGL_RED_SIZE;
+   attrs[i++]= RED_SIZE;
+   attrs[i++]= EGL_GREEN_SIZE;
+   attrs[i++]= GREEN_SIZE;
+   attrs[i++]= EGL_BLUE_SIZE;
+   attrs[i++]= BLUE_SIZE;
+   attrs[i++]= EGL_DEPTH_SIZE;
+   attrs[i++]= DEPTH_SIZE;
+   attrs[i++]= EGL_STENCIL_SIZE;
+   attrs[i++]= 0;
+   attrs[i++]= EGL_SURFACE_TYPE;
+   attrs[i++]= EGL_WINDOW_BIT;
+   attrs[i++]= EGL_RENDERABLE_TYPE;
+   attrs[i++]= EGL_OPENGL_ES2_BIT;
+   attrs[i++]= EGL_NONE;
+
+   br= eglChooseConfig( eglCtx->eglDisplay, attrs, configs, configCount, &configCount );
+   if ( !br )
+   {
+      printf("Error: initEGL: eglChooseConfig failed: %X\n", eglGetError() );
+      goto exit;
+   }
+
+   for( i= 0; i < configCount; ++i )
+   {
+      eglGetConfigAttrib( eglCtx->eglDisplay, configs[i], EGL_RED_SIZE, &redSize );
+      eglGetConfigAttrib( eglCtx->eglDisplay, configs[i], EGL_GREEN_SIZE, &greenSize );
+      eglGetConfigAttrib( eglCtx->eglDisplay, configs[i], EGL_BLUE_SIZE, &blueSize );
+      eglGetConfigAttrib( eglCtx->eglDisplay, configs[i], EGL_ALPHA_SIZE, &alphaSize );
+      eglGetConfigAttrib( eglCtx->eglDisplay, configs[i], EGL_DEPTH_SIZE, &depthSize );
+
+      printf("config %d: red: %d green: %d blue: %d alpha: %d depth: %d\n",
+              i, redSize, greenSize, blueSize, alphaSize, depthSize );
+
+      if ( (redSize == RED_SIZE) &&
+           (greenSize == GREEN_SIZE) &&
+           (blueSize == BLUE_SIZE) &&
+           (alphaSize == ALPHA_SIZE) &&
+           (depthSize >= DEPTH_SIZE) )
+      {
+         printf( "choosing config %d\n", i);
+         break;
+      }
+   }
+   if ( configCount == i )
+   {
+      printf("Error: initEGL: no suitable configuration is available\n");
+      goto exit;
+   }
+   eglCtx->eglConfig= configs[i];
+
+   attrs[0]= EGL_CONTEXT_CLIENT_VERSION;
+   attrs[1]= 2;
+   attrs[2]= EGL_NONE;
+    
+   eglCtx->eglContext= eglCreateContext( eglCtx->eglDisplay, eglCtx->eglConfig, EGL_NO_CONTEXT, attrs );
+   if ( eglCtx->eglContext == EGL_NO_CONTEXT )
+   {
+      printf( "Error: initEGL: eglCreateContext failed: %X\n", eglGetError() );
+      goto exit;
+   }
+
+   s= eglQueryString( eglCtx->eglDisplay, EGL_EXTENSIONS );
+   if ( s )
+   {
+      eglCtx->haveBufferAge= (strstr( s, "EGL_EXT_buffer_age" ) != 0);
+      if ( strstr( s, "EGL_KHR_swap_buffers_with_damage" ) )
+      {
+         eglCtx->eglSwapBuffersWithDamage= (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+      }
+      else if ( strstr( s, "EGL_EXT_swap_buffers_with_damage" ) )
+      {
+         eglCtx->eglSwapBuffersWithDamage= (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+      }
+      // Partial update is only safe alongside buffer age
+      if ( eglCtx->haveBufferAge && strstr( s, "EGL_KHR_partial_update" ) )
+      {
+         eglCtx->eglSetDamageRegion= (PFNEGLSETDAMAGEREGIONKHRPROC)eglGetProcAddress("eglSetDamageRegionKHR");
+      }
+   }
+
+   eglCtx->initialized= true;
+
+   result= true;
+
+exit:
+
+   if ( configs )
+   {
+      free( configs );
+   }
+
+   return result;
+}
+
+static void termEGL( EGLCtx *eglCtx )
+{
+   if ( eglCtx->eglDisplay != EGL_NO_DISPLAY )
+   {
+      eglMakeCurrent( eglCtx->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+   }
+
+   if ( eglCtx->eglSurface != EGL_NO_SURFACE )
+   {
+      eglDestroySurface( eglCtx->eglDisplay, eglCtx->eglSurface );
+      eglCtx->eglSurface= EGL_NO_SURFACE;
+   }
+
+   if ( eglCtx->eglContext != EGL_NO_CONTEXT )
+   {
+      eglDestroyContext( eglCtx->eglDisplay, eglCtx->eglContext );
+      eglCtx->eglContext= EGL_NO_CONTEXT;
+   }
+
+   if ( eglCtx->initialized )
+   {      
+      eglTerminate( eglCtx->eglDisplay );
+      eglReleaseThread();
+      eglCtx->initialized= false;
+   }
+}
+
+static const char *vertTexture=
+  "attribute vec2 pos;\n"
+  "attribute vec2 texcoord;\n"
+  "uniform mat4 u_matrix;\n"
+  "uniform vec2 u_resolution;\n"
+  "varying vec2 tx;\n"
+  "void main()\n"
+  "{\n"
+  "  vec4 v1= u_matrix * vec4(pos, 0, 1);\n"
+  "  vec4 v2= v1 / vec4(u_resolution, u_resolution.x, 1);\n"
+  "  vec4 v3= v2 * vec4(2.0, 2.0, 1, 1);\n"
+  "  vec4 v4= v3 - vec4(1.0, 1.0, 0, 0);\n"
+  "  v4.w= 1.0+v4.z;\n"
+  "  gl_Position=  v4 * vec4(1, -1, 1, 1);\n"
+  "  tx= texcoord;\n"
+  "}\n";
+
+static const char *fragTexture=
+  "#ifdef GL_ES\n"
+  "precision mediump float;\n"
+  "#endif\n"
+  "uniform sampler2D texture;\n"
+  "varying vec2 tx;\n"
+  "void main()\n"
+  "{\n"
+  "  gl_FragColor= texture2D(texture, tx);\n"
+  "}\n";
+
+static const char *vertTextureYUV=
+  "attribute vec2 pos;\n"
+  "attribute vec2 texcoord;\n"
+  "attribute vec2 texcoorduv;\n"
+  "uniform mat4 u_matrix;\n"
+  "uniform vec2 u_resolution;\n"
+  "varying vec2 tx;\n"
+  "varying vec2 txuv;\n"
+  "void main()\n"
+  "{\n"
+  "  vec4 v1= u_matrix * vec4(pos, 0, 1);\n"
+  "  vec4 v2= v1 / vec4(u_resolution, u_resolution.x, 1);\n"
+  "  vec4 v3= v2 * vec4(2.0, 2.0, 1, 1);\n"
+  "  vec4 v4= v3 - vec4(1.0, 1.0, 0, 0);\n"
+  "  v4.w= 1.0+v4.z;\n"
+  "  gl_Position=  v4 * vec4(1, -1, 1, 1);\n"
+  "  tx= texcoord;\n"
+  "  txuv= texcoorduv;\n"
+  "}\n";
+
+static const char *fragTextureYUV=
+  "#ifdef GL_ES\n"
+  "precision mediump float;\n"
+  "#endif\n"
+  "uniform sampler2D texture;\n"
+  "uniform sampler2D textureuv;\n"
+  "const vec3 cc_r= vec3(1.0, -0.8604, 1.59580);\n"
+  "const vec4 cc_g= vec4(1.0, 0.539815, -0.39173, -0.81290);\n"
+  "const vec3 cc_b= vec3(1.0, -1.071, 2.01700);\n"
+  "varying vec2 tx;\n"
+  "varying vec2 txuv;\n"
+  "void main()\n"
+  "{\n"
+  "   vec4 y_vec= texture2D(texture, tx);\n"
+  "   vec4 c_vec= texture2D(textureuv, txuv);\n"
+  "   vec4 temp_vec= vec4(y_vec.a, 1.0, c_vec.b, c_vec.a);\n"
+  "   gl_FragColor= vec4( dot(cc_r,temp_vec.xyw), dot(cc_g,temp_vec), dot(cc_b,temp_vec.xyz), 1.0 );\n"
+  "}\n";
+
+// Three plane and packed formats sample the planes as the single channel,
+// two channel and four channel images mesa creates for them
+static const char *fragTextureYUV3=
+  "#ifdef GL_ES\n"
+  "precision mediump float;\n"
+  "#endif\n"
+  "uniform sampler2D texture;\n"
+  "uniform sampler2D textureuv;\n"
+  "uniform sampler2D texturev;\n"
+  "const vec3 cc_r= vec3(1.0, -0.8604, 1.59580);\n"
+  "const vec4 cc_g= vec4(1.0, 0.539815, -0.39173, -0.81290);\n"
+  "const vec3 cc_b= vec3(1.0, -1.071, 2.01700);\n"
+  "varying vec2 tx;\n"
+  "varying vec2 txuv;\n"
+  "void main()\n"
+  "{\n"
+  "   vec4 y_vec= texture2D(texture, tx);\n"
+  "   vec4 u_vec= texture2D(textureuv, txuv);\n"
+  "   vec4 v_vec= texture2D(texturev, txuv);\n"
+  "   vec4 temp_vec= vec4(y_vec.r, 1.0, u_vec.r, v_vec.r);\n"
+  "   gl_FragColor= vec4( dot(cc_r,temp_vec.xyw), dot(cc_g,temp_vec), dot(cc_b,temp_vec.xyz), 1.0 );\n"
+  "}\n";
+
+static const char *fragTextureYUYV=
+  "#ifdef GL_ES\n"
+  "precision mediump float;\n"
+  "#endif\n"
+  "uniform sampler2D texture;\n"
+  "uniform sampler2D textureuv;\n"
+  "const vec3 cc_r= vec3(1.0, -0.8604, 1.59580);\n"
+  "const vec4 cc_g= vec4(1.0, 0.539815, -0.39173, -0.81290);\n"
+  "const vec3 cc_b= vec3(1.0, -1.071, 2.01700);\n"
+  "varying vec2 tx;\n"
+  "varying vec2 txuv;\n"
+  "void main()\n"
+  "{\n"
+  "   vec4 y_vec= texture2D(texture, tx);\n"
+  "   vec4 c_vec= texture2D(textureuv, txuv);\n"
+  "   vec4 temp_vec= vec4(y_vec.r, 1.0, c_vec.g, c_vec.a);\n"
+  "   gl_FragColor= vec4( dot(cc_r,temp_vec.xyw), dot(cc_g,temp_vec), dot(cc_b,temp_vec.xyz), 1.0 );\n"
+  "}\n";
+
+typedef struct _ProgramSource
+{
+   const char *vert;
+   const char *frag;
+   int textureCount;
+   int bitsPerPixel;
+} ProgramSource;
+
+// Indexed by PROGRAM_*
+static const ProgramSource gProgramSources[NUM_PROGRAMS]=
+{
+   { vertTexture, fragTexture, 1, 32 },
+   { vertTextureYUV, fragTextureYUV, 2, 12 },
+   { vertTextureYUV, fragTextureYUV3, 3, 12 },
+   { vertTextureYUV, fragTextureYUYV, 2, 16 }
+};
+
+#define SHADER_CACHE_FORMAT "%s/shader-%016llx-%d.bin"
+#define SHADER_CACHE_TEMP_FORMAT "%s/shader-%016llx-%d.bin.%d"
+#define SHADER_CACHE_MAGIC (0x57594D53)
+
+typedef struct _ShaderCacheHeader
+{
+   unsigned int magic;
+   unsigned int binaryFormat;
+   unsigned int length;
+} ShaderCacheHeader;
+
+static unsigned long long hashString( unsigned long long hash, const char *s )
+{
+   // FNV-1a
+   if ( s )
+   {
+      while( *s )
+      {
+         hash ^= (unsigned char)*s++;
+         hash *= 0x100000001B3ULL;
+      }
+   }
+   return hash;
+}
+
+// Cached binaries are loaded into the driver, so they live in a directory
+// only this user can write: $XDG_CACHE_HOME/waymetric, ~/.cache/waymetric or
+// $XDG_RUNTIME_DIR/waymetric, created with mode 0700.  Returns false, and no
+// cache is used, when none of these can be set up safely.
+static bool initProgramCacheDir( WaylandCtx *ctx )
+{
+   const char *base, *sub;
+   struct stat st;
+   int len;
+
+   sub= "waymetric";
+   base= getenv( "XDG_CACHE_HOME" );
+   if ( !base || (base[0] != '/') )
+   {
+      base= getenv( "HOME" );
+      sub= ".cache/waymetric";
+      if ( !base || (base[0] != '/') )
+      {
+         base= getenv( "XDG_RUNTIME_DIR" );
+         sub= "waymetric";
+      }
+   }
+   if ( !base || (base[0] != '/') )
+   {
+      return false;
+   }
+
+   len= snprintf( ctx->gl.cacheDir, sizeof(ctx->gl.cacheDir), "%s/%s", base, sub );
+   if ( (len < 0) || (len >= (int)sizeof(ctx->gl.cacheDir)) )
+   {
+      ctx->gl.cacheDir[0]= '\0';
+      return false;
+   }
+   if ( mkdir( ctx->gl.cacheDir, 0700 ) && (errno != EEXIST) )
+   {
+      ctx->gl.cacheDir[0]= '\0';
+      return false;
+   }
+   // Refuse a directory that is a symlink, someone else's, or open to others
+   if ( lstat( ctx->gl.cacheDir, &st ) || !S_ISDIR(st.st_mode) ||
+        (st.st_uid != getuid()) || (st.st_mode & 077) )
+   {
+      printf("Warning: initProgramCacheDir: not using shader cache directory %s\n", ctx->gl.cacheDir);
+      ctx->gl.cacheDir[0]= '\0';
+      return false;
+   }
+
+   return true;
+}
+
+static void initProgramCache( WaylandCtx *ctx )
+{
+   const char *s;
+   unsigned long long hash= 0xCBF29CE484222325ULL;
+
+   ctx->gl.haveProgramBinary= false;
+
+   s= (const char*)glGetString( GL_EXTENSIONS );
+   if ( s && strstr( s, "GL_OES_get_program_binary" ) )
+   {
+      ctx->gl.glGetProgramBinaryOES= (PFNGLGETPROGRAMBINARYOESPROC)eglGetProcAddress("glGetProgramBinaryOES");
+      ctx->gl.glProgramBinaryOES= (PFNGLPROGRAMBINARYOESPROC)eglGetProcAddress("glProgramBinaryOES");
+      if ( ctx->gl.glGetProgramBinaryOES && ctx->gl.glProgramBinaryOES )
+      {
+         ctx->gl.haveProgramBinary= initProgramCacheDir( ctx );
+      }
+   }
+
+   // Key cached binaries by driver identity so a driver update invalidates them
+   hash= hashString( hash, (const char*)glGetString( GL_VENDOR ) );
+   hash= hashString( hash, (const char*)glGetString( GL_RENDERER ) );
+   hash= hashString( hash, (const char*)glGetString( GL_VERSION ) );
+   for( int i= 0; i < NUM_PROGRAMS; ++i )
+   {
+      hash= hashString( hash, gProgramSources[i].vert );
+      hash= hashString( hash, gProgramSources[i].frag );
+   }
+   ctx->gl.cacheKey= hash;
+}
+
+static bool loadProgramBinary( WaylandCtx *ctx, int index )
+{
+   bool result= false;
+   GLProgram *program= &ctx->gl.programs[index];
+   char path[PATH_MAX];
+   FILE *pFile= 0;
+   ShaderCacheHeader hdr;
+   void *binary= 0;
+   GLint status;
+   struct stat st;
+   int fd;
+   long long time1, time2;
+
+   if ( !ctx->gl.haveProgramBinary )
+   {
+      goto exit;
+   }
+
+   time1= getCurrentTimeMicro();
+
+   snprintf( path, sizeof(path), SHADER_CACHE_FORMAT, ctx->gl.cacheDir, ctx->gl.cacheKey, index );
+   fd= open( path, O_RDONLY|O_NOFOLLOW|O_CLOEXEC );
+   if ( fd < 0 )
+   {
+      goto exit;
+   }
+   if ( fstat( fd, &st ) || !S_ISREG(st.st_mode) || (st.st_uid != getuid()) )
+   {
+      close( fd );
+      goto exit;
+   }
+   pFile= fdopen( fd, "rb" );
+   if ( !pFile )
+   {
+      close( fd );
+      goto exit;
+   }
+
+   if ( (fread( &hdr, sizeof(hdr), 1, pFile ) != 1) || (hdr.magic != SHADER_CACHE_MAGIC) || (hdr.length == 0) )
+   {
+      goto exit;
+   }
+
+   binary= malloc( hdr.length );
+   if ( !binary )
+   {
+      goto exit;
+   }
+
+   if ( fread( binary, 1, hdr.length, pFile ) != hdr.length )
+   {
+      goto exit;
+   }
+
+   program->prog= glCreateProgram();
+   ctx->gl.glProgramBinaryOES( program->prog, hdr.binaryFormat, binary, hdr.length );
+   glGetProgramiv( program->prog, GL_LINK_STATUS, &status );
+   if ( !status )
+   {
+      // Driver rejected the binary: fall back to compiling from source
+      glDeleteProgram( program->prog );
+      program->prog= 0;
+      remove( path );
+      goto exit;
+   }
+
+   time2= getCurrentTimeMicro();
+
+   program->fromCache= true;
+   program->loadTime= time2-time1;
+
+   result= true;
+
+exit:
+
+   if ( binary )
+   {
+      free( binary );
+   }
+
+   if ( pFile )
+   {
+      fclose( pFile );
+   }
+
+   return result;
+}
+
+static void saveProgramBinary( WaylandCtx *ctx, int index )
+{
+   GLProgram *program= &ctx->gl.programs[index];
+   char path[PATH_MAX];
+   char tempPath[PATH_MAX];
+   FILE *pFile= 0;
+   ShaderCacheHeader hdr;
+   void *binary= 0;
+   GLint length= 0;
+   GLsizei actualLength= 0;
+   GLenum binaryFormat;
+   int fd;
+   bool written;
+
+   if ( !ctx->gl.haveProgramBinary )
+   {
+      goto exit;
+   }
+
+   glGetProgramiv( program->prog, GL_PROGRAM_BINARY_LENGTH_OES, &length );
+   if ( length <= 0 )
+   {
+      goto exit;
+   }
+
+   binary= malloc( length );
+   if ( !binary )
+   {
+      goto exit;
+   }
+
+   ctx->gl.glGetProgramBinaryOES( program->prog, length, &actualLength, &binaryFormat, binary );
+   if ( actualLength <= 0 )
+   {
+      goto exit;
+   }
+
+   // Written to a new file of our own and renamed into place, so a reader
+   // never sees a partial binary and nothing at the path is followed
+   snprintf( path, sizeof(path), SHADER_CACHE_FORMAT, ctx->gl.cacheDir, ctx->gl.cacheKey, index );
+   snprintf( tempPath, sizeof(tempPath), SHADER_CACHE_TEMP_FORMAT, ctx->gl.cacheDir, ctx->gl.cacheKey, index, (int)getpid() );
+   fd= open( tempPath, O_WRONLY|O_CREAT|O_EXCL|O_NOFOLLOW|O_CLOEXEC, 0600 );
+   if ( fd < 0 )
+   {
+      printf("Warning: saveProgramBinary: unable to create shader cache file: %s\n", tempPath);
+      goto exit;
+   }
+   pFile= fdopen( fd, "wb" );
+   if ( !pFile )
+   {
+      close( fd );
+      unlink( tempPath );
+      goto exit;
+   }
+
+   hdr.magic= SHADER_CACHE_MAGIC;
+   hdr.binaryFormat= binaryFormat;
+   hdr.length= actualLength;
+   written= (fwrite( &hdr, sizeof(hdr), 1, pFile ) == 1) &&
+            (fwrite( binary, 1, actualLength, pFile ) == (size_t)actualLength);
+   if ( fclose( pFile ) )
+   {
+      written= false;
+   }
+   pFile= 0;
+   if ( !written || rename( tempPath, path ) )
+   {
+      printf("Warning: saveProgramBinary: unable to write shader cache file: %s\n", path);
+      unlink( tempPath );
+   }
+
+exit:
+
+   if ( binary )
+   {
+      free( binary );
+   }
+
+   if ( pFile )
+   {
+      fclose( pFile );
+   }
+}
+
+static bool compileProgram( WaylandCtx *ctx, int index )
+{
+   bool result= false;
+   GLProgram *program= &ctx->gl.programs[index];
+   GLint status;
+   GLsizei length;
+   char infoLog[512];
+   const char *fragSrc, *vertSrc;
+   long long time1, time2, time3;
+
+   fragSrc= gProgramSources[index].frag;
+   vertSrc= gProgramSources[index].vert;
+
+   time1= getCurrentTimeMicro();
+
+   program->frag= glCreateShader( GL_FRAGMENT_SHADER );
+   if ( !program->frag )
+   {
+      printf("Error: initGL: failed to create fragment shader\n");
+      goto exit;
+   }
+
+   glShaderSource( program->frag, 1, (const char **)&fragSrc, NULL );
+   glCompileShader( program->frag );
+   glGetShaderiv( program->frag, GL_COMPILE_STATUS, &status );
+   if ( !status )
+   {
+      glGetShaderInfoLog( program->frag, sizeof(infoLog), &length, infoLog );
+      printf("Error: initGL: compiling fragment shader: %*s\n", length, infoLog );
+      goto exit;
+   }
+
+   program->vert= glCreateShader( GL_VERTEX_SHADER );
+   if ( !program->vert )
+   {
+      printf("Error: initGL: failed to create vertex shader\n");
+      goto exit;
+   }
+
+   glShaderSource( program->vert, 1, (const char **)&vertSrc, NULL );
+   glCompileShader( program->vert );
+   glGetShaderiv( program->vert, GL_COMPILE_STATUS, &status );
+   if ( !status )
+   {
+      glGetShaderInfoLog( program->vert, sizeof(infoLog), &length, infoLog );
+      printf("Error: initGL: compiling vertex shader: \n%*s\n", length, infoLog );
+      goto exit;
+   }
+
+   time2= getCurrentTimeMicro();
+
+   program->prog= glCreateProgram();
+   glAttachShader(program->prog, program->frag);
+   glAttachShader(program->prog, program->vert);
+
+   glBindAttribLocation(program->prog, program->locPos, "pos");
+   glBindAttribLocation(program->prog, program->locTC, "texcoord");
+   if ( program->isYUV )
+   {
+      glBindAttribLocation(program->prog, program->locTCUV, "texcoorduv");
+   }
+
+   glLinkProgram(program->prog);
+   glGetProgramiv(program->prog, GL_LINK_STATUS, &status);
+   if (!status)
+   {
+      glGetProgramInfoLog(program->prog, sizeof(infoLog), &length, infoLog);
+      printf("Error: initGL: linking:\n%*s\n", length, infoLog);
+      goto exit;
+   }
+
+   time3= getCurrentTimeMicro();
+
+   program->compileTime= time2-time1;
+   program->linkTime= time3-time2;
+
+   saveProgramBinary( ctx, index );
+
+   result= true;
+
+exit:
+
+   return result;
+}
+
+static void termProgram( GLProgram *program )
+{
+   if ( program->frag )
+   {
+      glDeleteShader( program->frag );
+      program->frag= 0;
+   }
+   if ( program->vert )
+   {
+      glDeleteShader( program->vert );
+      program->vert= 0;
+   }
+   if ( program->prog )
+   {
+      glDeleteProgram( program->prog );
+      program->prog= 0;
+   }
+}
+
+// Nanoseconds for fence timing.  Not traceTime, which reads 0 without --trace.
+static long long gpuTimerNow( void )
+{
+   struct timespec ts;
+
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+static void gpuTimerInit( WaylandCtx *ctx, EGLDisplay eglDisplay )
+{
+   GpuTimer *gpu= &ctx->gpu;
+   AppCtx *appCtx= ctx->appCtx;
+   const char *s;
+
+   memset( gpu, 0, sizeof(GpuTimer) );
+   gpu->eglDisplay= eglDisplay;
+   if ( !gGpuTiming )
+   {
+      return;
+   }
+
+   s= (const char*)glGetString( GL_EXTENSIONS );
+   if ( s && strstr( s, "GL_EXT_disjoint_timer_query" ) )
+   {
+      gpu->glGenQueriesEXT= (PFNGLGENQUERIESEXTPROC)eglGetProcAddress("glGenQueriesEXT");
+      gpu->glDeleteQueriesEXT= (PFNGLDELETEQUERIESEXTPROC)eglGetProcAddress("glDeleteQueriesEXT");
+      gpu->glBeginQueryEXT= (PFNGLBEGINQUERYEXTPROC)eglGetProcAddress("glBeginQueryEXT");
+      gpu->glEndQueryEXT= (PFNGLENDQUERYEXTPROC)eglGetProcAddress("glEndQueryEXT");
+      gpu->glGetQueryObjectuivEXT= (PFNGLGETQUERYOBJECTUIVEXTPROC)eglGetProcAddress("glGetQueryObjectuivEXT");
+      gpu->glGetQueryObjectui64vEXT= (PFNGLGETQUERYOBJECTUI64VEXTPROC)eglGetProcAddress("glGetQueryObjectui64vEXT");
+      if ( gpu->glGenQueriesEXT && gpu->glDeleteQueriesEXT && gpu->glBeginQueryEXT &&
+           gpu->glEndQueryEXT && gpu->glGetQueryObjectuivEXT && gpu->glGetQueryObjectui64vEXT )
+      {
+         gpu->glGenQueriesEXT( GPU_TIMER_RING, gpu->queries );
+         gpu->mode= GPU_TIMER_QUERY;
+      }
+   }
+
+   if ( gpu->mode == GPU_TIMER_NONE )
+   {
+      s= eglQueryString( eglDisplay, EGL_EXTENSIONS );
+      if ( s && strstr( s, "EGL_KHR_fence_sync" ) )
+      {
+         gpu->eglCreateSyncKHR= (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+         gpu->eglDestroySyncKHR= (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+         gpu->eglClientWaitSyncKHR= (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+         if ( gpu->eglCreateSyncKHR && gpu->eglDestroySyncKHR && gpu->eglClientWaitSyncKHR )
+         {
+            gpu->mode= GPU_TIMER_FENCE;
+         }
+      }
+   }
+
+   if ( appCtx->pReport )
+   {
+      fprintf(appCtx->pReport, "%s: gpu timing: %s\n", ctx->name,
+              (gpu->mode == GPU_TIMER_QUERY) ? "GL_EXT_disjoint_timer_query" :
+              (gpu->mode == GPU_TIMER_FENCE) ? "EGL_KHR_fence_sync estimate" : "unavailable" );
+   }
+}
+
+static void gpuTimerRecord( WaylandCtx *ctx, long long ns )
+{
+   RoleMetrics *metrics= &ctx->metrics;
+   StepMetrics *step;
+
+   // Results arrive a few frames late so the last frames of one pacing
+   // step are credited to the next, and those landing in warm-up are dropped
+   if ( metrics->inStep && (metrics->currentStep >= 0) && (metrics->currentStep < PACING_STEP_COUNT) )
+   {
+      step= &metrics->steps[metrics->currentStep];
+      step->gpuMode= ctx->gpu.mode;
+      ++step->gpuFrames;
+      step->gpuNs += ns;
+      if ( ns > step->gpuMaxNs )
+      {
+         step->gpuMaxNs= ns;
+      }
+   }
+}
+
+// Read back whatever has completed without waiting on the GPU
+static void gpuTimerCollect( WaylandCtx *ctx )
+{
+   GpuTimer *gpu= &ctx->gpu;
+   int tail;
+
+   if ( gpu->mode == GPU_TIMER_QUERY )
+   {
+      GLint disjoint= 0;
+
+      glGetIntegerv( GL_GPU_DISJOINT_EXT, &disjoint );
+      while( gpu->pending > 0 )
+      {
+         GLuint available= 0;
+         GLuint64 elapsed= 0;
+
+         tail= (gpu->head+GPU_TIMER_RING-gpu->pending)%GPU_TIMER_RING;
+         gpu->glGetQueryObjectuivEXT( gpu->queries[tail], GL_QUERY_RESULT_AVAILABLE_EXT, &available );
+         if ( !available )
+         {
+            break;
+         }
+         gpu->glGetQueryObjectui64vEXT( gpu->queries[tail], GL_QUERY_RESULT_EXT, &elapsed );
+         --gpu->pending;
+         // A disjoint event such as a frequency change invalidates results in flight
+         if ( disjoint )
+         {
+            ++gpu->disjointCount;
+         }
+         else
+         {
+            gpuTimerRecord( ctx, (long long)elapsed );
+         }
+      }
+   }
+   else if ( gpu->mode == GPU_TIMER_FENCE )
+   {
+      while( gpu->pending > 0 )
+      {
+         EGLint rc;
+
+         tail= (gpu->head+GPU_TIMER_RING-gpu->pending)%GPU_TIMER_RING;
+         rc= gpu->eglClientWaitSyncKHR( gpu->eglDisplay, gpu->syncs[tail], EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 0 );
+         if ( rc != EGL_CONDITION_SATISFIED_KHR )
+         {
+            break;
+         }
+         // Time from submit until the signal was seen, an upper bound on GPU time
+         gpuTimerRecord( ctx, gpuTimerNow()-gpu->submitTime[tail] );
+         gpu->eglDestroySyncKHR( gpu->eglDisplay, gpu->syncs[tail] );
+         gpu->syncs[tail]= EGL_NO_SYNC_KHR;
+         --gpu->pending;
+      }
+   }
+}
+
+static void gpuTimerBegin( WaylandCtx *ctx )
+{
+   GpuTimer *gpu= &ctx->gpu;
+
+   if ( gpu->mode == GPU_TIMER_NONE )
+   {
+      return;
+   }
+   gpuTimerCollect( ctx );
+   // Skip timing this frame rather than stall when the ring is full
+   gpu->active= (gpu->pending < GPU_TIMER_RING);
+   if ( gpu->active )
+   {
+      gpu->submitTime[gpu->head]= gpuTimerNow();
+      if ( gpu->mode == GPU_TIMER_QUERY )
+      {
+         gpu->glBeginQueryEXT( GL_TIME_ELAPSED_EXT, gpu->queries[gpu->head] );
+      }
+   }
+}
+
+static void gpuTimerEnd( WaylandCtx *ctx )
+{
+   GpuTimer *gpu= &ctx->gpu;
+
+   if ( !gpu->active )
+   {
+      return;
+   }
+   if ( gpu->mode == GPU_TIMER_QUERY )
+   {
+      gpu->glEndQueryEXT( GL_TIME_ELAPSED_EXT );
+   }
+   else
+   {
+      EGLSyncKHR sync;
+      EGLint rc;
+
+      sync= gpu->eglCreateSyncKHR( gpu->eglDisplay, EGL_SYNC_FENCE_KHR, NULL );
+      if ( sync == EGL_NO_SYNC_KHR )
+      {
+         gpu->active= false;
+         return;
+      }
+      // Flush and wait briefly so a short frame's signal is seen when it
+      // happens rather than at the next frame, which would make the estimate
+      // the frame period.  Longer work is left to gpuTimerCollect.
+      rc= gpu->eglClientWaitSyncKHR( gpu->eglDisplay, sync, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, GPU_TIMER_FENCE_WAIT_NS );
+      if ( rc == EGL_CONDITION_SATISFIED_KHR )
+      {
+         gpuTimerRecord( ctx, gpuTimerNow()-gpu->submitTime[gpu->head] );
+         gpu->eglDestroySyncKHR( gpu->eglDisplay, sync );
+         gpu->active= false;
+         return;
+      }
+      gpu->syncs[gpu->head]= sync;
+   }
+   gpu->head= (gpu->head+1)%GPU_TIMER_RING;
+   ++gpu->pending;
+   gpu->active= false;
+}
+
+static void gpuTimerTerm( WaylandCtx *ctx )
+{
+   GpuTimer *gpu= &ctx->gpu;
+   int i;
+
+   if ( gpu->mode == GPU_TIMER_QUERY )
+   {
+      gpu->glDeleteQueriesEXT( GPU_TIMER_RING, gpu->queries );
+   }
+   else if ( gpu->mode == GPU_TIMER_FENCE )
+   {
+      for( i= 0; i < GPU_TIMER_RING; ++i )
+      {
+         if ( gpu->syncs[i] != EGL_NO_SYNC_KHR )
+         {
+            gpu->eglDestroySyncKHR( gpu->eglDisplay, gpu->syncs[i] );
+         }
+      }
+   }
+   memset( gpu, 0, sizeof(GpuTimer) );
+}
+
+static int hdrBucket( long long value )
+{
+   int msb, shift;
+
+   if ( value < HDR_SUB_COUNT )
+   {
+      return (value < 0) ? 0 : value;
+   }
+   if ( value > 0xFFFFFFFFLL )
+   {
+      value= 0xFFFFFFFFLL;
+   }
+   msb= 63-__builtin_clzll( value );
+   shift= msb-(HDR_SUB_BITS-1);
+   return HDR_SUB_COUNT+(shift-1)*HDR_HALF_COUNT+(int)((value>>shift)-HDR_HALF_COUNT);
+}
+
+static long long hdrBucketLimit( int bucket )
+{
+   int shift;
+
+   if ( bucket < HDR_SUB_COUNT )
+   {
+      return bucket;
+   }
+   shift= (bucket-HDR_SUB_COUNT)/HDR_HALF_COUNT+1;
+   return ((long long)((bucket-HDR_SUB_COUNT)%HDR_HALF_COUNT+HDR_HALF_COUNT+1)<<shift)-1;
+}
+
+static void hdrRecord( HdrHistogram *hist, long long value )
+{
+   ++hist->counts[hdrBucket( value )];
+   ++hist->count;
+   if ( value > hist->max )
+   {
+      hist->max= value;
+   }
+}
+
+static long long hdrPercentile( HdrHistogram *hist, double percent )
+{
+   long long target, count;
+   int i;
+
+   if ( hist->count == 0 )
+   {
+      return 0;
+   }
+   target= (long long)(hist->count*percent/100.0+0.5);
+   if ( target < 1 )
+   {
+      target= 1;
+   }
+   count= 0;
+   for( i= 0; i < HDR_BUCKETS; ++i )
+   {
+      count += hist->counts[i];
+      if ( count >= target )
+      {
+         return MIN( hdrBucketLimit( i ), hist->max );
+      }
+   }
+
+   return hist->max;
+}
+
+static SoakPage *soakPageOpen( bool create )
+{
+   SoakPage *page= 0;
+   void *map;
+   int fd;
+
+   fd= shm_open( SOAK_PAGE_NAME, (create ? (O_RDWR|O_CREAT|O_TRUNC) : O_RDWR), 0644 );
+   if ( fd < 0 )
+   {
+      printf("Error: soakPageOpen: shm_open %s failed: errno %d\n", SOAK_PAGE_NAME, errno);
+      goto exit;
+   }
+   if ( create && ftruncate( fd, sizeof(SoakPage) ) )
+   {
+      printf("Error: soakPageOpen: ftruncate failed: errno %d\n", errno);
+      goto exit;
+   }
+   map= mmap( 0, sizeof(SoakPage), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0 );
+   if ( map == MAP_FAILED )
+   {
+      printf("Error: soakPageOpen: mmap failed: errno %d\n", errno);
+      goto exit;
+   }
+   page= (SoakPage*)map;
+   if ( create )
+   {
+      page->version= SOAK_PAGE_VERSION;
+      __atomic_store_n( &page->magic, SOAK_PAGE_MAGIC, __ATOMIC_RELEASE );
+   }
+
+exit:
+   if ( fd >= 0 )
+   {
+      close( fd );
+   }
+
+   return page;
+}
+
+static void soakPageClose( SoakPage *page, bool unlink )
+{
+   if ( page )
+   {
+      munmap( page, sizeof(SoakPage) );
+   }
+   if ( unlink )
+   {
+      shm_unlink( SOAK_PAGE_NAME );
+   }
+}
+
+static bool soakInit( WaylandCtx *ctx, int slot )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   SoakCtx *soak;
+
+   soak= (SoakCtx*)calloc( 1, sizeof(SoakCtx) );
+   if ( !soak )
+   {
+      printf("Error: soakInit: no memory for soak state\n");
+      return false;
+   }
+   soak->stride= 1;
+   soak->startTime= getCurrentTimeMicro();
+   soak->nextPublish= soak->startTime+appCtx->soakInterval*1000000LL;
+   if ( appCtx->soakPage )
+   {
+      soak->slot= &appCtx->soakPage->slots[slot];
+      soak->slot->pid= getpid();
+      strncpy( soak->slot->role, ctx->name, sizeof(soak->slot->role)-1 );
+   }
+   ctx->soak= soak;
+
+   return true;
+}
+
+static void soakTerm( WaylandCtx *ctx )
+{
+   if ( ctx->soak )
+   {
+      free( ctx->soak );
+      ctx->soak= 0;
+   }
+}
+
+static void soakPublish( WaylandCtx *ctx, long long now )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   SoakCtx *soak= ctx->soak;
+   SoakPageSlot *slot= soak->slot;
+   SoakInterval interval;
+   MemSample mem;
+
+   sampleMemory( appCtx, &mem );
+   memset( &interval, 0, sizeof(interval) );
+   interval.elapsedS= (now-soak->startTime)/1000000LL;
+   interval.frames= soak->windowFrames;
+   interval.p50Us= hdrPercentile( &soak->window, 50.0 );
+   interval.p90Us= hdrPercentile( &soak->window, 90.0 );
+   interval.p99Us= hdrPercentile( &soak->window, 99.0 );
+   interval.maxUs= soak->window.max;
+   interval.surfaces= __atomic_load_n( &appCtx->surfacePool.inUse, __ATOMIC_RELAXED );
+   interval.eglImages= mem.eglImages;
+   interval.rss= mem.rss;
+   interval.pss= mem.pss;
+
+   if ( slot )
+   {
+      __atomic_add_fetch( &slot->seq, 1, __ATOMIC_ACQ_REL );
+      slot->elapsedMs= (now-soak->startTime)/1000LL;
+      slot->frames= soak->frames;
+      slot->p50Us= interval.p50Us;
+      slot->p90Us= interval.p90Us;
+      slot->p99Us= interval.p99Us;
+      slot->maxUs= interval.maxUs;
+      slot->totalP99Us= hdrPercentile( &soak->total, 99.0 );
+      slot->surfaces= interval.surfaces;
+      slot->bufferInfos= __atomic_load_n( &appCtx->bufferInfoPool.inUse, __ATOMIC_RELAXED );
+      slot->eglImages= interval.eglImages;
+      slot->rss= interval.rss;
+      slot->pss= interval.pss;
+      __atomic_add_fetch( &slot->seq, 1, __ATOMIC_ACQ_REL );
+   }
+
+   // Keep memory constant on long runs by thinning the history and halving
+   // its resolution whenever it fills
+   if ( (soak->intervalIndex % soak->stride) == 0 )
+   {
+      if ( soak->historyCount == SOAK_MAX_INTERVALS )
+      {
+         for( int i= 0; i < SOAK_MAX_INTERVALS/2; ++i )
+         {
+            soak->history[i]= soak->history[i*2];
+         }
+         soak->historyCount= SOAK_MAX_INTERVALS/2;
+         soak->stride *= 2;
+      }
+      if ( (soak->intervalIndex % soak->stride) == 0 )
+      {
+         soak->history[soak->historyCount++]= interval;
+      }
+   }
+   ++soak->intervalIndex;
+
+   memset( &soak->window, 0, sizeof(HdrHistogram) );
+   soak->windowFrames= 0;
+   soak->nextPublish += appCtx->soakInterval*1000000LL;
+}
+
+static void soakFrame( WaylandCtx *ctx )
+{
+   SoakCtx *soak= ctx->soak;
+   long long now;
+
+   now= getCurrentTimeMicro();
+   if ( soak->lastFrameTime )
+   {
+      hdrRecord( &soak->window, now-soak->lastFrameTime );
+      hdrRecord( &soak->total, now-soak->lastFrameTime );
+   }
+   soak->lastFrameTime= now;
+   ++soak->frames;
+   ++soak->windowFrames;
+   if ( now >= soak->nextPublish )
+   {
+      soakPublish( ctx, now );
+   }
+}
+
+static void soakReport( WaylandCtx *ctx )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   SoakCtx *soak= ctx->soak;
+   SoakInterval *first, *last;
+   FILE *pReport= appCtx->pReport;
+
+   if ( !soak || !pReport )
+   {
+      return;
+   }
+
+   fprintf(pReport, "%s soak: frames %lld frame interval p50 %lld us p90 %lld us p99 %lld us p99.9 %lld us max %lld us\n",
+           ctx->name, soak->frames,
+           hdrPercentile( &soak->total, 50.0 ),
+           hdrPercentile( &soak->total, 90.0 ),
+           hdrPercentile( &soak->total, 99.0 ),
+           hdrPercentile( &soak->total, 99.9 ),
+           soak->total.max );
+   resultValue( appCtx, ctx->name, 0, "soak_frames", soak->frames );
+   resultValue( appCtx, ctx->name, 0, "soak_p50_us", hdrPercentile( &soak->total, 50.0 ) );
+   resultValue( appCtx, ctx->name, 0, "soak_p99_us", hdrPercentile( &soak->total, 99.0 ) );
+   resultValue( appCtx, ctx->name, 0, "soak_max_us", soak->total.max );
+
+   fprintf(pReport, "%s soak intervals:\n", ctx->name);
+   fprintf(pReport, "%8s %8s %8s %8s %8s %8s %8s %8s %10s %10s\n",
+           "time s", "frames", "p50 us", "p90 us", "p99 us", "max us", "surfaces", "images", "rss KB", "pss KB");
+   for( int i= 0; i < soak->historyCount; ++i )
+   {
+      SoakInterval *interval= &soak->history[i];
+      fprintf(pReport, "%8d %8d %8d %8d %8d %8d %8d %8d %10lld %10lld\n",
+              interval->elapsedS, interval->frames, interval->p50Us, interval->p90Us, interval->p99Us,
+              interval->maxUs, interval->surfaces, interval->eglImages, interval->rss, interval->pss );
+   }
+
+   if ( soak->historyCount >= 2 )
+   {
+      first= &soak->history[0];
+      last= &soak->history[soak->historyCount-1];
+      fprintf(pReport, "%s soak drift over %d s: p50 %+d us p99 %+d us rss %+lld KB pss %+lld KB surfaces %+d images %+d\n",
+              ctx->name, last->elapsedS-first->elapsedS,
+              last->p50Us-first->p50Us, last->p99Us-first->p99Us,
+              last->rss-first->rss, last->pss-first->pss,
+              last->surfaces-first->surfaces, last->eglImages-first->eglImages );
+      resultValue( appCtx, ctx->name, 0, "soak_drift_p99_us", last->p99Us-first->p99Us );
+      resultValue( appCtx, ctx->name, 0, "soak_drift_rss_kb", last->rss-first->rss );
+      resultValue( appCtx, ctx->name, 0, "soak_drift_pss_kb", last->pss-first->pss );
+   }
+}
+
+static bool initGL( WaylandCtx *ctx )
+{
+   bool result= true;
+   AppCtx *appCtx= ctx->appCtx;
+
+   initProgramCache( ctx );
+
+   // Build every program up front so switching between RGB and YUV
+   // clients never compiles shaders inside the measured frames
+   for( int i= 0; i < NUM_PROGRAMS; ++i )
+   {
+      GLProgram *program= &ctx->gl.programs[i];
+
+      memset( program, 0, sizeof(GLProgram) );
+      program->isYUV= (i != PROGRAM_RGB);
+      program->textureCount= gProgramSources[i].textureCount;
+      program->locPos= 0;
+      program->locTC= 1;
+      program->locTCUV= 2;
+
+      if ( !loadProgramBinary( ctx, i ) )
+      {
+         if ( !compileProgram( ctx, i ) )
+         {
+            termProgram( program );
+            // Only the RGB program is essential.  Without a YUV one the
+            // surfaces needing it are not drawn, but everything else runs.
+            if ( i == PROGRAM_RGB )
+            {
+               result= false;
+            }
+            else if ( appCtx->pReport )
+            {
+               fprintf(appCtx->pReport, "%s: %s program unavailable, surfaces using it are not drawn\n",
+                       ctx->name, gProgramNames[i] );
+            }
+            continue;
+         }
+      }
+
+      program->locRes= glGetUniformLocation(program->prog,"u_resolution");
+      program->locMatrix= glGetUniformLocation(program->prog,"u_matrix");
+      program->locTexture= glGetUniformLocation(program->prog,"texture");
+      if ( program->isYUV )
+      {
+         program->locTextureUV= glGetUniformLocation(program->prog,"textureuv");
+      }
+      if ( program->textureCount > 2 )
+      {
+         program->locTextureV= glGetUniformLocation(program->prog,"texturev");
+      }
+
+      if ( appCtx->pReport )
+      {
+         if ( program->fromCache )
+         {
+            fprintf(appCtx->pReport, "%s: %s program loaded from binary cache in %lld us\n",
+                    ctx->name, gProgramNames[i], program->loadTime );
+         }
+         else
+         {
+            fprintf(appCtx->pReport, "%s: %s program compile %lld us link %lld us (binary cache %s)\n",
+                    ctx->name, gProgramNames[i], program->compileTime, program->linkTime,
+                    (ctx->gl.haveProgramBinary ? "available" : "unavailable") );
+         }
+      }
+   }
+
+   glGenBuffers( 1, &ctx->gl.vbo );
+   ctx->gl.vboQuadCapacity= 0;
+   ctx->gl.uploadedQuadCount= 0;
+
+   gpuTimerInit( ctx, ctx->eglServer.eglDisplay );
+
+   return result;
+}
+
+static void termGL( WaylandCtx *ctx )
+{
+   gpuTimerTerm( ctx );
+   for( int i= 0; i < NUM_PROGRAMS; ++i )
+   {
+      termProgram( &ctx->gl.programs[i] );
+   }
+   if ( ctx->gl.vbo )
+   {
+      glDeleteBuffers( 1, &ctx->gl.vbo );
+      ctx->gl.vbo= 0;
+   }
+}
+
+static void updateSurfaceTextures( WaylandCtx *ctx, Surface *surface )
+{
+   AppCtx *appCtx= ctx->appCtx;
+
+   if ( surface->textureId[0] == GL_NONE )
+   {
+      for ( int i= 0; i < surface->textureCount; ++i )
+      {
+         if ( surface->textureId[i] == GL_NONE )
+         {
+            glGenTextures(1, &surface->textureId[i] );
+         }
+       
+         glActiveTexture(GL_TEXTURE0+i);
+         glBindTexture(GL_TEXTURE_2D, surface->textureId[i] );
+         if ( surface->eglImage[i] )
+         {
+            appCtx->glEGLImageTargetTexture2DOES(GL_TEXTURE_2D, surface->eglImage[i]);
+         }
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+         glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+      }
+   }
+}
+
+static bool surfacesOverlap( Surface *s1, Surface *s2 )
+{
+   return ( (s1->x < s2->x+s2->width) && (s2->x < s1->x+s1->width) &&
+            (s1->y < s2->y+s2->height) && (s2->y < s1->y+s1->height) );
+}
+
+static int compareDrawItems( const void *p1, const void *p2 )
+{
+   const DrawItem *d1= (const DrawItem*)p1;
+   const DrawItem *d2= (const DrawItem*)p2;
+
+   if ( d1->batch != d2->batch )
+   {
+      return d1->batch - d2->batch;
+   }
+   if ( d1->program != d2->program )
+   {
+      return d1->program - d2->program;
+   }
+   if ( d1->blend != d2->blend )
+   {
+      return d1->blend ? 1 : -1;
+   }
+   if ( d1->surface->textureId[0] != d2->surface->textureId[0] )
+   {
+      return (d1->surface->textureId[0] < d2->surface->textureId[0]) ? -1 : 1;
+   }
+   return d1->order - d2->order;
+}
+
+static bool sameDrawState( DrawItem *d1, DrawItem *d2 )
+{
+   if ( (d1->program != d2->program) || (d1->blend != d2->blend) )
+   {
+      return false;
+   }
+   for( int i= 0; i < d1->surface->textureCount; ++i )
+   {
+      if ( d1->surface->textureId[i] != d2->surface->textureId[i] )
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+static void buildQuad( GLfloat *v, Surface *surface )
+{
+   GLfloat x0= surface->x;
+   GLfloat y0= surface->y;
+   GLfloat x1= surface->x+surface->width;
+   GLfloat y1= surface->y+surface->height;
+   const GLfloat quad[QUAD_FLOATS]=
+   {
+      x0, y0, 0, 0,
+      x1, y0, 1, 0,
+      x0, y1, 0, 1,
+      x1, y0, 1, 0,
+      x1, y1, 1, 1,
+      x0, y1, 0, 1
+   };
+   memcpy( v, quad, sizeof(quad) );
+}
+
+static void uploadGeometry( GLCtx *gl )
+{
+   int count= gl->drawCount;
+   size_t size= count*QUAD_FLOATS*sizeof(GLfloat);
+
+   if ( count > gl->vboQuadCapacity )
+   {
+      glBufferData( GL_ARRAY_BUFFER, size, gl->vertices, GL_DYNAMIC_DRAW );
+      gl->vboQuadCapacity= count;
+   }
+   else if ( (count == gl->uploadedQuadCount) && !memcmp( gl->vertices, gl->uploadedVertices, size ) )
+   {
+      // Geometry unchanged since last frame
+      return;
+   }
+   else
+   {
+      glBufferSubData( GL_ARRAY_BUFFER, 0, size, gl->vertices );
+   }
+   memcpy( gl->uploadedVertices, gl->vertices, size );
+   gl->uploadedQuadCount= count;
+}
+
+static void useProgram( WaylandCtx *ctx, GLProgram *program )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   const float identityMatrix[4][4]=
+   {
+      {1, 0, 0, 0},
+      {0, 1, 0, 0},
+      {0, 0, 1, 0},
+      {0, 0, 0, 1}
+   };
+
+   glUseProgram(program->prog);
+
+   // Uniform values persist with the program so only send them when they change
+   if ( !program->uniformsSet )
+   {
+      glUniformMatrix4fv(program->locMatrix, 1, GL_FALSE, (GLfloat*)identityMatrix);
+      glUniform1i(program->locTexture, 0);
+      if ( program->isYUV )
+      {
+         glUniform1i(program->locTextureUV, 1);
+      }
+      if ( program->textureCount > 2 )
+      {
+         glUniform1i(program->locTextureV, 2);
+      }
+      program->uniformsSet= true;
+   }
+   if ( (program->resWidth != appCtx->windowWidth) || (program->resHeight != appCtx->windowHeight) )
+   {
+      program->resWidth= appCtx->windowWidth;
+      program->resHeight= appCtx->windowHeight;
+      glUniform2f(program->locRes, program->resWidth, program->resHeight);
+   }
+
+   glVertexAttribPointer(program->locPos, 2, GL_FLOAT, GL_FALSE, VERTEX_FLOATS*sizeof(GLfloat), (void*)0);
+   glVertexAttribPointer(program->locTC, 2, GL_FLOAT, GL_FALSE, VERTEX_FLOATS*sizeof(GLfloat), (void*)(2*sizeof(GLfloat)));
+   glEnableVertexAttribArray(program->locPos);
+   glEnableVertexAttribArray(program->locTC);
+   if ( program->isYUV )
+   {
+      glVertexAttribPointer(program->locTCUV, 2, GL_FLOAT, GL_FALSE, VERTEX_FLOATS*sizeof(GLfloat), (void*)(2*sizeof(GLfloat)));
+      glEnableVertexAttribArray(program->locTCUV);
+   }
+   else
+   {
+      glDisableVertexAttribArray(program->locTCUV);
+   }
+}
+
+static int damageClamp( long long v )
+{
+   if ( v < 0 ) v= 0;
+   if ( v > INT_MAX ) v= INT_MAX;
+   return (int)v;
+}
+
+static void damageClear( DamageRect *r )
+{
+   r->x0= r->y0= r->x1= r->y1= 0;
+}
+
+static bool damageEmpty( const DamageRect *r )
+{
+   return (r->x1 <= r->x0) || (r->y1 <= r->y0);
+}
+
+// Clients commonly damage with huge sizes (Mesa uses INT32_MAX) to mean
+// everything, so work in 64 bits and clamp
+static void damageAdd( DamageRect *r, long long x, long long y, long long w, long long h )
+{
+   DamageRect a;
+
+   if ( (w <= 0) || (h <= 0) )
+   {
+      return;
+   }
+   a.x0= damageClamp( x );
+   a.y0= damageClamp( y );
+   a.x1= damageClamp( x+w );
+   a.y1= damageClamp( y+h );
+   if ( damageEmpty( &a ) )
+   {
+      return;
+   }
+   if ( damageEmpty( r ) )
+   {
+      *r= a;
+   }
+   else
+   {
+      if ( a.x0 < r->x0 ) r->x0= a.x0;
+      if ( a.y0 < r->y0 ) r->y0= a.y0;
+      if ( a.x1 > r->x1 ) r->x1= a.x1;
+      if ( a.y1 > r->y1 ) r->y1= a.y1;
+   }
+}
+
+static void damageUnion( DamageRect *r, const DamageRect *a )
+{
+   if ( !damageEmpty( a ) )
+   {
+      damageAdd( r, a->x0, a->y0, a->x1-a->x0, a->y1-a->y0 );
+   }
+}
+
+static void damageIntersect( DamageRect *r, const DamageRect *a )
+{
+   if ( a->x0 > r->x0 ) r->x0= a->x0;
+   if ( a->y0 > r->y0 ) r->y0= a->y0;
+   if ( a->x1 < r->x1 ) r->x1= a->x1;
+   if ( a->y1 < r->y1 ) r->y1= a->y1;
+   if ( damageEmpty( r ) )
+   {
+      damageClear( r );
+   }
+}
+
+static void damageClip( DamageRect *r, int width, int height )
+{
+   if ( r->x1 > width ) r->x1= width;
+   if ( r->y1 > height ) r->y1= height;
+   if ( damageEmpty( r ) )
+   {
+      damageClear( r );
+   }
+}
+
+static long long damageArea( const DamageRect *r )
+{
+   return damageEmpty( r ) ? 0 : (long long)(r->x1-r->x0)*(r->y1-r->y0);
+}
+
+// Move a surface's committed damage from buffer to output coordinates
+static void damageAddSurface( WaylandCtx *ctx, Surface *surface )
+{
+   DamageRect *d= &surface->damage;
+   long long x0, y0, x1, y1;
+
+   if ( damageEmpty( d ) || !surface->bufferWidth || !surface->bufferHeight )
+   {
+      return;
+   }
+   x0= surface->x+((long long)d->x0*surface->width)/surface->bufferWidth;
+   y0= surface->y+((long long)d->y0*surface->height)/surface->bufferHeight;
+   x1= surface->x+((long long)d->x1*surface->width+surface->bufferWidth-1)/surface->bufferWidth;
+   y1= surface->y+((long long)d->y1*surface->height+surface->bufferHeight-1)/surface->bufferHeight;
+   damageAdd( &ctx->outputDamage, x0, y0, x1-x0, y1-y0 );
+}
+
+// Work out what must be redrawn this frame.  A back buffer of age n holds
+// the output from n frames ago so it also lacks the damage of the n-1
+// frames since.  Unknown or old buffers are repainted in full.
+static void damageRepaintRegion( WaylandCtx *ctx, DamageRect *repaint )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   EGLCtx *eglCtx= &ctx->eglServer;
+   EGLint age= 0;
+   int i;
+
+   damageClip( &ctx->outputDamage, appCtx->windowWidth, appCtx->windowHeight );
+   *repaint= ctx->outputDamage;
+
+   if ( eglCtx->haveBufferAge )
+   {
+      eglQuerySurface( eglCtx->eglDisplay, eglCtx->eglSurface, EGL_BUFFER_AGE_EXT, &age );
+   }
+   if ( (age <= 0) || (age-1 > ctx->damageHistoryCount) )
+   {
+      damageClear( repaint );
+      damageAdd( repaint, 0, 0, appCtx->windowWidth, appCtx->windowHeight );
+      return;
+   }
+   for( i= 0; i < age-1; ++i )
+   {
+      damageUnion( repaint, &ctx->damageHistory[i] );
+   }
+}
+
+static void damageEndFrame( WaylandCtx *ctx, const DamageRect *repaint )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   RoleMetrics *metrics= &ctx->metrics;
+   StepMetrics *step;
+
+   memmove( &ctx->damageHistory[1], &ctx->damageHistory[0], (DAMAGE_HISTORY-1)*sizeof(DamageRect) );
+   ctx->damageHistory[0]= ctx->outputDamage;
+   if ( ctx->damageHistoryCount < DAMAGE_HISTORY )
+   {
+      ++ctx->damageHistoryCount;
+   }
+   damageClear( &ctx->outputDamage );
+
+   if ( metrics->inStep && (metrics->currentStep >= 0) && (metrics->currentStep < PACING_STEP_COUNT) )
+   {
+      step= &metrics->steps[metrics->currentStep];
+      ++step->repaintFrames;
+      step->repaintPixels += damageArea( repaint );
+      step->outputPixels += (long long)appCtx->windowWidth*appCtx->windowHeight;
+   }
+}
+
+// Present with damage when it is available.  The platform goes first so
+// swaps it interposes still see the frame.
+static void swapBuffersWithDamage( AppCtx *ctx, EGLCtx *eglCtx, EGLint *rects, EGLint count )
+{
+   if ( eglCtx->eglSwapBuffersWithDamage )
+   {
+      if ( !PlatformSwapBuffersWithDamage( ctx->platformCtx, eglCtx->eglDisplay, eglCtx->eglSurface, rects, count ) )
+      {
+         eglCtx->eglSwapBuffersWithDamage( eglCtx->eglDisplay, eglCtx->eglSurface, rects, count );
+      }
+   }
+   else
+   {
+      eglSwapBuffers( eglCtx->eglDisplay, eglCtx->eglSurface );
+   }
+}
+
+// A subsurface is only shown while it and each of its ancestors has a parent
+static bool surfaceMapped( Surface *surface )
+{
+   for( ; surface->isSubsurface; surface= surface->parent )
+   {
+      if ( !surface->parent )
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+// The part of a surface that hides whatever is below it, in output
+// coordinates.  Buffers without alpha are opaque throughout.
+static bool surfaceOpaqueRect( Surface *surface, DamageRect *r )
+{
+   DamageRect *o= &surface->opaque;
+   long long x0, y0, x1, y1;
+
+   damageClear( r );
+   if ( !surface->hasAlpha )
+   {
+      damageAdd( r, surface->x, surface->y, surface->width, surface->height );
+   }
+   else if ( !damageEmpty( o ) && surface->bufferWidth && surface->bufferHeight )
+   {
+      // Round inwards so a partly covered pixel is never claimed
+      x0= surface->x+((long long)o->x0*surface->width+surface->bufferWidth-1)/surface->bufferWidth;
+      y0= surface->y+((long long)o->y0*surface->height+surface->bufferHeight-1)/surface->bufferHeight;
+      x1= surface->x+((long long)MIN(o->x1,surface->bufferWidth)*surface->width)/surface->bufferWidth;
+      y1= surface->y+((long long)MIN(o->y1,surface->bufferHeight)*surface->height)/surface->bufferHeight;
+      damageAdd( r, x0, y0, x1-x0, y1-y0 );
+   }
+
+   return !damageEmpty( r );
+}
+
+static bool surfaceIsOpaque( Surface *surface )
+{
+   DamageRect *o= &surface->opaque;
+
+   return ( !surface->hasAlpha ||
+            ((o->x0 <= 0) && (o->y0 <= 0) && (o->x1 >= surface->bufferWidth) && (o->y1 >= surface->bufferHeight)) );
+}
+
+// True when a single opaque surface above hides all of the visible area
+static bool surfaceOccluded( WaylandCtx *ctx, Surface *surface, DamageRect *visible )
+{
+   Surface *other;
+   DamageRect r;
+   bool above= false;
+
+   wl_list_for_each( other, &ctx->surfaces, link )
+   {
+      if ( other == surface )
+      {
+         above= true;
+      }
+      else if ( above && other->textureCount && other->eglImage[0] && surfaceMapped( other ) &&
+                surfaceOpaqueRect( other, &r ) &&
+                (r.x0 <= visible->x0) && (r.y0 <= visible->y0) && (r.x1 >= visible->x1) && (r.y1 >= visible->y1) )
+      {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+void composeGL( WaylandCtx *ctx )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   EGLCtx *eglCtx= &ctx->eglServer;
+   GLCtx *gl= &ctx->gl;
+   Surface *surface;
+   GLProgram *current= 0;
+   GLuint boundTexture[MAX_TEXTURES];
+   bool coversOutput= false;
+   bool blending= false;
+   DamageRect repaint, visible;
+   int culled= 0, blended= 0;
+   long long area, drawnPixels= 0, blendedPixels= 0;
+   EGLint rect[4];
+   long long bytes= 0;
+   int i, j, run, batch, batchStart, order;
+   long long traceStart;
+
+   traceStart= traceTime();
+   gpuTimerBegin( ctx );
+
+   if ( appCtx->damageTracking )
+   {
+      damageRepaintRegion( ctx, &repaint );
+
+      // EGL and GL want bottom left origin
+      rect[0]= repaint.x0;
+      rect[1]= appCtx->windowHeight-repaint.y1;
+      rect[2]= repaint.x1-repaint.x0;
+      rect[3]= repaint.y1-repaint.y0;
+      if ( eglCtx->eglSetDamageRegion )
+      {
+         eglCtx->eglSetDamageRegion( eglCtx->eglDisplay, eglCtx->eglSurface, rect, 1 );
+      }
+      glEnable( GL_SCISSOR_TEST );
+      glScissor( rect[0], rect[1], rect[2], rect[3] );
+   }
+
+   // Gather visible surfaces in stacking order.  Surfaces that overlap an
+   // earlier surface start a new batch so sorting by program and texture
+   // within a batch never changes what ends up on screen.  Surfaces hidden
+   // under an opaque surface above are left out altogether.
+   gl->drawCount= 0;
+   batch= 0;
+   batchStart= 0;
+   order= 0;
+   wl_list_for_each( surface, &ctx->surfaces, link )
+   {
+      if ( !surface->textureCount || !surface->eglImage[0] || !surfaceMapped( surface ) )
+      {
+         continue;
+      }
+      if ( gl->drawCount >= MAX_DRAW_SURFACES )
+      {
+         printf("Warning: composeGL: more than %d surfaces, ignoring the rest\n", MAX_DRAW_SURFACES);
+         break;
+      }
+
+      damageClear( &visible );
+      damageAdd( &visible, surface->x, surface->y, surface->width, surface->height );
+      damageClip( &visible, appCtx->windowWidth, appCtx->windowHeight );
+      if ( damageEmpty( &visible ) || surfaceOccluded( ctx, surface, &visible ) )
+      {
+         ++culled;
+         continue;
+      }
+
+      updateSurfaceTextures( ctx, surface );
+
+      for( j= batchStart; j < gl->drawCount; ++j )
+      {
+         if ( surfacesOverlap( surface, gl->drawItems[j].surface ) )
+         {
+            ++batch;
+            batchStart= gl->drawCount;
+            break;
+         }
+      }
+
+      gl->drawItems[gl->drawCount].surface= surface;
+      gl->drawItems[gl->drawCount].program= surface->program;
+      gl->drawItems[gl->drawCount].batch= batch;
+      gl->drawItems[gl->drawCount].order= order++;
+      gl->drawItems[gl->drawCount].blend= !surfaceIsOpaque( surface );
+      bytes += (long long)surface->bufferWidth*surface->bufferHeight*gProgramSources[surface->program].bitsPerPixel/8;
+
+      if ( appCtx->damageTracking )
+      {
+         damageIntersect( &visible, &repaint );
+      }
+      area= damageArea( &visible );
+      drawnPixels += area;
+      if ( gl->drawItems[gl->drawCount].blend )
+      {
+         ++blended;
+         blendedPixels += area;
+      }
+      ++gl->drawCount;
+
+      if ( (surface->x <= 0) && (surface->y <= 0) &&
+           (surface->x+surface->width >= appCtx->windowWidth) &&
+           (surface->y+surface->height >= appCtx->windowHeight) &&
+           surfaceIsOpaque( surface ) )
+      {
+         coversOutput= true;
+      }
+   }
+   metricsLayers( ctx, gl->drawCount, culled, blended, drawnPixels, blendedPixels,
+                  appCtx->damageTracking ? damageArea( &repaint ) : (long long)appCtx->windowWidth*appCtx->windowHeight );
+
+   qsort( gl->drawItems, gl->drawCount, sizeof(DrawItem), compareDrawItems );
+
+   for( i= 0; i < gl->drawCount; ++i )
+   {
+      buildQuad( &gl->vertices[i*QUAD_FLOATS], gl->drawItems[i].surface );
+   }
+
+   if ( !coversOutput )
+   {
+      glClearColor( 0, 0, 0, 1 );
+      glClear( GL_COLOR_BUFFER_BIT );
+   }
+
+   glBindBuffer( GL_ARRAY_BUFFER, gl->vbo );
+   uploadGeometry( gl );
+
+   for( j= 0; j < MAX_TEXTURES; ++j )
+   {
+      boundTexture[j]= GL_NONE;
+   }
+
+   // Submit runs of surfaces sharing program and textures as a single draw
+   i= 0;
+   while( i < gl->drawCount )
+   {
+      DrawItem *item= &gl->drawItems[i];
+      GLProgram *program= &gl->programs[item->program];
+
+      run= 1;
+      while( (i+run < gl->drawCount) && sameDrawState( item, &gl->drawItems[i+run] ) )
+      {
+         ++run;
+      }
+
+      if ( program->prog )
+      {
+         if ( program != current )
+         {
+            useProgram( ctx, program );
+            current= program;
+         }
+         if ( item->blend != blending )
+         {
+            if ( item->blend )
+            {
+               // Client buffers hold premultiplied alpha
+               glEnable( GL_BLEND );
+               glBlendFunc( GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+            }
+            else
+            {
+               glDisable( GL_BLEND );
+            }
+            blending= item->blend;
+         }
+         for( j= 0; j < item->surface->textureCount; ++j )
+         {
+            if ( boundTexture[j] != item->surface->textureId[j] )
+            {
+               glActiveTexture(GL_TEXTURE0+j);
+               glBindTexture(GL_TEXTURE_2D, item->surface->textureId[j]);
+               boundTexture[j]= item->surface->textureId[j];
+            }
+         }
+         glDrawArrays(GL_TRIANGLES, i*QUAD_VERTICES, run*QUAD_VERTICES);
+      }
+      else
+      {
+         printf("Error: composeGL: no %s program available\n", gProgramNames[item->program]);
+      }
+
+      i += run;
+   }
+
+   glBindBuffer( GL_ARRAY_BUFFER, 0 );
+   if ( blending )
+   {
+      glDisable( GL_BLEND );
+   }
+   if ( appCtx->damageTracking )
+   {
+      glDisable( GL_SCISSOR_TEST );
+   }
+   gpuTimerEnd( ctx );
+
+   // Estimated as every visible texel read once plus the output written,
+   // traffic that direct scanout does not have
+   bytes += (appCtx->damageTracking ? damageArea( &repaint ) : (long long)appCtx->windowWidth*appCtx->windowHeight)*4;
+   metricsComposeBytes( ctx, bytes );
+
+   if ( gVerbose )
+   {
+      // glGetError can force a pipeline sync so only check it when debugging
+      GLenum glerr= glGetError();
+      if ( glerr != GL_NO_ERROR )
+      {
+         printf("Warning: composeGL: glGetError: %X\n", glerr);
+      }
+   }
+   traceSlice( "draw", traceStart, ctx->frameCount, 0 );
+
+   traceStart= traceTime();
+   if ( appCtx->damageTracking )
+   {
+      // Only this frame's changes are new to the display, whatever had to
+      // be repainted to bring an old buffer up to date
+      rect[0]= ctx->outputDamage.x0;
+      rect[1]= appCtx->windowHeight-ctx->outputDamage.y1;
+      rect[2]= ctx->outputDamage.x1-ctx->outputDamage.x0;
+      rect[3]= ctx->outputDamage.y1-ctx->outputDamage.y0;
+      swapBuffersWithDamage( appCtx, eglCtx, rect, damageEmpty( &ctx->outputDamage ) ? 0 : 1 );
+      damageEndFrame( ctx, &repaint );
+   }
+   else
+   {
+      eglSwapBuffers( eglCtx->eglDisplay, eglCtx->eglSurface );
+   }
+   traceSlice( "swap", traceStart, ctx->frameCount, 0 );
+}
+
+static EGLImageKHR createBufferImage( WaylandCtx *ctx, struct wl_resource *bufferResource, const EGLint *attrList )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   EGLImageKHR eglImage;
+
+   eglImage= appCtx->eglCreateImageKHR( ctx->eglServer.eglDisplay, EGL_NO_CONTEXT,
+                                        EGL_WAYLAND_BUFFER_WL, bufferResource,
+                                        attrList );
+   if ( eglImage )
+   {
+      __atomic_add_fetch( &gEGLImageCount, 1, __ATOMIC_RELAXED );
+   }
+
+   return eglImage;
+}
+
+// Import each plane of a YUV buffer as its own image
+static void createPlaneImages( WaylandCtx *ctx, Surface *surface, struct wl_resource *bufferResource, int planeCount )
+{
+   EGLImageKHR eglImage;
+   EGLint attrList[3];
+
+   attrList[0]= EGL_WAYLAND_PLANE_WL;
+   attrList[2]= EGL_NONE;
+   for( int i= 0; i < planeCount; ++i )
+   {
+      attrList[1]= i;
+
+      eglImage= createBufferImage( ctx, bufferResource, attrList );
+      if ( eglImage )
+      {
+         surface->eglImage[i]= eglImage;
+         if ( surface->textureId[i] != GL_NONE )
+         {
+            glDeleteTextures( 1, &surface->textureId[i] );
+         }
+         surface->textureId[i]= GL_NONE;
+      }
+   }
+   surface->textureCount= planeCount;
+}
+
+static void destroySurfaceImages( WaylandCtx *ctx, Surface *surface )
+{
+   AppCtx *appCtx= ctx->appCtx;
+
+   for( int i= 0; i < MAX_TEXTURES; ++i )
+   {
+      if ( surface->eglImage[i] )
+      {
+         appCtx->eglDestroyImageKHR( ctx->eglServer.eglDisplay, surface->eglImage[i] );
+         surface->eglImage[i]= 0;
+         __atomic_sub_fetch( &gEGLImageCount, 1, __ATOMIC_RELAXED );
+      }
+   }
+}
+
+static void surfaceDestroy(struct wl_client *client, struct wl_resource *resource)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+
+   if ( surface->surfaceNested )
+   {
+      wl_surface_destroy( surface->surfaceNested );
+      wl_display_flush( surface->ctx->upstreamDisplay );
+      surface->surfaceNested= 0;
+   }
+   // terminate display to end test once the client's main surface goes
+   if ( !surface->isSubsurface )
+   {
+      wl_display_terminate( wl_client_get_display(client) );
+   }
+   wl_resource_destroy(resource);
+}
+
+static void surfaceAttach(struct wl_client *client,
+                          struct wl_resource *resource,
+                          struct wl_resource *bufferResource, int32_t sx, int32_t sy)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+
+   pthread_mutex_lock( &surface->ctx->mutex );
+   traceInstant( "attach", surface->ctx->frameCount+1 );
+   if ( surface->attachedBufferResource != bufferResource )
+   {
+      if ( surface->ctx->scanoutSurface == surface )
+      {
+         // The detached buffer stays on the plane until the last commit's
+         // flip, which releases it
+         PlatformScanoutWait( surface->ctx->appCtx->platformCtx );
+      }
+      if ( surface->detachedBufferResource )
+      {
+         wl_list_remove(&surface->detachedBufferDestroyListener.link);
+         traceInstant( "buffer-release", surface->detachedFrame );
+         wl_buffer_send_release( surface->detachedBufferResource );
+      }
+      if ( surface->attachedBufferResource )
+      {
+         wl_list_remove(&surface->attachedBufferDestroyListener.link);
+      }
+      surface->detachedBufferResource= surface->attachedBufferResource;
+      surface->detachedFrame= surface->attachedFrame;
+      if ( surface->detachedBufferResource )
+      {
+         wl_resource_add_destroy_listener( surface->detachedBufferResource, &surface->detachedBufferDestroyListener );
+      }
+      surface->attachedBufferResource= 0;
+   }
+   if ( bufferResource )
+   {
+      if ( surface->attachedBufferResource != bufferResource )
+      {
+         surface->attachedBufferResource= bufferResource;
+         wl_resource_add_destroy_listener( surface->attachedBufferResource, &surface->attachedBufferDestroyListener );
+      }
+      surface->attachedX= sx;
+      surface->attachedY= sy;
+   }
+   pthread_mutex_unlock( &surface->ctx->mutex );
+}
+
+static void surfaceDamage(struct wl_client *, struct wl_resource *resource, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+
+   // Buffers are never scaled or transformed so surface and buffer
+   // coordinates are the same
+   pthread_mutex_lock( &surface->ctx->mutex );
+   damageAdd( &surface->pendingDamage, x, y, width, height );
+   pthread_mutex_unlock( &surface->ctx->mutex );
+}
+
+static void frameCallbackDestroy(struct wl_resource *resource)
+{
+   wl_list_remove( wl_resource_get_link(resource) );
+}
+
+static void surfaceFrame(struct wl_client *client, struct wl_resource *resource, uint32_t callback)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+   struct wl_resource *rescb;
+
+   // A client may have several callbacks pending, eg one from EGL for
+   // throttling and one of its own, and every one of them must be answered
+   rescb= wl_resource_create( client, &wl_callback_interface, 1, callback );
+   if ( rescb )
+   {
+      wl_resource_set_implementation( rescb, NULL, NULL, frameCallbackDestroy );
+      wl_list_insert( surface->ctx->frameCallbacks.prev, wl_resource_get_link(rescb) );
+   }
+   else
+   {
+      wl_resource_post_no_memory(resource);
+   }
+}
+
+static void surfaceSetOpaqueRegion(struct wl_client *, struct wl_resource *resource, struct wl_resource *regionResource)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+   WaylandCtx *ctx= surface->ctx;
+   Region *region;
+   DamageRect *r;
+   struct wl_region *upstream= 0;
+
+   pthread_mutex_lock( &ctx->mutex );
+   damageClear( &surface->pendingOpaque );
+   if ( regionResource )
+   {
+      region= (Region*)wl_resource_get_user_data(regionResource);
+      surface->pendingOpaque= region->rect;
+   }
+   surface->opaquePending= true;
+
+   if ( ctx->isRepeater && surface->surfaceNested )
+   {
+      // Pass it on so the upstream compositor can skip blending too
+      r= &surface->pendingOpaque;
+      if ( !damageEmpty( r ) )
+      {
+         upstream= wl_compositor_create_region( ctx->compositor );
+         if ( upstream )
+         {
+            wl_region_add( upstream, r->x0, r->y0, r->x1-r->x0, r->y1-r->y0 );
+         }
+      }
+      wl_surface_set_opaque_region( surface->surfaceNested, upstream );
+      if ( upstream )
+      {
+         wl_region_destroy( upstream );
+      }
+   }
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void surfaceSetInputRegion(struct wl_client *, struct wl_resource *, struct wl_resource *)
+{
+   // ignore
+}
+
+static void pushBufferToRelease( WaylandCtx *ctx, NestedBufferInfo *buffInfo )
+{
+   NestedBufferInfo *head;
+   uint64_t value= 1;
+
+   // Lock-free multi-producer push: the nested event loop is the single
+   // consumer and takes the whole list at once, so there is no ABA hazard
+   head= __atomic_load_n( &ctx->releaseQueue, __ATOMIC_RELAXED );
+   do
+   {
+      buffInfo->next= head;
+   }
+   while( !__atomic_compare_exchange_n( &ctx->releaseQueue, &head, buffInfo, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED ) );
+
+   if ( write( ctx->releaseEventFd, &value, sizeof(value) ) != sizeof(value) )
+   {
+      printf("Error: pushBufferToRelease: eventfd write failed\n");
+   }
+}
+
+static void buffer_release( void *data, struct wl_buffer *buffer )
+{
+   NestedBufferInfo *buffInfo= (NestedBufferInfo*)data;
+
+   wl_buffer_destroy( buffer );
+
+   if ( buffInfo )
+   {
+      if ( buffInfo->bufferRemote )
+      {
+         traceInstant( "upstream-release", buffInfo->frame );
+         buffInfo->releaseTime= getCurrentTimeMicro();
+         pushBufferToRelease( buffInfo->ctx, buffInfo );
+      }
+      else
+      {
+         poolFree( &buffInfo->ctx->appCtx->bufferInfoPool, buffInfo );
+      }
+   }
+}
+
+static struct wl_buffer_listener wl_buffer_listener=
+{
+   buffer_release
+};
+
+static void sendFrameCallbacks( WaylandCtx *ctx )
+{
+   struct wl_resource *rescb, *rescbNext;
+   uint32_t now;
+
+   if ( !wl_list_empty( &ctx->frameCallbacks ) )
+   {
+      now= getCurrentTimeMillis();
+      traceInstant( "frame-done", ctx->frameCount );
+      wl_resource_for_each_safe( rescb, rescbNext, &ctx->frameCallbacks )
+      {
+         wl_callback_send_done( rescb, now );
+         wl_resource_destroy( rescb );
+      }
+   }
+}
+
+// With --scanout the master puts a lone client surface straight on a
+// display plane.  Anything else, or a buffer the display can not read, goes
+// back to composition.  The plane commit does not block: the buffer it
+// replaces is released, and the frame counted as presented, at the flip.
+static bool surfaceScanout( WaylandCtx *ctx, Surface *surface, struct wl_resource *bufferResource )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   bool result= false;
+
+   if ( appCtx->directScanout && (ctx == &appCtx->master) && (wl_list_length( &ctx->surfaces ) == 1) )
+   {
+      result= PlatformScanoutBuffer( appCtx->platformCtx, bufferResource,
+                                     surface->x, surface->y, surface->width, surface->height );
+   }
+   if ( result )
+   {
+      if ( ctx->scanoutSurface != surface )
+      {
+         // Composition no longer needs the last imported buffer
+         destroySurfaceImages( ctx, surface );
+         ctx->scanoutSurface= surface;
+      }
+   }
+   else if ( ctx->scanoutSurface )
+   {
+      PlatformScanoutStop( appCtx->platformCtx );
+      ctx->scanoutSurface= 0;
+      // Nothing was drawn to the output while the plane was in use
+      ctx->damageHistoryCount= 0;
+      damageAdd( &ctx->outputDamage, 0, 0, appCtx->windowWidth, appCtx->windowHeight );
+      if ( surface->bufferWidth || surface->bufferHeight )
+      {
+         damageAdd( &surface->pendingDamage, 0, 0, surface->bufferWidth, surface->bufferHeight );
+      }
+   }
+
+   return result;
+}
+
+// A subsurface is synchronized if it or any of its ancestors is
+static bool subsurfaceIsSync( Surface *surface )
+{
+   for( ; surface && surface->isSubsurface; surface= surface->parent )
+   {
+      if ( surface->sync )
+      {
+         return true;
+      }
+   }
+   return false;
+}
+
+// Import a committed buffer for composition.  Root surfaces are stretched
+// to the window while subsurfaces are drawn at their buffer size.
+static void surfaceImportBuffer( WaylandCtx *ctx, Surface *surface, struct wl_resource *bufferResource )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   EGLImageKHR eglImage= 0;
+   EGLint value, format;
+   int bufferWidth= 0, bufferHeight= 0;
+   long long importStart, traceStep;
+
+   traceStep= traceTime();
+   importStart= getCurrentTimeMicro();
+   if (EGL_TRUE == appCtx->eglQueryWaylandBufferWL( ctx->eglServer.eglDisplay, bufferResource,
+                                                    EGL_WIDTH, &value ) )
+   {
+      bufferWidth= value;
+   }
+
+   if (EGL_TRUE == appCtx->eglQueryWaylandBufferWL( ctx->eglServer.eglDisplay, bufferResource,
+                                                    EGL_HEIGHT, &value ) )
+   {
+      bufferHeight= value;
+   }                                                        
+
+   if (EGL_TRUE == appCtx->eglQueryWaylandBufferWL( ctx->eglServer.eglDisplay, bufferResource,
+                                                    EGL_TEXTURE_FORMAT, &value ) )
+   {
+      format= value;
+   }
+
+   if ( (surface->bufferWidth != bufferWidth) || (surface->bufferHeight != bufferHeight) )
+   {
+      surface->bufferWidth= bufferWidth;
+      surface->bufferHeight= bufferHeight;
+      damageAdd( &surface->pendingDamage, 0, 0, bufferWidth, bufferHeight );
+      if ( surface->isSubsurface )
+      {
+         damageAdd( &ctx->outputDamage, surface->x, surface->y, surface->width, surface->height );
+         surface->width= bufferWidth;
+         surface->height= bufferHeight;
+      }
+   }
+
+   destroySurfaceImages( ctx, surface );
+
+   surface->hasAlpha= false;
+   switch ( format )
+   {
+      case EGL_TEXTURE_RGBA:
+         surface->hasAlpha= true;
+         // fall through
+      case EGL_TEXTURE_RGB:
+         eglImage= createBufferImage( ctx, bufferResource, NULL );
+         if ( eglImage )
+         {
+            surface->eglImage[0]= eglImage;
+            if ( surface->textureId[0] != GL_NONE )
+            {
+               glDeleteTextures( 1, &surface->textureId[0] );
+            }
+            surface->textureId[0]= GL_NONE;
+            surface->textureCount= 1;
+         }
+         surface->program= PROGRAM_RGB;
+         break;
+      
+      case EGL_TEXTURE_Y_U_V_WL:
+         createPlaneImages( ctx, surface, bufferResource, 3 );
+         surface->program= PROGRAM_YUV3;
+         break;
+       
+      case EGL_TEXTURE_Y_UV_WL:
+         createPlaneImages( ctx, surface, bufferResource, 2 );
+         surface->program= PROGRAM_YUV;
+         break;
+         
+      case EGL_TEXTURE_Y_XUXV_WL:
+         createPlaneImages( ctx, surface, bufferResource, 2 );
+         surface->program= PROGRAM_YUYV;
+         break;
+         
+      default:
+         printf("Error: surfaceImportBuffer: unknown texture format: %x\n", format );
+         break;
+   }
+   traceSlice( "egl-import", traceStep, ctx->frameCount, 0 );
+   metricsImport( ctx, surface->program, getCurrentTimeMicro()-importStart );
+
+   damageClip( &surface->pendingDamage, surface->bufferWidth, surface->bufferHeight );
+   surface->damage= surface->pendingDamage;
+   damageAddSurface( ctx, surface );
+}
+
+// Subsurface positions take effect when the parent commits, and move with it
+static void subsurfaceApplyState( WaylandCtx *ctx, Surface *parent )
+{
+   Surface *child;
+   int x, y;
+
+   wl_list_for_each( child, &ctx->surfaces, link )
+   {
+      if ( child->parent != parent )
+      {
+         continue;
+      }
+      if ( child->positionPending )
+      {
+         child->subX= child->pendingSubX;
+         child->subY= child->pendingSubY;
+         child->positionPending= false;
+      }
+      x= parent->x+child->subX;
+      y= parent->y+child->subY;
+      if ( (child->x != x) || (child->y != y) )
+      {
+         damageAdd( &ctx->outputDamage, child->x, child->y, child->width, child->height );
+         child->x= x;
+         child->y= y;
+         damageAdd( &ctx->outputDamage, child->x, child->y, child->width, child->height );
+      }
+      subsurfaceApplyState( ctx, child );
+   }
+}
+
+// Release the buffer replaced by the last attach once nothing reads it:
+// after its images have gone with the next import, or once the plane shows
+// the next buffer.  Holding it until the following attach would keep two
+// buffers from the client and starve a two buffer swapchain.
+static void surfaceReleaseDetached( Surface *surface )
+{
+   if ( surface->detachedBufferResource )
+   {
+      wl_list_remove(&surface->detachedBufferDestroyListener.link);
+      traceInstant( "buffer-release", surface->detachedFrame );
+      wl_buffer_send_release( surface->detachedBufferResource );
+      surface->detachedBufferResource= 0;
+   }
+}
+
+// Called with the master's mutex held, from its event loop or from a
+// scanout call waiting on the previous flip
+static void scanoutFlipped( void *userData, struct wl_resource *shown, struct wl_resource *released )
+{
+   WaylandCtx *ctx= (WaylandCtx*)userData;
+   Surface *surface= ctx->scanoutSurface;
+
+   // The detached buffer is the one the flip replaced, even when a change
+   // of plane took it off screen before the flip
+   if ( surface && surface->detachedBufferResource && (surface->detachedBufferResource != shown) )
+   {
+      surfaceReleaseDetached( surface );
+      wl_display_flush_clients( ctx->dispWayland );
+   }
+   metricsPresent( ctx, true );
+}
+
+static int scanoutEvent( int fd, uint32_t mask, void *data )
+{
+   WaylandCtx *ctx= (WaylandCtx*)data;
+
+   pthread_mutex_lock( &ctx->mutex );
+   PlatformDispatchEvents( ctx->appCtx->platformCtx );
+   pthread_mutex_unlock( &ctx->mutex );
+
+   return 0;
+}
+
+// A synchronized subsurface's new content is shown by its parent's next
+// commit, so nothing is composed here and the commit is not counted as a
+// frame.  The buffer is imported straight away rather than held back, which
+// costs the same and leaves the parent's commit timing only composition.
+// A desynchronized subsurface is composed at once.
+static void subsurfaceCommit( WaylandCtx *ctx, Surface *surface, struct wl_resource *bufferResource )
+{
+   AppCtx *appCtx= ctx->appCtx;
+
+   if ( bufferResource && appCtx->renderWayland )
+   {
+      surface->attachedFrame= ctx->frameCount;
+      surfaceImportBuffer( ctx, surface, bufferResource );
+      surfaceReleaseDetached( surface );
+      subsurfaceApplyState( ctx, surface );
+      if ( !subsurfaceIsSync( surface ) && !ctx->scanoutSurface )
+      {
+         composeGL( ctx );
+         sendFrameCallbacks( ctx );
+      }
+   }
+   damageClear( &surface->pendingDamage );
+}
+
+static void surfaceCommit(struct wl_client *client, struct wl_resource *resource)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+   struct wl_resource *committedBufferResource;
+   WaylandCtx *ctx= surface->ctx;
+   AppCtx *appCtx= ctx->appCtx;
+   long long traceStart, traceStep;
+
+   traceStart= traceTime();
+
+   pthread_mutex_lock( &ctx->mutex );
+
+   if ( surface->opaquePending )
+   {
+      surface->opaque= surface->pendingOpaque;
+      surface->opaquePending= false;
+   }
+
+   committedBufferResource= surface->attachedBufferResource;
+   if ( surface->isSubsurface && !ctx->isRepeater )
+   {
+      subsurfaceCommit( ctx, surface, committedBufferResource );
+   }
+   else if ( committedBufferResource )
+   {
+      ++ctx->frameCount;
+      metricsCompositorFrame( ctx );
+      surface->attachedFrame= ctx->frameCount;
+
+      if ( ctx->isRepeater )
+      {
+         struct wl_buffer *clone;
+         int bufferWidth, bufferHeight;
+
+         traceStep= traceTime();
+         clone= appCtx->remoteCloneBufferFromResource( appCtx->nested.dispWayland,
+                                                       committedBufferResource,
+                                                       appCtx->nested.upstreamDisplay,
+                                                       &bufferWidth,
+                                                       &bufferHeight );
+         if ( clone )
+         {
+            NestedBufferInfo *buffInfo= (NestedBufferInfo*)poolAlloc( &appCtx->bufferInfoPool );
+            if ( buffInfo )
+            {
+               buffInfo->ctx= ctx;
+               buffInfo->surface= surface->surfaceNested;
+               buffInfo->bufferRemote= committedBufferResource;
+               buffInfo->frame= ctx->frameCount;
+               wl_buffer_add_listener( clone, &wl_buffer_listener, buffInfo );
+            }
+
+            wl_surface_attach( surface->surfaceNested, clone, 0, 0 );
+            if ( appCtx->damageTracking && !damageEmpty( &surface->pendingDamage ) )
+            {
+               DamageRect *d= &surface->pendingDamage;
+
+               damageClip( d, bufferWidth, bufferHeight );
+               wl_surface_damage( surface->surfaceNested, d->x0, d->y0, d->x1-d->x0, d->y1-d->y0 );
+            }
+            else
+            {
+               wl_surface_damage( surface->surfaceNested, 0, 0, bufferWidth, bufferHeight);
+            }
+            wl_surface_commit( surface->surfaceNested );
+            wl_display_flush( appCtx->nested.upstreamDisplay );
+
+            wl_list_remove(&surface->attachedBufferDestroyListener.link);
+            surface->attachedBufferResource= 0;
+         }
+         traceSlice( "forward", traceStep, ctx->frameCount, 0 );
+      }
+      else
+      if ( appCtx->renderWayland && surfaceScanout( ctx, surface, committedBufferResource ) )
+      {
+         if ( appCtx->decoupleFrames )
+         {
+            sendFrameCallbacks( ctx );
+            wl_client_flush( client );
+         }
+      }
+      else
+      if ( appCtx->renderWayland )
+      {
+         surfaceImportBuffer( ctx, surface, committedBufferResource );
+         subsurfaceApplyState( ctx, surface );
+
+         if ( appCtx->decoupleFrames )
+         {
+            // The buffer is imported, so let the client start its next frame
+            // now rather than after this compositor's own swap
+            sendFrameCallbacks( ctx );
+            wl_client_flush( client );
+         }
+
+         composeGL( ctx );
+         metricsPresent( ctx, false );
+         surfaceReleaseDetached( surface );
+      }
+      damageClear( &surface->pendingDamage );
+
+      if ( ctx->soak )
+      {
+         soakFrame( ctx );
+      }
+
+      sendFrameCallbacks( ctx );
+
+      traceSlice( "commit", traceStart, ctx->frameCount, 't' );
+   }
+
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void surfaceSetBufferTransform(struct wl_client *, struct wl_resource *, int)
+{
+   // ignore
+}
+
+static void surfaceSetBufferScale(struct wl_client *, struct wl_resource *, int32_t)
+{
+   // ignore
+}
+
+#if ( (WAYLAND_VERSION_MAJOR >= 1) && (WAYLAND_VERSION_MINOR >= 18) )
+static void surfaceDamageBuffer(struct wl_client *, struct wl_resource *resource, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+
+   pthread_mutex_lock( &surface->ctx->mutex );
+   damageAdd( &surface->pendingDamage, x, y, width, height );
+   pthread_mutex_unlock( &surface->ctx->mutex );
+}
+#endif
+
+static const struct wl_surface_interface surface_interface= 
+{
+   surfaceDestroy,
+   surfaceAttach,
+   surfaceDamage,
+   surfaceFrame,
+   surfaceSetOpaqueRegion,
+   surfaceSetInputRegion,
+   surfaceCommit,
+   surfaceSetBufferTransform,
+   surfaceSetBufferScale,
+   #if ( (WAYLAND_VERSION_MAJOR >= 1) && (WAYLAND_VERSION_MINOR >= 18) )
+   surfaceDamageBuffer
+   #endif
+};
+
+static void attachedBufferDestroyCallback(struct wl_listener *listener, void *data )
+{
+   Surface *surface= wl_container_of(listener, surface, attachedBufferDestroyListener );
+   surface->attachedBufferResource= 0;
+}
+
+static void detachedBufferDestroyCallback(struct wl_listener *listener, void *data )
+{
+   Surface *surface= wl_container_of(listener, surface, detachedBufferDestroyListener );
+   surface->detachedBufferResource= 0;
+}
+
+static void destroySurfaceCallback(struct wl_resource *resource)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+
+   WaylandCtx *ctx= surface->ctx;
+
+   pthread_mutex_lock( &ctx->mutex );
+
+   surface->resource= NULL;
+
+   if ( --surface->refCount <= 0 )
+   {
+      Surface *child;
+
+      // Whatever the surface covered is exposed on the next composition
+      damageAdd( &ctx->outputDamage, surface->x, surface->y, surface->width, surface->height );
+      if ( surface->subsurfaceResource )
+      {
+         wl_resource_set_user_data( surface->subsurfaceResource, 0 );
+         surface->subsurfaceResource= 0;
+      }
+      // Children are unmapped along with their parent
+      wl_list_for_each( child, &ctx->surfaces, link )
+      {
+         if ( child->parent == surface )
+         {
+            damageAdd( &ctx->outputDamage, child->x, child->y, child->width, child->height );
+            child->parent= 0;
+         }
+      }
+      if ( ctx->scanoutSurface == surface )
+      {
+         // Off the plane before its buffers are released
+         PlatformScanoutStop( ctx->appCtx->platformCtx );
+         ctx->scanoutSurface= 0;
+         ctx->damageHistoryCount= 0;
+      }
+      if ( surface->attachedBufferResource || surface->detachedBufferResource )
+      {
+         if ( surface->detachedBufferResource )
+         {
+            wl_list_remove(&surface->detachedBufferDestroyListener.link);
+            wl_buffer_send_release( surface->detachedBufferResource );
+         }
+         if ( surface->attachedBufferResource )
+         {
+            wl_list_remove(&surface->attachedBufferDestroyListener.link);
+            wl_buffer_send_release( surface->attachedBufferResource );
+         }
+         surface->attachedBufferResource= 0;
+         surface->detachedBufferResource= 0;
+      }
+      destroySurfaceImages( ctx, surface );
+      if ( eglGetCurrentContext() != EGL_NO_CONTEXT )
+      {
+         for( int i= 0; i < MAX_TEXTURES; ++i )
+         {
+            if ( surface->textureId[i] != GL_NONE )
+            {
+               glDeleteTextures( 1, &surface->textureId[i] );
+               surface->textureId[i]= GL_NONE;
+            }
+         }
+      }
+      wl_list_remove( &surface->link );
+      poolFree( &ctx->appCtx->surfacePool, surface );
+   }
+
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void compositorCreateSurface( struct wl_client *client, struct wl_resource *resource, uint32_t id)
+{
+   WaylandCtx *ctx= (WaylandCtx*)wl_resource_get_user_data(resource);
+   Surface *surface;
+   
+   pthread_mutex_lock( &ctx->mutex );
+
+   surface= (Surface*)poolAlloc( &ctx->appCtx->surfacePool );
+   if (!surface) 
+   {
+      wl_resource_post_no_memory(resource);
+      pthread_mutex_unlock( &ctx->mutex );
+      return;
+   }
+
+   surface->ctx= ctx;
+   surface->refCount= 1;
+   surface->x= 0;
+   surface->y= 0;
+   surface->width= ctx->appCtx->windowWidth;
+   surface->height= ctx->appCtx->windowHeight;
+   surface->attachedBufferDestroyListener.notify= attachedBufferDestroyCallback;
+   surface->detachedBufferDestroyListener.notify= detachedBufferDestroyCallback;
+
+   surface->resource= wl_resource_create(client, &wl_surface_interface, MIN(3,wl_resource_get_version(resource)), id);
+   if (!surface->resource)
+   {
+      poolFree( &ctx->appCtx->surfacePool, surface );
+      wl_resource_post_no_memory(resource);
+      pthread_mutex_unlock( &ctx->mutex );
+      return;
+   }
+
+   wl_resource_set_implementation(surface->resource, &surface_interface, surface, destroySurfaceCallback);
+
+   if ( ctx->isRepeater )
+   {
+      surface->surfaceNested= wl_compositor_create_surface(ctx->compositor);
+      wl_display_flush( ctx->upstreamDisplay );
+      if ( !surface->surfaceNested )
+      {
+         poolFree( &ctx->appCtx->surfacePool, surface );
+         wl_resource_post_no_memory(resource);
+         pthread_mutex_unlock( &ctx->mutex );
+         return;
+      }
+   }
+
+   wl_list_insert( ctx->surfaces.prev, &surface->link );
+
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void regionDestroy(struct wl_client *, struct wl_resource *resource)
+{
+   wl_resource_destroy(resource);
+}
+
+static void regionAdd(struct wl_client *, struct wl_resource *resource, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+   Region *region= (Region*)wl_resource_get_user_data(resource);
+   DamageRect r;
+
+   damageClear( &r );
+   damageAdd( &r, x, y, width, height );
+   if ( damageArea( &r ) > damageArea( &region->rect ) )
+   {
+      region->rect= r;
+   }
+}
+
+static void regionSubtract(struct wl_client *, struct wl_resource *resource, int32_t x, int32_t y, int32_t width, int32_t height)
+{
+   Region *region= (Region*)wl_resource_get_user_data(resource);
+   DamageRect *r= &region->rect;
+
+   // Any overlap drops the whole rectangle rather than splitting it
+   if ( (width > 0) && (height > 0) &&
+        (x < r->x1) && (r->x0 < (long long)x+width) &&
+        (y < r->y1) && (r->y0 < (long long)y+height) )
+   {
+      damageClear( r );
+   }
+}
+
+static const struct wl_region_interface region_interface=
+{
+   regionDestroy,
+   regionAdd,
+   regionSubtract
+};
+
+static void destroyRegionCallback(struct wl_resource *resource)
+{
+   Region *region= (Region*)wl_resource_get_user_data(resource);
+
+   free( region );
+}
+
+static void compositorCreateRegion(struct wl_client *client, struct wl_resource *resource, uint32_t id)
+{
+   Region *region;
+
+   region= (Region*)calloc( 1, sizeof(Region) );
+   if ( !region )
+   {
+      wl_resource_post_no_memory(resource);
+      return;
+   }
+
+   region->resource= wl_resource_create(client, &wl_region_interface, 1, id);
+   if ( !region->resource )
+   {
+      free( region );
+      wl_resource_post_no_memory(resource);
+      return;
+   }
+
+   wl_resource_set_implementation(region->resource, &region_interface, region, destroyRegionCallback);
+}
+
+static const struct wl_compositor_interface compositor_interface= 
+{
+   compositorCreateSurface,
+   compositorCreateRegion
+};
+
+static void compositorBind( struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+   WaylandCtx *ctx= (WaylandCtx*)data;
+   struct wl_resource *resource;
+
+   resource= wl_resource_create(client, &wl_compositor_interface, MIN(3,version), id);
+   if (!resource)
+   {
+      wl_client_post_no_memory(client);
+   }
+   else
+   {
+      wl_resource_set_implementation(resource, &compositor_interface, ctx, 0);
+   }
+}
+
+static void subsurfaceDestroy(struct wl_client *, struct wl_resource *resource)
+{
+   wl_resource_destroy(resource);
+}
+
+static void subsurfaceSetPosition(struct wl_client *, struct wl_resource *resource, int32_t x, int32_t y)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+
+   if ( surface )
+   {
+      pthread_mutex_lock( &surface->ctx->mutex );
+      surface->pendingSubX= x;
+      surface->pendingSubY= y;
+      surface->positionPending= true;
+      pthread_mutex_unlock( &surface->ctx->mutex );
+   }
+}
+
+// Restacking is applied at once rather than with the parent's next commit.
+// Only the surface itself moves, not any children of its own.
+static void subsurfaceRestack( struct wl_resource *resource, struct wl_resource *siblingResource, bool above )
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+   Surface *sibling= (Surface*)wl_resource_get_user_data(siblingResource);
+   WaylandCtx *ctx;
+
+   if ( !surface || !surface->parent )
+   {
+      return;
+   }
+   if ( (sibling == surface) ||
+        ((sibling != surface->parent) && (!sibling->isSubsurface || (sibling->parent != surface->parent))) )
+   {
+      wl_resource_post_error( resource, WL_SUBSURFACE_ERROR_BAD_SURFACE, "surface is not the parent or a sibling" );
+      return;
+   }
+
+   ctx= surface->ctx;
+   pthread_mutex_lock( &ctx->mutex );
+   wl_list_remove( &surface->link );
+   wl_list_insert( above ? &sibling->link : sibling->link.prev, &surface->link );
+   damageAdd( &ctx->outputDamage, surface->x, surface->y, surface->width, surface->height );
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static void subsurfacePlaceAbove(struct wl_client *, struct wl_resource *resource, struct wl_resource *siblingResource)
+{
+   subsurfaceRestack( resource, siblingResource, true );
+}
+
+static void subsurfacePlaceBelow(struct wl_client *, struct wl_resource *resource, struct wl_resource *siblingResource)
+{
+   subsurfaceRestack( resource, siblingResource, false );
+}
+
+static void subsurfaceSetSync(struct wl_client *, struct wl_resource *resource)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+
+   if ( surface )
+   {
+      surface->sync= true;
+   }
+}
+
+static void subsurfaceSetDesync(struct wl_client *, struct wl_resource *resource)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+
+   // Nothing is cached for a synchronized subsurface so there is no state
+   // to apply here
+   if ( surface )
+   {
+      surface->sync= false;
+   }
+}
+
+static const struct wl_subsurface_interface subsurface_interface=
+{
+   subsurfaceDestroy,
+   subsurfaceSetPosition,
+   subsurfacePlaceAbove,
+   subsurfacePlaceBelow,
+   subsurfaceSetSync,
+   subsurfaceSetDesync
+};
+
+static void destroySubsurfaceCallback(struct wl_resource *resource)
+{
+   Surface *surface= (Surface*)wl_resource_get_user_data(resource);
+
+   // The surface stays a subsurface but is unmapped until given a new parent
+   if ( surface )
+   {
+      pthread_mutex_lock( &surface->ctx->mutex );
+      damageAdd( &surface->ctx->outputDamage, surface->x, surface->y, surface->width, surface->height );
+      surface->parent= 0;
+      surface->subsurfaceResource= 0;
+      pthread_mutex_unlock( &surface->ctx->mutex );
+   }
+}
+
+static void subcompositorDestroy(struct wl_client *, struct wl_resource *resource)
+{
+   wl_resource_destroy(resource);
+}
+
+static void subcompositorGetSubsurface(struct wl_client *client, struct wl_resource *resource, uint32_t id,
+                                       struct wl_resource *surfaceResource, struct wl_resource *parentResource)
+{
+   WaylandCtx *ctx= (WaylandCtx*)wl_resource_get_user_data(resource);
+   Surface *surface= (Surface*)wl_resource_get_user_data(surfaceResource);
+   Surface *parent= (Surface*)wl_resource_get_user_data(parentResource);
+   Surface *ancestor;
+   struct wl_resource *subsurfaceResource;
+
+   if ( surface->subsurfaceResource )
+   {
+      wl_resource_post_error( resource, WL_SUBCOMPOSITOR_ERROR_BAD_SURFACE, "surface is already a subsurface" );
+      return;
+   }
+   for( ancestor= parent; ancestor; ancestor= ancestor->parent )
+   {
+      if ( ancestor == surface )
+      {
+         wl_resource_post_error( resource, WL_SUBCOMPOSITOR_ERROR_BAD_SURFACE, "surface is an ancestor of its parent" );
+         return;
+      }
+   }
+
+   pthread_mutex_lock( &ctx->mutex );
+
+   subsurfaceResource= wl_resource_create(client, &wl_subsurface_interface, 1, id);
+   if ( !subsurfaceResource )
+   {
+      wl_resource_post_no_memory(resource);
+      pthread_mutex_unlock( &ctx->mutex );
+      return;
+   }
+   wl_resource_set_implementation(subsurfaceResource, &subsurface_interface, surface, destroySubsurfaceCallback);
+
+   surface->subsurfaceResource= subsurfaceResource;
+   surface->isSubsurface= true;
+   surface->parent= parent;
+   surface->sync= true;
+   surface->positionPending= false;
+   surface->subX= 0;
+   surface->subY= 0;
+   surface->x= parent->x;
+   surface->y= parent->y;
+   surface->width= surface->bufferWidth;
+   surface->height= surface->bufferHeight;
+
+   // New subsurfaces go on top of the stack
+   wl_list_remove( &surface->link );
+   wl_list_insert( ctx->surfaces.prev, &surface->link );
+
+   pthread_mutex_unlock( &ctx->mutex );
+}
+
+static const struct wl_subcompositor_interface subcompositor_interface=
+{
+   subcompositorDestroy,
+   subcompositorGetSubsurface
+};
+
+static void subcompositorBind( struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+   WaylandCtx *ctx= (WaylandCtx*)data;
+   struct wl_resource *resource;
+
+   resource= wl_resource_create(client, &wl_subcompositor_interface, 1, id);
+   if (!resource)
+   {
+      wl_client_post_no_memory(client);
+   }
+   else
+   {
+      wl_resource_set_implementation(resource, &subcompositor_interface, ctx, 0);
+   }
+}
+
+// waymetric_control is a private global through which the client marks the
+// start of each pacing step's measured frames.  Its requests arrive in order
+// with the client's surface requests, so the mark applies to the next commit.
+#define WAYMETRIC_CONTROL_MARK_STEP (0)
+
+static const struct wl_interface *gControlTypes[]=
+{
+   NULL
+};
+
+static const struct wl_message gControlRequests[]=
+{
+   { "mark_step", "", gControlTypes }
+};
+
+static const struct wl_interface gControlInterface=
+{
+   "waymetric_control", 1,
+   1, gControlRequests,
+   0, NULL
+};
+
+typedef struct _ControlInterface
+{
+   void (*markStep)( struct wl_client *client, struct wl_resource *resource );
+} ControlInterface;
+
+static void controlMarkStep( struct wl_client *, struct wl_resource *resource )
+{
+   WaylandCtx *ctx= (WaylandCtx*)wl_resource_get_user_data(resource);
+
+   // Pass it upstream so the master sees the same boundaries
+   ctx->stepMarkPending= true;
+   if ( ctx->upstreamDisplay && ctx->control )
+   {
+      wl_proxy_marshal( ctx->control, WAYMETRIC_CONTROL_MARK_STEP );
+   }
+}
+
+static const ControlInterface control_interface=
+{
+   controlMarkStep
+};
+
+static void controlBind( struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+   WaylandCtx *ctx= (WaylandCtx*)data;
+   struct wl_resource *resource;
+
+   resource= wl_resource_create(client, &gControlInterface, 1, id);
+   if (!resource)
+   {
+      wl_client_post_no_memory(client);
+   }
+   else
+   {
+      wl_resource_set_implementation(resource, &control_interface, ctx, 0);
+   }
+}
+
+static bool initWayland( WaylandCtx *ctx, const char *displayName )
+{
+   bool result= false;
+   AppCtx *appCtx= ctx->appCtx;
+
+   wl_list_init( &ctx->surfaces );
+   wl_list_init( &ctx->frameCallbacks );
+
+   ctx->dispWayland= wl_display_create();
+   if ( !ctx->dispWayland )
+   {
+      printf("Error: initWayland: wl_display_create failed\n");
+      goto exit;
+   }
+
+   protocolStatsInit( ctx );
+
+   if (!wl_global_create(ctx->dispWayland, &wl_compositor_interface, 3, ctx, compositorBind))
+   {
+      printf("Error: initWayland: failed to create compositor interface\n");
+      goto exit;
+   }
+
+   if (!wl_global_create(ctx->dispWayland, &wl_subcompositor_interface, 1, ctx, subcompositorBind))
+   {
+      printf("Error: initWayland: failed to create subcompositor interface\n");
+      goto exit;
+   }
+
+   if (!wl_global_create(ctx->dispWayland, &gControlInterface, 1, ctx, controlBind))
+   {
+      printf("Error: initWayland: failed to create control interface\n");
+      goto exit;
+   }
+
+   if ( wl_display_add_socket( ctx->dispWayland, displayName ) )
+   {
+      printf("Error: initWayland: failed to add socket\n");
+      goto exit;
+   }
+
+   if ( !appCtx->eglBindWaylandDisplayWL( ctx->eglServer.eglDisplay, ctx->dispWayland ) )
+   {
+      printf("Error: initWayland: failed to bind EGL to wayland display\n");
+      goto exit;
+   }
+   ctx->eglServer.displayBound= true;
+
+   result= true;
+
+exit:
+   return result;
+}
+
+static void termWayland( WaylandCtx *ctx )
+{
+   AppCtx *appCtx= ctx->appCtx;
+   if ( ctx->dispWayland )
+   {
+      if ( ctx->eglServer.displayBound )
+      {
+         appCtx->eglUnbindWaylandDisplayWL( ctx->eglServer.eglDisplay, ctx->dispWayland );
+         ctx->eglServer.displayBound= false;
+      }
+
+      protocolStatsTerm( ctx );
+
+      wl_display_destroy(ctx->dispWayland);
+      ctx->dispWayland= 0;
+   }
+}
+
+static struct wl_display *waylandConnect( const char *name )
+{
+   struct wl_display *display= 0;
+   long long deadline;
+
+   // The compositor's socket normally exists before its clients are started,
+   // but allow a short grace period for a slow start rather than failing
+   deadline= getCurrentTimeMicro()+WAYLAND_CONNECT_TIMEOUT_US;
+   for( ; ; )
+   {
+      display= wl_display_connect( name );
+      if ( display || (getCurrentTimeMicro() >= deadline) )
+      {
+         break;
+      }
+      usleep( 5000 );
+   }
+
+   return display;
+}
+
+// Round trip on a private queue so it is safe while another thread is
+// dispatching the default queue, as the repeater's dispatch thread does
+static void waylandSync( struct wl_display *display )
+{
+   struct wl_event_queue *queue;
+
+   queue= wl_display_create_queue( display );
+   if ( queue )
+   {
+      wl_display_roundtrip_queue( display, queue );
+      wl_event_queue_destroy( queue );
+   }
+}
+
+// wl_display_run returns as soon as the client destroys its surface.  Keep
+// dispatching until the child process has exited so its final requests and
+// round trip are answered rather than lost when it disconnects.
+static void waylandDrainUntilExit( WaylandCtx *ctx, pthread_t threadId )
+{
+   struct wl_event_loop *loop= wl_display_get_event_loop( ctx->dispWayland );
+
+   while( __atomic_load_n( &ctx->childActive, __ATOMIC_ACQUIRE ) )
+   {
+      wl_display_flush_clients( ctx->dispWayland );
+      wl_event_loop_dispatch( loop, 10 );
+   }
+   wl_display_flush_clients( ctx->dispWayland );
+
+   pthread_join( threadId, NULL );
+}
+
+// Mesa's wl_drm protocol, which EGL_WL_bind_wayland_display puts on the
+// compositor's display.  Defined here rather than generated as the video
+// and swapchain clients only need prime buffers from it.
+#define WL_DRM_CREATE_PRIME_BUFFER (3)
+#define WL_DRM_CAPABILITY_PRIME (1)
+
+#define VIDEO_FOURCC(a,b,c,d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+static const uint32_t gVideoFourcc[VIDEO_FORMAT_COUNT]=
+{
+   0,
+   VIDEO_FOURCC('N','V','1','2'),
+   VIDEO_FOURCC('Y','U','1','2'),
+   VIDEO_FOURCC('Y','U','Y','V')
+};
+
+// What the --client-buffers swapchain renders into
+#define CLIENT_BUFFER_FOURCC VIDEO_FOURCC('X','R','2','4')
+
+static const struct wl_interface *gDrmTypes[]=
+{
+   &wl_buffer_interface,
+   NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+};
+
+static const struct wl_message gDrmRequests[]=
+{
+   { "authenticate", "u", gDrmTypes+1 },
+   { "create_buffer", "nuiiuu", gDrmTypes },
+   { "create_planar_buffer", "nuiiuiiiiii", gDrmTypes },
+   { "create_prime_buffer", "2nhiiuiiiiii", gDrmTypes }
+};
+
+static const struct wl_message gDrmEvents[]=
+{
+   { "device", "s", gDrmTypes+1 },
+   { "format", "u", gDrmTypes+1 },
+   { "authenticated", "", gDrmTypes+1 },
+   { "capabilities", "u", gDrmTypes+1 }
+};
+
+static const struct wl_interface gDrmInterface=
+{
+   "wl_drm", 2,
+   4, gDrmRequests,
+   4, gDrmEvents
+};
+
+typedef struct _DrmListener
+{
+   void (*device)( void *data, struct wl_proxy *drm, const char *name );
+   void (*format)( void *data, struct wl_proxy *drm, uint32_t format );
+   void (*authenticated)( void *data, struct wl_proxy *drm );
+   void (*capabilities)( void *data, struct wl_proxy *drm, uint32_t value );
+} DrmListener;
+
+#define VIDEO_BUFFER_COUNT (4)
+
+typedef struct _VideoBuffer
+{
+   PlatformLinearBuffer mem;
+   struct wl_buffer *buffer;
+   bool busy;
+} VideoBuffer;
+
+typedef struct _Swapchain Swapchain;
+
+// A commit's frame callback.  With a swap interval of 0 a buffer can be
+// committed again before its last frame is done, so the commit time lives
+// with the callback rather than the buffer.
+typedef struct _SwapchainFrame
+{
+   struct _SwapchainFrame *next;
+   Swapchain *chain;
+   struct wl_callback *callback;
+   long long commitTime;
+   unsigned int seq;
+} SwapchainFrame;
+
+// A buffer of the --client-buffers swapchain: a dma-buf the client renders
+// into through an EGLImage backed framebuffer and shares with wl_drm
+typedef struct _ClientBuffer
+{
+   Swapchain *chain;
+   PlatformLinearBuffer mem;
+   struct wl_buffer *buffer;
+   EGLImageKHR eglImage;
+   GLuint texture;
+   GLuint fbo;
+   bool busy;
+   unsigned int frameSeq;
+   int lastFrame;
+} ClientBuffer;
+
+struct _Swapchain
+{
+   ClientBuffer buffers[MAX_CLIENT_BUFFERS];
+   int count;
+   SwapchainFrame *frames;
+   unsigned int commitSeq;
+   unsigned int doneSeq;
+   long long latencyTotal;
+   int latencyCount;
+};
+
+namespace waylandClient
+{
+static void drmDevice( void *, struct wl_proxy *, const char * )
+{
+   // ignore
+}
+
+static void drmFormat( void *data, struct wl_proxy *, uint32_t format )
+{
+   WaylandCtx *ctx = (WaylandCtx*)data;
+
+   for( int i= VIDEO_FORMAT_NONE+1; i < VIDEO_FORMAT_COUNT; ++i )
+   {
+      if ( format == gVideoFourcc[i] )
+      {
+         ctx->drmFormats |= (1 << i);
+      }
+   }
+   if ( format == CLIENT_BUFFER_FOURCC )
+   {
+      ctx->drmXrgb= true;
+   }
+}
+
+static void drmAuthenticated( void *, struct wl_proxy * )
+{
+   // ignore
+}
+
+static void drmCapabilities( void *data, struct wl_proxy *, uint32_t value )
+{
+   WaylandCtx *ctx = (WaylandCtx*)data;
+
+   ctx->drmPrime= ((value & WL_DRM_CAPABILITY_PRIME) != 0);
+}
+
+static const DrmListener drmListener=
+{
+   drmDevice,
+   drmFormat,
+   drmAuthenticated,
+   drmCapabilities
+};
+
+static void registryAdd(void *data,
+                        struct wl_registry *registry, uint32_t id,
+                        const char *interface, uint32_t version)
+{
+   WaylandCtx *ctx = (WaylandCtx*)data;
+   int len;
+
+   len= strlen(interface);
+   if ( (len==13) && !strncmp(interface, "wl_compositor", len) ) {
+      ctx->compositor= (struct wl_compositor*)wl_registry_bind(registry, id, &wl_compositor_interface, 1);
+   }
+   else if ( (len==16) && !strncmp(interface, "wl_subcompositor", len) ) {
+      ctx->subcompositor= (struct wl_subcompositor*)wl_registry_bind(registry, id, &wl_subcompositor_interface, 1);
+   }
+   else if ( (len==17) && !strncmp(interface, "waymetric_control", len) ) {
+      ctx->control= (struct wl_proxy*)wl_registry_bind(registry, id, &gControlInterface, 1);
+   }
+   else if ( (len==6) && !strncmp(interface, "wl_drm", len) && (version >= 2) ) {
+      ctx->drm= (struct wl_proxy*)wl_registry_bind(registry, id, &gDrmInterface, 2);
+      if ( ctx->drm )
+      {
+         wl_proxy_add_listener( ctx->drm, (void (**)(void))&drmListener, ctx );
+      }
+   }
+}
+
+static void registryRemove(void *, struct wl_registry *, uint32_t)
+{
+   // ignore
+}
+
+static const struct wl_registry_listener registryListener=
+{
+   registryAdd,
+   registryRemove
+};
+
+static void frameCallbackDone( void *data, struct wl_callback *callback, uint32_t time )
+{
+   bool *done= (bool*)data;
+
+   *done= true;
+   wl_callback_destroy( callback );
+}
+
+static const struct wl_callback_listener frameCallbackListener=
+{
+   frameCallbackDone
+};
+
+static void videoBufferRelease( void *data, struct wl_buffer *buffer )
+{
+   VideoBuffer *videoBuffer= (VideoBuffer*)data;
+
+   videoBuffer->busy= false;
+}
+
+static const struct wl_buffer_listener videoBufferListener=
+{
+   videoBufferRelease
+};
+
+static void clientBufferRelease( void *data, struct wl_buffer *buffer )
+{
+   ClientBuffer *clientBuffer= (ClientBuffer*)data;
+
+   clientBuffer->busy= false;
+}
+
+static const struct wl_buffer_listener clientBufferListener=
+{
+   clientBufferRelease
+};
+
+// Commit to frame done for a swapchain frame
+static void clientBufferFrameDone( void *data, struct wl_callback *callback, uint32_t time )
+{
+   SwapchainFrame *frame= (SwapchainFrame*)data;
+   Swapchain *chain= frame->chain;
+   SwapchainFrame **link;
+
+   chain->latencyTotal += getCurrentTimeMicro()-frame->commitTime;
+   ++chain->latencyCount;
+   // Frame callbacks are done in commit order
+   if ( frame->seq > chain->doneSeq )
+   {
+      chain->doneSeq= frame->seq;
+   }
+   for( link= &chain->frames; *link; link= &(*link)->next )
+   {
+      if ( *link == frame )
+      {
+         *link= frame->next;
+         break;
+      }
+   }
+   wl_callback_destroy( callback );
+   free( frame );
+}
+
+static const struct wl_callback_listener clientBufferFrameListener=
+{
+   clientBufferFrameDone
+};
+} // namespace waylandClient
+
+// Tell the compositors that the next commit starts a pacing step's measured
+// frames
+static void clientMarkStep( WaylandCtx *ctx )
+{
+   if ( ctx->control )
+   {
+      wl_proxy_marshal( ctx->control, WAYMETRIC_CONTROL_MARK_STEP );
+   }
+}
+
+// EGL configs carry alpha but nothing here draws translucent pixels unless
+// asked to, so let the compositor skip blending the surface
+static void setOpaqueRegion( WaylandCtx *ctx, struct wl_surface *surface, int width, int height )
+{
+   struct wl_region *region;
+
+   region= wl_compositor_create_region( ctx->compositor );
+   if ( region )
+   {
+      wl_region_add( region, 0, 0, width, height );
+      wl_surface_set_opaque_region( surface, region );
+      wl_region_destroy( region );
+   }
+}
+
+// Swap and wait for the compositor's frame callback, which is only sent once
+// the surface is mapped and the frame composed
+static bool presentAndWait( WaylandCtx *ctx )
+{
+   struct wl_callback *callback;
+   bool done= false;
+
+   callback= wl_surface_frame( ctx->surface );
+   if ( !callback )
+   {
+      printf("Error: presentAndWait: wl_surface_frame failed\n");
+      return false;
+   }
+   wl_callback_add_listener( callback, &waylandClient::frameCallbackListener, &done );
+
+   eglSwapBuffers( ctx->eglClient.eglDisplay, ctx->eglClient.eglSurface );
+
+   while( !done )
+   {
+      if ( wl_display_dispatch( ctx->upstreamDisplay ) == -1 )
+      {
+         printf("Error: presentAndWait: lost connection to compositor\n");
+         break;
+      }
+   }
+
+   return done;
+}
+
+// The centred box --damage-region redraws, in GL coordinates
+static void clientDamageRect( AppCtx *ctx, EGLint *rect )
+{
+   rect[2]= (ctx->damageWidth < ctx->windowWidth) ? ctx->damageWidth : ctx->windowWidth;
+   rect[3]= (ctx->damageHeight < ctx->windowHeight) ? ctx->damageHeight : ctx->windowHeight;
+   rect[0]= (ctx->windowWidth-rect[2])/2;
+   rect[1]= (ctx->windowHeight-rect[3])/2;
+}
+
+// Redraw only a centred box.  The rest of the buffer is unchanged from
+// frame to frame so it is only cleared when the buffer's contents are unknown.
+// Returns the buffer's age.
+static int clientDrawDamageRegion( AppCtx *ctx, GLfloat r, GLfloat g, GLfloat b, EGLint *rect )
+{
+   EGLCtx *eglCtx= &ctx->client.eglClient;
+   EGLint age= 0;
+
+   clientDamageRect( ctx, rect );
+
+   if ( eglCtx->haveBufferAge )
+   {
+      eglQuerySurface( eglCtx->eglDisplay, eglCtx->eglSurface, EGL_BUFFER_AGE_EXT, &age );
+   }
+   if ( age <= 0 )
+   {
+      glClearColor( 0, 0, 0, 1 );
+      glClear( GL_COLOR_BUFFER_BIT );
+   }
+   else if ( eglCtx->eglSetDamageRegion )
+   {
+      eglCtx->eglSetDamageRegion( eglCtx->eglDisplay, eglCtx->eglSurface, rect, 1 );
+   }
+
+   glEnable( GL_SCISSOR_TEST );
+   glScissor( rect[0], rect[1], rect[2], rect[3] );
+   glClearColor( r, g, b, 1 );
+   glClear( GL_COLOR_BUFFER_BIT );
+   glDisable( GL_SCISSOR_TEST );
+
+   return age;
+}
+
+static void countBufferAge( int *ages, int age )
+{
+   if ( age < 0 )
+   {
+      age= 0;
+   }
+   if ( age >= BUFFER_AGE_BUCKETS )
+   {
+      age= BUFFER_AGE_BUCKETS-1;
+   }
+   ++ages[age];
+}
+
+// How old the buffers drawn into were.  The steady age is the number of
+// buffers the swapchain cycles through.
+static void reportBufferAges( AppCtx *ctx, const char *name, int step, const int *ages )
+{
+   long long ageTotal= 0;
+   int frames= 0, known= 0;
+
+   for( int i= 0; i < BUFFER_AGE_BUCKETS; ++i )
+   {
+      frames += ages[i];
+      if ( i > 0 )
+      {
+         known += ages[i];
+         ageTotal += (long long)i*ages[i];
+      }
+   }
+   if ( frames == 0 )
+   {
+      return;
+   }
+   fprintf(ctx->pReport, "%s buffer age: 0: %d 1: %d 2: %d 3: %d 4+: %d\n",
+           name, ages[0], ages[1], ages[2], ages[3], ages[4] );
+   resultValue( ctx, name, step, "buffer_age", known ? (double)ageTotal/known : 0.0 );
+   resultValue( ctx, name, step, "age_unknown_pct", 100.0*ages[0]/frames );
+}
+
+// Handle compositor events, such as buffer releases, until the given time
+static bool clientDispatchUntil( WaylandCtx *ctx, long long until )
+{
+   struct wl_display *display= ctx->upstreamDisplay;
+   struct pollfd pfd;
+   long long now;
+   int rc, timeout;
+
+   for( ; ; )
+   {
+      while( wl_display_prepare_read( display ) != 0 )
+      {
+         wl_display_dispatch_pending( display );
+      }
+      wl_display_flush( display );
+
+      now= getCurrentTimeMicro();
+      if ( now >= until )
+      {
+         wl_display_cancel_read( display );
+         break;
+      }
+
+      timeout= (int)((until-now)/1000);
+      if ( timeout == 0 )
+      {
+         // Less than poll's resolution left
+         wl_display_cancel_read( display );
+         usleep( until-now );
+         continue;
+      }
+
+      pfd.fd= wl_display_get_fd( display );
+      pfd.events= POLLIN;
+      pfd.revents= 0;
+      rc= poll( &pfd, 1, timeout );
+      if ( rc > 0 )
+      {
+         if ( wl_display_read_events( display ) == -1 )
+         {
+            printf("Error: clientDispatchUntil: lost connection to compositor\n");
+            return false;
+         }
+         wl_display_dispatch_pending( display );
+      }
+      else
+      {
+         wl_display_cancel_read( display );
+      }
+   }
+
+   return true;
+}
+
+// Buffer size for a frame, with the chroma planes below the luma plane
+static void videoBufferSize( int format, int width, int height, int *bytesPerRow, int *rows )
+{
+   width= (width+1)&~1;
+   if ( format == VIDEO_FORMAT_YUYV )
+   {
+      *bytesPerRow= width*2;
+      *rows= height;
+   }
+   else
+   {
+      *bytesPerRow= width;
+      *rows= height+(height+1)/2;
+   }
+}
+
+// Plane offsets and strides in a buffer of the given stride, as passed to wl_drm
+static void videoBufferLayout( int format, int height, int stride, int *offset, int *pitch )
+{
+   for( int i= 0; i < 3; ++i )
+   {
+      offset[i]= 0;
+      pitch[i]= 0;
+   }
+   pitch[0]= stride;
+   switch( format )
+   {
+      case VIDEO_FORMAT_NV12:
+         offset[1]= stride*height;
+         pitch[1]= stride;
+         break;
+      case VIDEO_FORMAT_YUV420:
+         offset[1]= stride*height;
+         pitch[1]= stride/2;
+         offset[2]= offset[1]+pitch[1]*((height+1)/2);
+         pitch[2]= stride/2;
+         break;
+   }
+}
+
+// Address in the mapping of a byte offset into the buffer.  The mapping may
+// have a different pitch from the buffer, so go through the buffer's row and
+// column rather than using the offset directly.
+static unsigned char *videoMapAddress( PlatformLinearBuffer *mem, int offset )
+{
+   return (unsigned char*)mem->map+(offset/mem->stride)*mem->mapStride+(offset%mem->stride);
+}
+
+// Fill a frame with a luma ramp and chroma gradients.  Each buffer's ramp is
+// shifted so cycling through the pool looks like motion.
+static bool videoFill( AppCtx *ctx, VideoBuffer *videoBuffer, int format, int index )
+{
+   int width= ctx->windowWidth;
+   int height= ctx->windowHeight;
+   int chromaWidth= (width+1)/2;
+   int chromaHeight= (height+1)/2;
+   int shift= index*(256/VIDEO_BUFFER_COUNT);
+   PlatformLinearBuffer *mem= &videoBuffer->mem;
+   int offset[3], pitch[3];
+   unsigned char *row;
+   int x, y;
+
+   if ( !PlatformMapLinearBuffer( ctx->platformCtx, mem ) )
+   {
+      return false;
+   }
+   videoBufferLayout( format, height, videoBuffer->mem.stride, offset, pitch );
+
+   if ( format == VIDEO_FORMAT_YUYV )
+   {
+      for( y= 0; y < height; ++y )
+      {
+         row= videoMapAddress( mem, y*pitch[0] );
+         for( x= 0; x < chromaWidth; ++x )
+         {
+            row[x*4]= (unsigned char)(((x*2)*255/width+shift)&0xFF);
+            row[x*4+1]= (unsigned char)(y*255/height);
+            row[x*4+2]= (unsigned char)(((x*2+1)*255/width+shift)&0xFF);
+            row[x*4+3]= (unsigned char)(x*255/chromaWidth);
+         }
+      }
+   }
+   else
+   {
+      for( y= 0; y < height; ++y )
+      {
+         row= videoMapAddress( mem, offset[0]+y*pitch[0] );
+         for( x= 0; x < width; ++x )
+         {
+            row[x]= (unsigned char)((x*255/width+shift)&0xFF);
+         }
+      }
+      for( y= 0; y < chromaHeight; ++y )
+      {
+         if ( format == VIDEO_FORMAT_NV12 )
+         {
+            row= videoMapAddress( mem, offset[1]+y*pitch[1] );
+            for( x= 0; x < chromaWidth; ++x )
+            {
+               row[x*2]= (unsigned char)(y*255/chromaHeight);
+               row[x*2+1]= (unsigned char)(x*255/chromaWidth);
+            }
+         }
+         else
+         {
+            row= videoMapAddress( mem, offset[1]+y*pitch[1] );
+            for( x= 0; x < chromaWidth; ++x )
+            {
+               row[x]= (unsigned char)(y*255/chromaHeight);
+            }
+            row= videoMapAddress( mem, offset[2]+y*pitch[2] );
+            for( x= 0; x < chromaWidth; ++x )
+            {
+               row[x]= (unsigned char)(x*255/chromaWidth);
+            }
+         }
+      }
+   }
+
+   PlatformUnmapLinearBuffer( ctx->platformCtx, mem );
+
+   return true;
+}
+
+static void videoCommit( AppCtx *ctx, VideoBuffer *videoBuffer )
+{
+   videoBuffer->busy= true;
+   wl_surface_attach( ctx->client.surface, videoBuffer->buffer, 0, 0 );
+   wl_surface_damage( ctx->client.surface, 0, 0, ctx->windowWidth, ctx->windowHeight );
+   wl_surface_commit( ctx->client.surface );
+   wl_display_flush( ctx->client.upstreamDisplay );
+}
+
+// Play a pool of prepared frames at the video frame rate, the way a player
+// hands decoded frames to the compositor.  The surface gets no EGL window.
+static void waylandClientVideo( AppCtx *ctx, long long startTime )
+{
+   using namespace waylandClient;
+
+   WaylandCtx *client= &ctx->client;
+   VideoBuffer buffers[VIDEO_BUFFER_COUNT];
+   VideoBuffer *videoBuffer;
+   struct wl_callback *callback;
+   int format= ctx->videoFormat;
+   int offset[3], pitch[3];
+   int bytesPerRow, rows, step, maxStep, frame, next, bufferWaits;
+   long long periodUs, time1, time2, diff, frameTime, traceStart;
+   bool done;
+   SocketSnapshot socketStart;
+
+   memset( buffers, 0, sizeof(buffers) );
+   for( int i= 0; i < VIDEO_BUFFER_COUNT; ++i )
+   {
+      buffers[i].mem.fd= -1;
+   }
+
+   // wl_drm sends its capabilities and formats once bound
+   wl_display_roundtrip( client->upstreamDisplay );
+   if ( !client->drm || !client->drmPrime )
+   {
+      printf("Error: waylandClientVideo: compositor does not accept prime buffers\n");
+      goto exit;
+   }
+   if ( !(client->drmFormats & (1 << format)) )
+   {
+      printf("Error: waylandClientVideo: compositor does not accept %s buffers\n", gVideoFormatNames[format]);
+      goto exit;
+   }
+
+   videoBufferSize( format, ctx->windowWidth, ctx->windowHeight, &bytesPerRow, &rows );
+   for( int i= 0; i < VIDEO_BUFFER_COUNT; ++i )
+   {
+      if ( !PlatformAllocLinearBuffer( ctx->platformCtx, bytesPerRow, rows, &buffers[i].mem ) )
+      {
+         printf("Error: waylandClientVideo: unable to allocate %s buffers\n", gVideoFormatNames[format]);
+         goto exit;
+      }
+      if ( !videoFill( ctx, &buffers[i], format, i ) )
+      {
+         goto exit;
+      }
+      videoBufferLayout( format, ctx->windowHeight, buffers[i].mem.stride, offset, pitch );
+      buffers[i].buffer= (struct wl_buffer*)wl_proxy_marshal_constructor( client->drm, WL_DRM_CREATE_PRIME_BUFFER,
+                                                                         &wl_buffer_interface, NULL,
+                                                                         buffers[i].mem.fd,
+                                                                         ctx->windowWidth, ctx->windowHeight,
+                                                                         gVideoFourcc[format],
+                                                                         offset[0], pitch[0],
+                                                                         offset[1], pitch[1],
+                                                                         offset[2], pitch[2] );
+      if ( !buffers[i].buffer )
+      {
+         printf("Error: waylandClientVideo: create_prime_buffer failed\n");
+         goto exit;
+      }
+      wl_buffer_add_listener( buffers[i].buffer, &videoBufferListener, &buffers[i] );
+   }
+
+   done= false;
+   time1= getCurrentTimeMicro();
+   callback= wl_surface_frame( client->surface );
+   if ( !callback )
+   {
+      printf("Error: waylandClientVideo: wl_surface_frame failed\n");
+      goto exit;
+   }
+   wl_callback_add_listener( callback, &frameCallbackListener, &done );
+   videoCommit( ctx, &buffers[0] );
+   while( !done )
+   {
+      if ( wl_display_dispatch( client->upstreamDisplay ) == -1 )
+      {
+         printf("Error: waylandClientVideo: lost connection to compositor\n");
+         goto exit;
+      }
+   }
+   time2= getCurrentTimeMicro();
+   fprintf(ctx->pReport, "%s: first %s frame presented %lld us after start\n", client->name, gVideoFormatNames[format], time2-startTime);
+   resultValue( ctx, client->name, 0, "first_frame_us", time2-time1 );
+
+   periodUs= 1000000LL/ctx->videoFps;
+   frame= 1;
+   next= 1;
+   maxStep= ctx->pacingSteps-1;
+   metricsReset( &client->metrics, ctx );
+   getSocketSnapshot( &socketStart );
+   for( step= 0; step <= maxStep; ++step )
+   {
+      fprintf(ctx->pReport, "\n");
+      fprintf(ctx->pReport, "%d) video %s at %d fps\n", step+1, gVideoFormatNames[format], ctx->videoFps);
+      printf("%d) video %s at %d fps\n", step+1, gVideoFormatNames[format], ctx->videoFps);
+
+      ctx->waylandEGLIterationCount= 0;
+      ctx->waylandEGLTimeTotal= 0;
+      bufferWaits= 0;
+
+      clientMarkStep( client );
+      metricsStepBegin( &client->metrics, step, 0 );
+      time1= getCurrentTimeMicro();
+      frameTime= time1;
+      ctx->frameSampleCount= 0;
+      for( int i= 0; i < ctx->maxIterations; ++i )
+      {
+         ++frame;
+         traceStart= traceTime();
+         videoBuffer= &buffers[next];
+         next= (next+1) % VIDEO_BUFFER_COUNT;
+         if ( videoBuffer->busy )
+         {
+            ++bufferWaits;
+            while( videoBuffer->busy )
+            {
+               if ( wl_display_dispatch( client->upstreamDisplay ) == -1 )
+               {
+                  printf("Error: waylandClientVideo: lost connection to compositor\n");
+                  goto exit;
+               }
+            }
+         }
+         if ( !clientDispatchUntil( client, time1+i*periodUs ) )
+         {
+            goto exit;
+         }
+         traceSlice( "wait", traceStart, frame, 's' );
+         traceStart= traceTime();
+         videoCommit( ctx, videoBuffer );
+         traceSlice( "commit", traceStart, frame, 't' );
+         jankFrame( ctx, &client->metrics.steps[step].jank, recordFrameSample( ctx, &frameTime ) );
+      }
+      // Let the last frame be on screen for its full period
+      clientDispatchUntil( client, time1+ctx->maxIterations*periodUs );
+      time2= getCurrentTimeMicro();
+      metricsStepEnd( &client->metrics, ctx->maxIterations );
+
+      diff= (time2-time1);
+      ctx->waylandEGLIterationCount += ctx->maxIterations;
+      ctx->waylandEGLTimeTotal += diff;
+      ctx->waylandEGLFPS= ((double)(ctx->waylandEGLIterationCount*1000000.0)) / (double)(ctx->waylandEGLTimeTotal);
+
+      fprintf(ctx->pReport, "Iterations: %d Total time (us): %lld  FPS: %f\n",
+              ctx->waylandEGLIterationCount, ctx->waylandEGLTimeTotal, ctx->waylandEGLFPS );
+      fprintf(ctx->pReport, "%s waited for a released buffer %d times\n", client->name, bufferWaits);
+      reportStepMetrics( ctx->pReport, client->name, &client->metrics.steps[step] );
+      resultStepJank( ctx, client->name, step+1, &client->metrics.steps[step] );
+      resultStepProtocol( ctx, client->name, step+1, &client->metrics.steps[step] );
+      resultValue( ctx, client->name, step+1, "frames", ctx->waylandEGLIterationCount );
+      resultValue( ctx, client->name, step+1, "time_us", ctx->waylandEGLTimeTotal );
+      resultValue( ctx, client->name, step+1, "fps", ctx->waylandEGLFPS );
+      resultValue( ctx, client->name, step+1, "buffer_waits", bufferWaits );
+      resultSamples( ctx, client->name, step+1 );
+
+      fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+
+      ctx->waylandTotal += ctx->waylandEGLTimeTotal;
+   }
+   reportRoleMemory( ctx->pReport, client->name, &client->metrics );
+   reportProtocol( ctx, client->name, (maxStep+1)*ctx->maxIterations, 0, &socketStart );
+
+exit:
+   for( int i= 0; i < VIDEO_BUFFER_COUNT; ++i )
+   {
+      if ( buffers[i].buffer )
+      {
+         wl_buffer_destroy( buffers[i].buffer );
+      }
+      PlatformFreeLinearBuffer( ctx->platformCtx, &buffers[i].mem );
+   }
+}
+
+// Allocate the --client-buffers swapchain.  Each buffer is a linear XRGB
+// dma-buf that GL renders into through an EGLImage backed framebuffer and
+// that is shared with the compositor through wl_drm, so the buffer count is
+// chosen here rather than by the driver's wl_egl_window.
+static bool swapchainCreate( AppCtx *ctx, Swapchain *chain )
+{
+   using namespace waylandClient;
+
+   WaylandCtx *client= &ctx->client;
+   EGLCtx *eglCtx= &client->eglClient;
+   ClientBuffer *clientBuffer;
+   EGLint attrs[13];
+   bool result= false;
+
+   for( int i= 0; i < ctx->clientBuffers; ++i )
+   {
+      clientBuffer= &chain->buffers[chain->count++];
+      clientBuffer->chain= chain;
+
+      if ( !PlatformAllocLinearBuffer( ctx->platformCtx, ctx->windowWidth*4, ctx->windowHeight, &clientBuffer->mem ) )
+      {
+         printf("Error: swapchainCreate: unable to allocate buffers\n");
+         goto exit;
+      }
+
+      attrs[0]= EGL_WIDTH;
+      attrs[1]= ctx->windowWidth;
+      attrs[2]= EGL_HEIGHT;
+      attrs[3]= ctx->windowHeight;
+      attrs[4]= EGL_LINUX_DRM_FOURCC_EXT;
+      attrs[5]= CLIENT_BUFFER_FOURCC;
+      attrs[6]= EGL_DMA_BUF_PLANE0_FD_EXT;
+      attrs[7]= clientBuffer->mem.fd;
+      attrs[8]= EGL_DMA_BUF_PLANE0_OFFSET_EXT;
+      attrs[9]= 0;
+      attrs[10]= EGL_DMA_BUF_PLANE0_PITCH_EXT;
+      attrs[11]= clientBuffer->mem.stride;
+      attrs[12]= EGL_NONE;
+      clientBuffer->eglImage= ctx->eglCreateImageKHR( eglCtx->eglDisplay, EGL_NO_CONTEXT,
+                                                      EGL_LINUX_DMA_BUF_EXT, (EGLClientBuffer)NULL,
+                                                      attrs );
+      if ( !clientBuffer->eglImage )
+      {
+         printf("Error: swapchainCreate: eglCreateImageKHR failed: %X\n", eglGetError());
+         goto exit;
+      }
+      __atomic_add_fetch( &gEGLImageCount, 1, __ATOMIC_RELAXED );
+
+      glGenTextures( 1, &clientBuffer->texture );
+      glBindTexture( GL_TEXTURE_2D, clientBuffer->texture );
+      ctx->glEGLImageTargetTexture2DOES( GL_TEXTURE_2D, clientBuffer->eglImage );
+      glBindTexture( GL_TEXTURE_2D, 0 );
+
+      glGenFramebuffers( 1, &clientBuffer->fbo );
+      glBindFramebuffer( GL_FRAMEBUFFER, clientBuffer->fbo );
+      glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, clientBuffer->texture, 0 );
+      if ( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE )
+      {
+         printf("Error: swapchainCreate: buffers can not be rendered to\n");
+         goto exit;
+      }
+
+      clientBuffer->buffer= (struct wl_buffer*)wl_proxy_marshal_constructor( client->drm, WL_DRM_CREATE_PRIME_BUFFER,
+                                                                            &wl_buffer_interface, NULL,
+                                                                            clientBuffer->mem.fd,
+                                                                            ctx->windowWidth, ctx->windowHeight,
+                                                                            CLIENT_BUFFER_FOURCC,
+                                                                            0, clientBuffer->mem.stride,
+                                                                            0, 0,
+                                                                            0, 0 );
+      if ( !clientBuffer->buffer )
+      {
+         printf("Error: swapchainCreate: create_prime_buffer failed\n");
+         goto exit;
+      }
+      wl_buffer_add_listener( clientBuffer->buffer, &clientBufferListener, clientBuffer );
+   }
+
+   result= true;
+
+exit:
+   return result;
+}
+
+static void swapchainDestroy( AppCtx *ctx, Swapchain *chain )
+{
+   EGLCtx *eglCtx= &ctx->client.eglClient;
+   ClientBuffer *clientBuffer;
+
+   while( chain->frames )
+   {
+      SwapchainFrame *frame= chain->frames;
+
+      chain->frames= frame->next;
+      wl_callback_destroy( frame->callback );
+      free( frame );
+   }
+   for( int i= 0; i < chain->count; ++i )
+   {
+      clientBuffer= &chain->buffers[i];
+      if ( clientBuffer->buffer )
+      {
+         wl_buffer_destroy( clientBuffer->buffer );
+         clientBuffer->buffer= 0;
+      }
+      if ( clientBuffer->fbo )
+      {
+         glDeleteFramebuffers( 1, &clientBuffer->fbo );
+         clientBuffer->fbo= 0;
+      }
+      if ( clientBuffer->texture )
+      {
+         glDeleteTextures( 1, &clientBuffer->texture );
+         clientBuffer->texture= 0;
+      }
+      if ( clientBuffer->eglImage )
+      {
+         ctx->eglDestroyImageKHR( eglCtx->eglDisplay, clientBuffer->eglImage );
+         clientBuffer->eglImage= 0;
+         __atomic_sub_fetch( &gEGLImageCount, 1, __ATOMIC_RELAXED );
+      }
+      PlatformFreeLinearBuffer( ctx->platformCtx, &clientBuffer->mem );
+   }
+   chain->count= 0;
+}
+
+// Take the free buffer drawn into longest ago, as a driver swapchain would,
+// waiting for the compositor to release one if it holds them all.  Returns
+// null if the connection is lost.
+static ClientBuffer *swapchainAcquire( AppCtx *ctx, Swapchain *chain, int *waits, long long *waitUs )
+{
+   struct wl_display *display= ctx->client.upstreamDisplay;
+   ClientBuffer *clientBuffer= 0;
+   struct pollfd pfd;
+   long long waitStart= 0;
+
+   // Pick up releases that have already arrived without blocking
+   while( wl_display_prepare_read( display ) != 0 )
+   {
+      wl_display_dispatch_pending( display );
+   }
+   pfd.fd= wl_display_get_fd( display );
+   pfd.events= POLLIN;
+   pfd.revents= 0;
+   if ( poll( &pfd, 1, 0 ) > 0 )
+   {
+      wl_display_read_events( display );
+      wl_display_dispatch_pending( display );
+   }
+   else
+   {
+      wl_display_cancel_read( display );
+   }
+
+   for( ; ; )
+   {
+      for( int i= 0; i < chain->count; ++i )
+      {
+         ClientBuffer *candidate= &chain->buffers[i];
+         if ( !candidate->busy && (!clientBuffer || (candidate->lastFrame < clientBuffer->lastFrame)) )
+         {
+            clientBuffer= candidate;
+         }
+      }
+      if ( clientBuffer )
+      {
+         break;
+      }
+      if ( !waitStart )
+      {
+         ++(*waits);
+         waitStart= getCurrentTimeMicro();
+      }
+      if ( wl_display_dispatch( display ) == -1 )
+      {
+         printf("Error: swapchainAcquire: lost connection to compositor\n");
+         break;
+      }
+   }
+   if ( waitStart )
+   {
+      *waitUs += getCurrentTimeMicro()-waitStart;
+   }
+
+   return clientBuffer;
+}
+
+// Hand a drawn buffer to the compositor, damaging only the redrawn box when
+// one is given.  Framebuffer rows are buffer rows, so GL coordinates need no flip.
+static void swapchainCommit( AppCtx *ctx, ClientBuffer *clientBuffer, EGLint *rect )
+{
+   using namespace waylandClient;
+
+   WaylandCtx *client= &ctx->client;
+   Swapchain *chain= clientBuffer->chain;
+   SwapchainFrame *frame;
+
+   clientBuffer->busy= true;
+   wl_surface_attach( client->surface, clientBuffer->buffer, 0, 0 );
+   if ( rect )
+   {
+      wl_surface_damage( client->surface, rect[0], rect[1], rect[2], rect[3] );
+   }
+   else
+   {
+      wl_surface_damage( client->surface, 0, 0, ctx->windowWidth, ctx->windowHeight );
+   }
+   // Without a callback there is nothing to wait for
+   clientBuffer->frameSeq= chain->doneSeq;
+   frame= (SwapchainFrame*)calloc( 1, sizeof(SwapchainFrame) );
+   if ( frame )
+   {
+      frame->callback= wl_surface_frame( client->surface );
+      if ( frame->callback )
+      {
+         frame->chain= chain;
+         frame->seq= ++chain->commitSeq;
+         wl_callback_add_listener( frame->callback, &clientBufferFrameListener, frame );
+         frame->next= chain->frames;
+         chain->frames= frame;
+         clientBuffer->frameSeq= frame->seq;
+         frame->commitTime= getCurrentTimeMicro();
+      }
+      else
+      {
+         free( frame );
+      }
+   }
+   wl_surface_commit( client->surface );
+   wl_display_flush( client->upstreamDisplay );
+}
+
+// Wait for a buffer's last committed frame to be composed
+static bool swapchainWaitFrame( AppCtx *ctx, ClientBuffer *clientBuffer )
+{
+   while( clientBuffer->chain->doneSeq < clientBuffer->frameSeq )
+   {
+      if ( wl_display_dispatch( ctx->client.upstreamDisplay ) == -1 )
+      {
+         printf("Error: swapchainWaitFrame: lost connection to compositor\n");
+         return false;
+      }
+   }
+   return true;
+}
+
+// Render through a swapchain of our own instead of a wl_egl_window, so the
+// buffer count is known and the client can see when it is starved of a
+// free buffer.  With --damage-region the buffer's age says whether the box
+// alone can be redrawn.
+static void waylandClientSwapchain( AppCtx *ctx, long long startTime )
+{
+   WaylandCtx *client= &ctx->client;
+   EGLCtx *eglCtx= &client->eglClient;
+   Swapchain chain;
+   ClientBuffer *clientBuffer, *prevBuffer;
+   GLfloat r, g, b, t;
+   EGLint damageRect[4];
+   int ages[BUFFER_AGE_BUCKETS];
+   int pacingInc, step, maxStep, frame, age, bufferWaits, partialFrames;
+   long long time1, time2, diff, frameTime, traceStart, waitUs;
+   const char *s;
+   SocketSnapshot socketStart;
+
+   memset( &chain, 0, sizeof(chain) );
+   for( int i= 0; i < MAX_CLIENT_BUFFERS; ++i )
+   {
+      chain.buffers[i].mem.fd= -1;
+   }
+
+   // wl_drm sends its capabilities and formats once bound
+   wl_display_roundtrip( client->upstreamDisplay );
+   if ( !client->drm || !client->drmPrime || !client->drmXrgb )
+   {
+      printf("Error: waylandClientSwapchain: compositor does not accept XRGB8888 prime buffers\n");
+      goto exit;
+   }
+   s= eglQueryString( eglCtx->eglDisplay, EGL_EXTENSIONS );
+   if ( !s || !strstr( s, "EGL_EXT_image_dma_buf_import" ) || !strstr( s, "EGL_KHR_surfaceless_context" ) ||
+        !ctx->eglCreateImageKHR || !ctx->eglDestroyImageKHR || !ctx->glEGLImageTargetTexture2DOES )
+   {
+      printf("Error: waylandClientSwapchain: EGL can not render to dma-bufs\n");
+      goto exit;
+   }
+   if ( !eglMakeCurrent( eglCtx->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglCtx->eglContext ) )
+   {
+      printf("Error: waylandClientSwapchain: eglMakeCurrent failed: %X\n", eglGetError());
+      goto exit;
+   }
+   if ( !swapchainCreate( ctx, &chain ) )
+   {
+      goto exit;
+   }
+   gpuTimerInit( client, eglCtx->eglDisplay );
+   glViewport( 0, 0, ctx->windowWidth, ctx->windowHeight );
+
+   // Frames are numbered like compositor commits so trace flows match across processes
+   frame= 1;
+   clientBuffer= &chain.buffers[0];
+   glBindFramebuffer( GL_FRAMEBUFFER, clientBuffer->fbo );
+   glClearColor( 0, 0, 0, 1 );
+   glClear( GL_COLOR_BUFFER_BIT );
+   glFlush();
+   clientBuffer->lastFrame= frame;
+   time1= getCurrentTimeMicro();
+   swapchainCommit( ctx, clientBuffer, 0 );
+   if ( !swapchainWaitFrame( ctx, clientBuffer ) )
+   {
+      goto exit;
+   }
+   time2= getCurrentTimeMicro();
+   fprintf(ctx->pReport, "%s: first frame presented %lld us after start\n", client->name, time2-startTime);
+   resultValue( ctx, client->name, 0, "first_frame_us", time2-time1 );
+   prevBuffer= clientBuffer;
+
+   pacingInc= ctx->pacingIncrement;
+   maxStep= ctx->pacingSteps-1;
+   ctx->pacingDelay= ctx->pacingStart;
+   metricsReset( &client->metrics, ctx );
+   getSocketSnapshot( &socketStart );
+   for( step= 0; step <= maxStep; ++step )
+   {
+      fprintf(ctx->pReport, "\n");
+      fprintf(ctx->pReport, "%d) pacing %d us with %d client buffers\n", step+1, ctx->pacingDelay, chain.count);
+      printf("%d) pacing %d us with %d client buffers\n", step+1, ctx->pacingDelay, chain.count);
+
+      ctx->waylandEGLIterationCount= 0;
+      ctx->waylandEGLTimeTotal= 0;
+      bufferWaits= 0;
+      waitUs= 0;
+      partialFrames= 0;
+      chain.latencyTotal= 0;
+      chain.latencyCount= 0;
+      memset( ages, 0, sizeof(ages) );
+
+      clientMarkStep( client );
+
+      r= 0;
+      g= 1;
+      b= 0;
+      metricsStepBegin( &client->metrics, step, 0 );
+      time1= getCurrentTimeMicro();
+      frameTime= time1;
+      ctx->frameSampleCount= 0;
+      for( int i= 0; i < ctx->maxIterations; ++i )
+      {
+         ++frame;
+         traceStart= traceTime();
+         t= r;
+         r= g;
+         g= b;
+         b= t;
+         clientBuffer= swapchainAcquire( ctx, &chain, &bufferWaits, &waitUs );
+         if ( !clientBuffer )
+         {
+            goto exit;
+         }
+         age= (clientBuffer->lastFrame > 0) ? frame-clientBuffer->lastFrame : 0;
+         countBufferAge( ages, age );
+
+         gpuTimerBegin( client );
+         glBindFramebuffer( GL_FRAMEBUFFER, clientBuffer->fbo );
+         if ( ctx->damageWidth > 0 )
+         {
+            clientDamageRect( ctx, damageRect );
+            if ( age > 0 )
+            {
+               ++partialFrames;
+            }
+            else
+            {
+               glClearColor( 0, 0, 0, 1 );
+               glClear( GL_COLOR_BUFFER_BIT );
+            }
+            glEnable( GL_SCISSOR_TEST );
+            glScissor( damageRect[0], damageRect[1], damageRect[2], damageRect[3] );
+            glClearColor( r, g, b, 1 );
+            glClear( GL_COLOR_BUFFER_BIT );
+            glDisable( GL_SCISSOR_TEST );
+         }
+         else
+         {
+            glClearColor( r, g, b, 1 );
+            glClear( GL_COLOR_BUFFER_BIT );
+         }
+         glFlush();
+         gpuTimerEnd( client );
+         clientBuffer->lastFrame= frame;
+         if ( ctx->pacingDelay )
+         {
+            usleep( ctx->pacingDelay );
+         }
+         traceSlice( "render", traceStart, frame, 's' );
+         traceStart= traceTime();
+         if ( ctx->swapInterval > 0 )
+         {
+            // Throttle to the compositor as eglSwapInterval would
+            if ( !swapchainWaitFrame( ctx, prevBuffer ) )
+            {
+               goto exit;
+            }
+         }
+         swapchainCommit( ctx, clientBuffer, (ctx->damageWidth > 0) ? damageRect : 0 );
+         prevBuffer= clientBuffer;
+         traceSlice( "swap", traceStart, frame, 't' );
+         jankFrame( ctx, &client->metrics.steps[step].jank, recordFrameSample( ctx, &frameTime ) );
+      }
+      time2= getCurrentTimeMicro();
+      metricsStepEnd( &client->metrics, ctx->maxIterations );
+
+      diff= (time2-time1);
+      ctx->waylandEGLIterationCount += ctx->maxIterations;
+      ctx->waylandEGLTimeTotal += diff;
+      if ( ctx->waylandEGLIterationCount )
+      {
+         ctx->waylandEGLFPS= ((double)(ctx->waylandEGLIterationCount*1000000.0)) / (double)(ctx->waylandEGLTimeTotal);
+      }
+
+      fprintf(ctx->pReport, "Iterations: %d Total time (us): %lld  FPS: %f\n",
+              ctx->waylandEGLIterationCount, ctx->waylandEGLTimeTotal, ctx->waylandEGLFPS );
+      fprintf(ctx->pReport, "%s waited for a released buffer %d times, %lld us in all\n", client->name, bufferWaits, waitUs);
+      if ( chain.latencyCount > 0 )
+      {
+         fprintf(ctx->pReport, "%s commit to frame done: %.1f us\n", client->name, (double)chain.latencyTotal/chain.latencyCount);
+      }
+      if ( ctx->damageWidth > 0 )
+      {
+         fprintf(ctx->pReport, "%s redrew only the damage region in %d of %d frames\n", client->name, partialFrames, ctx->maxIterations);
+      }
+      reportBufferAges( ctx, client->name, step+1, ages );
+      reportStepMetrics( ctx->pReport, client->name, &client->metrics.steps[step] );
+      resultStepJank( ctx, client->name, step+1, &client->metrics.steps[step] );
+      resultStepProtocol( ctx, client->name, step+1, &client->metrics.steps[step] );
+      resultValue( ctx, client->name, step+1, "frames", ctx->waylandEGLIterationCount );
+      resultValue( ctx, client->name, step+1, "time_us", ctx->waylandEGLTimeTotal );
+      resultValue( ctx, client->name, step+1, "fps", ctx->waylandEGLFPS );
+      resultValue( ctx, client->name, step+1, "buffer_waits", bufferWaits );
+      resultValue( ctx, client->name, step+1, "buffer_wait_us", waitUs );
+      if ( chain.latencyCount > 0 )
+      {
+         resultValue( ctx, client->name, step+1, "latency_us", (double)chain.latencyTotal/chain.latencyCount );
+      }
+      if ( ctx->damageWidth > 0 )
+      {
+         resultValue( ctx, client->name, step+1, "partial_pct", 100.0*partialFrames/ctx->maxIterations );
+      }
+      resultSamples( ctx, client->name, step+1 );
+
+      fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+
+      ctx->pacingDelay += pacingInc;
+      ctx->waylandTotal += ctx->waylandEGLTimeTotal;
+   }
+   reportRoleMemory( ctx->pReport, client->name, &client->metrics );
+   reportProtocol( ctx, client->name, (maxStep+1)*ctx->maxIterations, 0, &socketStart );
+   gpuTimerTerm( client );
+
+   clientBuffer= swapchainAcquire( ctx, &chain, &bufferWaits, &waitUs );
+   if ( clientBuffer )
+   {
+      glBindFramebuffer( GL_FRAMEBUFFER, clientBuffer->fbo );
+      glClearColor( 0, 0, 0, 1 );
+      glClear( GL_COLOR_BUFFER_BIT );
+      glFlush();
+      swapchainCommit( ctx, clientBuffer, 0 );
+      swapchainWaitFrame( ctx, clientBuffer );
+   }
+
+exit:
+   if ( chain.count > 0 )
+   {
+      glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+   }
+   swapchainDestroy( ctx, &chain );
+}
+
+// Stack the requested subsurfaces over the main surface, each a quarter of
+// the window and offset so neighbours overlap by the given percentage.  They
+// are drawn once and left alone, so later frames cost the compositor their
+// composition while the client only redraws the main surface.
+static bool clientCreateLayers( AppCtx *ctx )
+{
+   WaylandCtx *client= &ctx->client;
+   EGLCtx *eglCtx= &client->eglClient;
+   ClientLayer *layer;
+   int width, height, stepX, stepY, colour;
+   GLfloat alpha;
+   bool result= false;
+
+   if ( !client->subcompositor )
+   {
+      printf("Error: clientCreateLayers: compositor does not support subsurfaces\n");
+      goto exit;
+   }
+
+   client->layers= (ClientLayer*)calloc( ctx->subsurfaceCount, sizeof(ClientLayer) );
+   if ( !client->layers )
+   {
+      printf("Error: clientCreateLayers: no memory\n");
+      goto exit;
+   }
+
+   width= ctx->windowWidth/2;
+   height= ctx->windowHeight/2;
+   stepX= width*(100-ctx->subsurfaceOverlap)/100;
+   stepY= height*(100-ctx->subsurfaceOverlap)/100;
+   alpha= ctx->subsurfaceAlpha/100.0;
+   for( int i= 0; i < ctx->subsurfaceCount; ++i )
+   {
+      layer= &client->layers[client->layerCount++];
+
+      layer->surface= wl_compositor_create_surface( client->compositor );
+      if ( !layer->surface )
+      {
+         printf("Error: clientCreateLayers: failed to create wayland surface\n");
+         goto exit;
+      }
+
+      layer->subsurface= wl_subcompositor_get_subsurface( client->subcompositor, layer->surface, client->surface );
+      if ( !layer->subsurface )
+      {
+         printf("Error: clientCreateLayers: failed to create subsurface\n");
+         goto exit;
+      }
+      wl_subsurface_set_position( layer->subsurface,
+                                  (i*stepX) % (ctx->windowWidth-width+1),
+                                  (i*stepY) % (ctx->windowHeight-height+1) );
+      if ( ctx->subsurfaceAlpha >= 100 )
+      {
+         setOpaqueRegion( client, layer->surface, width, height );
+      }
+
+      layer->winWayland= wl_egl_window_create( layer->surface, width, height );
+      if ( !layer->winWayland )
+      {
+         printf("Error: clientCreateLayers: failed to create wayland window\n");
+         goto exit;
+      }
+
+      layer->eglSurface= eglCreateWindowSurface( eglCtx->eglDisplay, eglCtx->eglConfig,
+                                                 (EGLNativeWindowType)layer->winWayland, NULL );
+      if ( layer->eglSurface == EGL_NO_SURFACE )
+      {
+         printf("Error: clientCreateLayers: failed to create EGL surface\n");
+         goto exit;
+      }
+
+      // Subsurfaces are synchronized so this only reaches the screen with
+      // the main surface's next commit, and nothing waits on it
+      eglMakeCurrent( eglCtx->eglDisplay, layer->eglSurface, layer->eglSurface, eglCtx->eglContext );
+      eglSwapInterval( eglCtx->eglDisplay, 0 );
+      colour= (i % 7)+1;
+      glClearColor( alpha*(colour & 1), alpha*((colour >> 1) & 1), alpha*((colour >> 2) & 1), alpha );
+      glClear( GL_COLOR_BUFFER_BIT );
+      eglSwapBuffers( eglCtx->eglDisplay, layer->eglSurface );
+   }
+
+   result= true;
+
+exit:
+   eglMakeCurrent( eglCtx->eglDisplay, eglCtx->eglSurface, eglCtx->eglSurface, eglCtx->eglContext );
+
+   return result;
+}
+
+static void clientDestroyLayers( AppCtx *ctx )
+{
+   WaylandCtx *client= &ctx->client;
+   ClientLayer *layer;
+
+   for( int i= client->layerCount-1; i >= 0; --i )
+   {
+      layer= &client->layers[i];
+      if ( layer->eglSurface != EGL_NO_SURFACE )
+      {
+         eglDestroySurface( client->eglClient.eglDisplay, layer->eglSurface );
+      }
+      if ( layer->winWayland )
+      {
+         wl_egl_window_destroy( layer->winWayland );
+      }
+      if ( layer->subsurface )
+      {
+         wl_subsurface_destroy( layer->subsurface );
+      }
+      if ( layer->surface )
+      {
+         wl_surface_destroy( layer->surface );
+      }
+   }
+   if ( client->layers )
+   {
+      free( client->layers );
+      client->layers= 0;
+   }
+   client->layerCount= 0;
+}
+
+static void waylandClientSoak( AppCtx *ctx )
+{
+   GLfloat r, g, b, t;
+   long long time1, endTime;
+
+   ctx->soakPage= soakPageOpen( false );
+   if ( !soakInit( &ctx->client, SOAK_SLOT_CLIENT ) )
+   {
+      return;
+   }
+   fprintf(ctx->pReport, "client soak: %d s pacing %d us\n", ctx->soakSeconds, ctx->soakPacing);
+   printf("client soak: %d s pacing %d us\n", ctx->soakSeconds, ctx->soakPacing);
+
+   r= 0;
+   g= 1;
+   b= 0;
+   time1= getCurrentTimeMicro();
+   endTime= time1+ctx->soakSeconds*1000000LL;
+   while( getCurrentTimeMicro() < endTime )
+   {
+      t= r;
+      r= g;
+      g= b;
+      b= t;
+      gpuTimerBegin( &ctx->client );
+      glClearColor( r, g, b, 1 );
+      glClear( GL_COLOR_BUFFER_BIT );
+      gpuTimerEnd( &ctx->client );
+      if ( ctx->soakPacing )
+      {
+         usleep( ctx->soakPacing );
+      }
+      eglSwapBuffers( ctx->client.eglClient.eglDisplay, ctx->client.eglClient.eglSurface );
+      soakFrame( &ctx->client );
+   }
+   ctx->waylandTotal= getCurrentTimeMicro()-time1;
+
+   soakReport( &ctx->client );
+   soakTerm( &ctx->client );
+   soakPageClose( ctx->soakPage, false );
+   ctx->soakPage= 0;
+   gpuTimerTerm( &ctx->client );
+
+   glClearColor( 0, 0, 0, 1 );
+   glClear( GL_COLOR_BUFFER_BIT );
+   presentAndWait( &ctx->client );
+}
+
+static void waylandClientRole( AppCtx *ctx )
+{
+   using namespace waylandClient;
+
+   struct wl_display *dispWayland= 0;
+   struct wl_registry *registry= 0;
+   long long time1, time2, diff, frameTime;
+   GLfloat r, g, b, t;
+   int rc, pacingInc, step, maxStep, frame;
+   int ages[BUFFER_AGE_BUCKETS];
+   EGLint damageRect[4];
+   long long traceStart, startTime;
+   const char *s;
+   SocketSnapshot socketStart;
+
+   startTime= getCurrentTimeMicro();
+   dispWayland= waylandConnect( ctx->client.upstreamDisplayName );
+   if ( !dispWayland )
+   {
+      printf("Error: roleWaylandClient: failed to connect to display\n");
+      goto exit;
+   }
+   ctx->client.upstreamDisplay= dispWayland;
+   gUpstreamFd= wl_display_get_fd( dispWayland );
+
+   registry= wl_display_get_registry(dispWayland);
+   if ( !registry )
+   {
+      printf("Error: roleWaylandClient: failed tp get wayland registry\n");
+      goto exit;
+   }
+
+   wl_registry_add_listener(registry, &registryListener, &ctx->client);
+
+   wl_display_roundtrip( dispWayland );
+
+   if ( !ctx->client.compositor )
+   {
+      printf("Error: roleWaylandClient: failed to obtain wayland compositor\n");
+      goto exit;
+   }
+
+   ctx->client.eglClient.useWayland= true;
+   ctx->client.eglClient.dispWayland= dispWayland;
+   if ( !initEGL( &ctx->client.eglClient ) )
+   {
+      printf("Error: roleWaylandClient: failed to setup EGL\n");
+      goto exit;
+   }
+
+   s= eglQueryString( ctx->client.eglClient.eglDisplay, EGL_VENDOR );
+   if ( s )
+   {
+      ctx->eglVendor= strdup(s);
+   }
+
+   ctx->client.surface= wl_compositor_create_surface(ctx->client.compositor);
+   if ( !ctx->client.surface )
+   {
+      printf("Error: roleWaylandClient: failed to create wayland surface\n");
+      goto exit;
+   }
+   setOpaqueRegion( &ctx->client, ctx->client.surface, ctx->windowWidth, ctx->windowHeight );
+
+   if ( ctx->videoFormat != VIDEO_FORMAT_NONE )
+   {
+      waylandClientVideo( ctx, startTime );
+      goto exit;
+   }
+
+   if ( ctx->clientBuffers > 0 )
+   {
+      waylandClientSwapchain( ctx, startTime );
+      goto exit;
+   }
+
+   ctx->client.winWayland= wl_egl_window_create(ctx->client.surface, ctx->windowWidth, ctx->windowHeight);
+   if ( !ctx->client.winWayland )
+   {
+      printf("Error: roleWaylandClient: failed to create wayland window\n");
+      goto exit;
+   }
+
+   ctx->client.eglClient.eglSurface= eglCreateWindowSurface( ctx->client.eglClient.eglDisplay,
+                                                      ctx->client.eglClient.eglConfig,
+                                                      (EGLNativeWindowType)ctx->client.winWayland,
+                                                      NULL );
+   if ( ctx->client.eglClient.eglSurface == EGL_NO_SURFACE )
+   {
+      printf("Error: roleWaylandClient: failed to create EGL surface\n");
+      goto exit;
+   }
+
+   eglMakeCurrent( ctx->client.eglClient.eglDisplay, ctx->client.eglClient.eglSurface,
+                   ctx->client.eglClient.eglSurface, ctx->client.eglClient.eglContext );
+
+   eglSwapInterval( ctx->client.eglClient.eglDisplay, ctx->swapInterval );
+   gpuTimerInit( &ctx->client, ctx->client.eglClient.eglDisplay );
+
+   glClearColor( 0, 0, 0, 1 );
+   glClear( GL_COLOR_BUFFER_BIT );
+   time1= getCurrentTimeMicro();
+   if ( !presentAndWait( &ctx->client ) )
+   {
+      goto exit;
+   }
+   time2= getCurrentTimeMicro();
+   fprintf(ctx->pReport, "%s: first frame presented %lld us after start\n", ctx->client.name, time2-startTime);
+   resultValue( ctx, ctx->client.name, 0, "first_frame_us", time2-time1 );
+
+   if ( (ctx->subsurfaceCount > 0) && !clientCreateLayers( ctx ) )
+   {
+      goto exit;
+   }
+
+   if ( ctx->soakSeconds > 0 )
+   {
+      waylandClientSoak( ctx );
+      goto exit;
+   }
+
+   // Frames are numbered like compositor commits so trace flows match across processes
+   frame= 1;
+   pacingInc= ctx->pacingIncrement;
+   maxStep= ctx->pacingSteps-1;
+   ctx->pacingDelay= ctx->pacingStart;
+   metricsReset( &ctx->client.metrics, ctx );
+   getSocketSnapshot( &socketStart );
+   for( step= 0; step <= maxStep; ++step  )
+   {
+      fprintf(ctx->pReport, "\n");
+      fprintf(ctx->pReport, "%d) pacing %d us\n", step+1, ctx->pacingDelay);
+      printf("%d) pacing %d us\n", step+1, ctx->pacingDelay);
+
+      ctx->waylandEGLIterationCount= 0;
+      ctx->waylandEGLTimeTotal= 0;
+
+      // The window lives for the whole run, so only its first step needs
+      // warming up; later steps follow on from steady frames
+      if ( step == 0 )
+      {
+         warmupRun( ctx, &ctx->warmup, ctx->client.eglClient.eglDisplay, ctx->client.eglClient.eglSurface, 0 );
+         frame += ctx->warmup.frames;
+      }
+      clientMarkStep( &ctx->client );
+
+      memset( ages, 0, sizeof(ages) );
+      r= 0;
+      g= 1;
+      b= 0;
+      metricsStepBegin( &ctx->client.metrics, step, 0 );
+      time1= getCurrentTimeMicro();
+      frameTime= time1;
+      ctx->frameSampleCount= 0;
+      for( int i= 0; i < ctx->maxIterations; ++i )
+      {
+         ++frame;
+         traceStart= traceTime();
+         t= r;
+         r= g;
+         g= b;
+         b= t;
+         gpuTimerBegin( &ctx->client );
+         if ( ctx->damageWidth > 0 )
+         {
+            countBufferAge( ages, clientDrawDamageRegion( ctx, r, g, b, damageRect ) );
+         }
+         else
+         {
+            glClearColor( r, g, b, 1 );
+            glClear( GL_COLOR_BUFFER_BIT );
+         }
+         gpuTimerEnd( &ctx->client );
+         if ( ctx->pacingDelay )
+         {
+            usleep( ctx->pacingDelay );
+         }
+         traceSlice( "render", traceStart, frame, 's' );
+         traceStart= traceTime();
+         if ( ctx->damageWidth > 0 )
+         {
+            swapBuffersWithDamage( ctx, &ctx->client.eglClient, damageRect, 1 );
+         }
+         else
+         {
+            eglSwapBuffers( ctx->client.eglClient.eglDisplay, ctx->client.eglClient.eglSurface );
+         }
+         traceSlice( "swap", traceStart, frame, 't' );
+         jankFrame( ctx, &ctx->client.metrics.steps[step].jank, recordFrameSample( ctx, &frameTime ) );
+      }
+      time2= getCurrentTimeMicro();
+      metricsStepEnd( &ctx->client.metrics, ctx->maxIterations );
+
+      diff= (time2-time1);
+      ctx->waylandEGLIterationCount += ctx->maxIterations;
+      ctx->waylandEGLTimeTotal += diff;
+      if ( ctx->waylandEGLIterationCount )
+      {
+         ctx->waylandEGLFPS= ((double)(ctx->waylandEGLIterationCount*1000000.0)) / (double)(ctx->waylandEGLTimeTotal);
+      }
+
+      fprintf(ctx->pReport, "Iterations: %d Total time (us): %lld  FPS: %f\n",
+              ctx->waylandEGLIterationCount, ctx->waylandEGLTimeTotal, ctx->waylandEGLFPS );
+      if ( step == 0 )
+      {
+         reportWarmup( ctx, ctx->client.name, step+1, &ctx->warmup );
+      }
+      if ( (ctx->damageWidth > 0) && ctx->client.eglClient.haveBufferAge )
+      {
+         reportBufferAges( ctx, ctx->client.name, step+1, ages );
+      }
+      reportStepMetrics( ctx->pReport, ctx->client.name, &ctx->client.metrics.steps[step] );
+      resultStepJank( ctx, ctx->client.name, step+1, &ctx->client.metrics.steps[step] );
+      resultStepProtocol( ctx, ctx->client.name, step+1, &ctx->client.metrics.steps[step] );
+      resultValue( ctx, ctx->client.name, step+1, "frames", ctx->waylandEGLIterationCount );
+      resultValue( ctx, ctx->client.name, step+1, "time_us", ctx->waylandEGLTimeTotal );
+      resultValue( ctx, ctx->client.name, step+1, "fps", ctx->waylandEGLFPS );
+      resultSamples( ctx, ctx->client.name, step+1 );
+
+      fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+
+      ctx->pacingDelay += pacingInc;
+      ctx->waylandTotal += ctx->waylandEGLTimeTotal;
+   }
+   reportRoleMemory( ctx->pReport, ctx->client.name, &ctx->client.metrics );
+   reportProtocol( ctx, ctx->client.name, (maxStep+1)*ctx->maxIterations, 0, &socketStart );
+   gpuTimerTerm( &ctx->client );
+
+   glClearColor( 0, 0, 0, 1 );
+   glClear( GL_COLOR_BUFFER_BIT );
+   presentAndWait( &ctx->client );
+
+exit:
+   writeResult( ctx->waylandTotal );
+
+   clientDestroyLayers( ctx );
+
+   if ( ctx->client.surface )
+   {
+      wl_surface_destroy( ctx->client.surface );
+      ctx->client.surface= 0;
+   }
+
+   if ( ctx->client.subcompositor )
+   {
+      wl_subcompositor_destroy( ctx->client.subcompositor );
+      ctx->client.subcompositor= 0;
+   }
+
+   if ( ctx->client.compositor )
+   {
+      wl_compositor_destroy( ctx->client.compositor );
+      ctx->client.compositor= 0;
+   }
+
+   if ( ctx->client.drm )
+   {
+      wl_proxy_destroy( ctx->client.drm );
+      ctx->client.drm= 0;
+   }
+
+   if ( ctx->client.control )
+   {
+      wl_proxy_destroy( ctx->client.control );
+      ctx->client.control= 0;
+   }
+
+   //TODO: why does this crash on some devices?
+   if ( strcmp( ctx->eglVendor, "ARM" ) !=  0 )
+   {
+      termEGL( &ctx->client.eglClient );
+   }
+
+   if ( ctx->client.winWayland )
+   {
+      wl_egl_window_destroy( ctx->client.winWayland );
+      ctx->client.winWayland= 0;
+   }
+
+   if ( registry )
+   {
+      wl_registry_destroy(registry);
+      registry= 0;
+   }
+
+   if ( ctx->client.upstreamDisplayName == ctx->nestedDisplayName )
+   {
+      if ( ctx->nested.dispWayland )
+      {
+         wl_display_terminate( ctx->nested.dispWayland );
+      }
+   }
+   else
+   {
+      if ( ctx->master.dispWayland )
+      {
+         wl_display_terminate( ctx->master.dispWayland );
+      }
+   }
+
+   if ( dispWayland )
+   {
+      // Make sure the compositor has processed the surface destroy before
+      // disconnecting: a hang up discards any requests it has not yet read
+      waylandSync( dispWayland );
+      wl_display_disconnect( dispWayland );
+      dispWayland= 0;
+   }
+}
+
+static void* waylandClientThread( void *arg )
+{
+   using namespace waylandClient;
+
+   AppCtx *ctx= (AppCtx*)arg;
+   ChildCommand cmd;
+
+   fflush( ctx->pReport );
+   if ( ctx->pResults )
+   {
+      fflush( ctx->pResults );
+   }
+
+   memset( &cmd, 0, sizeof(cmd) );
+   commandAppend( &cmd, "waymetric --iterations %d", ctx->maxIterations );
+   appendRunParameters( ctx, &cmd );
+   if ( ctx->client.upstreamDisplayName == ctx->nestedDisplayName )
+   {
+      commandAppend( &cmd, " --role-wayland-client-nested" );
+   }
+   else
+   {
+      commandAppend( &cmd, " --role-wayland-client" );
+   }
+   if ( !ctx->renderWayland )
+   {
+      commandAppend( &cmd, " --no-wayland-render" );
+   }
+   appendChildOptions( &cmd );
+   if ( ctx->soakSeconds > 0 )
+   {
+      commandAppend( &cmd, " --soak %d --soak-pacing %d --soak-interval %d",
+                     ctx->soakSeconds, ctx->soakPacing, ctx->soakInterval );
+   }
+   appendResultsOptions( ctx, &cmd );
+   appendRoleControls( ctx, &cmd );
+   runChildCommand( "waylandClientThread", &cmd );
+
+   if ( ctx->client.upstreamDisplayName == ctx->nestedDisplayName )
+   {
+      __atomic_store_n( &ctx->nested.childActive, false, __ATOMIC_RELEASE );
+   }
+   else
+   {
+      __atomic_store_n( &ctx->master.childActive, false, __ATOMIC_RELEASE );
+   }
+
+   fseek( ctx->pReport, 0LL, SEEK_END );
+   if ( ctx->pResults )
+   {
+      fseek( ctx->pResults, 0LL, SEEK_END );
+   }
+
+   return NULL;
+}
+
+namespace waylandNested
+{
+static void registryAdd(void *data,
+                        struct wl_registry *registry, uint32_t id,
+                        const char *interface, uint32_t version)
+{
+   WaylandCtx *ctx = (WaylandCtx*)data;
+   int len;
+
+   len= strlen(interface);
+   if ( (len==13) && !strncmp(interface, "wl_compositor", len) ) {
+      ctx->compositor= (struct wl_compositor*)wl_registry_bind(registry, id, &wl_compositor_interface, 1);
+   }
+   else if ( (len==17) && !strncmp(interface, "waymetric_control", len) ) {
+      ctx->control= (struct wl_proxy*)wl_registry_bind(registry, id, &gControlInterface, 1);
+   }
+}
+
+static void registryRemove(void *, struct wl_registry *, uint32_t)
+{
+   // ignore
+}
+
+static const struct wl_registry_listener registryListener=
+{
+   registryAdd,
+   registryRemove
+};
+} // namespace waylandNested
+
+static void* waylandNestedDispatchThread( void *arg )
+{
+   AppCtx *ctx= (AppCtx*)arg;
+   if ( ctx )
+   {
+      for( ; ; )
+      {
+         if ( wl_display_dispatch( ctx->nested.upstreamDisplay ) == -1 )
+         {
+            break;
+         }
+         wl_display_flush( ctx->nested.upstreamDisplay );
+      }
+   }
+   return NULL;
+}
+
+static void releaseNestedBuffers( WaylandCtx *ctx, bool sendRelease )
+{
+   NestedBufferInfo *list, *ordered, *next;
+   long long now, latency;
+
+   list= __atomic_exchange_n( &ctx->releaseQueue, (NestedBufferInfo*)0, __ATOMIC_ACQUIRE );
+
+   // Entries were pushed LIFO; reverse so clients get buffers back in release order
+   ordered= 0;
+   while( list )
+   {
+      next= list->next;
+      list->next= ordered;
+      ordered= list;
+      list= next;
+   }
+
+   now= getCurrentTimeMicro();
+   while( ordered )
+   {
+      next= ordered->next;
+
+      if ( sendRelease )
+      {
+         traceInstant( "buffer-release", ordered->frame );
+         wl_buffer_send_release( ordered->bufferRemote );
+
+         latency= now-ordered->releaseTime;
+         ctx->releaseLatencyTotal += latency;
+         if ( latency > ctx->releaseLatencyMax )
+         {
+            ctx->releaseLatencyMax= latency;
+         }
+         ++ctx->releaseCount;
+      }
+
+      poolFree( &ctx->appCtx->bufferInfoPool, ordered );
+      ordered= next;
+   }
+}
+
+static int nestedReleaseEvent( int fd, uint32_t mask, void *data )
+{
+   AppCtx *ctx= (AppCtx*)data;
+   uint64_t value;
+
+   if ( read( fd, &value, sizeof(value) ) != sizeof(value) )
+   {
+      if ( gVerbose ) printf("nestedReleaseEvent: spurious wakeup\n");
+   }
+
+   releaseNestedBuffers( &ctx->nested, true );
+
+   if ( ctx->nested.dispWayland )
+   {
+      wl_display_flush_clients( ctx->nested.dispWayland );
+   }
+
+   return 0;
+}
+
+static void waylandNestedRole( AppCtx *ctx )
+{
+   using namespace waylandNested;
+
+   struct wl_display *dispWayland= 0;
+   struct wl_registry *registry= 0;
+   int rc;
+
+   dispWayland= waylandConnect( ctx->displayName );
+   printf("waylandNestedRole: dispWayland %p from name %s\n", dispWayland, ctx->displayName);
+   if ( !dispWayland )
+   {
+      printf("Error: waylandNestedRole: failed to connect to display\n");
+      goto exit;
+   }
+   ctx->nested.upstreamDisplay= dispWayland;
+   gUpstreamFd= wl_display_get_fd( dispWayland );
+
+   registry= wl_display_get_registry(dispWayland);
+   if ( !registry )
+   {
+      printf("Error: waylandNestedRole: failed tp get wayland registry\n");
+      goto exit;
+   }
+
+   wl_registry_add_listener(registry, &registryListener, &ctx->nested);
+
+   wl_display_roundtrip( dispWayland );
+
+   if ( !ctx->nested.compositor )
+   {
+      printf("Error: waylandNestedRole: failed to obtain wayland compositor\n");
+      goto exit;
+   }
+
+   ctx->nested.eglServer.useWayland= true;
+   ctx->nested.eglServer.dispWayland= dispWayland;
+   if ( !initEGL( &ctx->nested.eglServer ) )
+   {
+      printf("Error: waylandNestedRole: failed to setup EGL\n");
+      goto exit;
+   }
+
+   ctx->nested.surface= wl_compositor_create_surface(ctx->nested.compositor);
+   if ( !ctx->nested.surface )
+   {
+      printf("Error: waylandNestedRole: failed to create wayland surface\n");
+      goto exit;
+   }
+   setOpaqueRegion( &ctx->nested, ctx->nested.surface, ctx->windowWidth, ctx->windowHeight );
+
+   ctx->nested.winWayland= wl_egl_window_create(ctx->nested.surface, ctx->windowWidth, ctx->windowHeight);
+   if ( !ctx->nested.winWayland )
+   {
+      printf("Error: waylandNestedRole: failed to create wayland window\n");
+      goto exit;
+   }
+
+   ctx->nested.eglServer.eglSurface= eglCreateWindowSurface( ctx->nested.eglServer.eglDisplay,
+                                                      ctx->nested.eglServer.eglConfig,
+                                                      (EGLNativeWindowType)ctx->nested.winWayland,
+                                                      NULL );
+   if ( ctx->nested.eglServer.eglSurface == EGL_NO_SURFACE )
+   {
+      printf("Error: waylandNestedRole: failed to create EGL surface\n");
+      goto exit;
+   }
+
+   eglMakeCurrent( ctx->nested.eglServer.eglDisplay, ctx->nested.eglServer.eglSurface,
+                   ctx->nested.eglServer.eglSurface, ctx->nested.eglServer.eglContext );
+
+   eglSwapInterval( ctx->nested.eglServer.eglDisplay, ctx->swapInterval );
+
+   if ( !initGL( &ctx->nested ) )
+   {
+      printf("Error: waylandNestedRole: initGL failed\n");
+   }
+
+   if ( !initWayland( &ctx->nested, ctx->nestedDisplayName ) )
+   {
+      printf("Error: waylandNestedRole: initWayland failed\n");
+      goto exit;
+   }
+
+   if ( ctx->canRemoteClone )
+   {
+      if ( !ctx->remoteBegin( ctx->nested.dispWayland, dispWayland ) )
+      {
+         printf("Error: waylandNestedRole: remoteBegin failure\n");
+         ctx->canRemoteClone= false;
+         goto exit;
+      }
+      ctx->nested.releaseQueue= 0;
+      ctx->nested.releaseEventFd= eventfd( 0, EFD_CLOEXEC|EFD_NONBLOCK );
+      if ( ctx->nested.releaseEventFd < 0 )
+      {
+         printf("Error: waylandNestedRole: unable to create release eventfd\n");
+         goto exit;
+      }
+      ctx->nested.releaseEventSource= wl_event_loop_add_fd( wl_display_get_event_loop(ctx->nested.dispWayland),
+                                                            ctx->nested.releaseEventFd,
+                                                            WL_EVENT_READABLE,
+                                                            nestedReleaseEvent,
+                                                            ctx );
+      if ( !ctx->nested.releaseEventSource )
+      {
+         printf("Error: waylandNestedRole: unable to add release eventfd to event loop\n");
+         goto exit;
+      }
+      rc= pthread_create( &ctx->nestedDispatchThreadId, NULL, waylandNestedDispatchThread, ctx );
+      if ( rc )
+      {
+         printf("Error: waylandNestedRole: failed to start nested dispatch thread\n");
+      }
+      ctx->nested.isRepeater= true;
+   }
+
+   ctx->client.upstreamDisplayName= ctx->nestedDisplayName;
+   __atomic_store_n( &ctx->nested.childActive, true, __ATOMIC_RELEASE );
+   rc= pthread_create( &ctx->clientThreadId, NULL, waylandClientThread, ctx );
+   if ( !rc )
+   {
+      AllocSnapshot allocStart;
+      SocketSnapshot socketStart;
+
+      ctx->nested.frameCount= 0;
+      metricsReset( &ctx->nested.metrics, ctx );
+      protocolStatsReset( &ctx->nested );
+      getSocketSnapshot( &socketStart );
+      getAllocSnapshot( ctx, &allocStart );
+      allocCountingBegin();
+
+      wl_display_run( ctx->nested.dispWayland );
+
+      allocCountingEnd();
+
+      waylandDrainUntilExit( &ctx->nested, ctx->clientThreadId );
+
+      reportAllocations( ctx, &ctx->nested, &allocStart );
+      reportProtocol( ctx, ctx->nested.name, ctx->nested.frameCount, &ctx->nested.protocol, &socketStart );
+      reportRoleMetrics( ctx, &ctx->nested );
+   }
+
+exit:
+   eglMakeCurrent( ctx->nested.eglServer.eglDisplay, EGL_NO_CONTEXT, EGL_NO_SURFACE, EGL_NO_SURFACE );
+
+   if ( ctx->nested.eglServer.eglSurface != EGL_NO_SURFACE )
+   {
+      termGL( &ctx->nested );
+
+      eglDestroySurface( ctx->nested.eglServer.eglDisplay, ctx->nested.eglServer.eglSurface );
+      ctx->nested.eglServer.eglSurface= EGL_NO_SURFACE;
+   }
+
+   if ( ctx->nested.isRepeater )
+   {
+      // The client is gone so anything still queued can only be discarded
+      releaseNestedBuffers( &ctx->nested, false );
+
+      if ( ctx->nested.releaseCount && ctx->pReport )
+      {
+         fprintf(ctx->pReport, "Repeater buffer release latency (upstream release to client release): count %d avg %lld us max %lld us\n",
+                 ctx->nested.releaseCount,
+                 ctx->nested.releaseLatencyTotal/ctx->nested.releaseCount,
+                 ctx->nested.releaseLatencyMax );
+      }
+   }
+
+   if ( ctx->nested.releaseEventSource )
+   {
+      wl_event_source_remove( ctx->nested.releaseEventSource );
+      ctx->nested.releaseEventSource= 0;
+   }
+
+   if ( ctx->nested.releaseEventFd >= 0 )
+   {
+      close( ctx->nested.releaseEventFd );
+      ctx->nested.releaseEventFd= -1;
+   }
+
+   if ( ctx->canRemoteClone )
+   {
+      ctx->remoteEnd( ctx->nested.dispWayland, dispWayland );
+   }
+
+   termWayland( &ctx->nested );
+
+   if ( ctx->nested.surface )
+   {
+      wl_surface_destroy( ctx->nested.surface );
+      ctx->nested.surface= 0;
+   }
+
+   if ( ctx->nested.control )
+   {
+      wl_proxy_destroy( ctx->nested.control );
+      ctx->nested.control= 0;
+   }
+
+   if ( ctx->nested.compositor )
+   {
+      wl_compositor_destroy( ctx->nested.compositor );
+      ctx->nested.compositor= 0;
+   }
+
+   if ( ctx->nested.winWayland )
+   {
+      wl_egl_window_destroy( ctx->nested.winWayland );
+      ctx->nested.winWayland= 0;
+   }
+
+   if ( registry )
+   {
+      wl_registry_destroy(registry);
+      registry= 0;
+   }
+
+   if ( dispWayland )
+   {
+      // Make sure the compositor has processed the surface destroy before
+      // disconnecting: a hang up discards any requests it has not yet read
+      waylandSync( dispWayland );
+      wl_display_disconnect( dispWayland );
+      dispWayland= 0;
+   }
+}
+
+static void* waylandNestedThread( void *arg )
+{
+   using namespace waylandNested;
+
+   AppCtx *ctx= (AppCtx*)arg;
+   ChildCommand cmd;
+
+   fflush( ctx->pReport );
+   if ( ctx->pResults )
+   {
+      fflush( ctx->pResults );
+   }
+
+   memset( &cmd, 0, sizeof(cmd) );
+   commandAppend( &cmd, "waymetric --role-wayland-nested --iterations %d", ctx->maxIterations );
+   appendRunParameters( ctx, &cmd );
+   if ( !ctx->renderWayland )
+   {
+      commandAppend( &cmd, " --no-wayland-render" );
+   }
+   if ( ctx->canRemoteClone )
+   {
+      commandAppend( &cmd, " --repeater" );
+   }
+   appendChildOptions( &cmd );
+   appendResultsOptions( ctx, &cmd );
+   appendRoleControls( ctx, &cmd );
+   runChildCommand( "waylandNestedThread", &cmd );
+
+   __atomic_store_n( &ctx->master.childActive, false, __ATOMIC_RELEASE );
+
+   fseek( ctx->pReport, 0LL, SEEK_END );
+   if ( ctx->pResults )
+   {
+      fseek( ctx->pResults, 0LL, SEEK_END );
+   }
+
+   return NULL;
+}
+
+static void reportDisplayInfo( AppCtx *ctx, const char *role )
+{
+   PlatformDisplayInfo info;
+
+   if ( PlatformGetDisplayInfo( ctx->platformCtx, &info ) )
+   {
+      fprintf(ctx->pReport, "Display: window %dx%d mode %dx%d refresh %.3f Hz%s\n",
+              ctx->windowWidth, ctx->windowHeight, info.modeWidth, info.modeHeight,
+              info.refreshMilliHz/1000.0, (info.scaled ? " (scaled to mode)" : "") );
+      resultValue( ctx, role, 0, "mode_width", info.modeWidth );
+      resultValue( ctx, role, 0, "mode_height", info.modeHeight );
+      resultValue( ctx, role, 0, "refresh_hz", info.refreshMilliHz/1000.0 );
+      resultValue( ctx, role, 0, "scaled", info.scaled ? 1 : 0 );
+   }
+}
+
+static void measureWaylandEGL( AppCtx *ctx, EGLCtx *eglCtx )
+{
+   int rc;
+   void *nativeWindow= 0;
+
+   if ( ctx->renderWayland )
+   {
+      nativeWindow= PlatformCreateNativeWindow( ctx->platformCtx, ctx->windowWidth, ctx->windowHeight );
+      if ( nativeWindow )
+      {
+         updateRefreshPeriod( ctx );
+         eglCtx->eglSurface= eglCreateWindowSurface( eglCtx->eglDisplay,
+                                                     eglCtx->eglConfig,
+                                                     (EGLNativeWindowType)nativeWindow,
+                                                     NULL );
+         if ( eglCtx->eglSurface != EGL_NO_SURFACE )
+         {
+            eglMakeCurrent( eglCtx->eglDisplay, eglCtx->eglSurface, eglCtx->eglSurface, eglCtx->eglContext );
+
+            eglSwapInterval( eglCtx->eglDisplay, ctx->swapInterval );
+
+            if ( !initGL( &ctx->master ) )
+            {
+               printf("Error: measureWaylandEGL: initGL failed\n");
+            }
+         }
+         else
+         {  
+            printf("Error: measureWaylandEGL: failed to create EGL surface\n");
+         }
+      }
+      else
+      {
+         printf("Error: measureWaylandEGL: failed to create native window\n");
+      }
+   }
+
+   ctx->client.upstreamDisplayName= ctx->displayName;
+   ++gTrace.run;
+   __atomic_store_n( &ctx->master.childActive, true, __ATOMIC_RELEASE );
+   rc= pthread_create( &ctx->clientThreadId, NULL, waylandClientThread, ctx );
+   if ( !rc )
+   {
+      AllocSnapshot allocStart;
+      SocketSnapshot socketStart;
+
+      ctx->master.frameCount= 0;
+      metricsReset( &ctx->master.metrics, ctx );
+      protocolStatsReset( &ctx->master );
+      getSocketSnapshot( &socketStart );
+      getAllocSnapshot( ctx, &allocStart );
+      allocCountingBegin();
+
+      wl_display_run( ctx->master.dispWayland );
+
+      allocCountingEnd();
+
+      waylandDrainUntilExit( &ctx->master, ctx->clientThreadId );
+      ctx->waylandTotal= readResult();
+
+      reportAllocations( ctx, &ctx->master, &allocStart );
+      reportProtocol( ctx, ctx->master.name, ctx->master.frameCount, &ctx->master.protocol, &socketStart );
+      reportRoleMetrics( ctx, &ctx->master );
+   }
+
+   if ( ctx->renderWayland )
+   {
+      eglMakeCurrent( eglCtx->eglDisplay, EGL_NO_CONTEXT, EGL_NO_SURFACE, EGL_NO_SURFACE );
+
+      if ( eglCtx->eglSurface != EGL_NO_SURFACE )
+      {
+         termGL( &ctx->master );
+
+         eglDestroySurface( eglCtx->eglDisplay, eglCtx->eglSurface );
+         eglCtx->eglSurface= EGL_NO_SURFACE;
+      }
+
+      if ( nativeWindow )
+      {
+         reportDisplayInfo( ctx, ctx->master.name );
+         PlatformDestroyNativeWindow( ctx->platformCtx, nativeWindow );
+      }
+   }
+}
+
+static const char *gSwapStageNames[PLATFORM_SWAP_STAGE_COUNT]=
+{
+   "swap",
+   "lock",
+   "addfb",
+   "build",
+   "commit",
+   "release",
+   "total"
+};
+
+// Upper bound in us of the histogram bucket holding the given percentile
+static long long swapStatsPercentile( PlatformSwapStats *stats, int stage, int percent )
+{
+   int i, count, target;
+
+   target= (stats->count*percent+99)/100;
+   count= 0;
+   for( i= 0; i < PLATFORM_SWAP_HIST_BUCKETS; ++i )
+   {
+      count += stats->hist[stage][i];
+      if ( count >= target )
+      {
+         break;
+      }
+   }
+
+   return (1LL<<i);
+}
+
+static void reportSwapStats( AppCtx *ctx, int step, PlatformSwapStats *stats, bool haveStats )
+{
+   char key[32];
+   double meanUs;
+   int i, j;
+
+   if ( !haveStats || (stats->count == 0) )
+   {
+      return;
+   }
+
+   // The interposer work is everything after the real eglSwapBuffers returns;
+   // it is part of the direct baseline but is not done by a wayland client
+   fprintf(ctx->pReport, "direct swap interposer: frames %d overhead per frame %.1f us (%.1f%% of swap)\n",
+           stats->count,
+           (double)(stats->totalNs[PLATFORM_SWAP_STAGE_TOTAL]-stats->totalNs[PLATFORM_SWAP_STAGE_SWAP])/(1000.0*stats->count),
+           stats->totalNs[PLATFORM_SWAP_STAGE_TOTAL] ?
+              100.0*(stats->totalNs[PLATFORM_SWAP_STAGE_TOTAL]-stats->totalNs[PLATFORM_SWAP_STAGE_SWAP])/stats->totalNs[PLATFORM_SWAP_STAGE_TOTAL] : 0.0 );
+   for( i= 0; i < PLATFORM_SWAP_STAGE_COUNT; ++i )
+   {
+      meanUs= stats->totalNs[i]/(1000.0*stats->count);
+      fprintf(ctx->pReport, "direct swap %-7s mean %8.1f us p50 <%lld us p99 <%lld us max %8.1f us hist:",
+              gSwapStageNames[i], meanUs,
+              swapStatsPercentile( stats, i, 50 ),
+              swapStatsPercentile( stats, i, 99 ),
+              stats->maxNs[i]/1000.0 );
+      for( j= 0; j < PLATFORM_SWAP_HIST_BUCKETS; ++j )
+      {
+         if ( stats->hist[i][j] )
+         {
+            fprintf(ctx->pReport, " <%lld:%d", (1LL<<j), stats->hist[i][j]);
+         }
+      }
+      fprintf(ctx->pReport, "\n");
+      snprintf( key, sizeof(key), "swap_%s_us", gSwapStageNames[i] );
+      resultValue( ctx, "direct", step, key, meanUs );
+   }
+}
+
+static void measureDirectEGL( AppCtx *ctx, EGLCtx *eglCtx )
+{
+   void *nativeWindow= 0;
+   long long time1, time2, diff, frameTime;
+   int step;
+
+   nativeWindow= PlatformCreateNativeWindow( ctx->platformCtx, ctx->windowWidth, ctx->windowHeight );
+   if ( nativeWindow )
+   {
+      updateRefreshPeriod( ctx );
+      eglCtx->eglSurface= eglCreateWindowSurface( eglCtx->eglDisplay,
+                                                  eglCtx->eglConfig,
+                                                  (EGLNativeWindowType)nativeWindow,
+                                                  NULL );
+      if ( eglCtx->eglSurface != EGL_NO_SURFACE )
+      {
+         GLfloat r, g, b, t;
+
+         eglMakeCurrent( eglCtx->eglDisplay, eglCtx->eglSurface, eglCtx->eglSurface, eglCtx->eglContext );
+
+         eglSwapInterval( eglCtx->eglDisplay, ctx->swapInterval );
+
+         // The first frame pays for buffer allocation and, on DRM, the modeset
+         time1= getCurrentTimeMicro();
+         glClearColor( 0, 0, 0, 1 );
+         glClear( GL_COLOR_BUFFER_BIT );
+         eglSwapBuffers( eglCtx->eglDisplay, eglCtx->eglSurface );
+         time2= getCurrentTimeMicro();
+         warmupRun( ctx, &ctx->warmup, eglCtx->eglDisplay, eglCtx->eglSurface, time2-time1 );
+
+         r= 0;
+         g= 1;
+         b= 0;
+         step= ctx->pacingStep;
+         metricsStepBegin( &ctx->master.metrics, step, 0 );
+         PlatformGetSwapStats( ctx->platformCtx, 0, true );
+         time1= getCurrentTimeMicro();
+         frameTime= time1;
+         ctx->frameSampleCount= 0;
+         for( int i= 0; i < ctx->maxIterations; ++i )
+         {
+            long long traceStart= traceTime();
+            t= r;
+            r= g;
+            g= b;
+            b= t;
+            glClearColor( r, g, b, 1 );
+            glClear( GL_COLOR_BUFFER_BIT );
+            if ( ctx->pacingDelay )
+            {
+               usleep( ctx->pacingDelay );
+            }            
+            traceSlice( "direct-render", traceStart, i+1, 0 );
+            traceStart= traceTime();
+            eglSwapBuffers( eglCtx->eglDisplay, eglCtx->eglSurface );
+            traceSlice( "direct-swap", traceStart, i+1, 0 );
+            jankFrame( ctx, &ctx->master.metrics.steps[step].jank, recordFrameSample( ctx, &frameTime ) );
+         }
+         time2= getCurrentTimeMicro();
+         ctx->haveDirectSwapStats= PlatformGetSwapStats( ctx->platformCtx, &ctx->directSwapStats, false );
+         metricsStepEnd( &ctx->master.metrics, ctx->maxIterations );
+         if ( step == 0 )
+         {
+            reportDisplayInfo( ctx, "direct" );
+         }
+
+         glClearColor( 0, 0, 0, 1 );
+         glClear( GL_COLOR_BUFFER_BIT );
+         eglSwapBuffers( eglCtx->eglDisplay, eglCtx->eglSurface );
+
+         diff= (time2-time1);
+         ctx->directEGLIterationCount += ctx->maxIterations;
+         ctx->directEGLTimeTotal += diff;
+         if ( ctx->directEGLIterationCount )
+         {
+            ctx->directEGLFPS= ((double)(ctx->directEGLIterationCount*1000000.0)) / (double)(ctx->directEGLTimeTotal);
+         }
+
+         eglMakeCurrent( eglCtx->eglDisplay, EGL_NO_CONTEXT, EGL_NO_SURFACE, EGL_NO_SURFACE );
+
+         eglDestroySurface( eglCtx->eglDisplay, eglCtx->eglSurface );
+         eglCtx->eglSurface= EGL_NO_SURFACE;
+      }
+      else
+      {
+         printf("Error: measureDirectEGL: eglSurface %p eglGetError %X\n", eglCtx->eglSurface, eglGetError());
+      }
+
+      PlatformDestroyNativeWindow( ctx->platformCtx, nativeWindow );
+   }
+}
+
+static long long measureDirectSweep( AppCtx *ctx )
+{
+   long long directTotal= 0;
+   int step;
+
+   metricsReset( &ctx->master.metrics, ctx );
+   ctx->pacingDelay= ctx->pacingStart;
+   for( step= 0; step < ctx->pacingSteps; ++step  )
+   {
+      fprintf(ctx->pReport, "\n");
+      fprintf(ctx->pReport, "%d) pacing %d us\n", step+1, ctx->pacingDelay);
+      printf("%d) pacing %d us\n", step+1, ctx->pacingDelay);
+
+      ctx->directEGLIterationCount= 0;
+      ctx->directEGLTimeTotal= 0;
+      ctx->pacingStep= step;
+      measureDirectEGL( ctx, &ctx->master.eglServer );
+
+      fprintf(ctx->pReport, "Iterations: %d Total time (us): %lld  FPS: %f\n", 
+              ctx->directEGLIterationCount, ctx->directEGLTimeTotal, ctx->directEGLFPS );
+      reportWarmup( ctx, "direct", step+1, &ctx->warmup );
+      reportStepMetrics( ctx->pReport, "direct", &ctx->master.metrics.steps[step] );
+      resultStepJank( ctx, "direct", step+1, &ctx->master.metrics.steps[step] );
+      resultStepProtocol( ctx, "direct", step+1, &ctx->master.metrics.steps[step] );
+      reportSwapStats( ctx, step+1, &ctx->directSwapStats, ctx->haveDirectSwapStats );
+      resultValue( ctx, "direct", step+1, "frames", ctx->directEGLIterationCount );
+      resultValue( ctx, "direct", step+1, "time_us", ctx->directEGLTimeTotal );
+      resultValue( ctx, "direct", step+1, "fps", ctx->directEGLFPS );
+      resultSamples( ctx, "direct", step+1 );
+
+      fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+
+      directTotal += ctx->directEGLTimeTotal;
+
+      ctx->pacingDelay += ctx->pacingIncrement;
+   }
+   reportRoleMemory( ctx->pReport, "direct", &ctx->master.metrics );
+
+   return directTotal;
+}
+
+static void measureWaylandNested( AppCtx *ctx, EGLCtx *eglCtx )
+{
+   int rc;
+   void *nativeWindow= 0;
+
+   if ( ctx->renderWayland )
+   {
+      nativeWindow= PlatformCreateNativeWindow( ctx->platformCtx, ctx->windowWidth, ctx->windowHeight );
+      if ( nativeWindow )
+      {
+         updateRefreshPeriod( ctx );
+         eglCtx->eglSurface= eglCreateWindowSurface( eglCtx->eglDisplay,
+                                                     eglCtx->eglConfig,
+                                                     (EGLNativeWindowType)nativeWindow,
+                                                     NULL );
+         if ( eglCtx->eglSurface != EGL_NO_SURFACE )
+         {
+            eglMakeCurrent( eglCtx->eglDisplay, eglCtx->eglSurface, eglCtx->eglSurface, eglCtx->eglContext );
+
+            eglSwapInterval( eglCtx->eglDisplay, ctx->swapInterval );
+
+            if ( !initGL( &ctx->master ) )
+            {
+               printf("Error: measureWaylandNested: initGL failed\n");
+            }
+         }
+         else
+         {
+            printf("Error: measureWaylandNested: failed to create EGL surface\n");
+         }
+      }
+      else
+      {
+         printf("Error: measureWaylandNested: failed to create native window\n");
+      }
+   }
+
+   ++gTrace.run;
+   __atomic_store_n( &ctx->master.childActive, true, __ATOMIC_RELEASE );
+   rc= pthread_create( &ctx->nestedThreadId, NULL, waylandNestedThread, ctx );
+   if ( !rc )
+   {
+      AllocSnapshot allocStart;
+      SocketSnapshot socketStart;
+
+      ctx->master.frameCount= 0;
+      metricsReset( &ctx->master.metrics, ctx );
+      protocolStatsReset( &ctx->master );
+      getSocketSnapshot( &socketStart );
+      getAllocSnapshot( ctx, &allocStart );
+      allocCountingBegin();
+
+      wl_display_run( ctx->master.dispWayland );
+
+      allocCountingEnd();
+
+      waylandDrainUntilExit( &ctx->master, ctx->nestedThreadId );
+      ctx->waylandTotal= readResult();
+
+      reportAllocations( ctx, &ctx->master, &allocStart );
+      reportProtocol( ctx, ctx->master.name, ctx->master.frameCount, &ctx->master.protocol, &socketStart );
+      reportRoleMetrics( ctx, &ctx->master );
+   }
+
+   if ( ctx->renderWayland )
+   {
+      eglMakeCurrent( eglCtx->eglDisplay, EGL_NO_CONTEXT, EGL_NO_SURFACE, EGL_NO_SURFACE );
+
+      if ( eglCtx->eglSurface != EGL_NO_SURFACE )
+      {
+         termGL( &ctx->master );
+
+         eglDestroySurface( eglCtx->eglDisplay, eglCtx->eglSurface );
+         eglCtx->eglSurface= EGL_NO_SURFACE;
+      }
+
+      if ( nativeWindow )
+      {
+         reportDisplayInfo( ctx, ctx->master.name );
+         PlatformDestroyNativeWindow( ctx->platformCtx, nativeWindow );
+      }
+   }
+}
+
+static void* waylandMultiThread( void *arg )
+{
+   MultiComp *comp= (MultiComp*)arg;
+   AppCtx *ctx= comp->appCtx;
+   bool result;
+
+   comp->started= true;
+
+   printf("multi %d thread started\n", comp->index);
+
+   comp->ctx.appCtx= ctx;
+   comp->ctx.eglServer.appCtx= ctx;
+   comp->ctx.eglServer.useWayland= false;
+   comp->ctx.eglServer.nativeDisplay= PlatformGetEGLDisplayType( ctx->platformCtx );
+   if ( !initEGL( &comp->ctx.eglServer ) )
+   {
+      printf("Error: waylandMultiThread %d failed to setup EGL\n", comp->index);
+      comp->error= true;
+   }
+
+   pthread_mutex_lock( &comp->mutexReady );
+   pthread_mutex_lock( &comp->mutexStart );
+   printf("multi %d thread signal ready\n", comp->index);
+   pthread_cond_signal( &comp->condReady );
+   pthread_mutex_unlock( &comp->mutexReady );
+
+   printf("multi %d thread wait start\n", comp->index);
+   pthread_cond_wait( &comp->condStart, &comp->mutexStart );
+   pthread_mutex_unlock( &comp->mutexStart );
+
+   if ( !comp->error )
+   {
+      result= initWayland( &comp->ctx, (const char*)comp->displayName );
+      if ( result )
+      {
+         printf("multi %d display created and bound\n", comp->index);
+         comp->init= true;
+      }
+      else
+      {
+         comp->error= true;
+      }
+   }
+
+   pthread_mutex_lock( &comp->mutexReady );
+   pthread_mutex_lock( &comp->mutexStart );
+   printf("multi %d thread signal ready\n", comp->index);
+   pthread_cond_signal( &comp->condReady );
+   pthread_mutex_unlock( &comp->mutexReady );
+
+   printf("multi %d thread wait start\n", comp->index);
+   pthread_cond_wait( &comp->condStart, &comp->mutexStart );
+   pthread_mutex_unlock( &comp->mutexStart );
+
+   termWayland( &comp->ctx );
+   printf("multi %d display unbound and destroyed\n", comp->index);
+   comp->term= true;
+
+   termEGL( &comp->ctx.eglServer );
+
+   pthread_mutex_lock( &comp->mutexReady );
+   printf("multi %d thread signal ready\n", comp->index);
+   pthread_cond_signal( &comp->condReady );
+   pthread_mutex_unlock( &comp->mutexReady );
+
+   return NULL;
+}
+
+#define NUM_COMP (4)
+static void testMultipleCompositorsPerProcess( AppCtx *ctx )
+{
+   MultiComp comp[NUM_COMP];
+   int i, rc, multiCount;
+
+   for( i= 0; i < NUM_COMP; ++i )
+   {
+      memset( &comp[i], 0, sizeof(MultiComp) );
+
+      comp[i].appCtx= ctx;
+      comp[i].index= i;
+      pthread_mutex_init( &comp[i].mutexReady, 0 );
+      pthread_cond_init( &comp[i].condReady, 0 );
+      pthread_mutex_init( &comp[i].mutexStart, 0 );
+      pthread_cond_init( &comp[i].condStart, 0 );
+
+      sprintf( comp[i].displayName, "waymetric-multi%d", i );
+
+      pthread_mutex_lock( &comp[i].mutexReady );
+      rc= pthread_create( &comp[i].threadId, NULL, waylandMultiThread, &comp[i] );
+      if ( !rc )
+      {
+         printf("control wait for %d ready\n", i);
+         pthread_cond_wait( &comp[i].condReady, &comp[i].mutexReady );
+      }
+      else
+      {
+         printf("Error: testMultipleCompositorsPerProcess: failed to start test thread for instance %d\n", i);
+      }
+      pthread_mutex_unlock( &comp[i].mutexReady );
+   }
+
+   for( i= 0; i < NUM_COMP; ++i )
+   {
+      if ( comp[i].started )
+      {
+         // signal to create and bind display
+         pthread_mutex_lock( &comp[i].mutexStart );
+         printf("control signal for %d start\n", i);
+         pthread_cond_signal( &comp[i].condStart );
+         pthread_mutex_unlock( &comp[i].mutexStart );
+
+         // wait till display creation confirmed
+         pthread_mutex_lock( &comp[i].mutexReady );
+         printf("control wait for %d ready\n", i);
+         pthread_cond_wait( &comp[i].condReady, &comp[i].mutexReady );
+         pthread_mutex_unlock( &comp[i].mutexReady );
+      }
+   }
+
+   for( i= 0; i < NUM_COMP; ++i )
+   {
+      if ( comp[i].started )
+      {
+         // signal to unbind and destroy display
+         pthread_mutex_lock( &comp[i].mutexStart );
+         printf("control signal for %d start\n", i);
+         pthread_cond_signal( &comp[i].condStart );
+         pthread_mutex_unlock( &comp[i].mutexStart );
+
+         // wait till display destruction confirmed
+         pthread_mutex_lock( &comp[i].mutexReady );
+         printf("control wait for %d ready\n", i);
+         pthread_cond_wait( &comp[i].condReady, &comp[i].mutexReady );
+         pthread_mutex_unlock( &comp[i].mutexReady );
+      }
+   }
+
+   multiCount= 0;
+   for( i= 0; i < NUM_COMP; ++i )
+   {
+      if ( comp[i].started &&
+           comp[i].init &&
+           comp[i].term &&
+           !comp[i].error )
+      {
+         multiCount += 1;
+      }
    }
+   fprintf(ctx->pReport, "Successful multiple compositor instances: %d out of %d\n", multiCount, NUM_COMP);
+}
 
-   ctx->client.surface= wl_compositor_create_surface(ctx->client.compositor);
-   if ( !ctx->client.surface )
-   {
-      printf("Error: roleWaylandClient: failed to create wayland surface\n");
-      goto exit;
-   }
+static void checkForRepeaterSupport( AppCtx *ctx )
+{
+   void *module= 0;
 
-   ctx->client.winWayland= wl_egl_window_create(ctx->client.surface, ctx->windowWidth, ctx->windowHeight);
-   if ( !ctx->client.winWayland )
+   module= dlopen( "libwayland-egl.so.0", RTLD_NOW );
+   if ( !module )
    {
-      printf("Error: roleWaylandClient: failed to create wayland window\n");
-      goto exit;
+      module= dlopen( "libwayland-egl.so.1", RTLD_NOW );
+      if ( !module )
+      {
+         module= dlopen( "libwayland-egl.so", RTLD_NOW );
+      }
    }
-
-   ctx->client.eglClient.eglSurface= eglCreateWindowSurface( ctx->client.eglClient.eglDisplay,
-                                                      ctx->client.eglClient.eglConfig,
-                                                      (EGLNativeWindowType)ctx->client.winWayland,
-                                                      NULL );
-   if ( ctx->client.eglClient.eglSurface == EGL_NO_SURFACE )
+   if ( module )
    {
-      printf("Error: roleWaylandClient: failed to create EGL surface\n");
-      goto exit;
-   }
+      ctx->remoteBegin= (PFNREMOTEBEGIN)dlsym( module, "wl_egl_remote_begin" );
+      ctx->remoteEnd= (PFNREMOTEEND)dlsym( module, "wl_egl_remote_end" );
+      ctx->remoteCloneBufferFromResource= (PFNREMOTECLONEBUFFERFROMRESOURCE)dlsym( module, "wl_egl_remote_buffer_clone" );
 
-   eglMakeCurrent( ctx->client.eglClient.eglDisplay, ctx->client.eglClient.eglSurface,
-                   ctx->client.eglClient.eglSurface, ctx->client.eglClient.eglContext );
+      if ( (ctx->remoteBegin != 0) &&
+           (ctx->remoteEnd != 0) &&
+           (ctx->remoteCloneBufferFromResource != 0) )
+      {
+         ctx->canRemoteClone= true;
+      }
 
-   eglSwapInterval( ctx->client.eglClient.eglDisplay, 1 );
+      dlclose( module );
+   }
+}
 
-   glClearColor( 0, 0, 0, 1 );
-   glClear( GL_COLOR_BUFFER_BIT );
-   eglSwapBuffers( ctx->client.eglClient.eglDisplay, ctx->client.eglClient.eglSurface );
-   usleep( 1500000 );
+// Repeat the wayland measurement with the master and client on the same
+// cpu and then on different cpus to show the cost of the cross process handoff
+static void measureAffinitySweep( AppCtx *ctx, long long directTotal, bool noWaylandRender )
+{
+   RoleControl savedMaster, savedClient;
+   cpu_set_t savedMask, mask;
+   const char *section;
+   const char *clientCpu;
+   long long waylandTotal;
+   int pass;
 
-   pacingInc= 1000;
-   maxStep= 17;
-   ctx->pacingDelay= 0;
-   for( step= 0; step <= maxStep; ++step  )
+   if ( sched_getaffinity( 0, sizeof(savedMask), &savedMask ) )
    {
-      fprintf(ctx->pReport, "\n");
-      fprintf(ctx->pReport, "%d) pacing %d us\n", step+1, ctx->pacingDelay);
-      printf("%d) pacing %d us\n", step+1, ctx->pacingDelay);
-
-      ctx->waylandEGLIterationCount= 0;
-      ctx->waylandEGLTimeTotal= 0;
+      printf("Error: measureAffinitySweep: sched_getaffinity failed: errno %d\n", errno);
+      return;
+   }
+   savedMaster= ctx->control[ROLE_MASTER];
+   savedClient= ctx->control[ROLE_CLIENT];
 
-      r= 0;
-      g= 1;
-      b= 0;
-      time1= getCurrentTimeMicro();
-      for( int i= 0; i < ctx->maxIterations; ++i )
+   for( pass= 0; pass < 2; ++pass )
+   {
+      if ( pass == 0 )
       {
-         t= r;
-         r= g;
-         g= b;
-         b= t;
-         glClearColor( r, g, b, 1 );
-         glClear( GL_COLOR_BUFFER_BIT );
-         if ( ctx->pacingDelay )
+         section= "wayland-same-cpu";
+         clientCpu= "0";
+      }
+      else
+      {
+         if ( sysconf( _SC_NPROCESSORS_ONLN ) < 2 )
          {
-            usleep( ctx->pacingDelay );
+            fprintf(ctx->pReport, "Skipping split cpu pass: only one cpu online\n");
+            break;
          }
-         eglSwapBuffers( ctx->client.eglClient.eglDisplay, ctx->client.eglClient.eglSurface );
+         section= "wayland-split-cpu";
+         clientCpu= "1";
       }
-      time2= getCurrentTimeMicro();
 
-      diff= (time2-time1);
-      ctx->waylandEGLIterationCount += ctx->maxIterations;
-      ctx->waylandEGLTimeTotal += diff;
-      if ( ctx->waylandEGLIterationCount )
+      fprintf(ctx->pReport, "\n");
+      fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+      fprintf(ctx->pReport, "Measuring Wayland (master cpu 0, client cpu %s)...\n", clientCpu);
+      printf("\nMeasuring Wayland (master cpu 0, client cpu %s)...\n", clientCpu);
+
+      ctx->control[ROLE_MASTER].cpuList= "0";
+      ctx->control[ROLE_CLIENT].cpuList= clientCpu;
+      CPU_ZERO( &mask );
+      CPU_SET( 0, &mask );
+      if ( sched_setaffinity( 0, sizeof(mask), &mask ) )
       {
-         ctx->waylandEGLFPS= ((double)(ctx->waylandEGLIterationCount*1000000.0)) / (double)(ctx->waylandEGLTimeTotal);
+         fprintf(ctx->pReport, "unable to set cpu affinity 0: %s\n", strerror(errno));
+         break;
       }
 
-      fprintf(ctx->pReport, "Iterations: %d Total time (us): %lld  FPS: %f\n",
-              ctx->waylandEGLIterationCount, ctx->waylandEGLTimeTotal, ctx->waylandEGLFPS );
-
-      fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+      ctx->section= section;
+      ctx->waylandTotal= 0;
+      ctx->renderWayland= !noWaylandRender;
+      measureWaylandEGL( ctx, &ctx->master.eglServer );
 
-      ctx->pacingDelay += pacingInc;
-      ctx->waylandTotal += ctx->waylandEGLTimeTotal;
+      waylandTotal= ctx->waylandTotal;
+      if ( waylandTotal == 0 )
+      {
+         fprintf(ctx->pReport, "Wayland failed\n");
+      }
+      else if ( directTotal > 0 )
+      {
+         fprintf(ctx->pReport, "\n");
+         fprintf(ctx->pReport, "=================================================================\n");
+         fprintf(ctx->pReport, "waymetric %s speed index: %f\n", section, ((double)waylandTotal / (double)directTotal) );
+         resultValue( ctx, ctx->master.name, 0, "speed_index", ((double)waylandTotal / (double)directTotal) );
+         fprintf(ctx->pReport, "=================================================================\n");
+      }
    }
 
-   glClearColor( 0, 0, 0, 1 );
-   glClear( GL_COLOR_BUFFER_BIT );
-   eglSwapBuffers( ctx->client.eglClient.eglDisplay, ctx->client.eglClient.eglSurface );
-   usleep( 1500000 );
+   sched_setaffinity( 0, sizeof(savedMask), &savedMask );
+   ctx->control[ROLE_MASTER]= savedMaster;
+   ctx->control[ROLE_CLIENT]= savedClient;
+   ctx->section= "wayland";
+}
 
-exit:
-   writeResult( ctx->waylandTotal );
+// Render continuously through the master compositor, publishing rolling
+// frame interval and memory statistics for both processes
+static void measureSoak( AppCtx *ctx, bool noWaylandRender )
+{
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+   fprintf(ctx->pReport, "Soaking Wayland for %d s at pacing %d us, stats every %d s in shm %s\n",
+           ctx->soakSeconds, ctx->soakPacing, ctx->soakInterval, SOAK_PAGE_NAME);
+   printf("\nSoaking Wayland for %d s...\n", ctx->soakSeconds);
 
-   if ( ctx->client.surface )
+   ctx->soakPage= soakPageOpen( true );
+   if ( !soakInit( &ctx->master, SOAK_SLOT_MASTER ) )
    {
-      wl_surface_destroy( ctx->client.surface );
-      ctx->client.surface= 0;
+      goto exit;
    }
 
-   if ( ctx->client.compositor )
+   ctx->section= "soak";
+   ctx->waylandTotal= 0;
+   ctx->renderWayland= !noWaylandRender;
+   measureWaylandEGL( ctx, &ctx->master.eglServer );
+
+   soakReport( &ctx->master );
+   soakTerm( &ctx->master );
+
+exit:
+   soakPageClose( ctx->soakPage, true );
+   ctx->soakPage= 0;
+}
+
+#define RESULT_NAME_LEN (32)
+
+typedef struct _ResultGroup
+{
+   char section[RESULT_NAME_LEN];
+   char role[RESULT_NAME_LEN];
+   int step;
+   int count;
+   int capacity;
+   double *samples;
+} ResultGroup;
+
+typedef struct _ResultScalar
+{
+   char section[RESULT_NAME_LEN];
+   char role[RESULT_NAME_LEN];
+   int step;
+   char key[RESULT_NAME_LEN];
+   double value;
+} ResultScalar;
+
+typedef struct _ResultSet
+{
+   int groupCount;
+   int groupCapacity;
+   ResultGroup *groups;
+   int scalarCount;
+   int scalarCapacity;
+   ResultScalar *scalars;
+} ResultSet;
+
+// True if both paths name the same file, so writing one would replace the other
+static bool sameFile( const char *path1, const char *path2 )
+{
+   struct stat st1, st2;
+
+   if ( !strcmp( path1, path2 ) )
    {
-      wl_compositor_destroy( ctx->client.compositor );
-      ctx->client.compositor= 0;
+      return true;
    }
-
-   //TODO: why does this crash on some devices?
-   if ( strcmp( ctx->eglVendor, "ARM" ) !=  0 )
+   if ( stat( path1, &st1 ) || stat( path2, &st2 ) )
    {
-      termEGL( &ctx->client.eglClient );
+      return false;
    }
+   return (st1.st_dev == st2.st_dev) && (st1.st_ino == st2.st_ino);
+}
 
-   if ( ctx->client.winWayland )
+// Make room for one more entry.  On failure the array is left as it was so
+// the caller can still free it.
+static bool growArray( void **array, int *capacity, int count, size_t size )
+{
+   void *grown;
+   int newCapacity;
+
+   if ( count < *capacity )
    {
-      wl_egl_window_destroy( ctx->client.winWayland );
-      ctx->client.winWayland= 0;
+      return true;
    }
-
-   if ( registry )
+   newCapacity= (*capacity ? *capacity*2 : 64);
+   grown= realloc( *array, newCapacity*size );
+   if ( !grown )
    {
-      wl_registry_destroy(registry);
-      registry= 0;
+      return false;
    }
+   *array= grown;
+   *capacity= newCapacity;
+   return true;
+}
 
-   if ( ctx->client.upstreamDisplayName == ctx->nestedDisplayName )
+static ResultGroup *resultSetFindGroup( ResultSet *set, const char *section, const char *role, int step )
+{
+   for( int i= 0; i < set->groupCount; ++i )
    {
-      if ( ctx->nested.dispWayland )
+      ResultGroup *group= &set->groups[i];
+      if ( (group->step == step) && !strcmp( group->section, section ) && !strcmp( group->role, role ) )
       {
-         wl_display_terminate( ctx->nested.dispWayland );
+         return group;
       }
    }
-   else
+   return 0;
+}
+
+static ResultScalar *resultSetFindScalar( ResultSet *set, const char *section, const char *role, int step, const char *key )
+{
+   for( int i= 0; i < set->scalarCount; ++i )
    {
-      if ( ctx->master.dispWayland )
+      ResultScalar *scalar= &set->scalars[i];
+      if ( (scalar->step == step) && !strcmp( scalar->key, key ) &&
+           !strcmp( scalar->section, section ) && !strcmp( scalar->role, role ) )
       {
-         wl_display_terminate( ctx->master.dispWayland );
+         return scalar;
       }
    }
+   return 0;
+}
 
-   if ( dispWayland )
+static void resultSetTerm( ResultSet *set )
+{
+   for( int i= 0; i < set->groupCount; ++i )
    {
-      wl_display_flush( dispWayland );
-      usleep(100000);
-      wl_display_disconnect( dispWayland );
-      dispWayland= 0;
+      free( set->groups[i].samples );
    }
+   free( set->groups );
+   free( set->scalars );
+   memset( set, 0, sizeof(ResultSet) );
 }
 
-static void* waylandClientThread( void *arg )
+static bool resultSetLoad( ResultSet *set, const char *filename )
 {
-   using namespace waylandClient;
+   bool result= false;
+   FILE *pFile= 0;
+   char line[256];
+   char section[RESULT_NAME_LEN], role[RESULT_NAME_LEN], key[RESULT_NAME_LEN];
+   int step;
+   double value;
 
-   AppCtx *ctx= (AppCtx*)arg;
-   char work[256];
+   memset( set, 0, sizeof(ResultSet) );
 
-   fflush( ctx->pReport );
+   pFile= fopen( filename, "rt" );
+   if ( !pFile )
+   {
+      printf("Error: resultSetLoad: unable to open %s\n", filename);
+      goto exit;
+   }
 
-   sprintf(work,"waymetric --iterations %d", ctx->maxIterations );
-   if ( ctx->client.upstreamDisplayName == ctx->nestedDisplayName )
+   while( fgets( line, sizeof(line), pFile ) )
    {
-      strcat( work, " --role-wayland-client-nested" );
+      if ( (line[0] == '#') ||
+           (sscanf( line, "%31s %31s %d %31s %lf", section, role, &step, key, &value ) != 5) )
+      {
+         continue;
+      }
+      if ( !strcmp( key, "frame_us" ) )
+      {
+         ResultGroup *group= resultSetFindGroup( set, section, role, step );
+         if ( !group )
+         {
+            if ( !growArray( (void**)&set->groups, &set->groupCapacity, set->groupCount, sizeof(ResultGroup) ) )
+            {
+               printf("Error: resultSetLoad: no memory\n");
+               goto exit;
+            }
+            group= &set->groups[set->groupCount++];
+            memset( group, 0, sizeof(ResultGroup) );
+            strcpy( group->section, section );
+            strcpy( group->role, role );
+            group->step= step;
+         }
+         if ( !growArray( (void**)&group->samples, &group->capacity, group->count, sizeof(double) ) )
+         {
+            printf("Error: resultSetLoad: no memory\n");
+            goto exit;
+         }
+         group->samples[group->count++]= value;
+      }
+      else
+      {
+         ResultScalar *scalar;
+         if ( !growArray( (void**)&set->scalars, &set->scalarCapacity, set->scalarCount, sizeof(ResultScalar) ) )
+         {
+            printf("Error: resultSetLoad: no memory\n");
+            goto exit;
+         }
+         scalar= &set->scalars[set->scalarCount++];
+         strcpy( scalar->section, section );
+         strcpy( scalar->role, role );
+         scalar->step= step;
+         strcpy( scalar->key, key );
+         scalar->value= value;
+      }
    }
-   else
+
+   result= true;
+
+exit:
+   if ( pFile )
    {
-      strcat( work, " --role-wayland-client" );
+      fclose( pFile );
    }
-   if ( !ctx->renderWayland )
+   if ( !result )
    {
-      strcat( work, " --no-wayland-render" );
+      resultSetTerm( set );
    }
-   system(work);
-
-   fseek( ctx->pReport, 0LL, SEEK_END );
 
-   return NULL;
+   return result;
 }
 
-namespace waylandNested
+typedef struct _RankedSample
 {
-static void registryAdd(void *data,
-                        struct wl_registry *registry, uint32_t id,
-                        const char *interface, uint32_t version)
-{
-   WaylandCtx *ctx = (WaylandCtx*)data;
-   int len;
+   double value;
+   int fromBaseline;
+} RankedSample;
 
-   len= strlen(interface);
-   if ( (len==13) && !strncmp(interface, "wl_compositor", len) ) {
-      ctx->compositor= (struct wl_compositor*)wl_registry_bind(registry, id, &wl_compositor_interface, 1);
-   }
+static int compareRankedSamples( const void *a, const void *b )
+{
+   double va= ((const RankedSample*)a)->value;
+   double vb= ((const RankedSample*)b)->value;
+   return (va < vb) ? -1 : ((va > vb) ? 1 : 0);
 }
 
-static void registryRemove(void *, struct wl_registry *, uint32_t)
+static int compareDoubles( const void *a, const void *b )
 {
-   // ignore
+   double va= *((const double*)a);
+   double vb= *((const double*)b);
+   return (va < vb) ? -1 : ((va > vb) ? 1 : 0);
 }
 
-static const struct wl_registry_listener registryListener=
+static double sampleMedian( double *samples, int count )
 {
-   registryAdd,
-   registryRemove
-};
-} // namespace waylandNested
+   qsort( samples, count, sizeof(double), compareDoubles );
+   return (count & 1) ? samples[count/2] : 0.5*(samples[count/2-1]+samples[count/2]);
+}
 
-static void* waylandNestedDispatchThread( void *arg )
+// Two sided Mann-Whitney U test using the normal approximation with tie
+// correction, which is accurate at the hundreds of frames per step used here
+static double mannWhitneyP( double *baseline, int n1, double *current, int n2 )
 {
-   AppCtx *ctx= (AppCtx*)arg;
-   if ( ctx )
+   RankedSample *all;
+   double rankSum, u, mu, sigma, z, tieSum, n;
+   int i, j, total;
+
+   total= n1+n2;
+   all= (RankedSample*)malloc( total*sizeof(RankedSample) );
+   if ( !all )
    {
-      for( ; ; )
+      return 1.0;
+   }
+   for( i= 0; i < n1; ++i )
+   {
+      all[i].value= baseline[i];
+      all[i].fromBaseline= 1;
+   }
+   for( i= 0; i < n2; ++i )
+   {
+      all[n1+i].value= current[i];
+      all[n1+i].fromBaseline= 0;
+   }
+   qsort( all, total, sizeof(RankedSample), compareRankedSamples );
+
+   rankSum= 0;
+   tieSum= 0;
+   for( i= 0; i < total; i= j )
+   {
+      double rank;
+      for( j= i+1; (j < total) && (all[j].value == all[i].value); ++j );
+      // Tied values share the average of the ranks they span
+      rank= 0.5*((i+1)+j);
+      for( int k= i; k < j; ++k )
       {
-         if ( wl_display_dispatch( ctx->nested.upstreamDisplay ) == -1 )
+         if ( all[k].fromBaseline )
          {
-            break;
+            rankSum += rank;
          }
-         wl_display_flush( ctx->nested.upstreamDisplay );
+      }
+      tieSum += (double)(j-i)*(j-i)*(j-i)-(j-i);
+   }
+   free( all );
+
+   n= total;
+   u= rankSum-0.5*n1*(n1+1.0);
+   mu= 0.5*n1*n2;
+   sigma= sqrt( (n1*(double)n2/12.0)*((n+1.0)-tieSum/(n*(n-1.0))) );
+   if ( sigma <= 0 )
+   {
+      return 1.0;
+   }
+   z= (fabs(u-mu)-0.5)/sigma;
+   if ( z < 0 )
+   {
+      z= 0;
+   }
+
+   return erfc( z/sqrt(2.0) );
+}
+
+// Compare this run's results against a baseline results file.  Returns the
+// number of regressions: frame time distributions that shifted significantly
+// and by more than the threshold, or speed indices that grew past it.
+static int compareResults( AppCtx *ctx )
+{
+   ResultSet baseline, current;
+   int regressions= 0;
+   int compared= 0;
+   FILE *pReport= ctx->pReport;
+
+   if ( !resultSetLoad( &baseline, ctx->compareFilename ) )
+   {
+      return -1;
+   }
+   if ( !resultSetLoad( &current, ctx->resultsFilename ) )
+   {
+      resultSetTerm( &baseline );
+      return -1;
+   }
+
+   fprintf(pReport, "\n");
+   fprintf(pReport, "-----------------------------------------------------------------\n");
+   fprintf(pReport, "Comparing with baseline %s (threshold %.1f%% alpha %g)\n",
+           ctx->compareFilename, ctx->compareThreshold, ctx->compareAlpha);
+   fprintf(pReport, "%-10s %-8s %4s %12s %12s %8s %10s %s\n",
+           "section", "role", "step", "base med us", "cur med us", "change", "p", "");
+
+   for( int i= 0; i < current.groupCount; ++i )
+   {
+      ResultGroup *cur= &current.groups[i];
+      ResultGroup *base= resultSetFindGroup( &baseline, cur->section, cur->role, cur->step );
+      double p, baseMedian, curMedian, change;
+      bool regressed;
+
+      if ( !base || (base->count < 2) || (cur->count < 2) )
+      {
+         continue;
+      }
+      p= mannWhitneyP( base->samples, base->count, cur->samples, cur->count );
+      baseMedian= sampleMedian( base->samples, base->count );
+      curMedian= sampleMedian( cur->samples, cur->count );
+      change= (baseMedian > 0) ? 100.0*(curMedian-baseMedian)/baseMedian : 0.0;
+      regressed= (p < ctx->compareAlpha) && (change > ctx->compareThreshold);
+      fprintf(pReport, "%-10s %-8s %4d %12.1f %12.1f %+7.1f%% %10.2g %s\n",
+              cur->section, cur->role, cur->step, baseMedian, curMedian, change, p,
+              regressed ? "REGRESSION" : ((p < ctx->compareAlpha) ? "changed" : "") );
+      ++compared;
+      if ( regressed )
+      {
+         ++regressions;
       }
    }
-   return NULL;
-}
 
-static int nestedDisplayTimeOut( void *data )
-{
-   AppCtx *ctx= (AppCtx*)data;
-   long long frameTime, now;
-   int nextFrameDelay;
+   for( int i= 0; i < current.scalarCount; ++i )
+   {
+      ResultScalar *cur= &current.scalars[i];
+      ResultScalar *base;
+      double change;
+      bool regressed;
 
-   frameTime= getCurrentTimeMillis();
+      if ( strcmp( cur->key, "speed_index" ) )
+      {
+         continue;
+      }
+      base= resultSetFindScalar( &baseline, cur->section, cur->role, cur->step, cur->key );
+      if ( !base || (base->value <= 0) )
+      {
+         continue;
+      }
+      change= 100.0*(cur->value-base->value)/base->value;
+      regressed= (change > ctx->compareThreshold);
+      fprintf(pReport, "%s speed index: baseline %f current %f change %+.1f%% %s\n",
+              cur->section, base->value, cur->value, change, regressed ? "REGRESSION" : "");
+      ++compared;
+      if ( regressed )
+      {
+         ++regressions;
+      }
+   }
 
-   pthread_mutex_lock( &ctx->nested.buffersToReleaseMutex );
-   while( ctx->nested.buffersToRelease.size() )
+   if ( compared == 0 )
    {
-      std::vector<NestedBufferInfo>::iterator it= ctx->nested.buffersToRelease.begin();
-      struct wl_resource *bufferResource= (*it).bufferRemote;
-      wl_buffer_send_release( bufferResource );
-      ctx->nested.buffersToRelease.erase(it);
+      fprintf(pReport, "No matching sections in baseline\n");
    }
-   pthread_mutex_unlock( &ctx->nested.buffersToReleaseMutex );
+   fprintf(pReport, "Regressions: %d\n", regressions);
+   printf("Compared %d results with baseline: %d regressions\n", compared, regressions);
 
-   now= getCurrentTimeMillis();
+   resultSetTerm( &baseline );
+   resultSetTerm( &current );
 
-   nextFrameDelay= (FRAME_PERIOD_MILLIS_60FPS-(now-frameTime));
-   if ( nextFrameDelay < 1 ) nextFrameDelay= 1;
+   return regressions;
+}
 
-   wl_event_source_timer_update( ctx->nested.displayTimer, nextFrameDelay );
+#define SCENARIO_MAX_CASES (64)
+#define SCENARIO_PATH_DIRECT (0)
+#define SCENARIO_PATH_WAYLAND (1)
+#define SCENARIO_PATH_NESTED (2)
+#define SCENARIO_PATH_REPEATER (3)
+#define SCENARIO_PATH_MULTI (4)
 
-   return 0;
-}
+static const char *gScenarioPathNames[]= { "direct", "wayland", "nested", "repeater", "multi" };
 
-static void waylandNestedRole( AppCtx *ctx )
+typedef struct _ScenarioCase
 {
-   using namespace waylandNested;
-
-   struct wl_display *dispWayland= 0;
-   struct wl_registry *registry= 0;
-   int rc;
+   char name[32];
+   char section[48];
+   int path;
+   int width;
+   int height;
+   int iterations;
+   int pacingStart;
+   int pacingIncrement;
+   int pacingSteps;
+   int swapInterval;
+   bool decoupleFrames;
+   bool scanout;
+   int videoFormat;
+   int videoFps;
+   int subsurfaceCount;
+   int subsurfaceOverlap;
+   int clientBuffers;
+   int repeat;
+   long long directTotal;
+   long long total;
+} ScenarioCase;
+
+typedef struct _Scenario
+{
+   int caseCount;
+   bool haveMulti;
+   ScenarioCase cases[SCENARIO_MAX_CASES];
+} Scenario;
 
-   dispWayland= wl_display_connect( ctx->displayName );
-   printf("waylandNestedRole: dispWayland %p from name %s\n", dispWayland, ctx->displayName);
-   if ( !dispWayland )
-   {
-      printf("Error: waylandNestedRole: failed to connect to display\n");
-      goto exit;
-   }
-   ctx->nested.upstreamDisplay= dispWayland;
+static bool scenarioParseCase( AppCtx *ctx, ScenarioCase *c, char *line, int lineNum )
+{
+   char *token, *value, *save= 0;
+   const char *settingKey= 0;
+   bool result= false;
 
-   registry= wl_display_get_registry(dispWayland);
-   if ( !registry )
-   {
-      printf("Error: waylandNestedRole: failed tp get wayland registry\n");
-      goto exit;
+   memset( c, 0, sizeof(ScenarioCase) );
+   c->path= -1;
+   c->width= ctx->windowWidth;
+   c->height= ctx->windowHeight;
+   c->iterations= ctx->maxIterations;
+   c->pacingStart= ctx->pacingStart;
+   c->pacingIncrement= ctx->pacingIncrement;
+   c->pacingSteps= ctx->pacingSteps;
+   c->swapInterval= ctx->swapInterval;
+   c->decoupleFrames= ctx->decoupleFrames;
+   c->scanout= ctx->directScanout;
+   c->videoFormat= ctx->videoFormat;
+   c->videoFps= ctx->videoFps;
+   c->subsurfaceCount= ctx->subsurfaceCount;
+   c->subsurfaceOverlap= ctx->subsurfaceOverlap;
+   c->clientBuffers= ctx->clientBuffers;
+   c->repeat= 1;
+
+   token= strtok_r( line, " \t\r\n", &save );
+   strncpy( c->name, token, sizeof(c->name)-1 );
+   while( (token= strtok_r( 0, " \t\r\n", &save )) )
+   {
+      value= strchr( token, '=' );
+      if ( !value )
+      {
+         printf("Error: scenario line %d: expected key=value: %s\n", lineNum, token);
+         goto exit;
+      }
+      *value++= '\0';
+      if ( strcmp( token, "path" ) && !settingKey )
+      {
+         settingKey= token;
+      }
+      if ( !strcmp( token, "path" ) )
+      {
+         for( int i= 0; i < (int)(sizeof(gScenarioPathNames)/sizeof(gScenarioPathNames[0])); ++i )
+         {
+            if ( !strcmp( value, gScenarioPathNames[i] ) )
+            {
+               c->path= i;
+            }
+         }
+      }
+      else if ( !strcmp( token, "size" ) )
+      {
+         if ( sscanf( value, "%dx%d", &c->width, &c->height ) != 2 )
+         {
+            printf("Error: scenario line %d: bad size: %s\n", lineNum, value);
+            goto exit;
+         }
+      }
+      else if ( !strcmp( token, "iterations" ) )
+      {
+         c->iterations= atoi( value );
+      }
+      else if ( !strcmp( token, "pacing" ) )
+      {
+         if ( !parsePacing( value, &c->pacingStart, &c->pacingIncrement, &c->pacingSteps ) )
+         {
+            printf("Error: scenario line %d: bad pacing: %s\n", lineNum, value);
+            goto exit;
+         }
+      }
+      else if ( !strcmp( token, "swap-interval" ) )
+      {
+         c->swapInterval= atoi( value );
+      }
+      else if ( !strcmp( token, "decouple" ) )
+      {
+         c->decoupleFrames= (atoi( value ) != 0);
+      }
+      else if ( !strcmp( token, "scanout" ) )
+      {
+         c->scanout= (atoi( value ) != 0);
+      }
+      else if ( !strcmp( token, "video" ) )
+      {
+         if ( !strcmp( value, "none" ) )
+         {
+            c->videoFormat= VIDEO_FORMAT_NONE;
+         }
+         else if ( !parseVideoSpec( value, &c->videoFormat, &c->videoFps ) )
+         {
+            printf("Error: scenario line %d: bad video: %s\n", lineNum, value);
+            goto exit;
+         }
+      }
+      else if ( !strcmp( token, "subsurfaces" ) )
+      {
+         if ( !parseSubsurfaceSpec( value, &c->subsurfaceCount, &c->subsurfaceOverlap ) )
+         {
+            printf("Error: scenario line %d: bad subsurfaces: %s\n", lineNum, value);
+            goto exit;
+         }
+      }
+      else if ( !strcmp( token, "client-buffers" ) )
+      {
+         c->clientBuffers= atoi( value );
+         if ( (c->clientBuffers != 0) && ((c->clientBuffers < MIN_CLIENT_BUFFERS) || (c->clientBuffers > MAX_CLIENT_BUFFERS)) )
+         {
+            printf("Error: scenario line %d: bad client-buffers: %s\n", lineNum, value);
+            goto exit;
+         }
+      }
+      else if ( !strcmp( token, "repeat" ) )
+      {
+         c->repeat= atoi( value );
+      }
+      else
+      {
+         printf("Error: scenario line %d: unknown key: %s\n", lineNum, token);
+         goto exit;
+      }
    }
 
-   wl_registry_add_listener(registry, &registryListener, &ctx->nested);
-
-   wl_display_roundtrip( dispWayland );
-
-   if ( !ctx->nested.compositor )
+   if ( c->path < 0 )
    {
-      printf("Error: waylandNestedRole: failed to obtain wayland compositor\n");
+      printf("Error: scenario line %d: case %s needs path=direct|wayland|nested|repeater|multi\n", lineNum, c->name);
       goto exit;
    }
-
-   ctx->nested.eglServer.useWayland= true;
-   ctx->nested.eglServer.dispWayland= dispWayland;
-   if ( !initEGL( &ctx->nested.eglServer ) )
+   if ( (c->path == SCENARIO_PATH_MULTI) && settingKey )
    {
-      printf("Error: waylandNestedRole: failed to setup EGL\n");
+      // The multi test only counts how many compositors start, once per run
+      printf("Error: scenario line %d: multi case %s takes no key but path: %s\n", lineNum, c->name, settingKey);
       goto exit;
    }
-
-   ctx->nested.surface= wl_compositor_create_surface(ctx->nested.compositor);
-   if ( !ctx->nested.surface )
+   if ( (c->iterations <= 0) || (c->repeat <= 0) || (c->width <= 0) || (c->height <= 0) )
    {
-      printf("Error: waylandNestedRole: failed to create wayland surface\n");
+      printf("Error: scenario line %d: bad value in case %s\n", lineNum, c->name);
       goto exit;
    }
-
-   ctx->nested.winWayland= wl_egl_window_create(ctx->nested.surface, ctx->windowWidth, ctx->windowHeight);
-   if ( !ctx->nested.winWayland )
+   if ( c->videoFormat != VIDEO_FORMAT_NONE )
    {
-      printf("Error: waylandNestedRole: failed to create wayland window\n");
-      goto exit;
+      // Video is paced by its frame rate, so further steps would repeat the first
+      c->pacingStart= 0;
+      c->pacingIncrement= 0;
+      c->pacingSteps= 1;
    }
 
-   ctx->nested.eglServer.eglSurface= eglCreateWindowSurface( ctx->nested.eglServer.eglDisplay,
-                                                      ctx->nested.eglServer.eglConfig,
-                                                      (EGLNativeWindowType)ctx->nested.winWayland,
-                                                      NULL );
-   if ( ctx->nested.eglServer.eglSurface == EGL_NO_SURFACE )
-   {
-      printf("Error: waylandNestedRole: failed to create EGL surface\n");
-      goto exit;
-   }
+   result= true;
 
-   eglMakeCurrent( ctx->nested.eglServer.eglDisplay, ctx->nested.eglServer.eglSurface,
-                   ctx->nested.eglServer.eglSurface, ctx->nested.eglServer.eglContext );
+exit:
+   return result;
+}
 
-   eglSwapInterval( ctx->nested.eglServer.eglDisplay, 1 );
+static Scenario *scenarioLoad( AppCtx *ctx, const char *filename )
+{
+   Scenario *scenario= 0;
+   FILE *pFile= 0;
+   char line[512];
+   int lineNum= 0;
+   char *p;
 
-   if ( !initGL( &ctx->nested ) )
+   pFile= fopen( filename, "rt" );
+   if ( !pFile )
    {
-      printf("Error: waylandNestedRole: initGL failed\n");
+      printf("Error: scenarioLoad: unable to open %s\n", filename);
+      goto exit;
    }
 
-   if ( !initWayland( &ctx->nested, ctx->nestedDisplayName ) )
+   scenario= (Scenario*)calloc( 1, sizeof(Scenario) );
+   if ( !scenario )
    {
-      printf("Error: waylandNestedRole: initWayland failed\n");
+      printf("Error: scenarioLoad: no memory\n");
       goto exit;
    }
 
-   if ( ctx->canRemoteClone )
+   while( fgets( line, sizeof(line), pFile ) )
    {
-      if ( !ctx->remoteBegin( ctx->nested.dispWayland, dispWayland ) )
+      ++lineNum;
+      p= line;
+      while( (*p == ' ') || (*p == '\t') ) ++p;
+      if ( (*p == '#') || (*p == '\n') || (*p == '\r') || (*p == '\0') )
       {
-         printf("Error: waylandNestedRole: remoteBegin failure\n");
-         ctx->canRemoteClone= false;
+         continue;
+      }
+      if ( scenario->caseCount >= SCENARIO_MAX_CASES )
+      {
+         printf("Error: scenarioLoad: more than %d cases\n", SCENARIO_MAX_CASES);
+         free( scenario );
+         scenario= 0;
          goto exit;
       }
-      pthread_mutex_init( &ctx->nested.buffersToReleaseMutex, 0 );
-      ctx->nested.buffersToRelease= std::vector<NestedBufferInfo>();
-      ctx->nested.displayTimer= wl_event_loop_add_timer( wl_display_get_event_loop(ctx->nested.dispWayland), nestedDisplayTimeOut, ctx );
-      wl_event_source_timer_update( ctx->nested.displayTimer, FRAME_PERIOD_MILLIS_60FPS );
-      rc= pthread_create( &ctx->nestedDispatchThreadId, NULL, waylandNestedDispatchThread, ctx );
-      if ( rc )
+      if ( !scenarioParseCase( ctx, &scenario->cases[scenario->caseCount], p, lineNum ) )
       {
-         printf("Error: waylandNestedRole: failed to start nested dispatch thread\n");
+         free( scenario );
+         scenario= 0;
+         goto exit;
       }
-      ctx->nested.isRepeater= true;
+      if ( scenario->cases[scenario->caseCount].path == SCENARIO_PATH_MULTI )
+      {
+         scenario->haveMulti= true;
+      }
+      ++scenario->caseCount;
    }
 
-   ctx->client.upstreamDisplayName= ctx->nestedDisplayName;
-   rc= pthread_create( &ctx->clientThreadId, NULL, waylandClientThread, ctx );
-   if ( !rc )
+exit:
+   if ( pFile )
    {
-      wl_display_run( ctx->nested.dispWayland );
+      fclose( pFile );
+   }
+
+   return scenario;
+}
 
-      pthread_join( ctx->clientThreadId, NULL );
+static void scenarioApply( AppCtx *ctx, ScenarioCase *c )
+{
+   ctx->windowWidth= c->width;
+   ctx->windowHeight= c->height;
+   ctx->maxIterations= c->iterations;
+   ctx->pacingStart= c->pacingStart;
+   ctx->pacingIncrement= c->pacingIncrement;
+   ctx->pacingSteps= c->pacingSteps;
+   ctx->swapInterval= c->swapInterval;
+   ctx->decoupleFrames= c->decoupleFrames;
+   ctx->directScanout= c->scanout;
+   ctx->videoFormat= c->videoFormat;
+   ctx->videoFps= c->videoFps;
+   ctx->subsurfaceCount= c->subsurfaceCount;
+   ctx->subsurfaceOverlap= c->subsurfaceOverlap;
+   ctx->clientBuffers= c->clientBuffers;
+   if ( ctx->frameSamples )
+   {
+      free( ctx->frameSamples );
+      ctx->frameSamples= (int*)calloc( ctx->maxIterations, sizeof(int) );
    }
+}
 
-exit:
-   eglMakeCurrent( ctx->nested.eglServer.eglDisplay, EGL_NO_CONTEXT, EGL_NO_SURFACE, EGL_NO_SURFACE );
+// The direct case run most recently with the same size, iterations, pacing and
+// swap interval is the baseline for a composited case's speed index
+static ScenarioCase *scenarioFindBaseline( Scenario *scenario, int index )
+{
+   ScenarioCase *c= &scenario->cases[index];
 
-   if ( ctx->nested.eglServer.eglSurface != EGL_NO_SURFACE )
+   for( int i= index-1; i >= 0; --i )
    {
-      termGL( &ctx->nested );
-
-      eglDestroySurface( ctx->nested.eglServer.eglDisplay, ctx->nested.eglServer.eglSurface );
-      ctx->nested.eglServer.eglSurface= EGL_NO_SURFACE;
+      ScenarioCase *base= &scenario->cases[i];
+      if ( (base->path == SCENARIO_PATH_DIRECT) && (base->directTotal > 0) &&
+           (base->width == c->width) && (base->height == c->height) &&
+           (base->iterations == c->iterations) &&
+           (base->pacingStart == c->pacingStart) && (base->pacingIncrement == c->pacingIncrement) &&
+           (base->pacingSteps == c->pacingSteps) && (base->swapInterval == c->swapInterval) )
+      {
+         return base;
+      }
    }
+   return 0;
+}
 
-   if ( ctx->canRemoteClone )
-   {
-      ctx->remoteEnd( ctx->nested.dispWayland, dispWayland );
+// Run every case in order.  The EGL display and context, platform and master
+// wayland display set up by main are shared by all cases; only the native
+// window and client processes are created per case.
+static void scenarioRun( AppCtx *ctx, Scenario *scenario, bool noWaylandRender )
+{
+   ScenarioCase saved;
+   ScenarioCase *base;
+   long long total;
+
+   memset( &saved, 0, sizeof(saved) );
+   saved.width= ctx->windowWidth;
+   saved.height= ctx->windowHeight;
+   saved.iterations= ctx->maxIterations;
+   saved.pacingStart= ctx->pacingStart;
+   saved.pacingIncrement= ctx->pacingIncrement;
+   saved.pacingSteps= ctx->pacingSteps;
+   saved.swapInterval= ctx->swapInterval;
+   saved.decoupleFrames= ctx->decoupleFrames;
+   saved.scanout= ctx->directScanout;
+   saved.videoFormat= ctx->videoFormat;
+   saved.videoFps= ctx->videoFps;
+   saved.subsurfaceCount= ctx->subsurfaceCount;
+   saved.subsurfaceOverlap= ctx->subsurfaceOverlap;
+   saved.clientBuffers= ctx->clientBuffers;
+
+   for( int i= 0; i < scenario->caseCount; ++i )
+   {
+      ScenarioCase *c= &scenario->cases[i];
+
+      if ( c->path == SCENARIO_PATH_MULTI )
+      {
+         // Run by main before the shared wayland display is created
+         continue;
+      }
+      if ( (c->path != SCENARIO_PATH_DIRECT) && !ctx->haveWaylandEGL )
+      {
+         fprintf(ctx->pReport, "Scenario case %s skipped: no wayland-egl\n", c->name);
+         continue;
+      }
+
+      scenarioApply( ctx, c );
+      for( int r= 0; r < c->repeat; ++r )
+      {
+         if ( c->repeat > 1 )
+         {
+            snprintf( c->section, sizeof(c->section), "%s-%d", c->name, r+1 );
+         }
+         else
+         {
+            snprintf( c->section, sizeof(c->section), "%s", c->name );
+         }
+         ctx->section= c->section;
+
+         fprintf(ctx->pReport, "\n");
+         fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+         fprintf(ctx->pReport, "Scenario case %s: path %s size %dx%d iterations %d pacing %d:%d:%d swap interval %d%s%s\n",
+                 c->section, gScenarioPathNames[c->path], c->width, c->height, c->iterations,
+                 c->pacingStart, c->pacingIncrement, c->pacingSteps, c->swapInterval,
+                 (c->decoupleFrames ? " decoupled" : ""), (c->scanout ? " scanout" : ""));
+         if ( (c->path != SCENARIO_PATH_DIRECT) && (c->videoFormat != VIDEO_FORMAT_NONE) )
+         {
+            fprintf(ctx->pReport, "Scenario case %s: video %s at %d fps\n", c->section, gVideoFormatNames[c->videoFormat], c->videoFps);
+         }
+         if ( (c->path != SCENARIO_PATH_DIRECT) && (c->subsurfaceCount > 0) )
+         {
+            fprintf(ctx->pReport, "Scenario case %s: %d subsurfaces overlapping %d%%\n", c->section, c->subsurfaceCount, c->subsurfaceOverlap);
+         }
+         if ( (c->path != SCENARIO_PATH_DIRECT) && (c->clientBuffers > 0) )
+         {
+            fprintf(ctx->pReport, "Scenario case %s: %d client buffers\n", c->section, c->clientBuffers);
+         }
+         printf("\nScenario case %s (%s)...\n", c->section, gScenarioPathNames[c->path]);
+
+         total= 0;
+         ctx->waylandTotal= 0;
+         ctx->renderWayland= !noWaylandRender;
+         switch( c->path )
+         {
+            case SCENARIO_PATH_DIRECT:
+               total= measureDirectSweep( ctx );
+               c->directTotal= total;
+               break;
+            case SCENARIO_PATH_WAYLAND:
+               measureWaylandEGL( ctx, &ctx->master.eglServer );
+               total= ctx->waylandTotal;
+               break;
+            case SCENARIO_PATH_NESTED:
+               ctx->canRemoteClone= false;
+               measureWaylandNested( ctx, &ctx->master.eglServer );
+               total= ctx->waylandTotal;
+               break;
+            case SCENARIO_PATH_REPEATER:
+               checkForRepeaterSupport( ctx );
+               if ( !ctx->canRemoteClone )
+               {
+                  fprintf(ctx->pReport, "Repeater support: no\n");
+                  break;
+               }
+               measureWaylandNested( ctx, &ctx->master.eglServer );
+               total= ctx->waylandTotal;
+               ctx->canRemoteClone= false;
+               break;
+         }
+         resultValue( ctx, ctx->master.name, 0, "total_us", total );
+         c->total= total;
+
+         if ( c->path != SCENARIO_PATH_DIRECT )
+         {
+            base= scenarioFindBaseline( scenario, i );
+            if ( total == 0 )
+            {
+               fprintf(ctx->pReport, "Scenario case %s failed\n", c->section);
+            }
+            else if ( base )
+            {
+               fprintf(ctx->pReport, "\n");
+               fprintf(ctx->pReport, "=================================================================\n");
+               fprintf(ctx->pReport, "waymetric %s speed index (vs %s): %f\n", c->section, base->section, ((double)total / (double)base->directTotal) );
+               resultValue( ctx, ctx->master.name, 0, "speed_index", ((double)total / (double)base->directTotal) );
+               fprintf(ctx->pReport, "=================================================================\n");
+            }
+         }
+      }
    }
 
-   termWayland( &ctx->nested );
+   scenarioApply( ctx, &saved );
+}
 
-   if ( ctx->nested.surface )
+// Add a case with the current run settings, for sweeps that build a scenario
+static ScenarioCase *scenarioAddCase( Scenario *scenario, AppCtx *ctx, int path )
+{
+   ScenarioCase *c;
+
+   if ( scenario->caseCount >= SCENARIO_MAX_CASES )
+   {
+      return 0;
+   }
+   c= &scenario->cases[scenario->caseCount++];
+   c->path= path;
+   c->width= ctx->windowWidth;
+   c->height= ctx->windowHeight;
+   c->iterations= ctx->maxIterations;
+   c->pacingStart= ctx->pacingStart;
+   c->pacingIncrement= ctx->pacingIncrement;
+   c->pacingSteps= ctx->pacingSteps;
+   c->swapInterval= ctx->swapInterval;
+   c->decoupleFrames= ctx->decoupleFrames;
+   c->scanout= ctx->directScanout;
+   c->videoFormat= ctx->videoFormat;
+   c->videoFps= ctx->videoFps;
+   c->subsurfaceCount= ctx->subsurfaceCount;
+   c->subsurfaceOverlap= ctx->subsurfaceOverlap;
+   c->clientBuffers= ctx->clientBuffers;
+   c->repeat= 1;
+
+   return c;
+}
+
+static double scenarioFrameUs( ScenarioCase *c )
+{
+   long long frames= (long long)c->iterations*c->pacingSteps;
+
+   return ((c->total > 0) && (frames > 0)) ? (double)c->total/frames : 0.0;
+}
+
+#define RESOLUTION_MAX_SIZES (16)
+
+static const char *gDefaultResolutions= "640x360,1280x720,1920x1080,2560x1440,3840x2160";
+
+static int parseResolutionList( const char *arg, int *widths, int *heights, int maxSizes )
+{
+   int count= 0;
+   const char *s= arg;
+
+   while ( *s )
    {
-      wl_surface_destroy( ctx->nested.surface );
-      ctx->nested.surface= 0;
+      int w, h, n= 0;
+      if ( (count >= maxSizes) ||
+           (sscanf( s, "%dx%d%n", &w, &h, &n ) != 2) ||
+           (w <= 0) || (h <= 0) )
+      {
+         return 0;
+      }
+      widths[count]= w;
+      heights[count]= h;
+      ++count;
+      s += n;
+      if ( *s == ',' )
+      {
+         ++s;
+      }
+      else if ( *s )
+      {
+         return 0;
+      }
    }
 
-   if ( ctx->nested.compositor )
+   return count;
+}
+
+// Least squares fit of y= a + b*x
+static bool fitLine( double *x, double *y, int n, double *a, double *b, double *r2 )
+{
+   double sx= 0, sy= 0, sxx= 0, sxy= 0, syy= 0;
+   double d, ssTot, ssRes;
+
+   if ( n < 2 )
    {
-      wl_compositor_destroy( ctx->nested.compositor );
-      ctx->nested.compositor= 0;
+      return false;
    }
-
-   if ( ctx->nested.winWayland )
+   for( int i= 0; i < n; ++i )
    {
-      wl_egl_window_destroy( ctx->nested.winWayland );
-      ctx->nested.winWayland= 0;
+      sx += x[i];
+      sy += y[i];
+      sxx += x[i]*x[i];
+      sxy += x[i]*y[i];
+      syy += y[i]*y[i];
    }
-
-   if ( registry )
+   d= n*sxx - sx*sx;
+   if ( d == 0 )
    {
-      wl_registry_destroy(registry);
-      registry= 0;
+      return false;
    }
-
-   if ( dispWayland )
+   *b= (n*sxy - sx*sy) / d;
+   *a= (sy - (*b)*sx) / n;
+   ssTot= syy - sy*sy/n;
+   ssRes= 0;
+   for( int i= 0; i < n; ++i )
    {
-      wl_display_flush( dispWayland );
-      usleep(100000);
-      wl_display_disconnect( dispWayland );
-      dispWayland= 0;
+      double e= y[i] - (*a + (*b)*x[i]);
+      ssRes += e*e;
    }
-}
+   *r2= (ssTot > 0) ? 1.0 - ssRes/ssTot : 1.0;
 
-static void* waylandNestedThread( void *arg )
-{
-   using namespace waylandNested;
-
-   AppCtx *ctx= (AppCtx*)arg;
-   char work[256];
+   return true;
+}
 
-   fflush( ctx->pReport );
+static void reportResolutionFit( AppCtx *ctx, const char *pathName, bool overhead, double *x, double *y, int n )
+{
+   const char *saveSection= ctx->section;
+   const char *key= (overhead ? "overhead" : "frame");
+   char section[48];
+   char work[48];
+   double a, b, r2;
 
-   sprintf(work,"waymetric --role-wayland-nested --iterations %d", ctx->maxIterations );
-   if ( !ctx->renderWayland )
+   if ( !fitLine( x, y, n, &a, &b, &r2 ) )
    {
-      strcat( work, " --no-wayland-render" );
+      fprintf(ctx->pReport, "%s %s: not enough sizes for a fit\n", pathName, key);
+      return;
    }
-   system(work);
 
-   fseek( ctx->pReport, 0LL, SEEK_END );
+   fprintf(ctx->pReport, "%s %s: %.1f us fixed + %.1f us per Mpixel (r^2 %.3f)",
+           pathName, (overhead ? "overhead vs direct" : "frame time"), a, b, r2 );
+   if ( overhead && (b > 0) )
+   {
+      // Past the crossover the per pixel term outweighs the fixed cost
+      fprintf(ctx->pReport, ", %.0f Mpixel/s, crossover %.2f Mpixels",
+              1000000.0/b, ((a > 0) ? a/b : 0.0) );
+   }
+   fprintf(ctx->pReport, "\n");
 
-   return NULL;
+   snprintf( section, sizeof(section), "resolution-%s", pathName );
+   ctx->section= section;
+   snprintf( work, sizeof(work), "%s_fixed_us", key );
+   resultValue( ctx, "fit", 0, work, a );
+   snprintf( work, sizeof(work), "%s_per_mpixel_us", key );
+   resultValue( ctx, "fit", 0, work, b );
+   snprintf( work, sizeof(work), "%s_r2", key );
+   resultValue( ctx, "fit", 0, work, r2 );
+   ctx->section= saveSection;
 }
 
-static void measureWaylandEGL( AppCtx *ctx, EGLCtx *eglCtx )
+// Run each enabled path at every size and fit per frame cost against pixel
+// count.  A large fixed term means composition overhead is per frame (protocol,
+// wakeups, imports); a large per megapixel term means it is bandwidth bound.
+static void measureResolutionSweep( AppCtx *ctx, const char *sizes, bool noDirect, bool noNormal, bool noNested, bool noWaylandRender )
 {
-   int rc;
-   void *nativeWindow= 0;
+   Scenario *scenario= 0;
+   int widths[RESOLUTION_MAX_SIZES];
+   int heights[RESOLUTION_MAX_SIZES];
+   int sizeCount, pathCount= 0;
+   int paths[3];
+   double mpixels[RESOLUTION_MAX_SIZES];
+   double frameUs[3][RESOLUTION_MAX_SIZES];
+   double x[RESOLUTION_MAX_SIZES], y[RESOLUTION_MAX_SIZES];
+
+   sizeCount= parseResolutionList( sizes, widths, heights, RESOLUTION_MAX_SIZES );
+   if ( !sizeCount )
+   {
+      printf("Error: measureResolutionSweep: bad size list: %s\n", sizes);
+      goto exit;
+   }
 
-   if ( ctx->renderWayland )
+   if ( !noDirect ) paths[pathCount++]= SCENARIO_PATH_DIRECT;
+   if ( !noNormal ) paths[pathCount++]= SCENARIO_PATH_WAYLAND;
+   if ( !noNested ) paths[pathCount++]= SCENARIO_PATH_NESTED;
+   if ( !pathCount )
    {
-      nativeWindow= PlatformCreateNativeWindow( ctx->platformCtx, ctx->windowWidth, ctx->windowHeight );
-      if ( nativeWindow )
+      goto exit;
+   }
+
+   scenario= (Scenario*)calloc( 1, sizeof(Scenario) );
+   if ( !scenario )
+   {
+      printf("Error: measureResolutionSweep: no memory\n");
+      goto exit;
+   }
+   for( int i= 0; i < sizeCount; ++i )
+   {
+      for( int j= 0; j < pathCount; ++j )
       {
-         eglCtx->eglSurface= eglCreateWindowSurface( eglCtx->eglDisplay,
-                                                     eglCtx->eglConfig,
-                                                     (EGLNativeWindowType)nativeWindow,
-                                                     NULL );
-         if ( eglCtx->eglSurface != EGL_NO_SURFACE )
+         ScenarioCase *c= scenarioAddCase( scenario, ctx, paths[j] );
+         if ( c )
          {
-            eglMakeCurrent( eglCtx->eglDisplay, eglCtx->eglSurface, eglCtx->eglSurface, eglCtx->eglContext );
-
-            eglSwapInterval( eglCtx->eglDisplay, 1 );
-
-            if ( !initGL( &ctx->master ) )
-            {
-               printf("Error: measureWaylandEGL: initGL failed\n");
-            }
-         }
-         else
-         {  
-            printf("Error: measureWaylandEGL: failed to create EGL surface\n");
+            snprintf( c->name, sizeof(c->name), "%s-%dx%d", gScenarioPathNames[paths[j]], widths[i], heights[i] );
+            c->width= widths[i];
+            c->height= heights[i];
          }
       }
-      else
+   }
+
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+   fprintf(ctx->pReport, "Measuring resolution sweep: %s\n", sizes);
+   printf("\nMeasuring resolution sweep...\n");
+
+   scenarioRun( ctx, scenario, noWaylandRender );
+
+   for( int i= 0; i < sizeCount; ++i )
+   {
+      mpixels[i]= ((double)widths[i]*heights[i])/1000000.0;
+      for( int j= 0; j < pathCount; ++j )
       {
-         printf("Error: measureWaylandEGL: failed to create native window\n");
+         frameUs[j][i]= (i*pathCount+j < scenario->caseCount) ? scenarioFrameUs( &scenario->cases[i*pathCount+j] ) : 0.0;
       }
    }
 
-   ctx->client.upstreamDisplayName= ctx->displayName;
-   rc= pthread_create( &ctx->clientThreadId, NULL, waylandClientThread, ctx );
-   if ( !rc )
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "=================================================================\n");
+   fprintf(ctx->pReport, "Resolution sweep: mean frame time (us) by path\n");
+   fprintf(ctx->pReport, "%-12s %10s", "size", "Mpixels");
+   for( int j= 0; j < pathCount; ++j )
    {
-      wl_display_run( ctx->master.dispWayland );
-
-      pthread_join( ctx->clientThreadId, NULL );
-      ctx->waylandTotal= readResult();
+      fprintf(ctx->pReport, " %12s", gScenarioPathNames[paths[j]]);
    }
-
-   if ( ctx->renderWayland )
+   fprintf(ctx->pReport, "\n");
+   for( int i= 0; i < sizeCount; ++i )
    {
-      eglMakeCurrent( eglCtx->eglDisplay, EGL_NO_CONTEXT, EGL_NO_SURFACE, EGL_NO_SURFACE );
-
-      if ( eglCtx->eglSurface != EGL_NO_SURFACE )
+      char work[32];
+      snprintf( work, sizeof(work), "%dx%d", widths[i], heights[i] );
+      fprintf(ctx->pReport, "%-12s %10.3f", work, mpixels[i]);
+      for( int j= 0; j < pathCount; ++j )
       {
-         termGL( &ctx->master );
+         fprintf(ctx->pReport, " %12.1f", frameUs[j][i]);
+      }
+      fprintf(ctx->pReport, "\n");
+   }
 
-         eglDestroySurface( eglCtx->eglDisplay, eglCtx->eglSurface );
-         eglCtx->eglSurface= EGL_NO_SURFACE;
+   // Fit each path's own frame time, and each composited path's overhead over
+   // direct at the same size so the pacing delay and client render cancel out
+   for( int j= 0; j < pathCount; ++j )
+   {
+      int n= 0;
+      for( int i= 0; i < sizeCount; ++i )
+      {
+         if ( frameUs[j][i] > 0 )
+         {
+            x[n]= mpixels[i];
+            y[n]= frameUs[j][i];
+            ++n;
+         }
       }
+      reportResolutionFit( ctx, gScenarioPathNames[paths[j]], false, x, y, n );
 
-      if ( nativeWindow )
+      if ( (j > 0) && (paths[0] == SCENARIO_PATH_DIRECT) )
       {
-         PlatformDestroyNativeWindow( ctx->platformCtx, nativeWindow );
+         n= 0;
+         for( int i= 0; i < sizeCount; ++i )
+         {
+            if ( (frameUs[j][i] > 0) && (frameUs[0][i] > 0) )
+            {
+               x[n]= mpixels[i];
+               y[n]= frameUs[j][i]-frameUs[0][i];
+               ++n;
+            }
+         }
+         reportResolutionFit( ctx, gScenarioPathNames[paths[j]], true, x, y, n );
       }
    }
+   fprintf(ctx->pReport, "=================================================================\n");
+
+exit:
+   if ( scenario )
+   {
+      free( scenario );
+   }
 }
 
-static void measureDirectEGL( AppCtx *ctx, EGLCtx *eglCtx )
+#define INTERVAL_MAX_COUNT (8)
+
+static const char *gDefaultSwapIntervals= "0,1,2";
+
+// Run each enabled path at every swap interval with frame callbacks sent as
+// soon as a commit is taken rather than after the compositor's own swap.  At
+// interval 0 nothing waits for vsync, so frame rates and the overhead over
+// direct are raw costs rather than multiples of the refresh period.
+static void measureSwapIntervalSweep( AppCtx *ctx, const char *intervalList, bool noDirect, bool noNormal, bool noNested, bool noWaylandRender )
 {
-   void *nativeWindow= 0;
-   long long time1, time2, diff;
+   Scenario *scenario= 0;
+   int intervals[INTERVAL_MAX_COUNT];
+   int intervalCount= 0, pathCount= 0;
+   int paths[3];
+   double frameUs[3][INTERVAL_MAX_COUNT];
+   const char *saveSection= ctx->section;
+   bool saveDecouple= ctx->decoupleFrames;
+   const char *s= intervalList;
+
+   while ( *s )
+   {
+      char *end;
+      long value= strtol( s, &end, 10 );
+      if ( (end == s) || (value < 0) || (intervalCount >= INTERVAL_MAX_COUNT) || (*end && (*end != ',')) )
+      {
+         printf("Error: measureSwapIntervalSweep: bad interval list: %s\n", intervalList);
+         goto exit;
+      }
+      intervals[intervalCount++]= (int)value;
+      s= (*end ? end+1 : end);
+   }
 
-   nativeWindow= PlatformCreateNativeWindow( ctx->platformCtx, ctx->windowWidth, ctx->windowHeight );
-   if ( nativeWindow )
+   if ( !noDirect ) paths[pathCount++]= SCENARIO_PATH_DIRECT;
+   if ( !noNormal ) paths[pathCount++]= SCENARIO_PATH_WAYLAND;
+   if ( !noNested ) paths[pathCount++]= SCENARIO_PATH_NESTED;
+   if ( !intervalCount || !pathCount )
    {
-      eglCtx->eglSurface= eglCreateWindowSurface( eglCtx->eglDisplay,
-                                                  eglCtx->eglConfig,
-                                                  (EGLNativeWindowType)nativeWindow,
-                                                  NULL );
-      if ( eglCtx->eglSurface != EGL_NO_SURFACE )
+      goto exit;
+   }
+
+   scenario= (Scenario*)calloc( 1, sizeof(Scenario) );
+   if ( !scenario )
+   {
+      printf("Error: measureSwapIntervalSweep: no memory\n");
+      goto exit;
+   }
+   ctx->decoupleFrames= true;
+   for( int i= 0; i < intervalCount; ++i )
+   {
+      for( int j= 0; j < pathCount; ++j )
       {
-         GLfloat r, g, b, t;
+         ScenarioCase *c= scenarioAddCase( scenario, ctx, paths[j] );
+         if ( c )
+         {
+            snprintf( c->name, sizeof(c->name), "%s-interval%d", gScenarioPathNames[paths[j]], intervals[i] );
+            c->swapInterval= intervals[i];
+         }
+      }
+   }
 
-         eglMakeCurrent( eglCtx->eglDisplay, eglCtx->eglSurface, eglCtx->eglSurface, eglCtx->eglContext );
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+   fprintf(ctx->pReport, "Measuring swap interval sweep: %s\n", intervalList);
+   printf("\nMeasuring swap interval sweep...\n");
 
-         eglSwapInterval( eglCtx->eglDisplay, 1 );
+   scenarioRun( ctx, scenario, noWaylandRender );
 
-         glClearColor( 0, 0, 0, 1 );
-         glClear( GL_COLOR_BUFFER_BIT );
-         eglSwapBuffers( eglCtx->eglDisplay, eglCtx->eglSurface );
+   for( int i= 0; i < intervalCount; ++i )
+   {
+      for( int j= 0; j < pathCount; ++j )
+      {
+         frameUs[j][i]= (i*pathCount+j < scenario->caseCount) ? scenarioFrameUs( &scenario->cases[i*pathCount+j] ) : 0.0;
+      }
+   }
 
-         r= 0;
-         g= 1;
-         b= 0;
-         time1= getCurrentTimeMicro();
-         for( int i= 0; i < ctx->maxIterations; ++i )
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "=================================================================\n");
+   fprintf(ctx->pReport, "Swap interval sweep (frame callbacks decoupled): fps and overhead over direct per frame\n");
+   for( int i= 0; i < intervalCount; ++i )
+   {
+      fprintf(ctx->pReport, "interval %d:", intervals[i]);
+      for( int j= 0; j < pathCount; ++j )
+      {
+         ScenarioCase *c= &scenario->cases[i*pathCount+j];
+         if ( frameUs[j][i] <= 0 )
          {
-            t= r;
-            r= g;
-            g= b;
-            b= t;
-            glClearColor( r, g, b, 1 );
-            glClear( GL_COLOR_BUFFER_BIT );
-            if ( ctx->pacingDelay )
-            {
-               usleep( ctx->pacingDelay );
-            }            
-            eglSwapBuffers( eglCtx->eglDisplay, eglCtx->eglSurface );
+            fprintf(ctx->pReport, " %s failed", gScenarioPathNames[paths[j]]);
+            continue;
          }
-         time2= getCurrentTimeMicro();
-
-         glClearColor( 0, 0, 0, 1 );
-         glClear( GL_COLOR_BUFFER_BIT );
-         eglSwapBuffers( eglCtx->eglDisplay, eglCtx->eglSurface );
-
-         diff= (time2-time1);
-         ctx->directEGLIterationCount += ctx->maxIterations;
-         ctx->directEGLTimeTotal += diff;
-         if ( ctx->directEGLIterationCount )
+         ctx->section= c->section;
+         fprintf(ctx->pReport, " %s %.1f fps", gScenarioPathNames[paths[j]], 1000000.0/frameUs[j][i]);
+         resultValue( ctx, "summary", 0, "fps", 1000000.0/frameUs[j][i] );
+         resultValue( ctx, "summary", 0, "frame_us", frameUs[j][i] );
+         if ( (j > 0) && (paths[0] == SCENARIO_PATH_DIRECT) && (frameUs[0][i] > 0) )
          {
-            ctx->directEGLFPS= ((double)(ctx->directEGLIterationCount*1000000.0)) / (double)(ctx->directEGLTimeTotal);
+            fprintf(ctx->pReport, " (+%.1f us)", frameUs[j][i]-frameUs[0][i]);
+            resultValue( ctx, "summary", 0, "overhead_us", frameUs[j][i]-frameUs[0][i] );
          }
-
-         eglMakeCurrent( eglCtx->eglDisplay, EGL_NO_CONTEXT, EGL_NO_SURFACE, EGL_NO_SURFACE );
-
-         eglDestroySurface( eglCtx->eglDisplay, eglCtx->eglSurface );
-         eglCtx->eglSurface= EGL_NO_SURFACE;
-      }
-      else
-      {
-         printf("Error: measureDirectEGL: eglSurface %p eglGetError %X\n", eglCtx->eglSurface, eglGetError());
       }
+      fprintf(ctx->pReport, "\n");
+   }
+   fprintf(ctx->pReport, "=================================================================\n");
 
-      PlatformDestroyNativeWindow( ctx->platformCtx, nativeWindow );
+exit:
+   ctx->section= saveSection;
+   ctx->decoupleFrames= saveDecouple;
+   if ( scenario )
+   {
+      free( scenario );
    }
 }
 
-static void measureWaylandNested( AppCtx *ctx, EGLCtx *eglCtx )
+typedef struct _PresentSummary
 {
-   int rc;
-   void *nativeWindow= 0;
+   int frames;
+   int scanoutFrames;
+   double frameUs;
+   double presentUs;
+   double cpuUs;
+   double composeBytes;
+   int importFrames;
+   double importUs;
+   double smoothPct;
+   double gpuUs;
+   double layers;
+   double culledLayers;
+   double overdraw;
+   double blendPct;
+} PresentSummary;
+
+static void summarizePresent( RoleMetrics *metrics, ScenarioCase *c, PresentSummary *summary )
+{
+   long long presentUs= 0, cpuUs= 0, composeBytes= 0, importUs= 0, gpuNs= 0;
+   long long layers= 0, culledLayers= 0, drawnPixels= 0, blendedPixels= 0, outputPixels= 0;
+   int cpuFrames= 0, jankFrames= 0, onTime= 0, gpuFrames= 0, layerFrames= 0;
 
-   if ( ctx->renderWayland )
+   memset( summary, 0, sizeof(PresentSummary) );
+   for( int step= 0; step < PACING_STEP_COUNT; ++step )
    {
-      nativeWindow= PlatformCreateNativeWindow( ctx->platformCtx, ctx->windowWidth, ctx->windowHeight );
-      if ( nativeWindow )
-      {
-         eglCtx->eglSurface= eglCreateWindowSurface( eglCtx->eglDisplay,
-                                                     eglCtx->eglConfig,
-                                                     (EGLNativeWindowType)nativeWindow,
-                                                     NULL );
-         if ( eglCtx->eglSurface != EGL_NO_SURFACE )
-         {
-            eglMakeCurrent( eglCtx->eglDisplay, eglCtx->eglSurface, eglCtx->eglSurface, eglCtx->eglContext );
+      StepMetrics *sm= &metrics->steps[step];
+      summary->frames += sm->presentFrames;
+      summary->scanoutFrames += sm->scanoutFrames;
+      presentUs += sm->presentUs;
+      composeBytes += sm->composeBytes;
+      cpuUs += sm->cpu.threadUser+sm->cpu.threadSys;
+      cpuFrames += sm->frames;
+      summary->importFrames += sm->importFrames;
+      importUs += sm->importUs;
+      jankFrames += sm->jank.frames;
+      onTime += sm->jank.onTime;
+      gpuFrames += sm->gpuFrames;
+      gpuNs += sm->gpuNs;
+      layerFrames += sm->layerFrames;
+      layers += sm->layers;
+      culledLayers += sm->culledLayers;
+      drawnPixels += sm->drawnPixels;
+      blendedPixels += sm->blendedPixels;
+      outputPixels += sm->layerOutputPixels;
+   }
+   summary->frameUs= scenarioFrameUs( c );
+   if ( summary->frames > 0 )
+   {
+      summary->presentUs= (double)presentUs/summary->frames;
+      summary->composeBytes= (double)composeBytes/summary->frames;
+   }
+   if ( cpuFrames > 0 )
+   {
+      summary->cpuUs= (double)cpuUs/cpuFrames;
+   }
+   if ( summary->importFrames > 0 )
+   {
+      summary->importUs= (double)importUs/summary->importFrames;
+   }
+   if ( jankFrames > 0 )
+   {
+      summary->smoothPct= 100.0*onTime/jankFrames;
+   }
+   if ( gpuFrames > 0 )
+   {
+      summary->gpuUs= gpuNs/(1000.0*gpuFrames);
+   }
+   if ( layerFrames > 0 )
+   {
+      summary->layers= (double)layers/layerFrames;
+      summary->culledLayers= (double)culledLayers/layerFrames;
+   }
+   if ( outputPixels > 0 )
+   {
+      summary->overdraw= (double)drawnPixels/outputPixels;
+      summary->blendPct= 100.0*blendedPixels/outputPixels;
+   }
+}
 
-            eglSwapInterval( eglCtx->eglDisplay, 1 );
+// Run the wayland path composed with GL and then with direct scanout, and
+// compare what the master compositor spends per frame in each
+static void measureScanoutCompare( AppCtx *ctx, bool noWaylandRender )
+{
+   Scenario *scenario= 0;
+   ScenarioCase *c;
+   PresentSummary summary[2];
+   const char *saveSection= ctx->section;
+   bool saveScanout= ctx->directScanout;
+   static const char *modeNames[2]= { "gl", "scanout" };
 
-            if ( !initGL( &ctx->master ) )
-            {
-               printf("Error: measureWaylandNested: initGL failed\n");
-            }
-         }
-         else
-         {
-            printf("Error: measureWaylandNested: failed to create EGL surface\n");
-         }
-      }
-      else
-      {
-         printf("Error: measureWaylandNested: failed to create native window\n");
-      }
+   if ( noWaylandRender )
+   {
+      printf("Error: measureScanoutCompare: needs the master compositor to render\n");
+      goto exit;
    }
 
-   rc= pthread_create( &ctx->nestedThreadId, NULL, waylandNestedThread, ctx );
-   if ( !rc )
+   scenario= (Scenario*)calloc( 1, sizeof(Scenario) );
+   if ( !scenario )
    {
-      wl_display_run( ctx->master.dispWayland );
+      printf("Error: measureScanoutCompare: no memory\n");
+      goto exit;
+   }
 
-      pthread_join( ctx->nestedThreadId, NULL );
-      ctx->waylandTotal= readResult();
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+   fprintf(ctx->pReport, "Measuring direct scanout against GL composition...\n");
+   printf("\nMeasuring direct scanout against GL composition...\n");
+
+   // One case at a time as the master's metrics only hold the latest run
+   c= scenarioAddCase( scenario, ctx, SCENARIO_PATH_WAYLAND );
+   for( int i= 0; i < 2; ++i )
+   {
+      snprintf( c->name, sizeof(c->name), "wayland-%s", modeNames[i] );
+      c->scanout= (i == 1);
+      c->total= 0;
+      scenarioRun( ctx, scenario, noWaylandRender );
+      summarizePresent( &ctx->master.metrics, c, &summary[i] );
    }
 
-   if ( ctx->renderWayland )
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "=================================================================\n");
+   fprintf(ctx->pReport, "Direct scanout vs GL composition: master compositor per frame\n");
+   for( int i= 0; i < 2; ++i )
    {
-      eglMakeCurrent( eglCtx->eglDisplay, EGL_NO_CONTEXT, EGL_NO_SURFACE, EGL_NO_SURFACE );
+      PresentSummary *p= &summary[i];
+      double mbPerSec= (p->frameUs > 0) ? p->composeBytes/p->frameUs : 0.0;
 
-      if ( eglCtx->eglSurface != EGL_NO_SURFACE )
+      if ( p->frames <= 0 )
       {
-         termGL( &ctx->master );
-
-         eglDestroySurface( eglCtx->eglDisplay, eglCtx->eglSurface );
-         eglCtx->eglSurface= EGL_NO_SURFACE;
+         fprintf(ctx->pReport, "%s: failed\n", modeNames[i]);
+         continue;
       }
-
-      if ( nativeWindow )
+      fprintf(ctx->pReport, "%s: frame %.1f us, commit to present %.1f us, CPU %.1f us, composition traffic %.1f kB (%.1f MB/s), %d of %d frames scanned out\n",
+              modeNames[i], p->frameUs, p->presentUs, p->cpuUs, p->composeBytes/1024.0, mbPerSec,
+              p->scanoutFrames, p->frames );
+      ctx->section= (i == 0) ? "wayland-gl" : "wayland-scanout";
+      resultValue( ctx, "summary", 0, "frame_us", p->frameUs );
+      resultValue( ctx, "summary", 0, "present_us", p->presentUs );
+      resultValue( ctx, "summary", 0, "cpu_us", p->cpuUs );
+      resultValue( ctx, "summary", 0, "compose_mb_per_s", mbPerSec );
+      resultValue( ctx, "summary", 0, "scanout_pct", 100.0*p->scanoutFrames/p->frames );
+   }
+   if ( (summary[0].frames > 0) && (summary[1].frames > 0) )
+   {
+      if ( summary[1].scanoutFrames == 0 )
       {
-         PlatformDestroyNativeWindow( ctx->platformCtx, nativeWindow );
+         fprintf(ctx->pReport, "No frames were scanned out: the client buffers or their format are not usable by a free plane\n");
       }
+      fprintf(ctx->pReport, "scanout saves: commit to present %.1f us, CPU %.1f us, composition traffic %.1f kB per frame\n",
+              summary[0].presentUs-summary[1].presentUs,
+              summary[0].cpuUs-summary[1].cpuUs,
+              (summary[0].composeBytes-summary[1].composeBytes)/1024.0 );
+   }
+   fprintf(ctx->pReport, "=================================================================\n");
+
+exit:
+   ctx->section= saveSection;
+   ctx->directScanout= saveScanout;
+   if ( scenario )
+   {
+      free( scenario );
    }
 }
 
-static void* waylandMultiThread( void *arg )
-{
-   MultiComp *comp= (MultiComp*)arg;
-   AppCtx *ctx= comp->appCtx;
-   bool result;
+#define VIDEO_FPS_MAX_COUNT (8)
 
-   comp->started= true;
+static const char *gDefaultVideoSweep= "nv12,yuv420,yuyv@24,30,60";
 
-   printf("multi %d thread started\n", comp->index);
+// Play each video format at each frame rate through the wayland path and
+// compare what the master compositor spends importing and composing them
+static void measureVideoSweep( AppCtx *ctx, const char *spec, bool noWaylandRender )
+{
+   Scenario *scenario= 0;
+   ScenarioCase *c;
+   int formats[VIDEO_FORMAT_COUNT];
+   int fps[VIDEO_FPS_MAX_COUNT];
+   int formatCount= 0, fpsCount= 0;
+   PresentSummary summary[VIDEO_FORMAT_COUNT][VIDEO_FPS_MAX_COUNT];
+   const char *saveSection= ctx->section;
+   int saveFormat= ctx->videoFormat;
+   int saveFps= ctx->videoFps;
+   const char *s, *end, *comma;
+   char section[48];
+
+   end= strchr( spec, '@' );
+   if ( !end )
+   {
+      end= spec+strlen(spec);
+   }
+   s= spec;
+   while( s < end )
+   {
+      comma= strchr( s, ',' );
+      if ( !comma || (comma > end) )
+      {
+         comma= end;
+      }
+      if ( formatCount >= VIDEO_FORMAT_COUNT )
+      {
+         printf("Error: measureVideoSweep: bad format list: %s\n", spec);
+         goto exit;
+      }
+      formats[formatCount]= parseVideoFormat( s, (int)(comma-s) );
+      if ( formats[formatCount] == VIDEO_FORMAT_NONE )
+      {
+         printf("Error: measureVideoSweep: bad format list: %s\n", spec);
+         goto exit;
+      }
+      ++formatCount;
+      s= ((comma < end) ? comma+1 : end);
+   }
+   if ( *end == '@' )
+   {
+      s= end+1;
+      while ( *s )
+      {
+         char *next;
+         long value= strtol( s, &next, 10 );
+         if ( (next == s) || (value <= 0) || (fpsCount >= VIDEO_FPS_MAX_COUNT) || (*next && (*next != ',')) )
+         {
+            printf("Error: measureVideoSweep: bad frame rate list: %s\n", spec);
+            goto exit;
+         }
+         fps[fpsCount++]= (int)value;
+         s= (*next ? next+1 : next);
+      }
+   }
+   else
+   {
+      fps[fpsCount++]= ctx->videoFps;
+   }
+   if ( !formatCount || !fpsCount )
+   {
+      printf("Error: measureVideoSweep: nothing to run: %s\n", spec);
+      goto exit;
+   }
 
-   comp->ctx.appCtx= ctx;
-   comp->ctx.eglServer.appCtx= ctx;
-   comp->ctx.eglServer.useWayland= false;
-   comp->ctx.eglServer.nativeDisplay= PlatformGetEGLDisplayType( ctx->platformCtx );
-   if ( !initEGL( &comp->ctx.eglServer ) )
+   if ( noWaylandRender )
    {
-      printf("Error: waylandMultiThread %d failed to setup EGL\n", comp->index);
-      comp->error= true;
+      printf("Error: measureVideoSweep: needs the master compositor to render\n");
+      goto exit;
    }
 
-   pthread_mutex_lock( &comp->mutexReady );
-   pthread_mutex_lock( &comp->mutexStart );
-   printf("multi %d thread signal ready\n", comp->index);
-   pthread_cond_signal( &comp->condReady );
-   pthread_mutex_unlock( &comp->mutexReady );
+   scenario= (Scenario*)calloc( 1, sizeof(Scenario) );
+   if ( !scenario )
+   {
+      printf("Error: measureVideoSweep: no memory\n");
+      goto exit;
+   }
 
-   printf("multi %d thread wait start\n", comp->index);
-   pthread_cond_wait( &comp->condStart, &comp->mutexStart );
-   pthread_mutex_unlock( &comp->mutexStart );
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+   fprintf(ctx->pReport, "Measuring video playback...\n");
+   printf("\nMeasuring video playback...\n");
 
-   if ( !comp->error )
+   // One case at a time as the master's metrics only hold the latest run
+   c= scenarioAddCase( scenario, ctx, SCENARIO_PATH_WAYLAND );
+   for( int f= 0; f < formatCount; ++f )
    {
-      result= initWayland( &comp->ctx, (const char*)comp->displayName );
-      if ( result )
+      for( int r= 0; r < fpsCount; ++r )
       {
-         printf("multi %d display created and bound\n", comp->index);
-         comp->init= true;
+         snprintf( c->name, sizeof(c->name), "video-%s-%d", gVideoFormatNames[formats[f]], fps[r] );
+         c->videoFormat= formats[f];
+         c->videoFps= fps[r];
+         c->total= 0;
+         scenarioRun( ctx, scenario, noWaylandRender );
+         summarizePresent( &ctx->master.metrics, c, &summary[f][r] );
       }
-      else
+   }
+
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "=================================================================\n");
+   fprintf(ctx->pReport, "Video playback: master compositor per frame\n");
+   for( int f= 0; f < formatCount; ++f )
+   {
+      for( int r= 0; r < fpsCount; ++r )
       {
-         comp->error= true;
+         PresentSummary *p= &summary[f][r];
+         double mbPerSec= (p->frameUs > 0) ? p->composeBytes/p->frameUs : 0.0;
+         double delivered= (p->frameUs > 0) ? 1000000.0/p->frameUs : 0.0;
+
+         if ( p->frames <= 0 )
+         {
+            fprintf(ctx->pReport, "%s at %d fps: failed\n", gVideoFormatNames[formats[f]], fps[r]);
+            continue;
+         }
+         fprintf(ctx->pReport, "%s at %d fps: import %.1f us, commit to present %.1f us, CPU %.1f us, composition traffic %.1f kB (%.1f MB/s), delivered %.1f fps, %.1f%% smooth\n",
+                 gVideoFormatNames[formats[f]], fps[r], p->importUs, p->presentUs, p->cpuUs,
+                 p->composeBytes/1024.0, mbPerSec, delivered, p->smoothPct );
+         snprintf( section, sizeof(section), "video-%s-%d", gVideoFormatNames[formats[f]], fps[r] );
+         ctx->section= section;
+         resultValue( ctx, "summary", 0, "import_us", p->importUs );
+         resultValue( ctx, "summary", 0, "present_us", p->presentUs );
+         resultValue( ctx, "summary", 0, "cpu_us", p->cpuUs );
+         resultValue( ctx, "summary", 0, "compose_mb_per_s", mbPerSec );
+         resultValue( ctx, "summary", 0, "fps", delivered );
+         resultValue( ctx, "summary", 0, "smooth_pct", p->smoothPct );
       }
    }
+   fprintf(ctx->pReport, "=================================================================\n");
 
-   pthread_mutex_lock( &comp->mutexReady );
-   pthread_mutex_lock( &comp->mutexStart );
-   printf("multi %d thread signal ready\n", comp->index);
-   pthread_cond_signal( &comp->condReady );
-   pthread_mutex_unlock( &comp->mutexReady );
-
-   printf("multi %d thread wait start\n", comp->index);
-   pthread_cond_wait( &comp->condStart, &comp->mutexStart );
-   pthread_mutex_unlock( &comp->mutexStart );
+exit:
+   ctx->section= saveSection;
+   ctx->videoFormat= saveFormat;
+   ctx->videoFps= saveFps;
+   if ( scenario )
+   {
+      free( scenario );
+   }
+}
 
-   termWayland( &comp->ctx );
-   printf("multi %d display unbound and destroyed\n", comp->index);
-   comp->term= true;
+#define SUBSURFACE_SWEEP_MAX_COUNT (16)
 
-   termEGL( &comp->ctx.eglServer );
+static const char *gDefaultSubsurfaceSweep= "0,1,2,4,8,16:50";
 
-   pthread_mutex_lock( &comp->mutexReady );
-   printf("multi %d thread signal ready\n", comp->index);
-   pthread_cond_signal( &comp->condReady );
-   pthread_mutex_unlock( &comp->mutexReady );
+// Stack more and more subsurfaces over the client's surface and see how the
+// master compositor's cost grows with layer count and overdraw
+static void measureSubsurfaceSweep( AppCtx *ctx, const char *spec, bool noWaylandRender )
+{
+   Scenario *scenario= 0;
+   ScenarioCase *c;
+   int counts[SUBSURFACE_SWEEP_MAX_COUNT];
+   int countCount= 0;
+   int overlap= ctx->subsurfaceOverlap;
+   PresentSummary summary[SUBSURFACE_SWEEP_MAX_COUNT];
+   const char *saveSection= ctx->section;
+   int saveCount= ctx->subsurfaceCount;
+   int saveOverlap= ctx->subsurfaceOverlap;
+   const char *s;
+   char section[48];
 
-   return NULL;
-}
+   s= spec;
+   while ( *s && (*s != ':') )
+   {
+      char *next;
+      long value= strtol( s, &next, 10 );
+      if ( (next == s) || (value < 0) || (value > MAX_SUBSURFACES) || (countCount >= SUBSURFACE_SWEEP_MAX_COUNT) ||
+           (*next && (*next != ',') && (*next != ':')) )
+      {
+         printf("Error: measureSubsurfaceSweep: bad count list: %s\n", spec);
+         goto exit;
+      }
+      counts[countCount++]= (int)value;
+      s= ((*next == ',') ? next+1 : next);
+   }
+   if ( *s == ':' )
+   {
+      overlap= atoi( s+1 );
+      if ( (overlap < 0) || (overlap > 100) )
+      {
+         printf("Error: measureSubsurfaceSweep: bad overlap: %s\n", spec);
+         goto exit;
+      }
+   }
+   if ( !countCount )
+   {
+      printf("Error: measureSubsurfaceSweep: nothing to run: %s\n", spec);
+      goto exit;
+   }
 
-#define NUM_COMP (4)
-static void testMultipleCompositorsPerProcess( AppCtx *ctx )
-{
-   MultiComp comp[NUM_COMP];
-   int i, rc, multiCount;
+   if ( noWaylandRender )
+   {
+      printf("Error: measureSubsurfaceSweep: needs the master compositor to render\n");
+      goto exit;
+   }
 
-   for( i= 0; i < NUM_COMP; ++i )
+   scenario= (Scenario*)calloc( 1, sizeof(Scenario) );
+   if ( !scenario )
    {
-      memset( &comp[i], 0, sizeof(MultiComp) );
+      printf("Error: measureSubsurfaceSweep: no memory\n");
+      goto exit;
+   }
 
-      comp[i].appCtx= ctx;
-      comp[i].index= i;
-      pthread_mutex_init( &comp[i].mutexReady, 0 );
-      pthread_cond_init( &comp[i].condReady, 0 );
-      pthread_mutex_init( &comp[i].mutexStart, 0 );
-      pthread_cond_init( &comp[i].condStart, 0 );
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+   fprintf(ctx->pReport, "Measuring subsurface composition...\n");
+   printf("\nMeasuring subsurface composition...\n");
 
-      sprintf( comp[i].displayName, "waymetric-multi%d", i );
+   // One case at a time as the master's metrics only hold the latest run
+   c= scenarioAddCase( scenario, ctx, SCENARIO_PATH_WAYLAND );
+   for( int i= 0; i < countCount; ++i )
+   {
+      snprintf( c->name, sizeof(c->name), "subsurfaces-%d", counts[i] );
+      c->subsurfaceCount= counts[i];
+      c->subsurfaceOverlap= overlap;
+      c->total= 0;
+      scenarioRun( ctx, scenario, noWaylandRender );
+      summarizePresent( &ctx->master.metrics, c, &summary[i] );
+   }
 
-      pthread_mutex_lock( &comp[i].mutexReady );
-      rc= pthread_create( &comp[i].threadId, NULL, waylandMultiThread, &comp[i] );
-      if ( !rc )
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "=================================================================\n");
+   fprintf(ctx->pReport, "Subsurfaces overlapping %d%% at %d%% alpha: master compositor per frame\n", overlap, ctx->subsurfaceAlpha);
+   for( int i= 0; i < countCount; ++i )
+   {
+      PresentSummary *p= &summary[i];
+
+      if ( p->frames <= 0 )
       {
-         printf("control wait for %d ready\n", i);
-         pthread_cond_wait( &comp[i].condReady, &comp[i].mutexReady );
+         fprintf(ctx->pReport, "%d subsurfaces: failed\n", counts[i]);
+         continue;
       }
-      else
+      fprintf(ctx->pReport, "%d subsurfaces: layers drawn %.1f culled %.1f, overdraw %.2fx, blended %.1f%%, commit to present %.1f us, CPU %.1f us",
+              counts[i], p->layers, p->culledLayers, p->overdraw, p->blendPct, p->presentUs, p->cpuUs );
+      if ( p->gpuUs > 0 )
       {
-         printf("Error: testMultipleCompositorsPerProcess: failed to start test thread for instance %d\n", i);
+         fprintf(ctx->pReport, ", GPU %.1f us", p->gpuUs );
+      }
+      fprintf(ctx->pReport, "\n");
+      snprintf( section, sizeof(section), "subsurfaces-%d", counts[i] );
+      ctx->section= section;
+      resultValue( ctx, "summary", 0, "layers", p->layers );
+      resultValue( ctx, "summary", 0, "overdraw", p->overdraw );
+      resultValue( ctx, "summary", 0, "blend_pct", p->blendPct );
+      resultValue( ctx, "summary", 0, "present_us", p->presentUs );
+      resultValue( ctx, "summary", 0, "cpu_us", p->cpuUs );
+      if ( p->gpuUs > 0 )
+      {
+         resultValue( ctx, "summary", 0, "gpu_us", p->gpuUs );
       }
-      pthread_mutex_unlock( &comp[i].mutexReady );
    }
+   fprintf(ctx->pReport, "=================================================================\n");
 
-   for( i= 0; i < NUM_COMP; ++i )
+exit:
+   ctx->section= saveSection;
+   ctx->subsurfaceCount= saveCount;
+   ctx->subsurfaceOverlap= saveOverlap;
+   if ( scenario )
    {
-      if ( comp[i].started )
-      {
-         // signal to create and bind display
-         pthread_mutex_lock( &comp[i].mutexStart );
-         printf("control signal for %d start\n", i);
-         pthread_cond_signal( &comp[i].condStart );
-         pthread_mutex_unlock( &comp[i].mutexStart );
-
-         // wait till display creation confirmed
-         pthread_mutex_lock( &comp[i].mutexReady );
-         printf("control wait for %d ready\n", i);
-         pthread_cond_wait( &comp[i].condReady, &comp[i].mutexReady );
-         pthread_mutex_unlock( &comp[i].mutexReady );
-      }
+      free( scenario );
    }
+}
 
-   for( i= 0; i < NUM_COMP; ++i )
+#define CLIENT_BUFFERS_SWEEP_MAX_COUNT (8)
+
+static const char *gDefaultClientBuffersSweep= "0,2,3,4";
+
+// Run the client with each swapchain depth, 0 being the driver's own
+// wl_egl_window, and compare what reaches the master compositor.  The
+// client's own waits for a free buffer and its latency are in each case's
+// client section.
+static void measureClientBuffersSweep( AppCtx *ctx, const char *spec, bool noWaylandRender )
+{
+   Scenario *scenario= 0;
+   ScenarioCase *c;
+   int counts[CLIENT_BUFFERS_SWEEP_MAX_COUNT];
+   int countCount= 0;
+   PresentSummary summary[CLIENT_BUFFERS_SWEEP_MAX_COUNT];
+   const char *saveSection= ctx->section;
+   int saveCount= ctx->clientBuffers;
+   const char *s;
+   char section[48];
+
+   s= spec;
+   while ( *s )
    {
-      if ( comp[i].started )
+      char *next;
+      long value= strtol( s, &next, 10 );
+      if ( (next == s) || ((value != 0) && ((value < MIN_CLIENT_BUFFERS) || (value > MAX_CLIENT_BUFFERS))) ||
+           (countCount >= CLIENT_BUFFERS_SWEEP_MAX_COUNT) || (*next && (*next != ',')) )
       {
-         // signal to unbind and destroy display
-         pthread_mutex_lock( &comp[i].mutexStart );
-         printf("control signal for %d start\n", i);
-         pthread_cond_signal( &comp[i].condStart );
-         pthread_mutex_unlock( &comp[i].mutexStart );
-
-         // wait till display destruction confirmed
-         pthread_mutex_lock( &comp[i].mutexReady );
-         printf("control wait for %d ready\n", i);
-         pthread_cond_wait( &comp[i].condReady, &comp[i].mutexReady );
-         pthread_mutex_unlock( &comp[i].mutexReady );
+         printf("Error: measureClientBuffersSweep: bad count list: %s\n", spec);
+         goto exit;
       }
+      counts[countCount++]= (int)value;
+      s= (*next ? next+1 : next);
+   }
+   if ( !countCount )
+   {
+      printf("Error: measureClientBuffersSweep: nothing to run: %s\n", spec);
+      goto exit;
    }
 
-   multiCount= 0;
-   for( i= 0; i < NUM_COMP; ++i )
+   if ( noWaylandRender )
    {
-      if ( comp[i].started &&
-           comp[i].init &&
-           comp[i].term &&
-           !comp[i].error )
-      {
-         multiCount += 1;
-      }
+      printf("Error: measureClientBuffersSweep: needs the master compositor to render\n");
+      goto exit;
    }
-   fprintf(ctx->pReport, "Successful multiple compositor instances: %d out of %d\n", multiCount, NUM_COMP);
-}
 
-static void checkForRepeaterSupport( AppCtx *ctx )
-{
-   void *module= 0;
+   scenario= (Scenario*)calloc( 1, sizeof(Scenario) );
+   if ( !scenario )
+   {
+      printf("Error: measureClientBuffersSweep: no memory\n");
+      goto exit;
+   }
 
-   module= dlopen( "libwayland-egl.so.0", RTLD_NOW );
-   if ( !module )
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+   fprintf(ctx->pReport, "Measuring client buffer counts...\n");
+   printf("\nMeasuring client buffer counts...\n");
+
+   // One case at a time as the master's metrics only hold the latest run
+   c= scenarioAddCase( scenario, ctx, SCENARIO_PATH_WAYLAND );
+   for( int i= 0; i < countCount; ++i )
    {
-      module= dlopen( "libwayland-egl.so.1", RTLD_NOW );
-      if ( !module )
+      if ( counts[i] > 0 )
       {
-         module= dlopen( "libwayland-egl.so", RTLD_NOW );
+         snprintf( c->name, sizeof(c->name), "client-buffers-%d", counts[i] );
+      }
+      else
+      {
+         snprintf( c->name, sizeof(c->name), "client-buffers-egl" );
       }
+      c->clientBuffers= counts[i];
+      c->total= 0;
+      scenarioRun( ctx, scenario, noWaylandRender );
+      summarizePresent( &ctx->master.metrics, c, &summary[i] );
    }
-   if ( module )
+
+   fprintf(ctx->pReport, "\n");
+   fprintf(ctx->pReport, "=================================================================\n");
+   fprintf(ctx->pReport, "Client buffer counts: master compositor per frame\n");
+   for( int i= 0; i < countCount; ++i )
    {
-      ctx->remoteBegin= (PFNREMOTEBEGIN)dlsym( module, "wl_egl_remote_begin" );
-      ctx->remoteEnd= (PFNREMOTEEND)dlsym( module, "wl_egl_remote_end" );
-      ctx->remoteCloneBufferFromResource= (PFNREMOTECLONEBUFFERFROMRESOURCE)dlsym( module, "wl_egl_remote_buffer_clone" );
+      PresentSummary *p= &summary[i];
+      double delivered= (p->frameUs > 0) ? 1000000.0/p->frameUs : 0.0;
 
-      if ( (ctx->remoteBegin != 0) &&
-           (ctx->remoteEnd != 0) &&
-           (ctx->remoteCloneBufferFromResource != 0) )
+      if ( counts[i] > 0 )
       {
-         ctx->canRemoteClone= true;
+         snprintf( section, sizeof(section), "client-buffers-%d", counts[i] );
+         fprintf(ctx->pReport, "%d buffers: ", counts[i]);
+      }
+      else
+      {
+         snprintf( section, sizeof(section), "client-buffers-egl" );
+         fprintf(ctx->pReport, "EGL window: ");
+      }
+      if ( p->frames <= 0 )
+      {
+         fprintf(ctx->pReport, "failed\n");
+         continue;
       }
+      fprintf(ctx->pReport, "delivered %.1f fps, commit to present %.1f us, CPU %.1f us, %.1f%% smooth\n",
+              delivered, p->presentUs, p->cpuUs, p->smoothPct );
+      ctx->section= section;
+      resultValue( ctx, "summary", 0, "fps", delivered );
+      resultValue( ctx, "summary", 0, "present_us", p->presentUs );
+      resultValue( ctx, "summary", 0, "cpu_us", p->cpuUs );
+      resultValue( ctx, "summary", 0, "smooth_pct", p->smoothPct );
+   }
+   fprintf(ctx->pReport, "=================================================================\n");
 
-      dlclose( module );
+exit:
+   ctx->section= saveSection;
+   ctx->clientBuffers= saveCount;
+   if ( scenario )
+   {
+      free( scenario );
    }
 }
 
@@ -2088,6 +11271,25 @@ void showUsage( void )
    printf("options are one of:\n");
    printf("--window-size <width>x<height> (eg --window-size 640x480)\n");
    printf("--iterations <count>\n");
+   printf("--pacing <start-us>[:<increment-us>:<steps>] (eg --pacing 0:1000:18)\n");
+   printf("--swap-interval <interval>\n");
+   printf("--warmup <max-frames> (0 to disable)\n");
+   printf("--refresh-period <us>\n");
+   printf("--swap-interval-sweep <interval-list>|default (eg --swap-interval-sweep 0,2)\n");
+   printf("--decouple-frame-callbacks\n");
+   printf("--damage\n");
+   printf("--damage-region <width>x<height>\n");
+   printf("--scanout\n");
+   printf("--scanout-compare\n");
+   printf("--video <format>[@<fps>] (eg --video nv12@24, format is nv12, yuv420 or yuyv)\n");
+   printf("--video-sweep <format-list>[@<fps-list>]|default (eg --video-sweep nv12,yuyv@30,60)\n");
+   printf("--subsurfaces <count>[:<overlap-percent>] (eg --subsurfaces 4:50)\n");
+   printf("--subsurface-alpha <percent>\n");
+   printf("--subsurface-sweep <count-list>[:<overlap-percent>]|default (eg --subsurface-sweep 0,2,4:75)\n");
+   printf("--client-buffers <count> (2 to 4, 0 for an EGL window)\n");
+   printf("--client-buffers-sweep <count-list>|default (eg --client-buffers-sweep 0,2,3)\n");
+   printf("--scenario <scenario-file>\n");
+   printf("--resolution-sweep <size-list>|default (eg --resolution-sweep 1280x720,1920x1080)\n");
    printf("--no-direct\n");
    printf("--no-wayland\n");
    printf("--no-multi\n");
@@ -2095,6 +11297,20 @@ void showUsage( void )
    printf("--no-nested\n");
    printf("--no-repeater\n");
    printf("--no-wayland-render\n");
+   printf("--perf-counters\n");
+   printf("--trace <trace-file>\n");
+   printf("--protocol-stats\n");
+   printf("--gpu-timing\n");
+   printf("--soak <seconds>\n");
+   printf("--soak-pacing <us>\n");
+   printf("--soak-interval <seconds>\n");
+   printf("--results <results-file>\n");
+   printf("--compare <baseline-results-file>\n");
+   printf("--compare-threshold <percent>\n");
+   printf("--compare-alpha <p-value>\n");
+   printf("--affinity <role>:<cpu-list> (eg --affinity client:2-3, role is master, nested, client or all)\n");
+   printf("--sched <role>:<policy>[:<priority>] (eg --sched master:fifo:10, policy is fifo, rr, other or batch)\n");
+   printf("--affinity-sweep\n");
    printf("--verbose\n");
    printf("-? : show usage\n");
    printf("\n");
@@ -2116,12 +11332,31 @@ int main( int argc, const char **argv )
    bool roleWaylandClient= false;
    bool roleWaylandClientNested= false;
    bool roleWaylandNested= false;
+   bool roleRepeater= false;
+   bool affinitySweep= false;
+   const char *resolutionSizes= 0;
+   const char *swapIntervals= 0;
+   bool scanoutCompare= false;
+   const char *videoSweep= 0;
+   const char *subsurfaceSweep= 0;
+   const char *clientBuffersSweep= 0;
+   bool pacingSet= false;
+   bool sweepNoDirect= false;
+   bool sweepNoNormal= false;
+   bool sweepNoNested= false;
+   const char *scenarioFilename= 0;
+   Scenario *scenario= 0;
    const char *reportFilename= 0;
-   int pacingInc, step, maxStep;
    long long directTotal, waylandTotal;
+   int regressions= 0;
 
    printf("waymetric v%s\n", WAYMETRIC_VERSION);
 
+   if ( !haveSocketHooks() )
+   {
+      goto exit;
+   }
+
    ctx= (AppCtx*)calloc( 1, sizeof(AppCtx) );
    if ( !ctx )
    {
@@ -2138,11 +11373,34 @@ int main( int argc, const char **argv )
    pthread_mutex_init( &ctx->client.mutex, 0 );
    pthread_mutex_init( &ctx->client.mutexReady, 0 );
    pthread_cond_init( &ctx->client.condReady, 0 );
+   {
+      cpu_set_t startMask;
+      if ( !sched_getaffinity( 0, sizeof(startMask), &startMask ) )
+      {
+         formatCpuList( &startMask, ctx->startCpuList, sizeof(ctx->startCpuList) );
+      }
+   }
    ctx->displayName= "waymetric0";
    ctx->nestedDisplayName= "waymetric-nested0";
    ctx->maxIterations= DEFAULT_ITERATIONS;
+   ctx->pacingStart= 0;
+   ctx->pacingIncrement= PACING_INCREMENT;
+   ctx->pacingSteps= PACING_STEP_COUNT;
+   ctx->swapInterval= 1;
+   ctx->warmupMaxFrames= DEFAULT_WARMUP_MAX_FRAMES;
+   ctx->refreshPeriodUs= DEFAULT_REFRESH_PERIOD_US;
+   ctx->compareThreshold= DEFAULT_COMPARE_THRESHOLD;
+   ctx->compareAlpha= DEFAULT_COMPARE_ALPHA;
    ctx->windowWidth= DEFAULT_WIDTH;
    ctx->windowHeight= DEFAULT_HEIGHT;
+   ctx->videoFps= DEFAULT_VIDEO_FPS;
+   ctx->subsurfaceOverlap= DEFAULT_SUBSURFACE_OVERLAP;
+   ctx->subsurfaceAlpha= 100;
+   poolInit( &ctx->surfacePool, "surface", sizeof(Surface), SURFACE_POOL_CAPACITY );
+   poolInit( &ctx->bufferInfoPool, "buffer info", sizeof(NestedBufferInfo), BUFFER_INFO_POOL_CAPACITY );
+   ctx->master.releaseEventFd= -1;
+   ctx->nested.releaseEventFd= -1;
+   ctx->client.releaseEventFd= -1;
 
    argidx= 1;
    while( argidx < argc )
@@ -2152,22 +11410,195 @@ int main( int argc, const char **argv )
          int len= strlen( argv[argidx] );
          if ( (len == 2) && !strncmp( argv[argidx], "-?", len) )
          {
-            showUsage();
-            exit(0);
+            showUsage();
+            exit(0);
+         }
+         else if ( (len == 13) && !strncmp( argv[argidx], "--window-size", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               int w, h;
+               if ( sscanf( argv[argidx], "%dx%d", &w, &h ) == 2 )
+               {
+                  ctx->windowWidth= w;
+                  ctx->windowHeight= h;
+               }
+            }
+         }
+         else if ( (len == 8) && !strncmp( argv[argidx], "--pacing", len) )
+         {
+            ++argidx;
+            if ( (argidx < argc) && !parsePacing( argv[argidx], &ctx->pacingStart, &ctx->pacingIncrement, &ctx->pacingSteps ) )
+            {
+               printf("Error: bad pacing: %s\n", argv[argidx]);
+            }
+            pacingSet= true;
+         }
+         else if ( (len == 21) && !strncmp( argv[argidx], "--swap-interval-sweep", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               swapIntervals= argv[argidx];
+               if ( !strcmp( swapIntervals, "default" ) )
+               {
+                  swapIntervals= gDefaultSwapIntervals;
+               }
+            }
+         }
+         else if ( (len == 26) && !strncmp( argv[argidx], "--decouple-frame-callbacks", len) )
+         {
+            ctx->decoupleFrames= true;
+         }
+         else if ( (len == 8) && !strncmp( argv[argidx], "--damage", len) )
+         {
+            ctx->damageTracking= true;
+         }
+         else if ( (len == 9) && !strncmp( argv[argidx], "--scanout", len) )
+         {
+            ctx->directScanout= true;
+         }
+         else if ( (len == 17) && !strncmp( argv[argidx], "--scanout-compare", len) )
+         {
+            scanoutCompare= true;
+         }
+         else if ( (len == 7) && !strncmp( argv[argidx], "--video", len) )
+         {
+            ++argidx;
+            if ( (argidx < argc) && !parseVideoSpec( argv[argidx], &ctx->videoFormat, &ctx->videoFps ) )
+            {
+               printf("Error: bad video: %s\n", argv[argidx]);
+               ctx->videoFormat= VIDEO_FORMAT_NONE;
+            }
+         }
+         else if ( (len == 13) && !strncmp( argv[argidx], "--video-sweep", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               videoSweep= argv[argidx];
+               if ( !strcmp( videoSweep, "default" ) )
+               {
+                  videoSweep= gDefaultVideoSweep;
+               }
+            }
+         }
+         else if ( (len == 13) && !strncmp( argv[argidx], "--subsurfaces", len) )
+         {
+            ++argidx;
+            if ( (argidx < argc) && !parseSubsurfaceSpec( argv[argidx], &ctx->subsurfaceCount, &ctx->subsurfaceOverlap ) )
+            {
+               printf("Error: bad subsurfaces: %s\n", argv[argidx]);
+               ctx->subsurfaceCount= 0;
+            }
+         }
+         else if ( (len == 18) && !strncmp( argv[argidx], "--subsurface-alpha", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               int alpha= atoi(argv[argidx]);
+               if ( (alpha >= 0) && (alpha <= 100) )
+               {
+                  ctx->subsurfaceAlpha= alpha;
+               }
+               else
+               {
+                  printf("Error: bad subsurface alpha: %s\n", argv[argidx]);
+               }
+            }
+         }
+         else if ( (len == 18) && !strncmp( argv[argidx], "--subsurface-sweep", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               subsurfaceSweep= argv[argidx];
+               if ( !strcmp( subsurfaceSweep, "default" ) )
+               {
+                  subsurfaceSweep= gDefaultSubsurfaceSweep;
+               }
+            }
          }
-         else if ( (len == 13) && !strncmp( argv[argidx], "--window-size", len) )
+         else if ( (len == 16) && !strncmp( argv[argidx], "--client-buffers", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               int count= atoi(argv[argidx]);
+               if ( (count == 0) || ((count >= MIN_CLIENT_BUFFERS) && (count <= MAX_CLIENT_BUFFERS)) )
+               {
+                  ctx->clientBuffers= count;
+               }
+               else
+               {
+                  printf("Error: bad client buffer count: %s\n", argv[argidx]);
+               }
+            }
+         }
+         else if ( (len == 22) && !strncmp( argv[argidx], "--client-buffers-sweep", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               clientBuffersSweep= argv[argidx];
+               if ( !strcmp( clientBuffersSweep, "default" ) )
+               {
+                  clientBuffersSweep= gDefaultClientBuffersSweep;
+               }
+            }
+         }
+         else if ( (len == 15) && !strncmp( argv[argidx], "--damage-region", len) )
          {
             ++argidx;
             if ( argidx < argc )
             {
                int w, h;
-               if ( sscanf( argv[argidx], "%dx%d", &w, &h ) == 2 )
+               if ( (sscanf( argv[argidx], "%dx%d", &w, &h ) == 2) && (w > 0) && (h > 0) )
                {
-                  ctx->windowWidth= w;
-                  ctx->windowHeight= h;
+                  ctx->damageWidth= w;
+                  ctx->damageHeight= h;
+               }
+               else
+               {
+                  printf("Error: bad damage region: %s\n", argv[argidx]);
                }
             }
          }
+         else if ( (len == 16) && !strncmp( argv[argidx], "--refresh-period", len) )
+         {
+            ++argidx;
+            if ( (argidx < argc) && (atoll( argv[argidx] ) > 0) )
+            {
+               ctx->refreshPeriodUs= atoll( argv[argidx] );
+               ctx->refreshPeriodSet= true;
+            }
+         }
+         else if ( (len == 8) && !strncmp( argv[argidx], "--warmup", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               ctx->warmupMaxFrames= atoi( argv[argidx] );
+            }
+         }
+         else if ( (len == 15) && !strncmp( argv[argidx], "--swap-interval", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               ctx->swapInterval= atoi( argv[argidx] );
+            }
+         }
+         else if ( (len == 10) && !strncmp( argv[argidx], "--scenario", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               scenarioFilename= argv[argidx];
+            }
+         }
          else if ( (len == 12) && !strncmp( argv[argidx], "--iterations", len) )
          {
             ++argidx;
@@ -2217,6 +11648,149 @@ int main( int argc, const char **argv )
          {
             roleWaylandNested= true;
          }
+         else if ( (len == 10) && !strncmp( argv[argidx], "--repeater", len) )
+         {
+            roleRepeater= true;
+         }
+         else if ( (len == 15) && !strncmp( argv[argidx], "--perf-counters", len) )
+         {
+            gPerf.requested= true;
+         }
+         else if ( (len == 7) && !strncmp( argv[argidx], "--trace", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               if ( strlen( argv[argidx] ) < 256 )
+               {
+                  gTrace.filename= argv[argidx];
+                  gTrace.enabled= true;
+               }
+               else
+               {
+                  printf("Error: trace file name too long: %s\n", argv[argidx]);
+               }
+            }
+         }
+         else if ( (len == 16) && !strncmp( argv[argidx], "--protocol-stats", len) )
+         {
+            gProtocolStats= true;
+         }
+         else if ( (len == 12) && !strncmp( argv[argidx], "--gpu-timing", len) )
+         {
+            gGpuTiming= true;
+         }
+         else if ( (len == 6) && !strncmp( argv[argidx], "--soak", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               ctx->soakSeconds= atoi( argv[argidx] );
+            }
+         }
+         else if ( (len == 13) && !strncmp( argv[argidx], "--soak-pacing", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               ctx->soakPacing= atoi( argv[argidx] );
+            }
+         }
+         else if ( (len == 15) && !strncmp( argv[argidx], "--soak-interval", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               ctx->soakInterval= atoi( argv[argidx] );
+            }
+         }
+         else if ( (len == 9) && !strncmp( argv[argidx], "--results", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               if ( strlen( argv[argidx] ) < 256 )
+               {
+                  ctx->resultsFilename= argv[argidx];
+               }
+               else
+               {
+                  printf("Error: results file name too long: %s\n", argv[argidx]);
+               }
+            }
+         }
+         else if ( (len == 9) && !strncmp( argv[argidx], "--compare", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               ctx->compareFilename= argv[argidx];
+            }
+         }
+         else if ( (len == 19) && !strncmp( argv[argidx], "--compare-threshold", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               ctx->compareThreshold= atof( argv[argidx] );
+            }
+         }
+         else if ( (len == 15) && !strncmp( argv[argidx], "--compare-alpha", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               ctx->compareAlpha= atof( argv[argidx] );
+            }
+         }
+         else if ( (len == 9) && !strncmp( argv[argidx], "--section", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               ctx->section= argv[argidx];
+            }
+         }
+         else if ( (len == 11) && !strncmp( argv[argidx], "--trace-run", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               gTrace.run= atoi( argv[argidx] );
+            }
+         }
+         else if ( (len == 10) && !strncmp( argv[argidx], "--affinity", len) )
+         {
+            ++argidx;
+            if ( (argidx < argc) && !parseRoleControl( ctx, argv[argidx], false ) )
+            {
+               printf("Error: bad affinity: %s\n", argv[argidx]);
+            }
+         }
+         else if ( (len == 7) && !strncmp( argv[argidx], "--sched", len) )
+         {
+            ++argidx;
+            if ( (argidx < argc) && !parseRoleControl( ctx, argv[argidx], true ) )
+            {
+               printf("Error: bad scheduling: %s\n", argv[argidx]);
+            }
+         }
+         else if ( (len == 16) && !strncmp( argv[argidx], "--affinity-sweep", len) )
+         {
+            affinitySweep= true;
+         }
+         else if ( (len == 18) && !strncmp( argv[argidx], "--resolution-sweep", len) )
+         {
+            ++argidx;
+            if ( argidx < argc )
+            {
+               resolutionSizes= argv[argidx];
+               if ( !strcmp( resolutionSizes, "default" ) )
+               {
+                  resolutionSizes= gDefaultResolutions;
+               }
+            }
+         }
          else if ( (len == 9) && !strncmp( argv[argidx], "--verbose", len) )
          {
             gVerbose= true;
@@ -2237,11 +11811,92 @@ int main( int argc, const char **argv )
       reportFilename= "/tmp/waymetric-report.txt";
    }
 
+   if ( ctx->compareFilename && !ctx->resultsFilename )
+   {
+      // The comparison reads this run back from its results file
+      ctx->resultsFilename= "/tmp/waymetric-results.txt";
+   }
+   if ( ctx->compareFilename && sameFile( ctx->compareFilename, ctx->resultsFilename ) )
+   {
+      printf("Error: the results file %s is the --compare baseline; give --results another file\n", ctx->resultsFilename);
+      goto exit;
+   }
+   if ( ctx->resultsFilename && (ctx->maxIterations > 0) )
+   {
+      ctx->frameSamples= (int*)calloc( ctx->maxIterations, sizeof(int) );
+   }
+
+   if ( ctx->soakInterval <= 0 )
+   {
+      ctx->soakInterval= DEFAULT_SOAK_INTERVAL;
+   }
+   if ( (ctx->videoFormat != VIDEO_FORMAT_NONE) || videoSweep )
+   {
+      // Video is paced by its frame rate, so further steps would repeat the first
+      if ( pacingSet )
+      {
+         printf("Warning: --pacing does not apply to video, measuring a single step\n");
+      }
+      ctx->pacingStart= 0;
+      ctx->pacingIncrement= 0;
+      ctx->pacingSteps= 1;
+   }
+   if ( scenarioFilename )
+   {
+      scenario= scenarioLoad( ctx, scenarioFilename );
+      if ( !scenario )
+      {
+         goto exit;
+      }
+      // The scenario replaces the fixed test order
+      noDirect= true;
+      noMulti= !scenario->haveMulti;
+      noNormal= true;
+      noNested= true;
+      noRepeater= true;
+   }
+   if ( resolutionSizes || swapIntervals || scanoutCompare || videoSweep || subsurfaceSweep || clientBuffersSweep )
+   {
+      if ( ((scenario ? 1 : 0)+(resolutionSizes ? 1 : 0)+(swapIntervals ? 1 : 0)+(scanoutCompare ? 1 : 0)+(videoSweep ? 1 : 0)+(subsurfaceSweep ? 1 : 0)+(clientBuffersSweep ? 1 : 0)) > 1 )
+      {
+         printf("Error: --resolution-sweep, --swap-interval-sweep, --scanout-compare, --video-sweep, --subsurface-sweep, --client-buffers-sweep and --scenario can not be combined\n");
+         goto exit;
+      }
+      if ( (swapIntervals || subsurfaceSweep || clientBuffersSweep) && !pacingSet )
+      {
+         // Measure raw throughput unless a pacing was asked for
+         ctx->pacingStart= 0;
+         ctx->pacingIncrement= 0;
+         ctx->pacingSteps= 1;
+      }
+      // The sweep replaces the fixed test order
+      sweepNoDirect= noDirect;
+      sweepNoNormal= noNormal || noWayland;
+      sweepNoNested= noNested || noWayland;
+      noDirect= true;
+      noMulti= true;
+      noNormal= true;
+      noNested= true;
+      noRepeater= true;
+   }
+   if ( ctx->soakSeconds > 0 )
+   {
+      // A soak replaces the fixed sweep
+      noDirect= true;
+      noMulti= true;
+      noNormal= true;
+      noNested= true;
+      noRepeater= true;
+   }
+
    setenv( "XDG_RUNTIME_DIR", "/tmp", true );
 
    ctx->master.appCtx= ctx;
    ctx->nested.appCtx= ctx;
    ctx->client.appCtx= ctx;
+   ctx->master.name= "master";
+   ctx->nested.name= "nested";
+   ctx->client.name= "client";
    ctx->master.eglServer.appCtx= ctx;
    ctx->nested.eglServer.appCtx= ctx;
    ctx->client.eglClient.appCtx= ctx;
@@ -2257,6 +11912,11 @@ int main( int argc, const char **argv )
    if ( roleWaylandClient )
    {
       ctx->pReport= fopen( reportFilename, "at");
+      if ( ctx->resultsFilename )
+      {
+         ctx->pResults= fopen( ctx->resultsFilename, "at");
+      }
+      applyRoleControl( ctx, ROLE_CLIENT );
       ctx->platformCtx= PlatfromInit();
       if ( !ctx->platformCtx )
       {
@@ -2270,6 +11930,8 @@ int main( int argc, const char **argv )
       {
          ctx->client.upstreamDisplayName= ctx->displayName;
       }
+      perfInit( ctx, ctx->client.name );
+      traceInit( ctx->client.name, false );
       waylandClientRole( ctx );
       nRC= 0;
       goto exit;
@@ -2277,6 +11939,11 @@ int main( int argc, const char **argv )
    else if ( roleWaylandNested )
    {
       ctx->pReport= fopen( reportFilename, "at");
+      if ( ctx->resultsFilename )
+      {
+         ctx->pResults= fopen( ctx->resultsFilename, "at");
+      }
+      applyRoleControl( ctx, ROLE_NESTED );
       ctx->platformCtx= PlatfromInit();
       if ( !ctx->platformCtx )
       {
@@ -2284,19 +11951,42 @@ int main( int argc, const char **argv )
       }
       ctx->renderWayland= !noWaylandRender;
       ctx->client.upstreamDisplayName= ctx->displayName;
+      if ( roleRepeater )
+      {
+         checkForRepeaterSupport( ctx );
+      }
+      perfInit( ctx, ctx->nested.name );
+      traceInit( ctx->nested.name, false );
       waylandNestedRole( ctx );
       nRC= 0;
       goto exit;
    }
 
    ctx->pReport= fopen( reportFilename, "wt");
-   
+   if ( ctx->resultsFilename )
+   {
+      ctx->pResults= fopen( ctx->resultsFilename, "wt");
+      if ( ctx->pResults )
+      {
+         fprintf(ctx->pResults, "# waymetric v%s results: <section> <role> <step> <key> <value>\n", WAYMETRIC_VERSION);
+      }
+      else
+      {
+         printf("Error: unable to open results file: %s\n", ctx->resultsFilename);
+      }
+   }
+
+   fprintf(ctx->pReport, "waymetric v%s\n", WAYMETRIC_VERSION);
+   fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+   applyRoleControl( ctx, ROLE_MASTER );
+
    ctx->platformCtx= PlatfromInit();
    if ( !ctx->platformCtx )
    {
       printf("Error: PlatformInit failed\n");
       goto exit;
    }
+   updateRefreshPeriod( ctx );
 
    ctx->master.eglServer.useWayland= false;
    ctx->master.eglServer.nativeDisplay= PlatformGetEGLDisplayType( ctx->platformCtx );
@@ -2339,7 +12029,6 @@ int main( int argc, const char **argv )
       ctx->haveWaylandEGL= true;
    }
 
-   fprintf(ctx->pReport, "waymetric v%s\n", WAYMETRIC_VERSION);
    fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
    fprintf(ctx->pReport, "Have wayland-egl: %d\n", ctx->haveWaylandEGL );
    fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
@@ -2355,6 +12044,8 @@ int main( int argc, const char **argv )
    fprintf(ctx->pReport, "eglDestroyImageKHR: %s\n", ctx->eglDestroyImageKHR ? "true" : "false");
    fprintf(ctx->pReport, "glEGLImageTargetTexture2DOES: %s\n", ctx->glEGLImageTargetTexture2DOES ? "true" : "false");
    fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+   perfInit( ctx, ctx->master.name );
+   traceInit( ctx->master.name, true );
 
    if ( !noWayland && ctx->haveWaylandEGL && !noMulti )
    {
@@ -2397,11 +12088,22 @@ int main( int argc, const char **argv )
          printf("Error: initWayland failed\n");
          goto exit;
       }
+      if ( ctx->directScanout && (PlatformGetEventFd( ctx->platformCtx ) >= 0) )
+      {
+         PlatformSetScanoutListener( ctx->platformCtx, scanoutFlipped, &ctx->master );
+         ctx->master.scanoutEventSource= wl_event_loop_add_fd( wl_display_get_event_loop(ctx->master.dispWayland),
+                                                               PlatformGetEventFd( ctx->platformCtx ),
+                                                               WL_EVENT_READABLE,
+                                                               scanoutEvent,
+                                                               &ctx->master );
+         if ( !ctx->master.scanoutEventSource )
+         {
+            printf("Error: unable to add the display fd to the event loop\n");
+            goto exit;
+         }
+      }
    }
 
-   pacingInc= 1000;
-   maxStep= 17;
-   ctx->pacingDelay= 0;
    directTotal= 0;
    waylandTotal= 0;
 
@@ -2412,25 +12114,48 @@ int main( int argc, const char **argv )
       fprintf(ctx->pReport, "Measuring EGL direct...\n");
       printf("\nMeasuring EGL direct...\n");
 
-      for( step= 0; step <= maxStep; ++step  )
-      {
-         fprintf(ctx->pReport, "\n");
-         fprintf(ctx->pReport, "%d) pacing %d us\n", step+1, ctx->pacingDelay);
-         printf("%d) pacing %d us\n", step+1, ctx->pacingDelay);
+      ctx->section= "direct";
+      directTotal= measureDirectSweep( ctx );
+   }
 
-         ctx->directEGLIterationCount= 0;
-         ctx->directEGLTimeTotal= 0;
-         measureDirectEGL( ctx, &ctx->master.eglServer );
+   if ( scenario )
+   {
+      scenarioRun( ctx, scenario, noWaylandRender );
+   }
 
-         fprintf(ctx->pReport, "Iterations: %d Total time (us): %lld  FPS: %f\n", 
-                 ctx->directEGLIterationCount, ctx->directEGLTimeTotal, ctx->directEGLFPS );
+   if ( resolutionSizes && (ctx->soakSeconds <= 0) )
+   {
+      measureResolutionSweep( ctx, resolutionSizes, sweepNoDirect, sweepNoNormal, sweepNoNested, noWaylandRender );
+   }
 
-         fprintf(ctx->pReport, "-----------------------------------------------------------------\n");
+   if ( swapIntervals && (ctx->soakSeconds <= 0) )
+   {
+      measureSwapIntervalSweep( ctx, swapIntervals, sweepNoDirect, sweepNoNormal, sweepNoNested, noWaylandRender );
+   }
 
-         directTotal += ctx->directEGLTimeTotal;
+   if ( scanoutCompare && (ctx->soakSeconds <= 0) && ctx->haveWaylandEGL )
+   {
+      measureScanoutCompare( ctx, noWaylandRender );
+   }
 
-         ctx->pacingDelay += pacingInc;
-      }
+   if ( videoSweep && (ctx->soakSeconds <= 0) && ctx->haveWaylandEGL )
+   {
+      measureVideoSweep( ctx, videoSweep, noWaylandRender );
+   }
+
+   if ( subsurfaceSweep && (ctx->soakSeconds <= 0) && ctx->haveWaylandEGL )
+   {
+      measureSubsurfaceSweep( ctx, subsurfaceSweep, noWaylandRender );
+   }
+
+   if ( clientBuffersSweep && (ctx->soakSeconds <= 0) && ctx->haveWaylandEGL )
+   {
+      measureClientBuffersSweep( ctx, clientBuffersSweep, noWaylandRender );
+   }
+
+   if ( !noWayland && ctx->haveWaylandEGL && (ctx->soakSeconds > 0) )
+   {
+      measureSoak( ctx, noWaylandRender );
    }
 
    if ( !noWayland && !noNormal && ctx->haveWaylandEGL )
@@ -2440,6 +12165,7 @@ int main( int argc, const char **argv )
       fprintf(ctx->pReport, "Measuring Wayland...\n");
       printf("\nMeasuring Wayland...\n");
 
+      ctx->section= "wayland";
       ctx->renderWayland= !noWaylandRender;
       measureWaylandEGL( ctx, &ctx->master.eglServer );
 
@@ -2456,8 +12182,14 @@ int main( int argc, const char **argv )
          fprintf(ctx->pReport, "\n");
          fprintf(ctx->pReport, "=================================================================\n");
          fprintf(ctx->pReport, "waymetric speed index: %f\n", ((double)waylandTotal / (double)directTotal) );
+         resultValue( ctx, ctx->master.name, 0, "speed_index", ((double)waylandTotal / (double)directTotal) );
          fprintf(ctx->pReport, "=================================================================\n");
       }
+
+      if ( affinitySweep )
+      {
+         measureAffinitySweep( ctx, directTotal, noWaylandRender );
+      }
    }
 
    if ( !noWayland && !noNested && ctx->haveWaylandEGL )
@@ -2467,6 +12199,7 @@ int main( int argc, const char **argv )
       fprintf(ctx->pReport, "Measuring Wayland Nested...\n");
       printf("\nMeasuring Wayland Nested...\n");
 
+      ctx->section= "nested";
       ctx->waylandTotal= 0;
       ctx->renderWayland= !noWaylandRender;
       measureWaylandNested( ctx, &ctx->master.eglServer );
@@ -2484,6 +12217,7 @@ int main( int argc, const char **argv )
          fprintf(ctx->pReport, "\n");
          fprintf(ctx->pReport, "=================================================================\n");
          fprintf(ctx->pReport, "waymetric nested speed index: %f\n", ((double)waylandTotal / (double)directTotal) );
+         resultValue( ctx, ctx->master.name, 0, "speed_index", ((double)waylandTotal / (double)directTotal) );
          fprintf(ctx->pReport, "=================================================================\n");
       }
    }
@@ -2501,6 +12235,7 @@ int main( int argc, const char **argv )
          fprintf(ctx->pReport, "Measuring Wayland Repeating...\n");
          printf("\nMeasuring Wayland Repeating...\n");
 
+         ctx->section= "repeater";
          ctx->waylandTotal= 0;
          ctx->renderWayland= !noWaylandRender;
          measureWaylandNested( ctx, &ctx->master.eglServer );
@@ -2518,15 +12253,23 @@ int main( int argc, const char **argv )
             fprintf(ctx->pReport, "\n");
             fprintf(ctx->pReport, "=================================================================\n");
             fprintf(ctx->pReport, "waymetric repeater speed index: %f\n", ((double)waylandTotal / (double)directTotal) );
+            resultValue( ctx, ctx->master.name, 0, "speed_index", ((double)waylandTotal / (double)directTotal) );
             fprintf(ctx->pReport, "=================================================================\n");
          }
       }
    }
 
+   if ( ctx->compareFilename && ctx->pResults )
+   {
+      fflush( ctx->pResults );
+      regressions= compareResults( ctx );
+   }
+
    printf("\n");
    printf("writing report to %s\n", reportFilename );
 
-   nRC= 0;
+   // Exit non-zero so scripts can gate on a comparison with a baseline
+   nRC= (regressions > 0) ? 2 : ((regressions < 0) ? 1 : 0);
 
 exit:
 
@@ -2534,6 +12277,15 @@ exit:
 
    if ( ctx )
    {
+      if ( ctx->master.scanoutEventSource )
+      {
+         wl_event_source_remove( ctx->master.scanoutEventSource );
+         ctx->master.scanoutEventSource= 0;
+      }
+      if ( ctx->platformCtx )
+      {
+         PlatformSetScanoutListener( ctx->platformCtx, 0, 0 );
+      }
       if ( !noWayland && ctx->haveWaylandEGL )
       {
          termWayland( &ctx->master );
@@ -2582,12 +12334,37 @@ exit:
       pthread_mutex_destroy( &ctx->master.mutexReady );
       pthread_mutex_destroy( &ctx->mutex );
 
+      poolTerm( &ctx->bufferInfoPool );
+      poolTerm( &ctx->surfacePool );
+
+      if ( ctx->frameSamples )
+      {
+         free( ctx->frameSamples );
+         ctx->frameSamples= 0;
+      }
+
+      if ( scenario )
+      {
+         free( scenario );
+         scenario= 0;
+      }
+
+      perfTerm();
+
+      traceTerm();
+
       if ( ctx->pReport )
       {
          fclose( ctx->pReport );
          ctx->pReport= 0;
       }
 
+      if ( ctx->pResults )
+      {
+         fclose( ctx->pResults );
+         ctx->pResults= 0;
+      }
+
       free( ctx );
    }
 